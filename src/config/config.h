@@ -137,6 +137,19 @@
 // *************switch for fpv / other, requires fet
 // *************comment out to disable
 #define FPV_SWITCH AUX_CHANNEL_ON
+// *************switch for blackbox logging while armed, AUX_CHANNEL_ON logs every flight
+//#define BLACKBOX_SWITCH AUX_CHANNEL_OFF
+// *************log every nth loop to the blackbox, per field rates and the logged fields are set in the profile
+#define BLACKBOX_RATE_DIVIDER 4
+// *************time the blackbox flash writer may take per loop in us, it picks up where it left off next loop
+#define BLACKBOX_FLASH_BUDGET_US 20
+// *************keep this many ms of frames from before logging starts and write them ahead of the log, needs a blackbox switch
+// *************they wait in the 8k flash write buffer which holds roughly 100ms, a log that starts with them is not compressed
+//#define BLACKBOX_PRE_TRIGGER_MS 100
+// *************lz compress the log before it goes to the flash, PERF_COUNTER_BLACKBOX_COMPRESS shows the cost and ratio
+#define BLACKBOX_COMPRESSION 1
+// *************length of a gyro capture in ms, the capture mode is picked in the blackbox menu
+#define BLACKBOX_CAPTURE_MS 5000
 
 // *************RRD/LLD stick gesture aux start up state.  Gesture aux is AUX_CHANNEL_GESTURE
 //#define GESTURE_AUX_START_ON
@@ -179,6 +192,23 @@
 //**********************************************************************************************************************
 //***********************************************FILTER SETTINGS********************************************************
 
+// *************sync the loop to the data ready interrupt of the gyro instead of a fixed timer
+// *************the gyro read is started by the interrupt and the loop runs as soon as the data has landed
+// *************only has an effect on targets that define GYRO_INT
+//#define GYRO_EXTI_SYNC
+
+// *************burst read every sample the gyro buffered in its fifo instead of only the latest one
+// *************all samples are run through the gyro filters at the gyro output rate (8k icm426xx, 6.4k bmi270)
+// *************gyros without fifo support keep reading a single sample per loop
+//#define GYRO_FIFO
+
+// *************run the pid controller and motor output only on every nth gyro sample
+// *************the gyro is still read and filtered at the full loop rate, which is not lowered by the looptime autodetect
+// *************while the divider is above 1. the gyro is only sampled at its output rate if the loop runs at that rate
+// *************(e.g. 8k loop with an 8k gyro), or with GYRO_FIFO which filters every buffered sample
+// *************the pid uses the latest filtered sample, e.g. 8k gyro / 4k pid with a divider of 2
+#define PID_RATE_DIVIDER 1
+
 // Gyro Filters
 // GYRO FILTER PASS 1 - FILTER TYPE  - define only one or none to disable this pass
 #define GYRO_FILTER_PASS1_PT1
@@ -206,6 +236,22 @@
 #define DYNAMIC_FREQ_MIN 70
 #define DYNAMIC_FREQ_MAX 260
 
+// Dynamic gyro notch
+// an fft of the raw gyro is computed a few steps per loop. the strongest noise peaks between DYNAMIC_NOTCH_MIN and DYNAMIC_NOTCH_MAX
+// are tracked on each axis and a bank of notch filters follows them. this allows for less static lowpass filtering on frames with
+// a narrow resonance. the notches are applied after the two static gyro filter passes.
+//#define GYRO_DYNAMIC_NOTCH
+#define DYNAMIC_NOTCH_Q 3.0
+#define DYNAMIC_NOTCH_MIN 150
+#define DYNAMIC_NOTCH_MAX 600
+
+// RPM gyro filter
+// places a notch on the fundamental, 2nd and 3rd harmonic of every motor on all three gyro axes. requires rpm telemetry
+// from the escs, notches for motors spinning slower than RPM_FILTER_MIN hz are switched off.
+//#define GYRO_RPM_FILTER
+#define RPM_FILTER_Q 5.0
+#define RPM_FILTER_MIN 100
+
 // Fixed D-Term Filters
 // D-Term FILTER PASS 1 - FILTER TYPE  - define only one or none to disable this pass
 #define DTERM_FILTER_PASS1_PT1
@@ -244,6 +290,12 @@
 // *************retune it back up to where it feels good.  I'm finding about 60 to 65% of my previous D value seems to work.
 //#define TORQUE_BOOST 1.0
 
+// *************bidirectional dshot, the escs reply with erpm after every frame. required for the rpm filter
+// *************needs an esc firmware with bidirectional dshot support (bluejay, blheli_32, jesc)
+//#define DSHOT_TELEMETRY
+// *************number of magnet poles of the motors, used to convert erpm to rpm
+#define MOTOR_POLES 14
+
 // *************pwm frequency for motor control
 // *************a higher frequency makes the motors more linear
 // *************in Hz
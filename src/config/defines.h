@@ -10,6 +10,8 @@ typedef enum {
   LOOPTIME_8K = 125,
 } looptime_autodetect_t;
 
+#define PID_RATE_DIVIDER_MAX 8
+
 #define PID_SIZE 3
 #define ANGLE_PID_SIZE 2
 
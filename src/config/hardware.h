@@ -50,6 +50,17 @@
 #define WITHIN_DMA_RAM(p) (((uint32_t)p & 0xfffe0000) == 0x30000000)
 #endif
 
+#ifdef SIMULATOR
+#define SYS_CLOCK_FREQ_HZ 168000000
+#define PWM_CLOCK_FREQ_HZ 84000000
+#define SPI_CLOCK_FREQ_HZ (SYS_CLOCK_FREQ_HZ / 4)
+
+#define LOOPTIME LOOPTIME_8K
+
+#define WITHIN_DTCM_RAM(p) (false)
+#define WITHIN_DMA_RAM(p) (false)
+#endif
+
 #ifdef USE_FAST_RAM
 #define FAST_RAM __attribute__((section(".fast_ram"), aligned(4)))
 #else
@@ -62,11 +73,16 @@
 #define DMA_RAM
 #endif
 
+// buffers the dma reads or writes in place, a cache line of their own so they can be invalidated alone
+#define DMA_ALIGN __attribute__((aligned(32)))
+
 #ifdef BRUSHLESS_TARGET
 // dshot pin initialization & usb interface to esc
 #define USE_DSHOT_DMA_DRIVER
+#ifndef SIMULATOR
 #define USE_SERIAL_4WAY_BLHELI_INTERFACE
 #endif
+#endif
 
 #ifdef BRUSHED_TARGET
 // pwm pin initialization
@@ -77,6 +93,14 @@
 #define ENABLE_BLACKBOX
 #endif
 
+#if defined(GYRO_EXTI_SYNC) && defined(GYRO_INT)
+#define USE_GYRO_EXTI
+#endif
+
+#if defined(GYRO_FIFO)
+#define USE_GYRO_FIFO
+#endif
+
 #define SERIAL_RX
 
 #if defined(USE_CC2500)
@@ -85,6 +85,13 @@
 #define MOTOR_PIN_PE11 MOTOR_PIN(E, 11, GPIO_AF1_TIM1, TIM1, 2)
 #endif
 
+#ifdef SIMULATOR
+#define MOTOR_PIN_PA0 MOTOR_PIN(A, 0, 0, NULL, 1)
+#define MOTOR_PIN_PA1 MOTOR_PIN(A, 1, 0, NULL, 2)
+#define MOTOR_PIN_PA2 MOTOR_PIN(A, 2, 0, NULL, 3)
+#define MOTOR_PIN_PA3 MOTOR_PIN(A, 3, 0, NULL, 4)
+#endif
+
 #define MOTOR_PINS \
   MOTOR_PIN0       \
   MOTOR_PIN1       \
@@ -115,6 +115,12 @@ const profile_t default_profile = {
         .motor_limit = MOTOR_LIMIT,
         .digital_idle = DIGITAL_IDLE,
         .dshot_time = DSHOT_TIME_600,
+#ifdef DSHOT_TELEMETRY
+        .dshot_telemetry = 1,
+#else
+        .dshot_telemetry = 0,
+#endif
+        .motor_poles = MOTOR_POLES,
 
 #ifdef TORQUE_BOOST
         .torque_boost = TORQUE_BOOST,
@@ -162,14 +168,17 @@ const profile_t default_profile = {
 #ifdef GYRO_FILTER_PASS1_PT1
                 .type = FILTER_LP_PT1,
                 .cutoff_freq = GYRO_FREQ_PASS1,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #else // GYRO_FILTER_PASS1_PT2
                 .type = FILTER_LP_PT2,
                 .cutoff_freq = GYRO_FREQ_PASS1,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #endif
             },
 #else
             {
                 .type = FILTER_NONE,
+                .q = FILTER_Q_TYPE_DEFAULT,
             },
 #endif
 #if defined(GYRO_FILTER_PASS2_PT1) || defined(GYRO_FILTER_PASS2_PT2)
@@ -177,14 +186,17 @@ const profile_t default_profile = {
 #ifdef GYRO_FILTER_PASS2_PT1
                 .type = FILTER_LP_PT1,
                 .cutoff_freq = GYRO_FREQ_PASS1,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #else // GYRO_FILTER_PASS2_PT2
                 .type = FILTER_LP_PT2,
                 .cutoff_freq = GYRO_FREQ_PASS1,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #endif
             }
 #else
             {
                 .type = FILTER_NONE,
+                .q = FILTER_Q_TYPE_DEFAULT,
             }
 #endif
         },
@@ -195,14 +207,17 @@ const profile_t default_profile = {
 #ifdef DTERM_FILTER_PASS1_PT1
                 .type = FILTER_LP_PT1,
                 .cutoff_freq = DTERM_FREQ_PASS1,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #else // DTERM_FILTER_PASS1_PT2
                 .type = FILTER_LP_PT2,
                 .cutoff_freq = DTERM_FREQ_PASS1,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #endif
             },
 #else
             {
                 .type = FILTER_NONE,
+                .q = FILTER_Q_TYPE_DEFAULT,
             },
 #endif
 #if defined(DTERM_FILTER_PASS2_PT1) || defined(DTERM_FILTER_PASS2_PT2)
@@ -210,14 +225,17 @@ const profile_t default_profile = {
 #ifdef DTERM_FILTER_PASS2_PT1
                 .type = FILTER_LP_PT1,
                 .cutoff_freq = DTERM_FREQ_PASS2,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #else // DTERM_FILTER_PASS2_PT2
                 .type = FILTER_LP_PT2,
                 .cutoff_freq = DTERM_FREQ_PASS2,
+                .q = FILTER_Q_TYPE_DEFAULT,
 #endif
             }
 #else
             {
                 .type = FILTER_NONE,
+                .q = FILTER_Q_TYPE_DEFAULT,
             }
 #endif
         },
@@ -233,6 +251,24 @@ const profile_t default_profile = {
 #ifdef DYNAMIC_FREQ_MAX
         .dterm_dynamic_max = DYNAMIC_FREQ_MAX,
 #endif
+
+#ifdef GYRO_DYNAMIC_NOTCH
+        .gyro_dynamic_notch_enable = 1,
+#else
+        .gyro_dynamic_notch_enable = 0,
+#endif
+        .gyro_dynamic_notch_q = DYNAMIC_NOTCH_Q,
+        .gyro_dynamic_notch_min = DYNAMIC_NOTCH_MIN,
+        .gyro_dynamic_notch_max = DYNAMIC_NOTCH_MAX,
+
+#ifdef GYRO_RPM_FILTER
+        .gyro_rpm_filter_enable = 1,
+#else
+        .gyro_rpm_filter_enable = 0,
+#endif
+        .gyro_rpm_filter_q = RPM_FILTER_Q,
+        .gyro_rpm_filter_min = RPM_FILTER_MIN,
+        .pid_rate_divider = PID_RATE_DIVIDER,
     },
 
     .rate = {
@@ -408,6 +444,20 @@ const profile_t default_profile = {
         .ibat_scale = 0,
 #endif
     },
+    .blackbox = {
+        .field_flags = BLACKBOX_FIELD_ALL,
+        .rate_divider = BLACKBOX_RATE_DIVIDER,
+        .field_divider = {[0 ... BLACKBOX_FIELD_MAX - 1] = 1},
+#ifdef BLACKBOX_PRE_TRIGGER_MS
+        .pre_trigger_ms = BLACKBOX_PRE_TRIGGER_MS,
+#else
+        .pre_trigger_ms = 0,
+#endif
+        .compression = BLACKBOX_COMPRESSION,
+        .capture = BLACKBOX_CAPTURE_OFF,
+        .capture_rate = BLACKBOX_CAPTURE_RATE_SAMPLE,
+        .capture_ms = BLACKBOX_CAPTURE_MS,
+    },
     .receiver = {
 #if defined(RX_EXPRESS_LRS)
         .protocol = RX_PROTOCOL_EXPRESS_LRS,
@@ -451,7 +501,11 @@ const profile_t default_profile = {
 #else
             AUX_CHANNEL_OFF,
 #endif
-            AUX_CHANNEL_OFF, // AUX_BLACKBOX
+#ifdef BLACKBOX_SWITCH // AUX_BLACKBOX
+            BLACKBOX_SWITCH,
+#else
+            AUX_CHANNEL_OFF,
+#endif
             PREARM,          // AUX_PREARM
         },
         .lqi_source = RX_LQI_SOURCE_PACKET_RATE,
@@ -636,6 +690,10 @@ CBOR_START_STRUCT_ENCODER(profile_voltage_t)
 VOLTAGE_MEMBERS
 CBOR_END_STRUCT_ENCODER()
 
+CBOR_START_STRUCT_ENCODER(profile_blackbox_t)
+BLACKBOX_MEMBERS
+CBOR_END_STRUCT_ENCODER()
+
 CBOR_START_STRUCT_ENCODER(pid_rate_t)
 PID_RATE_MEMBERS
 CBOR_END_STRUCT_ENCODER()
@@ -758,6 +816,10 @@ CBOR_START_STRUCT_DECODER(profile_voltage_t)
 VOLTAGE_MEMBERS
 CBOR_END_STRUCT_DECODER()
 
+CBOR_START_STRUCT_DECODER(profile_blackbox_t)
+BLACKBOX_MEMBERS
+CBOR_END_STRUCT_DECODER()
+
 CBOR_START_STRUCT_DECODER(pid_rate_t)
 PID_RATE_MEMBERS
 CBOR_END_STRUCT_DECODER()
@@ -174,6 +174,8 @@ typedef struct {
   float digital_idle;
   float motor_limit;
   dshot_time_t dshot_time;
+  uint8_t dshot_telemetry;
+  uint8_t motor_poles;
   uint8_t invert_yaw;
   uint8_t gyro_orientation;
   float torque_boost;
@@ -186,6 +188,8 @@ typedef struct {
   MEMBER(digital_idle, float)        \
   MEMBER(motor_limit, float)         \
   MEMBER(dshot_time, uint16)         \
+  MEMBER(dshot_telemetry, uint8)     \
+  MEMBER(motor_poles, uint8)         \
   MEMBER(invert_yaw, uint8)          \
   MEMBER(gyro_orientation, uint8)    \
   MEMBER(torque_boost, float)        \
@@ -263,12 +267,14 @@ typedef struct {
 
 typedef struct {
   filter_type_t type;
-  float cutoff_freq;
+  float cutoff_freq; // cutoff or center frequency for notch filters
+  float q;           // only used by the biquad filters, 0 picks the default of the type
 } profile_filter_parameter_t;
 
 #define FILTER_PARAMETER_MEMBERS \
   MEMBER(type, uint8)            \
-  MEMBER(cutoff_freq, float)
+  MEMBER(cutoff_freq, float)     \
+  MEMBER(q, float)
 
 typedef struct {
   profile_filter_parameter_t gyro[FILTER_MAX_SLOTS];
@@ -276,6 +282,14 @@ typedef struct {
   uint8_t dterm_dynamic_enable;
   float dterm_dynamic_min;
   float dterm_dynamic_max;
+  uint8_t gyro_dynamic_notch_enable;
+  float gyro_dynamic_notch_q;
+  float gyro_dynamic_notch_min;
+  float gyro_dynamic_notch_max;
+  uint8_t gyro_rpm_filter_enable;
+  float gyro_rpm_filter_q;
+  float gyro_rpm_filter_min;
+  uint8_t pid_rate_divider; // pid and motor output run on every nth gyro sample
 } profile_filter_t;
 
 #define FILTER_MEMBERS                                              \
@@ -283,7 +297,69 @@ typedef struct {
   ARRAY_MEMBER(dterm, FILTER_MAX_SLOTS, profile_filter_parameter_t) \
   MEMBER(dterm_dynamic_enable, uint8)                               \
   MEMBER(dterm_dynamic_min, float)                                  \
-  MEMBER(dterm_dynamic_max, float)
+  MEMBER(dterm_dynamic_max, float)                                  \
+  MEMBER(gyro_dynamic_notch_enable, uint8)                          \
+  MEMBER(gyro_dynamic_notch_q, float)                               \
+  MEMBER(gyro_dynamic_notch_min, float)                             \
+  MEMBER(gyro_dynamic_notch_max, float)                             \
+  MEMBER(gyro_rpm_filter_enable, uint8)                             \
+  MEMBER(gyro_rpm_filter_q, float)                                  \
+  MEMBER(gyro_rpm_filter_min, float)                                \
+  MEMBER(pid_rate_divider, uint8)
+
+// same order as BLACKBOX_FIELDS
+typedef enum {
+  BLACKBOX_FIELD_LOOP,
+  BLACKBOX_FIELD_TIME,
+  BLACKBOX_FIELD_PID_P_TERM,
+  BLACKBOX_FIELD_PID_I_TERM,
+  BLACKBOX_FIELD_PID_D_TERM,
+  BLACKBOX_FIELD_RX,
+  BLACKBOX_FIELD_SETPOINT,
+  BLACKBOX_FIELD_ACCEL_RAW,
+  BLACKBOX_FIELD_ACCEL_FILTER,
+  BLACKBOX_FIELD_GYRO_RAW,
+  BLACKBOX_FIELD_GYRO_FILTER,
+  BLACKBOX_FIELD_MOTOR,
+  BLACKBOX_FIELD_CPU_LOAD,
+  BLACKBOX_FIELD_DEBUG,
+  BLACKBOX_FIELD_MAX,
+} blackbox_field_t;
+
+#define BLACKBOX_FIELD_ALL ((1 << BLACKBOX_FIELD_MAX) - 1)
+
+// instead of frames only the gyro is logged at its full rate, for a few seconds once logging starts
+typedef enum {
+  BLACKBOX_CAPTURE_OFF,
+  BLACKBOX_CAPTURE_GYRO,          // raw gyro
+  BLACKBOX_CAPTURE_GYRO_FILTERED, // raw and filtered gyro in pairs
+} blackbox_capture_t;
+
+typedef enum {
+  BLACKBOX_CAPTURE_RATE_SAMPLE, // every gyro sample, all of them when the fifo is read
+  BLACKBOX_CAPTURE_RATE_LOOP,   // the newest sample of every loop
+} blackbox_capture_rate_t;
+
+typedef struct {
+  uint32_t field_flags;                      // one bit per blackbox_field_t, loop is always logged
+  uint8_t rate_divider;                      // log every nth loop
+  uint8_t field_divider[BLACKBOX_FIELD_MAX]; // log a field every nth logged loop
+  uint16_t pre_trigger_ms;                   // frames kept from before logging starts, 0 disables
+  uint8_t compression;                       // lz compress the log, 0 writes it as is
+  uint8_t capture;                           // blackbox_capture_t
+  uint8_t capture_rate;                      // blackbox_capture_rate_t
+  uint16_t capture_ms;                       // length of a capture
+} profile_blackbox_t;
+
+#define BLACKBOX_MEMBERS                                 \
+  MEMBER(field_flags, uint32)                            \
+  MEMBER(rate_divider, uint8)                            \
+  ARRAY_MEMBER(field_divider, BLACKBOX_FIELD_MAX, uint8) \
+  MEMBER(pre_trigger_ms, uint16)                         \
+  MEMBER(compression, uint8)                             \
+  MEMBER(capture, uint8)                                 \
+  MEMBER(capture_rate, uint8)                            \
+  MEMBER(capture_ms, uint16)
 
 typedef struct {
   uint8_t name[36];
@@ -301,6 +377,7 @@ typedef struct {
   profile_receiver_t receiver;
   profile_pid_t pid;
   profile_voltage_t voltage;
+  profile_blackbox_t blackbox;
 } profile_t;
 
 #define PROFILE_MEMBERS                \
@@ -312,7 +389,8 @@ typedef struct {
   MEMBER(rate, profile_rate_t)         \
   MEMBER(receiver, profile_receiver_t) \
   MEMBER(pid, profile_pid_t)           \
-  MEMBER(voltage, profile_voltage_t)
+  MEMBER(voltage, profile_voltage_t)   \
+  MEMBER(blackbox, profile_blackbox_t)
 
 typedef enum {
   FEATURE_BRUSHLESS = (1 << 1),
@@ -48,4 +48,8 @@
 #include <stm32h7xx_ll_system.h>
 #include <stm32h7xx_ll_tim.h>
 #include <stm32h7xx_ll_usart.h>
-#endif
\ No newline at end of file
+#endif
+
+#ifdef SIMULATOR
+#include "sitl.h"
+#endif
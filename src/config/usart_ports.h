@@ -58,6 +58,10 @@
 #define USART8_PE0PE1 USART_PORT(8, PIN_E0, PIN_E1)
 #endif
 
+#ifdef SIMULATOR
+#define USART1_PA10PA9 USART_PORT(1, PIN_A10, PIN_A9)
+#endif
+
 #define USART_IDENT(channel) USART_PORT##channel
 #define SOFT_SERIAL_IDENT(channel) SOFT_SERIAL_PORT##channel
 
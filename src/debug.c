@@ -4,11 +4,13 @@
 #include "drv_time.h"
 #include "flight/control.h"
 #include "util/cbor_helper.h"
+#include "util/util.h"
 
-#ifdef DEBUG
-
+// the histograms are reset once after this many loops so startup transients do not skew them
 #define SKIP_LOOPS 20000
 
+#define PERF_HISTOGRAM_SUB_BUCKETS (1 << PERF_HISTOGRAM_SUB_BITS)
+
 perf_counter_t perf_counters[PERF_COUNTER_MAX];
 
 static const char *perf_counter_names[PERF_COUNTER_MAX] = {
@@ -20,43 +22,141 @@ static const char *perf_counter_names[PERF_COUNTER_MAX] = {
     "PERF_COUNTER_MISC",
     "PERF_COUNTER_BLACKBOX",
     "PERF_COUNTER_DEBUG",
+    "PERF_COUNTER_DYN_NOTCH",
+    "PERF_COUNTER_FILTER_LP",
+    "PERF_COUNTER_FILTER_RPM",
+    "PERF_COUNTER_FILTER_DYN_NOTCH",
+    "PERF_COUNTER_SPI_WAIT",
+    "PERF_COUNTER_SPI_DMA_ISR",
+    "PERF_COUNTER_BLACKBOX_COMPRESS",
+    "PERF_COUNTER_SPI_QUEUE_GYRO",
+    "PERF_COUNTER_SPI_QUEUE_FLASH",
+    "PERF_COUNTER_SPI_QUEUE_OSD",
+    "PERF_COUNTER_SPI_QUEUE_RX",
 };
 
 static uint32_t perf_counter_start_time[PERF_COUNTER_MAX];
 static uint32_t loop_counter = 0;
 
-void perf_counter_init() {
+void perf_counter_reset() {
   for (uint32_t i = 0; i < PERF_COUNTER_MAX; i++) {
     perf_counters[i].min = UINT32_MAX;
     perf_counters[i].max = 0;
     perf_counters[i].current = 0;
+    perf_counters[i].bytes_in = 0;
+    perf_counters[i].bytes_out = 0;
+
+    for (uint32_t j = 0; j < PERF_HISTOGRAM_BUCKETS; j++) {
+      perf_counters[i].histogram[j] = 0;
+    }
   }
 }
 
+void perf_counter_init() {
+  loop_counter = 0;
+  perf_counter_reset();
+}
+
+static uint32_t perf_histogram_bucket(uint32_t cycles) {
+  if (cycles < (1 << PERF_HISTOGRAM_MIN_BITS)) {
+    return 0;
+  }
+
+  const uint32_t msb = 31 - __builtin_clz(cycles);
+  const uint32_t sub = (cycles >> (msb - PERF_HISTOGRAM_SUB_BITS)) & (PERF_HISTOGRAM_SUB_BUCKETS - 1);
+  const uint32_t bucket = 1 + ((msb - PERF_HISTOGRAM_MIN_BITS) << PERF_HISTOGRAM_SUB_BITS) + sub;
+  if (bucket >= PERF_HISTOGRAM_BUCKETS) {
+    return PERF_HISTOGRAM_BUCKETS - 1;
+  }
+  return bucket;
+}
+
+// lowest cycle count that lands in the bucket
+static uint32_t perf_histogram_bucket_start(uint32_t bucket) {
+  if (bucket == 0) {
+    return 0;
+  }
+
+  const uint32_t msb = PERF_HISTOGRAM_MIN_BITS + ((bucket - 1) >> PERF_HISTOGRAM_SUB_BITS);
+  const uint32_t sub = (bucket - 1) & (PERF_HISTOGRAM_SUB_BUCKETS - 1);
+  return (PERF_HISTOGRAM_SUB_BUCKETS + sub) << (msb - PERF_HISTOGRAM_SUB_BITS);
+}
+
 void perf_counter_start(perf_counters_t counter) {
   perf_counter_start_time[counter] = time_cycles();
 }
 
 void perf_counter_end(perf_counters_t counter) {
-  if (loop_counter < SKIP_LOOPS) {
-    return;
-  }
+  perf_counter_record(counter, time_cycles() - perf_counter_start_time[counter]);
+}
 
-  uint32_t delta = time_cycles() - perf_counter_start_time[counter];
+void perf_counter_record(perf_counters_t counter, uint32_t delta) {
+  perf_counter_t *c = &perf_counters[counter];
 
-  if (delta > perf_counters[counter].max) {
-    perf_counters[counter].max = delta;
+  if (delta > c->max) {
+    c->max = delta;
   }
 
-  if (delta < perf_counters[counter].min) {
-    perf_counters[counter].min = delta;
+  if (delta < c->min) {
+    c->min = delta;
+  }
+
+  c->current = delta;
+
+  uint16_t *bucket = &c->histogram[perf_histogram_bucket(delta)];
+  (*bucket)++;
+  if (*bucket == UINT16_MAX) {
+    for (uint32_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+      c->histogram[i] >>= 1;
+    }
   }
+}
 
-  perf_counters[counter].current = delta;
+void perf_counter_bytes(perf_counters_t counter, uint32_t in, uint32_t out) {
+  perf_counters[counter].bytes_in += in;
+  perf_counters[counter].bytes_out += out;
 }
 
 void perf_counter_update() {
   loop_counter++;
+  if (loop_counter == SKIP_LOOPS) {
+    perf_counter_reset();
+  }
+}
+
+uint32_t perf_counter_percentile(perf_counters_t counter, uint32_t per_mille) {
+  const uint16_t *histogram = perf_counters[counter].histogram;
+
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+    total += histogram[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  const uint64_t target = (uint64_t)total * per_mille;
+
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+    const uint64_t count = (uint64_t)histogram[i] * 1000;
+    if (count == 0 || sum + count < target) {
+      sum += count;
+      continue;
+    }
+
+    // the last bucket is open ended, report its start
+    const uint32_t start = perf_histogram_bucket_start(i);
+    if (i == PERF_HISTOGRAM_BUCKETS - 1) {
+      return start;
+    }
+
+    const uint32_t width = perf_histogram_bucket_start(i + 1) - start;
+    const uint32_t value = start + (uint32_t)((target - sum) * width / count);
+    return constrain(value, perf_counters[counter].min, perf_counters[counter].max);
+  }
+
+  return perf_counters[counter].max;
 }
 
 #define ENCODE_CYCLES(val)                                     \
@@ -65,6 +165,12 @@ void perf_counter_update() {
     CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &us));      \
   }
 
+#define ENCODE_CYCLES_FLOAT(val)                                      \
+  {                                                                   \
+    const float us = (float)(val) / (SYS_CLOCK_FREQ_HZ / 1000000.0f); \
+    CBOR_CHECK_ERROR(res = cbor_encode_float(enc, &us));              \
+  }
+
 cbor_result_t cbor_encode_perf_counters(cbor_value_t *enc) {
   CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_array_indefinite(enc));
 
@@ -83,6 +189,23 @@ cbor_result_t cbor_encode_perf_counters(cbor_value_t *enc) {
     CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "current"));
     ENCODE_CYCLES(perf_counters[i].current)
 
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "p50"));
+    ENCODE_CYCLES_FLOAT(perf_counter_percentile(i, 500))
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "p99"));
+    ENCODE_CYCLES_FLOAT(perf_counter_percentile(i, 990))
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "p999"));
+    ENCODE_CYCLES_FLOAT(perf_counter_percentile(i, 999))
+
+    if (perf_counters[i].bytes_in) {
+      CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "bytes_in"));
+      CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &perf_counters[i].bytes_in));
+
+      CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "bytes_out"));
+      CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &perf_counters[i].bytes_out));
+    }
+
     CBOR_CHECK_ERROR(res = cbor_encode_end_indefinite(enc));
   }
 
@@ -91,6 +214,37 @@ cbor_result_t cbor_encode_perf_counters(cbor_value_t *enc) {
   return res;
 }
 
+// start of every bucket in us, shared by all histograms
+cbor_result_t cbor_encode_perf_histogram_buckets(cbor_value_t *enc) {
+  CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_array(enc, PERF_HISTOGRAM_BUCKETS));
+
+  for (uint32_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+    ENCODE_CYCLES_FLOAT(perf_histogram_bucket_start(i))
+  }
+
+  return res;
+}
+
+cbor_result_t cbor_encode_perf_histogram(cbor_value_t *enc, perf_counters_t counter) {
+  CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_map_indefinite(enc));
+
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "name"));
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, perf_counter_names[counter]));
+
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "histogram"));
+  CBOR_CHECK_ERROR(res = cbor_encode_array(enc, PERF_HISTOGRAM_BUCKETS));
+  for (uint32_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+    const uint32_t count = perf_counters[counter].histogram[i];
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &count));
+  }
+
+  CBOR_CHECK_ERROR(res = cbor_encode_end_indefinite(enc));
+
+  return res;
+}
+
+#ifdef DEBUG
+
 void debug_pin_init() {
 #if defined(DEBUG_PIN0) || defined(DEBUG_PIN1)
   LL_GPIO_InitTypeDef gpio_init;
@@ -153,12 +307,6 @@ void debug_pin_toggle(uint8_t index) {
 
 #else
 
-void perf_counter_start(perf_counters_t counter) {}
-void perf_counter_end(perf_counters_t counter) {}
-
-void perf_counter_init() {}
-void perf_counter_update() {}
-
 void debug_pin_init() {}
 
 void debug_pin_enable(uint8_t index) {}
@@ -15,25 +15,59 @@ typedef enum {
   PERF_COUNTER_MISC,
   PERF_COUNTER_BLACKBOX,
   PERF_COUNTER_DEBUG,
+  PERF_COUNTER_DYN_NOTCH,
+  PERF_COUNTER_FILTER_LP,
+  PERF_COUNTER_FILTER_RPM,
+  PERF_COUNTER_FILTER_DYN_NOTCH,
+  PERF_COUNTER_SPI_WAIT,
+  PERF_COUNTER_SPI_DMA_ISR,
+  PERF_COUNTER_BLACKBOX_COMPRESS,
+  // time a spi txn waited in the queue before it started, per device
+  PERF_COUNTER_SPI_QUEUE_GYRO,
+  PERF_COUNTER_SPI_QUEUE_FLASH,
+  PERF_COUNTER_SPI_QUEUE_OSD,
+  PERF_COUNTER_SPI_QUEUE_RX,
 
   PERF_COUNTER_MAX
 } perf_counters_t;
 
+// log scale histogram with 4 buckets per power of two,
+// the first bucket collects everything below 2^PERF_HISTOGRAM_MIN_BITS cycles and the last everything above the range
+#define PERF_HISTOGRAM_SUB_BITS 2
+#define PERF_HISTOGRAM_MIN_BITS 7
+#define PERF_HISTOGRAM_BUCKETS 64
+
 typedef struct {
   uint32_t min;
   uint32_t max;
   uint32_t current;
+
+  // for counters around a stage that transforms data, like compression
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+
+  // once a bucket saturates all buckets are halved, which keeps the shape and ages out old samples
+  uint16_t histogram[PERF_HISTOGRAM_BUCKETS];
 } perf_counter_t;
 
 extern perf_counter_t perf_counters[PERF_COUNTER_MAX];
 
 void perf_counter_start(perf_counters_t counter);
 void perf_counter_end(perf_counters_t counter);
+// for spans that start and end in different places, delta is in cycles
+void perf_counter_record(perf_counters_t counter, uint32_t delta);
+void perf_counter_bytes(perf_counters_t counter, uint32_t in, uint32_t out);
 
 void perf_counter_init();
+void perf_counter_reset();
 void perf_counter_update();
 
+// per mille percentile of a counter in cycles, interpolated within the bucket
+uint32_t perf_counter_percentile(perf_counters_t counter, uint32_t per_mille);
+
 cbor_result_t cbor_encode_perf_counters(cbor_value_t *enc);
+cbor_result_t cbor_encode_perf_histogram(cbor_value_t *enc, perf_counters_t counter);
+cbor_result_t cbor_encode_perf_histogram_buckets(cbor_value_t *enc);
 
 void debug_pin_init();
 
@@ -76,111 +76,58 @@ const dma_stream_def_t dma_stream_defs[DMA_DEVICE_MAX] = {DMA_STREAMS};
 #define CACHE_LINE_MASK (CACHE_LINE_SIZE - 1)
 #endif
 
-typedef struct _dma_allocation {
-  uint32_t size;
-  uint16_t magic;
-  uint16_t free;
+static DMA_RAM uint8_t dma_arena_data[DMA_ALLOC_BUFFER_SIZE] __attribute__((aligned(SLAB_ALIGN)));
+static slab_t dma_arena_slabs[DMA_ALLOC_BUFFER_SIZE / SLAB_SIZE];
 
-  struct _dma_allocation *prev;
-  struct _dma_allocation *next;
-} __attribute__((aligned(32))) dma_allocation_t;
+_Static_assert(DMA_ALLOC_BUFFER_SIZE / SLAB_SIZE <= SLAB_ARENA_MAX, "dma arena has more slabs than it can track");
 
-#define DMA_ALIGN_SIZE 32
-#define DMA_ALIGN(offset) ((offset + (DMA_ALIGN_SIZE - 1)) & -DMA_ALIGN_SIZE)
+static slab_arena_t dma_arena = {
+    .data = dma_arena_data,
+    .slabs = dma_arena_slabs,
+    .count = DMA_ALLOC_BUFFER_SIZE / SLAB_SIZE,
+    .unused = SLAB_ARENA_UNUSED(DMA_ALLOC_BUFFER_SIZE / SLAB_SIZE),
+};
 
-static DMA_RAM uint8_t buffer[DMA_ALLOC_BUFFER_SIZE];
-
-void *dma_alloc(uint32_t min_size) {
-  ATOMIC_BLOCK_ALL {
-    dma_allocation_t *alloc = (dma_allocation_t *)buffer;
-    while (alloc != NULL) {
-      if (alloc->free && alloc->size >= min_size) {
-        break;
-      }
-      if (alloc->next == NULL && alloc->size == 0) {
-        alloc->size = DMA_ALIGN(min_size);
-        alloc->next = NULL;
-        alloc->prev = NULL;
-        break;
-      }
-      if (alloc->next == NULL) {
-        dma_allocation_t *new_alloc = (dma_allocation_t *)((void *)(alloc) + sizeof(dma_allocation_t) + alloc->size);
-        if (((void *)(new_alloc) - (void *)(buffer)) >= DMA_ALLOC_BUFFER_SIZE) {
-          failloop(FAILLOOP_FAULT);
-        }
-
-        new_alloc->size = DMA_ALIGN(min_size);
-        new_alloc->next = NULL;
-        new_alloc->prev = alloc;
-
-        alloc->next = new_alloc;
-        alloc = new_alloc;
-        break;
-      }
-      alloc = alloc->next;
-    }
-
-    alloc->magic = 0xBEEF;
-    alloc->free = 0;
+void dma_pool_init(slab_pool_t *pool) {
+  slab_pool_init(pool, &dma_arena);
+}
 
-    return (void *)(alloc) + sizeof(dma_allocation_t);
+void *dma_alloc(slab_pool_t *pool, uint32_t *size) {
+  void *ptr = slab_alloc(pool, size);
+  if (ptr == NULL) {
+    failloop(FAILLOOP_DMA);
   }
-
-  failloop(FAILLOOP_FAULT);
-  return NULL;
+  return ptr;
 }
 
 void dma_free(void *ptr) {
-  ATOMIC_BLOCK_ALL {
-    dma_allocation_t *alloc = (dma_allocation_t *)(ptr - sizeof(dma_allocation_t));
-    if (alloc->magic != 0xBEEF) {
-      failloop(FAILLOOP_DMA);
-    }
-
-    alloc->free = 1;
-
-    while (alloc->next != NULL) {
-      alloc = alloc->next;
-    }
-
-    while (alloc != NULL && alloc->free) {
-      alloc->free = 0;
-      alloc->size = 0;
-      alloc->next = NULL;
-
-      dma_allocation_t *prev = alloc->prev;
-      if (prev) {
-        prev->next = NULL;
-      }
-      alloc->prev = NULL;
-
-      alloc = prev;
-    }
+  if (!slab_free(&dma_arena, ptr)) {
+    failloop(FAILLOOP_DMA);
   }
 }
 
-void *dma_realloc(void *ptr, uint32_t min_size) {
-  ATOMIC_BLOCK_ALL {
-    dma_allocation_t *alloc = (dma_allocation_t *)(ptr - sizeof(dma_allocation_t));
-    if (alloc->size >= min_size) {
-      return ptr;
-    }
-
-    uint32_t old_size = alloc->size;
-    dma_free(ptr);
-
-    void *new_ptr = dma_alloc(min_size);
-    if (new_ptr && new_ptr != ptr) {
-      memcpy(new_ptr, ptr, old_size);
-    }
-    return new_ptr;
+bool dma_can_access(const void *addr, uint32_t size, bool write) {
+  const uint32_t start = (uint32_t)addr;
+  const uint32_t end = start + size - 1;
+#if defined(STM32H7)
+  // the dma streams do not reach the dtcm, dma ram is kept out of the cache
+  return WITHIN_DMA_RAM(start) && WITHIN_DMA_RAM(end);
+#else
+  // neither flash nor the core coupled memory of the f405
+  if ((start & 0xF0000000) != 0x20000000 || (end & 0xF0000000) != 0x20000000) {
+    return false;
   }
-
-  failloop(FAILLOOP_FAULT);
-  return NULL;
+#if defined(STM32F7)
+  // invalidating the cache lines has to leave the memory next to it alone
+  if (write && !(WITHIN_DTCM_RAM(start) && WITHIN_DTCM_RAM(end)) && ((start | size) & CACHE_LINE_MASK)) {
+    return false;
+  }
+#endif
+  return true;
+#endif
 }
 
-void dma_prepare_tx_memory(void *addr, uint32_t size) {
+void dma_prepare_tx_memory(const void *addr, uint32_t size) {
 #if defined(STM32F7) || defined(STM32H7)
   if (!WITHIN_DTCM_RAM(addr) && !WITHIN_DMA_RAM(addr)) {
     SCB_CleanDCache_by_Addr((uint32_t *)((uint32_t)addr & ~CACHE_LINE_MASK), (size + CACHE_LINE_SIZE) & ~CACHE_LINE_MASK);
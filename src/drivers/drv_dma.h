@@ -1,10 +1,13 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "project.h"
+#include "util/slab.h"
 
-#define DMA_ALLOC_BUFFER_SIZE 4096
+// shared by the pools of all spi ports, a pool takes a SLAB_SIZE slab per size class it uses
+#define DMA_ALLOC_BUFFER_SIZE (8 * SLAB_SIZE)
 
 typedef enum {
   DMA_DEVICE_SPI1_RX,
@@ -41,11 +44,15 @@ typedef struct {
 
 extern const dma_stream_def_t dma_stream_defs[DMA_DEVICE_MAX];
 
-void *dma_alloc(uint32_t min_size);
-void *dma_realloc(void *ptr, uint32_t min_size);
+void dma_pool_init(slab_pool_t *pool);
+// size is the minimum on the way in and the size of the buffer on the way out
+void *dma_alloc(slab_pool_t *pool, uint32_t *size);
 void dma_free(void *ptr);
 
-void dma_prepare_tx_memory(void *addr, uint32_t size);
+// whether the dma can read or (with write set) write size bytes at addr in place
+bool dma_can_access(const void *addr, uint32_t size, bool write);
+
+void dma_prepare_tx_memory(const void *addr, uint32_t size);
 void dma_prepare_rx_memory(void *addr, uint32_t size);
 
 void dma_enable_rcc(dma_device_t dev);
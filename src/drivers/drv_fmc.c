@@ -21,7 +21,7 @@
 
 #define FLASH_PTR(offset) (_config_flash + FLASH_ALIGN(offset))
 
-uint8_t __attribute__((section(".config_flash"))) _config_flash[16384];
+uint8_t __attribute__((section(".config_flash"))) _config_flash[FMC_FLASH_SIZE];
 
 void fmc_lock() {
   HAL_FLASH_Lock();
@@ -10,6 +10,9 @@ typedef uint64_t flash_word_t;
 typedef uint32_t flash_word_t;
 #endif
 
+// size of the config flash section
+#define FMC_FLASH_SIZE 16384
+
 #define FLASH_ALIGN(offset) ((offset + (FLASH_WORD_SIZE - 1)) & -FLASH_WORD_SIZE)
 
 void fmc_lock();
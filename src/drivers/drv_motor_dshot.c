@@ -9,8 +9,11 @@
 #include "drv_spi.h"
 #include "drv_time.h"
 #include "flight/control.h"
+#include "flight/filter.h"
 #include "profile.h"
 #include "project.h"
+#include "util/dshot_encode.h"
+#include "util/dshot_telemetry.h"
 #include "util/util.h"
 
 #if defined(USE_DSHOT_DMA_DRIVER)
@@ -29,6 +32,23 @@
 
 #define DSHOT_MAX_PORT_COUNT 3
 #define DSHOT_DMA_BUFFER_SIZE (3 * (16 + 2))
+// every bit is a start, a data and an idle word, the packet is framed by one idle bit on either side
+#define DSHOT_DMA_DATA_WORD(bit) (((bit) + 1) * 3 + 1)
+
+// the timer keeps running at 3x the dshot bitrate while capturing, the reply is sent at 5/4 of the dshot bitrate
+#define DSHOT_TELEMETRY_SAMPLES_PER_BIT_Q8 ((3 * 4 * 256) / 5)
+// the esc answers about 30us after the frame
+#define DSHOT_TELEMETRY_DELAY_US 40
+// the 21 bits of the reply plus a little slack for clock differences
+#define DSHOT_TELEMETRY_REPLY_SAMPLES (DSHOT_TELEMETRY_BITS * 3 * 4 / 5 + 4)
+// the capture only covers the reply window, samples are taken at 3x the dshot bitrate in khz
+#define DSHOT_TELEMETRY_SAMPLES(dshot_time) (DSHOT_TELEMETRY_DELAY_US * 3 * (dshot_time) / 1000 + DSHOT_TELEMETRY_REPLY_SAMPLES)
+#define DSHOT_TELEMETRY_SAMPLES_MAX DSHOT_TELEMETRY_SAMPLES(DSHOT_TIME_600)
+
+// averaging factor for the per motor telemetry error rate
+#define DSHOT_TELEMETRY_ERROR_FILTER 0.99f
+// frames in a row without a good reply before the rpm of a motor is no longer trusted
+#define DSHOT_TELEMETRY_MISS_MAX 32
 
 #define DSHOT_DIR_CHANGE_IDLE_TIME_US 10000
 #define DSHOT_DIR_CHANGE_CMD_TIME_US 1000
@@ -55,8 +75,14 @@ typedef struct {
   uint32_t port_low;  // motor pins for BSRRL, for setting pins low
   uint32_t port_high; // motor pins for BSRRH, for setting pins high
 
+  uint32_t moder_mask;   // MODER bits of all motor pins, cleared for input
+  uint32_t moder_output; // MODER bits of all motor pins set to output
+
   uint32_t timer_channel;
   dma_device_t dma_device;
+
+  // data word per combination of motor bits, see dshot_encode.h
+  uint32_t bit_table[DSHOT_ENCODE_TABLE_SIZE];
 } dshot_gpio_port_t;
 
 static bool dir_change_done = true;
@@ -84,7 +110,17 @@ static dshot_gpio_port_t gpio_ports[DSHOT_MAX_PORT_COUNT] = {
     },
 };
 
-static volatile DMA_RAM uint32_t port_dma_buffer[DSHOT_MAX_PORT_COUNT][DSHOT_DMA_BUFFER_SIZE];
+// the next frame is encoded into one buffer while the dma might still be sending the other
+static volatile DMA_RAM uint32_t port_dma_buffer[2][DSHOT_MAX_PORT_COUNT][DSHOT_DMA_BUFFER_SIZE];
+static uint8_t port_dma_buffer_next = 0;
+
+// bidirectional dshot, replies are captured from IDR into this buffer
+static bool dshot_bidir = false;
+static volatile bool port_capturing[DSHOT_MAX_PORT_COUNT];
+static volatile bool telemetry_captured = false;
+static volatile DMA_RAM uint32_t port_capture_buffer[DSHOT_MAX_PORT_COUNT][DSHOT_TELEMETRY_SAMPLES_MAX];
+static uint32_t telemetry_samples = 0;
+static uint8_t telemetry_misses[4];
 
 #define MOTOR_PIN(_port, _pin, pin_af, timer, timer_channel) \
   {                                                          \
@@ -98,15 +134,25 @@ static motor_pin_t motor_pins[MOTOR_PIN_MAX] = {MOTOR_PINS};
 
 #undef MOTOR_PIN
 
+_Static_assert(MOTOR_PIN_MAX == DSHOT_ENCODE_MOTORS, "dshot encoder expects 4 motors");
+
 static void dshot_init_motor_pin(uint32_t index) {
   LL_GPIO_InitTypeDef gpio_init;
   gpio_init.Mode = LL_GPIO_MODE_OUTPUT;
   gpio_init.OutputType = LL_GPIO_OUTPUT_PUSHPULL;
-  gpio_init.Pull = LL_GPIO_PULL_NO;
+  gpio_init.Pull = dshot_bidir ? LL_GPIO_PULL_UP : LL_GPIO_PULL_NO;
   gpio_init.Speed = LL_GPIO_SPEED_FREQ_VERY_HIGH;
   gpio_init.Pin = motor_pins[index].pin;
   LL_GPIO_Init(motor_pins[index].port, &gpio_init);
-  LL_GPIO_ResetOutputPin(motor_pins[index].port, motor_pins[index].pin);
+
+  // inverted signal idles high
+  if (dshot_bidir) {
+    LL_GPIO_SetOutputPin(motor_pins[index].port, motor_pins[index].pin);
+  } else {
+    LL_GPIO_ResetOutputPin(motor_pins[index].port, motor_pins[index].pin);
+  }
+
+  const uint32_t pin_pos = __builtin_ctz(motor_pins[index].pin);
 
   for (uint8_t i = 0; i < DSHOT_MAX_PORT_COUNT; i++) {
     if (gpio_ports[i].gpio == motor_pins[index].port || i == gpio_port_count) {
@@ -115,6 +161,8 @@ static void dshot_init_motor_pin(uint32_t index) {
       gpio_ports[i].gpio = motor_pins[index].port;
       gpio_ports[i].port_high |= motor_pins[index].pin;
       gpio_ports[i].port_low |= (motor_pins[index].pin << 16);
+      gpio_ports[i].moder_mask |= (0x3 << (pin_pos * 2));
+      gpio_ports[i].moder_output |= (0x1 << (pin_pos * 2));
 
       motor_pins[index].dshot_port = i;
 
@@ -150,7 +198,7 @@ static void dshot_init_gpio_port(dshot_gpio_port_t *port) {
   DMA_InitStructure.Channel = dma->channel;
 #endif
   DMA_InitStructure.PeriphOrM2MSrcAddress = (uint32_t)&port->gpio->BSRR;
-  DMA_InitStructure.MemoryOrM2MDstAddress = (uint32_t)port_dma_buffer[0];
+  DMA_InitStructure.MemoryOrM2MDstAddress = (uint32_t)port_dma_buffer[0][0];
   DMA_InitStructure.Direction = LL_DMA_DIRECTION_MEMORY_TO_PERIPH;
   DMA_InitStructure.NbData = DSHOT_DMA_BUFFER_SIZE;
   DMA_InitStructure.PeriphOrM2MSrcIncMode = LL_DMA_PERIPH_NOINCREMENT;
@@ -201,8 +249,49 @@ static void dshot_disable_dma_request(uint32_t timer_channel) {
   }
 }
 
+// the idle level of the line, high for inverted (bidirectional) dshot
+static inline uint32_t dshot_port_idle(dshot_gpio_port_t *port) {
+  return dshot_bidir ? port->port_high : port->port_low;
+}
+
+static inline uint32_t dshot_port_active(dshot_gpio_port_t *port) {
+  return dshot_bidir ? port->port_low : port->port_high;
+}
+
+static void dshot_init_bit_table(uint32_t index) {
+  uint32_t high[DSHOT_ENCODE_MOTORS] = {0};
+  uint32_t low[DSHOT_ENCODE_MOTORS] = {0};
+
+  for (uint32_t motor = 0; motor < MOTOR_PIN_MAX; motor++) {
+    if (motor_pins[motor].dshot_port != index) {
+      continue;
+    }
+
+    // for 1 hold the line active for two timeunits, for 0 return it to idle after the start bit
+    high[motor] = dshot_bidir ? (motor_pins[motor].pin << 16) : (motor_pins[motor].pin);
+    low[motor] = dshot_bidir ? (motor_pins[motor].pin) : (motor_pins[motor].pin << 16);
+  }
+
+  dshot_encode_table(gpio_ports[index].bit_table, high, low);
+}
+
+// time from the start of a frame until the last reply sample, every dma word and sample takes one timer period
+static uint32_t dshot_frame_time_us() {
+  const uint32_t symbols = DSHOT_DMA_BUFFER_SIZE + (dshot_bidir ? telemetry_samples : 0);
+  return symbols * 1000 / (3 * DSHOT_TIME);
+}
+
 void motor_init() {
   gpio_port_count = 0;
+  dshot_bidir = profile.motor.dshot_telemetry;
+  telemetry_samples = DSHOT_TELEMETRY_SAMPLES(DSHOT_TIME);
+
+  // the motors are written once per pid loop, a reply that is still coming in
+  // when the next frame is due would stall every loop. this needs a faster dshot rate or a slower loop.
+  const uint32_t motor_period_us = state.looptime_autodetect * constrain(profile.filter.pid_rate_divider, 1, PID_RATE_DIVIDER_MAX);
+  if (dshot_bidir && dshot_frame_time_us() > motor_period_us) {
+    dshot_bidir = false;
+  }
 
   LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_TIM1);
   LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2);
@@ -224,11 +313,16 @@ void motor_init() {
 
   for (uint32_t j = 0; j < gpio_port_count; j++) {
     dshot_init_gpio_port(&gpio_ports[j]);
+    dshot_init_bit_table(j);
 
-    for (uint32_t i = 0; i < DSHOT_DMA_BUFFER_SIZE; i += 3) {
-      port_dma_buffer[j][i + 0] = gpio_ports[j].port_low;
-      port_dma_buffer[j][i + 1] = gpio_ports[j].port_low;
-      port_dma_buffer[j][i + 2] = gpio_ports[j].port_low;
+    // only the data words change from frame to frame
+    for (uint32_t b = 0; b < 2; b++) {
+      for (uint32_t i = 0; i < DSHOT_DMA_BUFFER_SIZE; i++) {
+        port_dma_buffer[b][j][i] = dshot_port_idle(&gpio_ports[j]);
+      }
+      for (uint32_t i = 0; i < DSHOT_ENCODE_BITS; i++) {
+        port_dma_buffer[b][j][DSHOT_DMA_DATA_WORD(i) - 1] = dshot_port_active(&gpio_ports[j]); // start bit
+      }
     }
   }
 
@@ -239,20 +333,81 @@ void motor_init() {
   motor_dir = MOTOR_FORWARD;
 }
 
-static void dshot_dma_setup_port(uint32_t index) {
+static void dshot_dma_setup_port(uint32_t index, uint32_t buffer) {
   dshot_gpio_port_t *port = &gpio_ports[index];
   const dma_stream_def_t *dma = &dma_stream_defs[port->dma_device];
 
   dma_clear_flag_tc(dma->port, dma->stream_index);
 
+  if (dshot_bidir) {
+    LL_DMA_SetDataTransferDirection(dma->port, dma->stream_index, LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+  }
+
   dma->stream->PAR = (uint32_t)&port->gpio->BSRR;
-  dma->stream->M0AR = (uint32_t)&port_dma_buffer[index][0];
+  dma->stream->M0AR = (uint32_t)&port_dma_buffer[buffer][index][0];
   dma->stream->NDTR = DSHOT_DMA_BUFFER_SIZE;
 
+  port_capturing[index] = false;
+
+  LL_DMA_EnableStream(dma->port, dma->stream_index);
+  dshot_enable_dma_request(port->timer_channel);
+}
+
+// called from the dma isr once the frame is out, turns the pins around and samples the reply
+static void dshot_dma_setup_capture(uint32_t index) {
+  dshot_gpio_port_t *port = &gpio_ports[index];
+  const dma_stream_def_t *dma = &dma_stream_defs[port->dma_device];
+
+  port->gpio->MODER &= ~port->moder_mask;
+
+  LL_DMA_SetDataTransferDirection(dma->port, dma->stream_index, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+
+  dma->stream->PAR = (uint32_t)&port->gpio->IDR;
+  dma->stream->M0AR = (uint32_t)&port_capture_buffer[index][0];
+  dma->stream->NDTR = telemetry_samples;
+
+  port_capturing[index] = true;
+
   LL_DMA_EnableStream(dma->port, dma->stream_index);
   dshot_enable_dma_request(port->timer_channel);
 }
 
+static void dshot_decode_telemetry() {
+  dma_prepare_rx_memory((void *)port_capture_buffer, sizeof(port_capture_buffer));
+
+  for (uint32_t i = 0; i < 4; i++) {
+    const motor_pin_t *pin = &motor_pins[profile.motor.motor_pins[i]];
+
+    uint32_t gcr = 0;
+    uint32_t erpm = 0;
+
+    dshot_telemetry_result_t res = dshot_telemetry_decode_samples(
+        (const uint32_t *)port_capture_buffer[pin->dshot_port], telemetry_samples,
+        pin->pin, DSHOT_TELEMETRY_SAMPLES_PER_BIT_Q8, &gcr);
+    if (res == DSHOT_TELEMETRY_OK) {
+      res = dshot_telemetry_decode_gcr(gcr, &erpm);
+    }
+
+    if (res == DSHOT_TELEMETRY_OK) {
+      state.motor_rpm.axis[i] = erpm / (profile.motor.motor_poles / 2.0f);
+      telemetry_misses[i] = 0;
+    } else if (telemetry_misses[i] < DSHOT_TELEMETRY_MISS_MAX) {
+      telemetry_misses[i]++;
+    } else {
+      // a stale rpm would keep the rpm filter notching where the motor no longer is
+      state.motor_rpm.axis[i] = 0;
+    }
+
+    // missing replies are not counted, the esc might not support telemetry yet
+    if (res == DSHOT_TELEMETRY_NO_RESPONSE) {
+      continue;
+    }
+
+    const float error = res == DSHOT_TELEMETRY_OK ? 0.0f : 100.0f;
+    lpf(&state.dshot_telemetry_error_rate.axis[i], error, DSHOT_TELEMETRY_ERROR_FILTER);
+  }
+}
+
 // make dshot packet
 static void make_packet(uint8_t number, uint16_t value, bool telemetry) {
   uint16_t packet = (value << 1) | (telemetry ? 1 : 0); // Here goes telemetry bit
@@ -265,6 +420,11 @@ static void make_packet(uint8_t number, uint16_t value, bool telemetry) {
     csum_data >>= 4;
   }
 
+  // bidirectional dshot uses an inverted checksum
+  if (dshot_bidir) {
+    csum = ~csum;
+  }
+
   csum &= 0xf;
   // append checksum
   dshot_packet[number] = (packet << 4) | csum;
@@ -278,47 +438,30 @@ static void make_packet_all(uint16_t value, bool telemetry) {
 
 // make dshot dma packet, then fire
 static void dshot_dma_start() {
-  motor_wait_for_ready();
+  const uint32_t buffer = port_dma_buffer_next;
 
+  // the other buffer is still in use until the previous frame is out, this one is free to fill
+  const dshot_encode_bits_t bits = dshot_encode_transpose(dshot_packet);
   for (uint32_t j = 0; j < gpio_port_count; j++) {
-    // set all ports to low before and after the packet
-    port_dma_buffer[j][0] = gpio_ports[j].port_low;
-    port_dma_buffer[j][1] = gpio_ports[j].port_low;
-    port_dma_buffer[j][2] = gpio_ports[j].port_low;
-
-    port_dma_buffer[j][16 * 3 + 0] = gpio_ports[j].port_low;
-    port_dma_buffer[j][16 * 3 + 1] = gpio_ports[j].port_low;
-    port_dma_buffer[j][16 * 3 + 2] = gpio_ports[j].port_low;
+    dshot_encode_port(gpio_ports[j].bit_table, bits, (uint32_t *)&port_dma_buffer[buffer][j][DSHOT_DMA_DATA_WORD(0)], 3);
   }
 
-  for (uint8_t i = 0; i < 16; i++) {
-    for (uint32_t j = 0; j < gpio_port_count; j++) {
-      port_dma_buffer[j][(i + 1) * 3 + 0] = gpio_ports[j].port_high; // start bit
-      port_dma_buffer[j][(i + 1) * 3 + 1] = 0;                       // actual bit, set below
-      port_dma_buffer[j][(i + 1) * 3 + 2] = gpio_ports[j].port_low;  // return line to low
-    }
-
-    for (uint8_t motor = 0; motor < MOTOR_PIN_MAX; motor++) {
-      const uint32_t port = motor_pins[motor].dshot_port;
-      const uint32_t motor_high = (motor_pins[motor].pin);
-      const uint32_t motor_low = (motor_pins[motor].pin << 16);
-
-      const bool bit = dshot_packet[motor] & 0x8000;
+  dma_prepare_tx_memory((void *)port_dma_buffer[buffer], sizeof(port_dma_buffer[buffer]));
 
-      // for 1 hold the line high for two timeunits
-      // first timeunit is already applied
-      port_dma_buffer[port][(i + 1) * 3 + 1] |= bit ? motor_high : motor_low;
+  motor_wait_for_ready();
 
-      dshot_packet[motor] <<= 1;
-    }
+  if (telemetry_captured) {
+    dshot_decode_telemetry();
+    telemetry_captured = false;
   }
 
-  dma_prepare_tx_memory((void *)port_dma_buffer, sizeof(port_dma_buffer));
-
-  dshot_dma_phase = gpio_port_count;
+  // with telemetry every port goes through a transmit and a capture phase
+  dshot_dma_phase = dshot_bidir ? gpio_port_count * 2 : gpio_port_count;
   for (uint32_t j = 0; j < gpio_port_count; j++) {
-    dshot_dma_setup_port(j);
+    dshot_dma_setup_port(j, buffer);
   }
+
+  port_dma_buffer_next = !buffer;
 }
 
 void motor_wait_for_ready() {
@@ -459,6 +602,17 @@ void dshot_dma_isr(dma_device_t dev) {
     LL_DMA_DisableStream(dma->port, dma->stream_index);
     dshot_disable_dma_request(gpio_ports[j].timer_channel);
 
+    if (dshot_bidir) {
+      if (port_capturing[j]) {
+        // capture done, drive the idle level again
+        gpio_ports[j].gpio->MODER = (gpio_ports[j].gpio->MODER & ~gpio_ports[j].moder_mask) | gpio_ports[j].moder_output;
+        port_capturing[j] = false;
+        telemetry_captured = true;
+      } else {
+        dshot_dma_setup_capture(j);
+      }
+    }
+
     dshot_dma_phase--;
     break;
   }
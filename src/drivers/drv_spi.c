@@ -2,6 +2,7 @@
 
 #include <string.h>
 
+#include "debug.h"
 #include "failloop.h"
 #include "io/usb_configurator.h"
 #include "project.h"
@@ -37,6 +38,10 @@ typedef struct {
   spi_bus_device_t *active_device;
   spi_mode_t mode;
   uint32_t hz;
+
+  // highest priority first, in the order they were initialized otherwise
+  spi_bus_device_t *devices[SPI_PORT_DEVICES_MAX];
+  uint8_t device_count;
 } spi_port_config_t;
 
 #define SPI_PORT(chan, sck_pin, miso_pin, mosi_pin) \
@@ -44,14 +49,22 @@ typedef struct {
       .active_device = NULL,                        \
       .mode = SPI_MODE_INVALID,                     \
       .hz = 0,                                      \
+      .device_count = 0,                            \
   },
 
 static volatile spi_port_config_t spi_port_config[SPI_PORTS_MAX] = {{}, SPI_PORTS};
 
 #undef SPI_PORT
 
+// txn buffers per port, so a busy device can not take the memory of another port
+static slab_pool_t spi_pools[SPI_PORTS_MAX];
+
 volatile uint8_t dma_transfer_done[16] = {[0 ... 15] = 1};
 
+// stand in for the memory side of direct segments that only send or only receive
+static DMA_RAM uint8_t spi_dummy_tx __attribute__((aligned(SLAB_ALIGN))) = 0xFF;
+static DMA_RAM uint8_t spi_dummy_rx __attribute__((aligned(SLAB_ALIGN)));
+
 #define PORT spi_port_defs[port]
 
 void spi_enable_rcc(spi_ports_t port) {
@@ -178,7 +191,13 @@ static void spi_dma_reset_rx(spi_ports_t port, uint8_t *rx_data, uint32_t rx_siz
   while (LL_DMA_IsEnabledStream(dma->port, dma->stream_index))
     ;
 
-  dma_prepare_rx_memory(rx_data, rx_size);
+  if (rx_data) {
+    dma_prepare_rx_memory(rx_data, rx_size);
+    LL_DMA_SetMemoryIncMode(dma->port, dma->stream_index, LL_DMA_MEMORY_INCREMENT);
+  } else {
+    rx_data = &spi_dummy_rx;
+    LL_DMA_SetMemoryIncMode(dma->port, dma->stream_index, LL_DMA_MEMORY_NOINCREMENT);
+  }
 
 #ifdef STM32H7
   LL_DMA_SetPeriphAddress(dma->port, dma->stream_index, (uint32_t)&PORT.channel->RXDR);
@@ -217,13 +236,19 @@ static void spi_dma_init_tx(spi_ports_t port) {
   LL_DMA_Init(dma->port, dma->stream_index, &DMA_InitStructure);
 }
 
-static void spi_dma_reset_tx(spi_ports_t port, uint8_t *tx_data, uint32_t tx_size) {
+static void spi_dma_reset_tx(spi_ports_t port, const uint8_t *tx_data, uint32_t tx_size) {
   const dma_stream_def_t *dma = &dma_stream_defs[PORT.dma_tx];
 
   while (LL_DMA_IsEnabledStream(dma->port, dma->stream_index))
     ;
 
-  dma_prepare_tx_memory(tx_data, tx_size);
+  if (tx_data) {
+    dma_prepare_tx_memory(tx_data, tx_size);
+    LL_DMA_SetMemoryIncMode(dma->port, dma->stream_index, LL_DMA_MEMORY_INCREMENT);
+  } else {
+    tx_data = &spi_dummy_tx;
+    LL_DMA_SetMemoryIncMode(dma->port, dma->stream_index, LL_DMA_MEMORY_NOINCREMENT);
+  }
 
 #ifdef STM32H7
   LL_DMA_SetPeriphAddress(dma->port, dma->stream_index, (uint32_t)&PORT.channel->TXDR);
@@ -277,7 +302,8 @@ static void spi_reconfigure(spi_bus_device_t *bus, volatile spi_port_config_t *c
   }
 }
 
-static void spi_dma_transfer_begin(spi_ports_t port, uint8_t *buffer, uint32_t length) {
+// rx_data and tx_data may be the same memory, NULL uses a dummy byte instead
+static void spi_dma_transfer_begin(spi_ports_t port, uint8_t *rx_data, const uint8_t *tx_data, uint32_t length) {
   dma_transfer_done[port] = 0;
 
 #if !defined(STM32H7)
@@ -292,8 +318,8 @@ static void spi_dma_transfer_begin(spi_ports_t port, uint8_t *buffer, uint32_t l
   dma_clear_flag_tc(dma_rx->port, dma_rx->stream_index);
   dma_clear_flag_tc(dma_tx->port, dma_tx->stream_index);
 
-  spi_dma_reset_rx(port, buffer, length);
-  spi_dma_reset_tx(port, buffer, length);
+  spi_dma_reset_rx(port, rx_data, length);
+  spi_dma_reset_tx(port, tx_data, length);
 
   LL_DMA_EnableIT_TC(dma_rx->port, dma_rx->stream_index);
   LL_DMA_EnableIT_TE(dma_rx->port, dma_rx->stream_index);
@@ -313,7 +339,7 @@ static void spi_dma_transfer_begin(spi_ports_t port, uint8_t *buffer, uint32_t l
 #endif
 }
 
-static uint8_t spi_transfer(spi_ports_t port, uint8_t *data, uint32_t size) {
+static uint8_t spi_transfer(spi_ports_t port, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size) {
 #if defined(STM32H7)
   LL_SPI_SetTransferSize(PORT.channel, size);
   LL_SPI_Enable(PORT.channel);
@@ -323,12 +349,15 @@ static uint8_t spi_transfer(spi_ports_t port, uint8_t *data, uint32_t size) {
     while (!LL_SPI_IsActiveFlag_TXP(PORT.channel))
       ;
 
-    LL_SPI_TransmitData8(PORT.channel, data[i]);
+    LL_SPI_TransmitData8(PORT.channel, tx_data ? tx_data[i] : 0xFF);
 
     while (!LL_SPI_IsActiveFlag_RXP(PORT.channel))
       ;
 
-    data[i] = LL_SPI_ReceiveData8(PORT.channel);
+    const uint8_t rx = LL_SPI_ReceiveData8(PORT.channel);
+    if (rx_data) {
+      rx_data[i] = rx;
+    }
   }
 
   while (!LL_SPI_IsActiveFlag_EOT(PORT.channel))
@@ -343,12 +372,15 @@ static uint8_t spi_transfer(spi_ports_t port, uint8_t *data, uint32_t size) {
     while (LL_SPI_IsActiveFlag_BSY(PORT.channel) || !LL_SPI_IsActiveFlag_TXE(PORT.channel))
       ;
 
-    LL_SPI_TransmitData8(PORT.channel, data[i]);
+    LL_SPI_TransmitData8(PORT.channel, tx_data ? tx_data[i] : 0xFF);
 
     while (LL_SPI_IsActiveFlag_BSY(PORT.channel) || !LL_SPI_IsActiveFlag_RXNE(PORT.channel))
       ;
 
-    data[i] = LL_SPI_ReceiveData8(PORT.channel);
+    const uint8_t rx = LL_SPI_ReceiveData8(PORT.channel);
+    if (rx_data) {
+      rx_data[i] = rx;
+    }
   }
 
   LL_SPI_Disable(PORT.channel);
@@ -357,10 +389,37 @@ static uint8_t spi_transfer(spi_ports_t port, uint8_t *data, uint32_t size) {
   return 1;
 }
 
+static void spi_port_add_device(spi_bus_device_t *bus) {
+  volatile spi_port_config_t *config = &spi_port_config[bus->port];
+  for (uint32_t i = 0; i < config->device_count; i++) {
+    if (config->devices[i] == bus) {
+      return;
+    }
+  }
+  if (config->device_count >= SPI_PORT_DEVICES_MAX) {
+    failloop(FAILLOOP_SPI);
+  }
+
+  uint32_t index = config->device_count++;
+  while (index > 0 && config->devices[index - 1]->priority < bus->priority) {
+    config->devices[index] = config->devices[index - 1];
+    index--;
+  }
+  config->devices[index] = bus;
+}
+
 void spi_bus_device_init(spi_bus_device_t *bus) {
   bus->txn_head = 0;
   bus->txn_tail = 0;
 
+  ATOMIC_BLOCK_ALL {
+    spi_port_add_device(bus);
+  }
+
+  if (spi_pools[bus->port].arena == NULL) {
+    dma_pool_init(&spi_pools[bus->port]);
+  }
+
   spi_init_pins(bus->port, bus->nss);
   spi_enable_rcc(bus->port);
 
@@ -423,8 +482,11 @@ spi_txn_t *spi_txn_init(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn) {
     failloop(FAILLOOP_SPI);
   }
 
-  txn->buffer = dma_alloc(16);
-  txn->buffer_size = 16;
+  // the smallest slot, txns grow into larger ones as segments are added
+  txn->buffer_size = 1;
+  txn->buffer = dma_alloc(&spi_pools[bus->port], &txn->buffer_size);
+
+  txn->rx_buffer = NULL;
 
   txn->bus = bus;
   txn->segment_count = 0;
@@ -436,17 +498,37 @@ spi_txn_t *spi_txn_init(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn) {
   return (spi_txn_t *)txn;
 }
 
+spi_txn_t *spi_txn_init_persistent(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn) {
+  spi_txn_t *txn = spi_txn_init(bus, done_fn);
+  txn->flags = TXN_PERSISTENT;
+  return txn;
+}
+
+uint8_t *spi_txn_rx_data(spi_txn_t *txn) {
+  return txn->rx_buffer;
+}
+
+void spi_txn_release(spi_txn_t *txn) {
+  dma_free(txn->buffer);
+  txn->buffer = NULL;
+  if (txn->rx_buffer) {
+    dma_free(txn->rx_buffer);
+    txn->rx_buffer = NULL;
+  }
+  txn->status = TXN_IDLE;
+}
+
 static void spi_txn_ensure_buffer_space(spi_txn_t *txn, uint32_t size) {
   if (txn->buffer_size >= (txn->size + size)) {
     return;
   }
 
-  uint32_t new_size = txn->buffer_size;
-  while (new_size < (txn->size + size)) {
-    new_size *= 2;
-  }
+  uint32_t new_size = txn->size + size;
+  uint8_t *buffer = dma_alloc(&spi_pools[txn->bus->port], &new_size);
+  memcpy(buffer, txn->buffer, txn->size);
+  dma_free(txn->buffer);
 
-  txn->buffer = dma_realloc(txn->buffer, new_size);
+  txn->buffer = buffer;
   txn->buffer_size = new_size;
 }
 
@@ -463,6 +545,29 @@ void spi_txn_add_seg_delay(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_d
   txn->segments[txn->segment_count].rx_data = rx_data;
   txn->segments[txn->segment_count].tx_data = tx_data;
   txn->segments[txn->segment_count].size = size;
+  txn->segments[txn->segment_count].direct = false;
+  txn->segment_count++;
+}
+
+void spi_txn_add_seg_direct(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+
+  if ((rx_data && !dma_can_access(rx_data, size, true)) || (tx_data && !dma_can_access(tx_data, size, false))) {
+    spi_txn_add_seg(txn, rx_data, tx_data, size);
+    return;
+  }
+
+  if (txn->segment_count >= SPI_TXN_SEG_MAX) {
+    failloop(FAILLOOP_SPI);
+  }
+
+  spi_txn_segment_t *seg = &txn->segments[txn->segment_count];
+  seg->rx_data = rx_data;
+  seg->tx_data = tx_data;
+  seg->size = size;
+  seg->direct = true;
   txn->segment_count++;
 }
 
@@ -479,7 +584,7 @@ void spi_txn_add_seg(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, u
   txn->size += size;
 
   spi_txn_segment_t *last_seg = txn->segment_count > 0 ? &txn->segments[txn->segment_count - 1] : NULL;
-  if (rx_data == NULL && last_seg != NULL && last_seg->rx_data == NULL && last_seg->tx_data == NULL) {
+  if (rx_data == NULL && last_seg != NULL && !last_seg->direct && last_seg->rx_data == NULL && last_seg->tx_data == NULL) {
     // merge segments
     last_seg->size += size;
   } else {
@@ -496,6 +601,7 @@ void spi_txn_add_seg(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, u
     seg->rx_data = rx_data;
     seg->tx_data = NULL;
     seg->size = size;
+    seg->direct = false;
     txn->segment_count++;
   }
 }
@@ -511,7 +617,7 @@ uint8_t *spi_txn_add_seg_tx_raw(spi_txn_t *txn, uint32_t size) {
   txn->size += size;
 
   spi_txn_segment_t *last_seg = txn->segment_count > 0 ? &txn->segments[txn->segment_count - 1] : NULL;
-  if (last_seg != NULL && last_seg->rx_data == NULL && last_seg->tx_data == NULL) {
+  if (last_seg != NULL && !last_seg->direct && last_seg->rx_data == NULL && last_seg->tx_data == NULL) {
     // merge segments
     last_seg->size += size;
   } else {
@@ -524,6 +630,7 @@ uint8_t *spi_txn_add_seg_tx_raw(spi_txn_t *txn, uint32_t size) {
     seg->rx_data = NULL;
     seg->tx_data = NULL;
     seg->size = size;
+    seg->direct = false;
     txn->segment_count++;
   }
 
@@ -539,9 +646,15 @@ bool spi_txn_ready(spi_bus_device_t *bus) {
 }
 
 void spi_txn_submit(spi_txn_t *txn) {
+  if ((txn->flags & TXN_PERSISTENT) && txn->rx_buffer == NULL) {
+    uint32_t size = txn->size;
+    txn->rx_buffer = dma_alloc(&spi_pools[txn->bus->port], &size);
+  }
+
   ATOMIC_BLOCK_ALL {
     const uint8_t head = (txn->bus->txn_head + 1) % SPI_TXN_MAX;
     txn->status = TXN_READY;
+    txn->submit_time = time_cycles();
     txn->bus->txns[head] = txn;
     txn->bus->txn_head = head;
   }
@@ -552,11 +665,16 @@ static void spi_txn_finish(spi_bus_device_t *bus) {
   spi_txn_t *txn = bus->txns[tail];
 
   if (txn->flags & TXN_DELAYED_RX) {
+    const uint8_t *rx_buffer = txn->rx_buffer ? txn->rx_buffer : txn->buffer;
+
     uint32_t txn_size = 0;
     for (uint32_t i = 0; i < txn->segment_count; ++i) {
       spi_txn_segment_t *seg = &txn->segments[i];
+      if (seg->direct) {
+        continue;
+      }
       if (seg->rx_data) {
-        memcpy(seg->rx_data, (uint8_t *)txn->buffer + txn_size, seg->size);
+        memcpy(seg->rx_data, rx_buffer + txn_size, seg->size);
       }
       txn_size += seg->size;
     }
@@ -566,9 +684,14 @@ static void spi_txn_finish(spi_bus_device_t *bus) {
     txn->done_fn();
   }
 
-  dma_free(txn->buffer);
-  txn->buffer = NULL;
-  txn->status = TXN_IDLE;
+  if (txn->flags & TXN_PERSISTENT) {
+    // back with its owner, ready to be submitted again
+    txn->status = TXN_WAITING;
+  } else {
+    dma_free(txn->buffer);
+    txn->buffer = NULL;
+    txn->status = TXN_IDLE;
+  }
 
   bus->txns[tail] = NULL;
   bus->txn_tail = tail;
@@ -585,22 +708,83 @@ static bool spi_txn_should_use_dma(spi_bus_device_t *bus, spi_txn_t *txn) {
   return true;
 }
 
-void spi_txn_continue_ex(spi_bus_device_t *bus, bool force_sync) {
-  ATOMIC_BLOCK_ALL {
-    if (!spi_dma_is_ready(bus->port)) {
-      return;
+// a txn goes out in parts while the chip select stays low. consecutive segments in the txn buffer
+// make up one part, every direct segment is a part of its own.
+static bool spi_txn_next_part(spi_txn_t *txn, uint8_t **rx_data, const uint8_t **tx_data, uint32_t *size) {
+  if (txn->part_segment >= txn->segment_count) {
+    return false;
+  }
+
+  const spi_txn_segment_t *seg = &txn->segments[txn->part_segment];
+  if (seg->direct) {
+    *rx_data = seg->rx_data;
+    *tx_data = seg->tx_data;
+    *size = seg->size;
+    txn->part_segment++;
+    return true;
+  }
+
+  uint32_t part_size = 0;
+  while (txn->part_segment < txn->segment_count && !txn->segments[txn->part_segment].direct) {
+    part_size += txn->segments[txn->part_segment].size;
+    txn->part_segment++;
+  }
+
+  *rx_data = (txn->rx_buffer ? txn->rx_buffer : txn->buffer) + txn->part_offset;
+  *tx_data = txn->buffer + txn->part_offset;
+  *size = part_size;
+  txn->part_offset += part_size;
+  return true;
+}
+
+static bool spi_device_pending(spi_bus_device_t *bus) {
+  return bus->txn_head != bus->txn_tail && (bus->poll_fn == NULL || bus->poll_fn());
+}
+
+// picks the device that gets the port, a pending device with a higher priority always goes first, then bus itself.
+// once a transfer is done, the port is also handed on to other devices that continue on their own.
+static spi_bus_device_t *spi_port_next(spi_bus_device_t *bus, bool handover) {
+  volatile spi_port_config_t *config = &spi_port_config[bus->port];
+
+  for (uint32_t i = 0; i < config->device_count; i++) {
+    spi_bus_device_t *dev = config->devices[i];
+    if (dev->priority <= bus->priority) {
+      break;
+    }
+    if (spi_device_pending(dev)) {
+      return dev;
+    }
+  }
+
+  if ((!handover || bus->auto_continue) && spi_device_pending(bus)) {
+    return bus;
+  }
+
+  if (handover) {
+    for (uint32_t i = 0; i < config->device_count; i++) {
+      spi_bus_device_t *dev = config->devices[i];
+      if (dev != bus && dev->auto_continue && spi_device_pending(dev)) {
+        return dev;
+      }
     }
+  }
 
-    if (bus->txn_head == bus->txn_tail) {
+  return NULL;
+}
+
+static void spi_port_continue(spi_bus_device_t *caller, bool handover, bool force_sync) {
+  ATOMIC_BLOCK_ALL {
+    if (!spi_dma_is_ready(caller->port)) {
       return;
     }
 
-    volatile spi_port_config_t *config = &spi_port_config[bus->port];
-    if (config->active_device != NULL && config->active_device != bus) {
+    volatile spi_port_config_t *config = &spi_port_config[caller->port];
+    if (config->active_device != NULL && config->active_device != caller) {
       return;
     }
 
-    if (bus->poll_fn && !bus->poll_fn()) {
+    spi_bus_device_t *bus = spi_port_next(caller, handover);
+    if (bus == NULL) {
       return;
     }
 
@@ -610,10 +794,17 @@ void spi_txn_continue_ex(spi_bus_device_t *bus, bool force_sync) {
     config->active_device = bus;
     txn->status = TXN_IN_PROGRESS;
 
+    if (bus->wait_counter) {
+      perf_counter_record(bus->wait_counter, time_cycles() - txn->submit_time);
+    }
+
     if (txn->flags & TXN_DELAYED_TX) {
       uint32_t txn_size = 0;
       for (uint32_t i = 0; i < txn->segment_count; ++i) {
         spi_txn_segment_t *seg = &txn->segments[i];
+        if (seg->direct) {
+          continue;
+        }
         if (seg->tx_data) {
           memcpy((uint8_t *)txn->buffer + txn_size, seg->tx_data, seg->size);
         }
@@ -623,31 +814,46 @@ void spi_txn_continue_ex(spi_bus_device_t *bus, bool force_sync) {
 
     spi_reconfigure(bus, config);
 
-    if (spi_txn_should_use_dma(bus, txn) && !force_sync) {
+    txn->part_segment = 0;
+    txn->part_offset = 0;
+
+    uint8_t *rx_data = NULL;
+    const uint8_t *tx_data = NULL;
+    uint32_t size = 0;
+
+    // only the txns of the caller can be forced to finish right away
+    if (spi_txn_should_use_dma(bus, txn) && !(force_sync && bus == caller)) {
+      spi_txn_next_part(txn, &rx_data, &tx_data, &size);
+
       spi_csn_enable(bus);
-      spi_dma_transfer_begin(bus->port, txn->buffer, txn->size);
+      spi_dma_transfer_begin(bus->port, rx_data, tx_data, size);
     } else {
       spi_csn_enable(bus);
-      spi_transfer(bus->port, txn->buffer, txn->size);
+      while (spi_txn_next_part(txn, &rx_data, &tx_data, &size)) {
+        spi_transfer(bus->port, rx_data, tx_data, size);
+      }
       spi_csn_disable(bus);
 
       spi_txn_finish(bus);
-
-      if (bus->auto_continue) {
-        spi_txn_continue(bus);
-      }
+      spi_port_continue(bus, true, false);
     }
   }
 }
 
+void spi_txn_continue_ex(spi_bus_device_t *bus, bool force_sync) {
+  spi_port_continue(bus, false, force_sync);
+}
+
 void spi_txn_continue(spi_bus_device_t *bus) {
   spi_txn_continue_ex(bus, false);
 }
 
 void spi_txn_wait(spi_bus_device_t *bus) {
+  perf_counter_start(PERF_COUNTER_SPI_WAIT);
   while (!spi_txn_ready(bus)) {
     spi_txn_continue(bus);
   }
+  perf_counter_end(PERF_COUNTER_SPI_WAIT);
 }
 
 void spi_txn_submit_wait(spi_bus_device_t *bus, spi_txn_t *txn) {
@@ -697,14 +903,23 @@ static void handle_dma_rx_isr(spi_ports_t port) {
   }
 
   spi_bus_device_t *bus = spi_port_config[port].active_device;
+
+  const uint32_t tail = (bus->txn_tail + 1) % SPI_TXN_MAX;
+  uint8_t *rx_data = NULL;
+  const uint8_t *tx_data = NULL;
+  uint32_t size = 0;
+  if (spi_txn_next_part(bus->txns[tail], &rx_data, &tx_data, &size)) {
+    // the chip select stays low, the device sees one transfer
+    spi_dma_transfer_begin(port, rx_data, tx_data, size);
+    return;
+  }
+
   spi_csn_disable(bus);
 
   spi_txn_finish(bus);
   dma_transfer_done[port] = 1;
 
-  if (bus->auto_continue) {
-    spi_txn_continue(bus);
-  }
+  spi_port_continue(bus, true, false);
 }
 
 #define SPI_PORT(channel, sck_pin, miso_pin, mosi_pin) \
@@ -715,12 +930,16 @@ static void handle_dma_rx_isr(spi_ports_t port) {
     break;
 
 void spi_dma_isr(dma_device_t dev) {
+  perf_counter_start(PERF_COUNTER_SPI_DMA_ISR);
+
   switch (dev) {
     SPI_PORTS
 
   default:
     break;
   }
+
+  perf_counter_end(PERF_COUNTER_SPI_DMA_ISR);
 }
 
 #undef SPI_DMA
\ No newline at end of file
@@ -24,11 +24,15 @@ typedef struct {
 
 #define SPI_TXN_MAX 32
 #define SPI_TXN_SEG_MAX 8
+// devices sharing one port
+#define SPI_PORT_DEVICES_MAX 4
 
 typedef struct {
   const uint8_t *tx_data;
   uint8_t *rx_data;
   uint32_t size;
+  // the dma works on tx_data and rx_data in place instead of the txn buffer
+  bool direct;
 } spi_txn_segment_t;
 
 struct spi_bus_device;
@@ -39,6 +43,13 @@ typedef enum {
   SPI_MODE_TRAILING_EDGE,
 } spi_mode_t;
 
+// a pending txn of a device with a higher priority always gets the port next.
+// a txn that started runs to the end, the chip select can not be taken away mid transfer.
+typedef enum {
+  SPI_PRIORITY_NORMAL,
+  SPI_PRIORITY_HIGH,
+} spi_priority_t;
+
 typedef enum {
   TXN_IDLE,
   TXN_WAITING,
@@ -49,6 +60,7 @@ typedef enum {
 typedef enum {
   TXN_DELAYED_TX = (1 << 0),
   TXN_DELAYED_RX = (1 << 1),
+  TXN_PERSISTENT = (1 << 2),
 } spi_txn_flags_t;
 
 typedef void (*spi_txn_done_fn_t)();
@@ -64,8 +76,15 @@ typedef struct {
 
   uint8_t *buffer;
   uint32_t buffer_size;
+  // persistent txns receive here, so buffer still holds the bytes to send next time
+  uint8_t *rx_buffer;
 
-  uint32_t size;
+  uint32_t size; // bytes in buffer, direct segments not included
+  uint32_t submit_time; // cycles
+
+  // the part of a txn in flight, see spi_txn_next_part
+  uint8_t part_segment;
+  uint32_t part_offset;
 
   spi_txn_done_fn_t done_fn;
 } spi_txn_t;
@@ -77,6 +96,10 @@ typedef struct spi_bus_device {
   bool auto_continue;
   bool (*poll_fn)();
 
+  spi_priority_t priority;
+  // perf_counters_t of the time txns wait in the queue, zero for none
+  uint8_t wait_counter;
+
   // only modified by the main loop
   volatile uint8_t txn_head;
   // only modified by the intterupt or protected code
@@ -100,8 +123,17 @@ void spi_csn_enable(spi_bus_device_t *bus);
 void spi_csn_disable(spi_bus_device_t *bus);
 
 spi_txn_t *spi_txn_init(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn);
+// built once and kept by the caller, every spi_txn_submit sends it again as is
+spi_txn_t *spi_txn_init_persistent(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn);
+// what came back for the buffered segments of a persistent txn, at the offsets they were added at
+uint8_t *spi_txn_rx_data(spi_txn_t *txn);
+// hands a persistent txn that is not queued back to the pool
+void spi_txn_release(spi_txn_t *txn);
 void spi_txn_add_seg(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size);
 uint8_t *spi_txn_add_seg_tx_raw(spi_txn_t *txn, uint32_t size);
+// tx_data and rx_data have to stay valid until the txn is done, NULL sends 0xFF or drops what comes back.
+// falls back to spi_txn_add_seg for memory the dma can not reach.
+void spi_txn_add_seg_direct(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size);
 void spi_txn_add_seg_delay(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size);
 void spi_txn_add_seg_const(spi_txn_t *txn, const uint8_t tx_data);
 void spi_txn_submit(spi_txn_t *txn);
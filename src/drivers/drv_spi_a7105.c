@@ -1,6 +1,7 @@
 #include "drv_spi_a7105.h"
 #include "drv_spi.h"
 #include "drv_time.h"
+#include "debug.h"
 #include "drv_exti.h"
 #include "project.h"
 
@@ -11,6 +12,7 @@ static spi_bus_device_t bus = {
     .nss = A7105_NSS_PIN,
 
     .auto_continue = true,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_RX,
 };
 
 //------------------------------------------------------------------------------
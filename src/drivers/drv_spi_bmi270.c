@@ -101,6 +101,20 @@ void bmi270_configure() {
 
   bmi270_write(BMI270_REG_PWR_CTRL, BMI270_PWR_CTRL);
   time_delay_ms(1);
+
+#ifdef USE_GYRO_FIFO
+  bmi270_write(BMI270_REG_FIFO_DOWNS, BMI270_FIFO_DOWNS);
+  time_delay_ms(1);
+
+  bmi270_write(BMI270_REG_FIFO_CONFIG_0, BMI270_FIFO_CONFIG_0);
+  time_delay_ms(1);
+
+  bmi270_write(BMI270_REG_FIFO_CONFIG_1, BMI270_FIFO_CONFIG_1);
+  time_delay_ms(1);
+
+  bmi270_write(BMI270_REG_CMD, BMI270_CMD_FIFOFLUSH);
+  time_delay_ms(1);
+#endif
 }
 
 uint8_t bmi270_read(uint8_t reg) {
@@ -141,4 +155,16 @@ void bmi270_read_data(uint8_t reg, uint8_t *data, uint32_t size) {
   spi_txn_add_seg_const(txn, 0xFF);
   spi_txn_add_seg(txn, data, NULL, size);
   spi_txn_submit_wait(&gyro_bus, txn);
-}
\ No newline at end of file
+}
+
+// persistent txn reading size bytes from reg, they end up at the end of spi_txn_rx_data.
+// done_fn is called from the dma interrupt once the data is there
+spi_txn_t *bmi270_read_txn(uint8_t reg, uint32_t size, spi_txn_done_fn_t done_fn) {
+  spi_bus_device_reconfigure(&gyro_bus, SPI_MODE_TRAILING_EDGE, SPI_SPEED_FAST);
+
+  spi_txn_t *txn = spi_txn_init_persistent(&gyro_bus, done_fn);
+  spi_txn_add_seg_const(txn, reg | 0x80);
+  spi_txn_add_seg_const(txn, 0xFF);
+  spi_txn_add_seg(txn, NULL, NULL, size);
+  return txn;
+}
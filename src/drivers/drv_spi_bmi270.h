@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "drv_spi.h"
+
 #define BMI270_REG_CHIP_ID 0x00
 #define BMI270_REG_ERR_REG 0x02
 #define BMI270_REG_STATUS 0x03
@@ -66,13 +68,20 @@
 #define BMI270_GYRO_RANGE_2000DPS 0x08
 
 #define BMI270_INT_MAP_DATA_DRDY_INT1 0x04 // enable the data ready interrupt pin 1
-#define BMI270_INT_MAP_FIFO_WM_INT1 0x02   // enable the FIFO watermark interrupt pin 1
 #define BMI270_INT1_IO_CTRL_PINMODE 0x0A   // active high, push-pull, output enabled, input disabled
 #define BMI270_FIFO_CONFIG_0 0x00          // don't stop when full, disable sensortime frame
 #define BMI270_FIFO_CONFIG_1 0x80          // only gyro data in FIFO, use headerless mode
 #define BMI270_FIFO_DOWNS 0x00             // select unfiltered gyro data with no downsampling (6.4KHz samples)
-#define BMI270_FIFO_WTM_0 0x06             // set the FIFO watermark level to 1 gyro sample (6 bytes)
-#define BMI270_FIFO_WTM_1 0x00             // FIFO watermark MSB
+
+#define BMI270_FIFO_FRAME_SIZE 6  // headerless gyro only frame
+#define BMI270_FIFO_PERIOD_US 156 // 6.4khz unfiltered gyro
+#define BMI270_FIFO_LENGTH_MASK 0x3FFF
+
+// a burst from the accel data registers runs through temperature and fifo length into the fifo data,
+// the address stops incrementing at the fifo data register
+#define BMI270_FIFO_BURST_TEMP_OFFSET (BMI270_REG_TEMPERATURE_LSB - BMI270_REG_ACC_DATA_X_LSB)
+#define BMI270_FIFO_BURST_LENGTH_OFFSET (BMI270_REG_FIFO_LENGTH_LSB - BMI270_REG_ACC_DATA_X_LSB)
+#define BMI270_FIFO_BURST_DATA_OFFSET (BMI270_REG_FIFO_DATA - BMI270_REG_ACC_DATA_X_LSB)
 
 uint8_t bmi270_detect();
 void bmi270_configure();
@@ -81,4 +90,5 @@ void bmi270_write(uint8_t reg, uint8_t data);
 void bmi270_write_data(uint8_t reg, uint8_t *data, uint32_t size);
 
 uint8_t bmi270_read(uint8_t reg);
-void bmi270_read_data(uint8_t reg, uint8_t *data, uint32_t size);
\ No newline at end of file
+void bmi270_read_data(uint8_t reg, uint8_t *data, uint32_t size);
+spi_txn_t *bmi270_read_txn(uint8_t reg, uint32_t size, spi_txn_done_fn_t done_fn);
@@ -1,5 +1,6 @@
 #include "drv_spi_cc2500.h"
 
+#include "debug.h"
 #include "drv_spi.h"
 #include "drv_time.h"
 #include "project.h"
@@ -13,6 +14,7 @@ static spi_bus_device_t bus = {
     .nss = CC2500_NSS_PIN,
 
     .auto_continue = true,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_RX,
 };
 
 uint8_t cc2500_read_gdo0() {
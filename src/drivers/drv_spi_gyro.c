@@ -1,20 +1,35 @@
 #include "drv_spi_gyro.h"
 
+#include <string.h>
+
+#include "debug.h"
+#include "drv_exti.h"
+#include "drv_interrupt.h"
 #include "drv_spi.h"
 #include "drv_time.h"
 #include "project.h"
+#include "util/util.h"
 
 #include "drv_spi_bmi270.h"
 #include "drv_spi_icm42605.h"
 #include "drv_spi_mpu6xxx.h"
 
 gyro_types_t gyro_type = GYRO_TYPE_INVALID;
+gyro_sample_info_t gyro_sample_info;
 
 spi_bus_device_t gyro_bus = {
     .port = GYRO_SPI_PORT,
     .nss = GYRO_NSS,
+
+    // the control loop waits on every read, flash and osd txns queue behind it
+    .priority = SPI_PRIORITY_HIGH,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_GYRO,
 };
 
+#ifdef USE_GYRO_EXTI
+static void gyro_spi_exti_update();
+#endif
+
 static gyro_types_t gyro_spi_detect() {
   gyro_types_t type = GYRO_TYPE_INVALID;
 
@@ -96,10 +111,127 @@ uint8_t gyro_spi_init() {
     break;
   }
 
+#ifdef USE_GYRO_EXTI
+  if (gyro_type != GYRO_TYPE_INVALID) {
+    gyro_spi_exti_update();
+    exti_enable(GYRO_INT, LL_EXTI_TRIGGER_RISING);
+  }
+#endif
+
   return gyro_type;
 }
 
-gyro_data_t gyro_spi_read() {
+#ifdef USE_GYRO_FIFO
+#define GYRO_BUF_SIZE (GYRO_FIFO_MAX_SAMPLES * ICM42605_FIFO_PACKET_SIZE)
+#else
+#define GYRO_BUF_SIZE 14
+#endif
+
+// read this many samples more than expected per loop so a backlog in the fifo is drained
+#define GYRO_FIFO_SPARE_SAMPLES 2
+
+// number of fifo samples per burst, zero reads the latest sample from the data registers
+static volatile uint32_t gyro_fifo_read_count = 0;
+
+static uint32_t gyro_spi_fifo_period() {
+#ifdef USE_GYRO_FIFO
+  switch (gyro_type) {
+  case GYRO_TYPE_ICM42605:
+  case GYRO_TYPE_ICM42688P:
+    return ICM42605_FIFO_PERIOD_US;
+
+  case GYRO_TYPE_BMI270:
+    return BMI270_FIFO_PERIOD_US;
+
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
+
+static void gyro_spi_fifo_update(uint32_t looptime_us) {
+  const uint32_t period = gyro_spi_fifo_period();
+  if (period == 0) {
+    gyro_fifo_read_count = 0;
+    return;
+  }
+
+  const uint32_t expected = (looptime_us + period - 1) / period;
+  gyro_fifo_read_count = constrain(expected + GYRO_FIFO_SPARE_SAMPLES, 1, GYRO_FIFO_MAX_SAMPLES);
+}
+
+uint32_t gyro_spi_sample_period(uint32_t looptime_us) {
+  const uint32_t period = gyro_spi_fifo_period();
+  if (period == 0) {
+    return looptime_us;
+  }
+  return period;
+}
+
+static uint32_t gyro_spi_read_size(uint32_t count) {
+  switch (gyro_type) {
+  case GYRO_TYPE_ICM42605:
+  case GYRO_TYPE_ICM42688P:
+    return count ? count * ICM42605_FIFO_PACKET_SIZE : 14;
+
+  case GYRO_TYPE_BMI270:
+    return count ? BMI270_FIFO_BURST_DATA_OFFSET + count * BMI270_FIFO_FRAME_SIZE : 12;
+
+  default:
+    return 14;
+  }
+}
+
+// a persistent txn per reader, built for one burst size and submitted as is every loop
+typedef struct {
+  spi_txn_t *txn;
+  uint32_t count;
+} gyro_read_txn_t;
+
+static spi_txn_t *gyro_spi_build_read(uint32_t count, spi_txn_done_fn_t done_fn) {
+  const uint32_t size = gyro_spi_read_size(count);
+
+  switch (gyro_type) {
+  case GYRO_TYPE_MPU6000:
+  case GYRO_TYPE_MPU6500:
+  case GYRO_TYPE_ICM20601:
+  case GYRO_TYPE_ICM20602:
+  case GYRO_TYPE_ICM20608:
+  case GYRO_TYPE_ICM20649:
+  case GYRO_TYPE_ICM20689:
+    return mpu6xxx_read_txn(MPU_RA_ACCEL_XOUT_H, size, done_fn);
+
+  case GYRO_TYPE_ICM42605:
+  case GYRO_TYPE_ICM42688P:
+    return icm42605_read_txn(count ? ICM42605_FIFO_DATA : ICM42605_TEMP_DATA1, size, done_fn);
+
+  case GYRO_TYPE_BMI270:
+    return bmi270_read_txn(BMI270_REG_ACC_DATA_X_LSB, size, done_fn);
+
+  default:
+    return NULL;
+  }
+}
+
+// only while the txn is not queued
+static void gyro_spi_update_read(gyro_read_txn_t *read, uint32_t count, spi_txn_done_fn_t done_fn) {
+  if (read->txn != NULL && read->count == count) {
+    return;
+  }
+  if (read->txn != NULL) {
+    spi_txn_release(read->txn);
+  }
+  read->txn = gyro_spi_build_read(count, done_fn);
+  read->count = count;
+}
+
+// the data follows the register address in the reply
+static const uint8_t *gyro_spi_read_data(const gyro_read_txn_t *read) {
+  return spi_txn_rx_data(read->txn) + read->txn->size - gyro_spi_read_size(read->count);
+}
+
+static gyro_data_t gyro_spi_decode(const uint8_t *buf) {
   gyro_data_t data;
 
   switch (gyro_type) {
@@ -110,9 +242,6 @@ gyro_data_t gyro_spi_read() {
   case GYRO_TYPE_ICM20608:
   case GYRO_TYPE_ICM20649:
   case GYRO_TYPE_ICM20689: {
-    uint8_t buf[14];
-    mpu6xxx_read_data(MPU_RA_ACCEL_XOUT_H, buf, 14);
-
     data.accel.axis[0] = -(int16_t)((buf[0] << 8) | buf[1]);
     data.accel.axis[1] = -(int16_t)((buf[2] << 8) | buf[3]);
     data.accel.axis[2] = (int16_t)((buf[4] << 8) | buf[5]);
@@ -127,9 +256,6 @@ gyro_data_t gyro_spi_read() {
 
   case GYRO_TYPE_ICM42605:
   case GYRO_TYPE_ICM42688P: {
-    uint8_t buf[14];
-    icm42605_read_data(ICM42605_TEMP_DATA1, buf, 14);
-
     data.temp = (float)((int16_t)((buf[0] << 8) | buf[1])) / 132.48f + 25.f;
 
     data.accel.axis[0] = -(int16_t)((buf[2] << 8) | buf[3]);
@@ -144,9 +270,6 @@ gyro_data_t gyro_spi_read() {
   }
 
   case GYRO_TYPE_BMI270: {
-    uint8_t buf[12];
-    bmi270_read_data(BMI270_REG_ACC_DATA_X_LSB, buf, 12);
-
     data.accel.axis[0] = -(int16_t)((buf[1] << 8) | buf[0]);
     data.accel.axis[1] = -(int16_t)((buf[3] << 8) | buf[2]);
     data.accel.axis[2] = (int16_t)((buf[5] << 8) | buf[4]);
@@ -160,8 +283,232 @@ gyro_data_t gyro_spi_read() {
   }
 
   default:
+    data.gyro.axis[0] = data.gyro.axis[1] = data.gyro.axis[2] = 0;
+    data.accel.axis[0] = data.accel.axis[1] = data.accel.axis[2] = 0;
+    data.temp = 0;
     break;
   }
 
   return data;
-}
\ No newline at end of file
+}
+
+static uint32_t gyro_spi_decode_fifo(const uint8_t *buf, uint32_t count, gyro_data_t *samples) {
+  uint32_t decoded = 0;
+
+  switch (gyro_type) {
+  case GYRO_TYPE_ICM42605:
+  case GYRO_TYPE_ICM42688P: {
+    for (uint32_t i = 0; i < count; i++) {
+      const uint8_t *packet = buf + i * ICM42605_FIFO_PACKET_SIZE;
+
+      // reading past the fill level returns empty packets
+      const uint8_t header = packet[0];
+      if ((header & ICM42605_FIFO_HEADER_EMPTY) || !(header & ICM42605_FIFO_HEADER_ACCEL) || !(header & ICM42605_FIFO_HEADER_GYRO)) {
+        continue;
+      }
+
+      gyro_data_t *data = &samples[decoded++];
+
+      data->accel.axis[0] = -(int16_t)((packet[1] << 8) | packet[2]);
+      data->accel.axis[1] = -(int16_t)((packet[3] << 8) | packet[4]);
+      data->accel.axis[2] = (int16_t)((packet[5] << 8) | packet[6]);
+
+      data->gyro.axis[1] = (int16_t)((packet[7] << 8) | packet[8]);
+      data->gyro.axis[0] = (int16_t)((packet[9] << 8) | packet[10]);
+      data->gyro.axis[2] = (int16_t)((packet[11] << 8) | packet[12]);
+
+      data->temp = (float)((int8_t)packet[13]) / 2.07f + 25.f;
+    }
+    break;
+  }
+
+  case GYRO_TYPE_BMI270: {
+    // the fifo only holds gyro frames, accel and temperature are shared by all samples of a burst
+    const gyro_data_t regs = gyro_spi_decode(buf);
+    const float temp = (float)((int16_t)((buf[BMI270_FIFO_BURST_TEMP_OFFSET + 1] << 8) | buf[BMI270_FIFO_BURST_TEMP_OFFSET])) / 512.f + 23.f;
+
+    const uint32_t length = ((buf[BMI270_FIFO_BURST_LENGTH_OFFSET + 1] << 8) | buf[BMI270_FIFO_BURST_LENGTH_OFFSET]) & BMI270_FIFO_LENGTH_MASK;
+    const uint32_t frames = min(length / BMI270_FIFO_FRAME_SIZE, count);
+
+    for (uint32_t i = 0; i < frames; i++) {
+      const uint8_t *frame = buf + BMI270_FIFO_BURST_DATA_OFFSET + i * BMI270_FIFO_FRAME_SIZE;
+
+      gyro_data_t *data = &samples[decoded++];
+
+      data->accel = regs.accel;
+
+      data->gyro.axis[1] = (int16_t)((frame[1] << 8) | frame[0]);
+      data->gyro.axis[0] = (int16_t)((frame[3] << 8) | frame[2]);
+      data->gyro.axis[2] = (int16_t)((frame[5] << 8) | frame[4]);
+
+      data->temp = temp;
+    }
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  return decoded;
+}
+
+#ifdef USE_GYRO_EXTI
+
+// wait at most this many loop periods for a data ready edge before falling back to a blocking read
+#define GYRO_EXTI_TIMEOUT_PERIODS 2
+
+typedef enum {
+  GYRO_EXTI_IDLE,
+  GYRO_EXTI_READING,
+  GYRO_EXTI_READY,
+} gyro_exti_state_t;
+
+static gyro_read_txn_t gyro_exti_read;
+static volatile gyro_exti_state_t gyro_exti_state = GYRO_EXTI_IDLE;
+
+static volatile uint32_t gyro_exti_edge_time = 0;
+static volatile uint32_t gyro_exti_edge_interval = 0;
+static volatile uint32_t gyro_exti_edge_count = 0;
+static volatile uint32_t gyro_exti_divider = 1;
+
+static volatile uint32_t gyro_exti_read_time = 0;
+static volatile uint32_t gyro_exti_sample_time = 0;
+
+static void gyro_spi_exti_read_done() {
+  gyro_exti_sample_time = gyro_exti_read_time;
+  gyro_exti_state = GYRO_EXTI_READY;
+}
+
+// called from the exti interrupt on every data ready edge of the gyro
+void gyro_spi_handle_exti() {
+  const uint32_t now = time_cycles();
+
+  gyro_exti_edge_interval = now - gyro_exti_edge_time;
+  gyro_exti_edge_time = now;
+
+  // the gyro might output faster than the loop runs, only every nth sample is read
+  gyro_exti_edge_count++;
+  if (gyro_exti_edge_count < gyro_exti_divider) {
+    return;
+  }
+  gyro_exti_edge_count = 0;
+
+  if (gyro_exti_state == GYRO_EXTI_READING) {
+    // previous transfer did not finish yet
+    gyro_sample_info.overruns++;
+    return;
+  }
+  if (gyro_exti_read.txn == NULL) {
+    return;
+  }
+
+  gyro_exti_read_time = now;
+  gyro_exti_state = GYRO_EXTI_READING;
+  spi_txn_submit_continue(&gyro_bus, gyro_exti_read.txn);
+}
+
+// rebuilds the txn for a new burst size, once the last sample it read was picked up
+static void gyro_spi_exti_update() {
+  ATOMIC_BLOCK_ALL {
+    if (gyro_exti_state == GYRO_EXTI_IDLE) {
+      gyro_spi_update_read(&gyro_exti_read, gyro_fifo_read_count, gyro_spi_exti_read_done);
+    }
+  }
+}
+
+uint32_t gyro_spi_exti_looptime(uint32_t target_us) {
+  const uint32_t interval = gyro_exti_edge_interval;
+  if (interval == 0) {
+    // no edges measured yet
+    return target_us;
+  }
+
+  const uint32_t target = target_us * TICKS_PER_US;
+  gyro_exti_divider = max((target + interval / 2) / interval, 1);
+  return (interval * gyro_exti_divider + TICKS_PER_US / 2) / TICKS_PER_US;
+}
+
+bool gyro_spi_exti_wait(uint32_t period_us) {
+  const uint32_t start = time_cycles();
+  const uint32_t timeout = period_us * TICKS_PER_US * GYRO_EXTI_TIMEOUT_PERIODS;
+
+  while (gyro_exti_state != GYRO_EXTI_READY) {
+    if ((time_cycles() - start) > timeout) {
+      gyro_sample_info.timeouts++;
+      return false;
+    }
+
+    // the bus might have been busy when the read was queued
+    spi_txn_continue(&gyro_bus);
+  }
+
+  return true;
+}
+
+#endif
+
+// one for the data registers and one for fifo bursts, so falling back to the registers does not rebuild them
+static gyro_read_txn_t gyro_blocking_read[2];
+
+static const uint8_t *gyro_spi_read_blocking(uint32_t count) {
+  gyro_read_txn_t *read = &gyro_blocking_read[count ? 1 : 0];
+
+  gyro_spi_update_read(read, count, NULL);
+  if (read->txn == NULL) {
+    return NULL;
+  }
+
+  spi_txn_submit_wait(&gyro_bus, read->txn);
+  return gyro_spi_read_data(read);
+}
+
+// count is the number of fifo samples to read if no interrupt triggered read is pending
+static uint32_t gyro_spi_read_pending(gyro_data_t *samples, uint32_t count) {
+  const uint8_t *buf = NULL;
+
+#ifdef USE_GYRO_EXTI
+  // the next edge reads into the same buffer again
+  uint8_t exti_buf[GYRO_BUF_SIZE];
+
+  ATOMIC_BLOCK_ALL {
+    if (gyro_exti_state == GYRO_EXTI_READY) {
+      count = gyro_exti_read.count;
+      memcpy(exti_buf, gyro_spi_read_data(&gyro_exti_read), gyro_spi_read_size(count));
+      gyro_sample_info.sample_time = gyro_exti_sample_time;
+      gyro_exti_state = GYRO_EXTI_IDLE;
+      buf = exti_buf;
+    }
+  }
+  gyro_spi_exti_update();
+#endif
+
+  if (buf == NULL) {
+    gyro_sample_info.sample_time = time_cycles();
+    // stays NULL without a gyro, decoding that yields zeros
+    buf = gyro_spi_read_blocking(count);
+  }
+
+  if (count == 0) {
+    samples[0] = gyro_spi_decode(buf);
+    return 1;
+  }
+  return gyro_spi_decode_fifo(buf, count, samples);
+}
+
+uint32_t gyro_spi_read_samples(gyro_data_t *samples, uint32_t looptime_us) {
+  gyro_spi_fifo_update(looptime_us);
+  return gyro_spi_read_pending(samples, gyro_fifo_read_count);
+}
+
+gyro_data_t gyro_spi_read() {
+  gyro_data_t samples[GYRO_FIFO_MAX_SAMPLES];
+
+  uint32_t count = gyro_spi_read_pending(samples, 0);
+  if (count == 0) {
+    // the interrupt triggered fifo read came back empty, read the data registers instead
+    count = gyro_spi_read_pending(samples, 0);
+  }
+
+  return samples[count - 1];
+}
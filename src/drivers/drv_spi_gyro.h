@@ -1,7 +1,17 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "project.h"
 #include "util/vector.h"
 
+#ifdef USE_GYRO_FIFO
+#define GYRO_FIFO_MAX_SAMPLES 16
+#else
+#define GYRO_FIFO_MAX_SAMPLES 1
+#endif
+
 typedef enum {
   GYRO_TYPE_INVALID,
 
@@ -26,7 +36,26 @@ typedef struct {
   float temp;
 } gyro_data_t;
 
+typedef struct {
+  uint32_t sample_time; // time_cycles() at the data ready edge of the last sample, or at the start of a blocking read
+  uint32_t overruns;    // data ready edges dropped because the previous read was still in flight
+  uint32_t timeouts;    // loops where no data ready edge arrived and a blocking read was used
+} gyro_sample_info_t;
+
 extern gyro_types_t gyro_type;
+extern gyro_sample_info_t gyro_sample_info;
 
 uint8_t gyro_spi_init();
-gyro_data_t gyro_spi_read();
\ No newline at end of file
+gyro_data_t gyro_spi_read();
+
+// reads every sample buffered by the gyro since the last call, oldest first
+// returns the number of samples written, which can be zero if the gyro had no new data
+uint32_t gyro_spi_read_samples(gyro_data_t *samples, uint32_t looptime_us);
+// period of the samples returned by gyro_spi_read_samples in us
+uint32_t gyro_spi_sample_period(uint32_t looptime_us);
+
+// picks how many data ready edges make up one loop for the target looptime,
+// returns the period the loop actually runs at in us, a multiple of the gyro output period
+uint32_t gyro_spi_exti_looptime(uint32_t target_us);
+// waits until the data ready triggered read has landed, returns false on timeout
+bool gyro_spi_exti_wait(uint32_t period_us);
@@ -47,6 +47,17 @@ void icm42605_configure() {
 
   icm42605_write(ICM42605_INT_CONFIG0, ICM42605_UI_DRDY_INT_CLEAR_ON_SBR);
   time_delay_ms(100);
+
+#ifdef USE_GYRO_FIFO
+  icm42605_write(ICM42605_FIFO_CONFIG1, ICM42605_FIFO_TEMP_EN | ICM42605_FIFO_GYRO_EN | ICM42605_FIFO_ACCEL_EN);
+  time_delay_ms(15);
+
+  icm42605_write(ICM42605_FIFO_CONFIG, ICM42605_FIFO_MODE_STREAM);
+  time_delay_ms(15);
+
+  icm42605_write(ICM42605_SIGNAL_PATH_RESET, ICM42605_FIFO_FLUSH);
+  time_delay_ms(1);
+#endif
 }
 
 uint8_t icm42605_read(uint8_t reg) {
@@ -77,4 +88,15 @@ void icm42605_read_data(uint8_t reg, uint8_t *data, uint32_t size) {
   spi_txn_add_seg_const(txn, reg | 0x80);
   spi_txn_add_seg(txn, data, NULL, size);
   spi_txn_submit_wait(&gyro_bus, txn);
-}
\ No newline at end of file
+}
+
+// persistent txn reading size bytes from reg, they end up at the end of spi_txn_rx_data.
+// done_fn is called from the dma interrupt once the data is there
+spi_txn_t *icm42605_read_txn(uint8_t reg, uint32_t size, spi_txn_done_fn_t done_fn) {
+  spi_bus_device_reconfigure(&gyro_bus, SPI_MODE_TRAILING_EDGE, SPI_SPEED_FAST);
+
+  spi_txn_t *txn = spi_txn_init_persistent(&gyro_bus, done_fn);
+  spi_txn_add_seg_const(txn, reg | 0x80);
+  spi_txn_add_seg(txn, NULL, NULL, size);
+  return txn;
+}
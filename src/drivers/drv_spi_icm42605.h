@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "drv_spi.h"
+
 // Bank 0
 #define ICM42605_DEVICE_CONFIG 0x11
 #define ICM42605_DRIVE_CONFIG 0x13
@@ -179,6 +181,23 @@
 #define ICM42605_UI_DRDY_INT_CLEAR_ON_F1BR ((1 << 5) || (0 << 4))
 #define ICM42605_UI_DRDY_INT_CLEAR_ON_SBR_AND_F1BR ((1 << 5) || (1 << 4))
 
+#define ICM42605_FIFO_MODE_BYPASS (0 << 6)
+#define ICM42605_FIFO_MODE_STREAM (1 << 6)
+
+#define ICM42605_FIFO_ACCEL_EN (1 << 0)
+#define ICM42605_FIFO_GYRO_EN (1 << 1)
+#define ICM42605_FIFO_TEMP_EN (1 << 2)
+
+#define ICM42605_FIFO_FLUSH (1 << 1)
+
+// packet 3: header, accel, gyro, temp and timestamp
+#define ICM42605_FIFO_PACKET_SIZE 16
+#define ICM42605_FIFO_PERIOD_US 125 // 8khz gyro and accel odr
+
+#define ICM42605_FIFO_HEADER_EMPTY (1 << 7)
+#define ICM42605_FIFO_HEADER_ACCEL (1 << 6)
+#define ICM42605_FIFO_HEADER_GYRO (1 << 5)
+
 #define ICM42605_INT_ASYNC_RESET_BIT 4
 #define ICM42605_INT_TDEASSERT_DISABLE_BIT 5
 #define ICM42605_INT_TDEASSERT_ENABLED (0 << ICM42605_INT_TDEASSERT_DISABLE_BIT)
@@ -193,4 +212,5 @@ void icm42605_configure();
 void icm42605_write(uint8_t reg, uint8_t data);
 
 uint8_t icm42605_read(uint8_t reg);
-void icm42605_read_data(uint8_t reg, uint8_t *data, uint32_t size);
\ No newline at end of file
+void icm42605_read_data(uint8_t reg, uint8_t *data, uint32_t size);
+spi_txn_t *icm42605_read_txn(uint8_t reg, uint32_t size, spi_txn_done_fn_t done_fn);
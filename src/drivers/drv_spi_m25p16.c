@@ -2,8 +2,10 @@
 
 #include <string.h>
 
+#include "debug.h"
 #include "drv_spi.h"
 #include "project.h"
+#include "util/util.h"
 
 #if defined(USE_M25P16)
 
@@ -29,8 +31,14 @@ static spi_bus_device_t bus = {
     .nss = M25P16_NSS_PIN,
 
     .auto_continue = true,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_FLASH,
 };
 
+static uint8_t status = 0;
+static bool status_pending = false;
+// set whenever a program or erase starts, cleared once the status register says it is done
+static bool chip_busy = true;
+
 void m25p16_init() {
   spi_bus_device_init(&bus);
   spi_bus_device_reconfigure(&bus, SPI_MODE_LEADING_EDGE, M25P16_BAUD_RATE);
@@ -47,7 +55,35 @@ uint8_t m25p16_is_ready() {
   spi_txn_add_seg(txn, buffer, buffer, 2);
   spi_txn_submit_wait(&bus, txn);
 
-  return (buffer[1] & 0x01) == 0;
+  chip_busy = (buffer[1] & 0x01) != 0;
+  return !chip_busy;
+}
+
+// checks the status read queued by the last call and queues the next one if the chip is still busy.
+// never waits on the bus or the chip, the caller just tries again next loop.
+uint8_t m25p16_poll_ready() {
+  if (!spi_txn_ready(&bus)) {
+    return 0;
+  }
+  if (!chip_busy) {
+    return 1;
+  }
+
+  if (status_pending) {
+    status_pending = false;
+    if ((status & 0x01) == 0) {
+      chip_busy = false;
+      return 1;
+    }
+  }
+
+  spi_txn_t *txn = spi_txn_init(&bus, NULL);
+  spi_txn_add_seg_const(txn, M25P16_READ_STATUS_REGISTER);
+  spi_txn_add_seg(txn, &status, NULL, 1);
+  spi_txn_submit_continue(&bus, txn);
+
+  status_pending = true;
+  return 0;
 }
 
 void m25p16_wait_for_ready() {
@@ -64,6 +100,10 @@ uint8_t m25p16_command(const uint8_t cmd) {
   spi_txn_add_seg(txn, &ret, &cmd, 1);
   spi_txn_submit_wait(&bus, txn);
 
+  if (cmd == M25P16_BULK_ERASE) {
+    chip_busy = true;
+  }
+
   return ret;
 }
 
@@ -86,22 +126,45 @@ static void m25p16_set_addr(spi_txn_t *txn, const uint32_t addr) {
   spi_txn_add_seg_const(txn, addr & 0xFF);
 }
 
+// page sized txns like m25p16_read_start, a gyro read on the same port never waits for more than a page
 uint8_t m25p16_read_addr(const uint8_t cmd, const uint32_t addr, uint8_t *data, const uint32_t len) {
   m25p16_wait_for_ready();
 
   uint8_t ret = 0;
 
-  spi_txn_t *txn = spi_txn_init(&bus, NULL);
-  spi_txn_add_seg(txn, &ret, &cmd, 1);
-  m25p16_set_addr(txn, addr);
-  spi_txn_add_seg(txn, data, NULL, len);
-  spi_txn_submit_wait(&bus, txn);
+  for (uint32_t offset = 0; offset < len; offset += M25P16_PAGE_SIZE) {
+    spi_txn_t *txn = spi_txn_init(&bus, NULL);
+    spi_txn_add_seg(txn, &ret, &cmd, 1);
+    m25p16_set_addr(txn, addr + offset);
+    spi_txn_add_seg_direct(txn, data + offset, NULL, min(len - offset, M25P16_PAGE_SIZE));
+    spi_txn_submit(txn);
+  }
+  spi_txn_wait(&bus);
 
   return ret;
 }
 
+// queues the read without waiting, the data is there once m25p16_poll_ready returns true again.
+// longer reads are split into page sized txns so the txn buffers stay small and the gyro can go in between
+uint8_t m25p16_read_start(const uint32_t addr, uint8_t *data, const uint32_t len) {
+  if (!m25p16_poll_ready()) {
+    return 0;
+  }
+
+  for (uint32_t offset = 0; offset < len; offset += M25P16_PAGE_SIZE) {
+    spi_txn_t *txn = spi_txn_init(&bus, NULL);
+    spi_txn_add_seg_const(txn, M25P16_READ_DATA_BYTES);
+    m25p16_set_addr(txn, addr + offset);
+    spi_txn_add_seg_direct(txn, data + offset, NULL, min(len - offset, M25P16_PAGE_SIZE));
+    spi_txn_submit(txn);
+  }
+  spi_txn_continue(&bus);
+
+  return 1;
+}
+
 uint8_t m25p16_page_program(const uint32_t addr, const uint8_t *buf, const uint32_t size) {
-  if (!m25p16_is_ready()) {
+  if (!m25p16_poll_ready()) {
     return 0;
   }
 
@@ -115,11 +178,36 @@ uint8_t m25p16_page_program(const uint32_t addr, const uint8_t *buf, const uint3
     spi_txn_t *txn = spi_txn_init(&bus, NULL);
     spi_txn_add_seg_const(txn, M25P16_PAGE_PROGRAM);
     m25p16_set_addr(txn, addr);
-    spi_txn_add_seg(txn, NULL, buf, size);
+    spi_txn_add_seg_direct(txn, NULL, buf, size);
+    spi_txn_submit(txn);
+  }
+
+  spi_txn_continue(&bus);
+  chip_busy = true;
+
+  return 1;
+}
+
+uint8_t m25p16_sector_erase(const uint32_t addr) {
+  if (!m25p16_poll_ready()) {
+    return 0;
+  }
+
+  {
+    spi_txn_t *txn = spi_txn_init(&bus, NULL);
+    spi_txn_add_seg_const(txn, M25P16_WRITE_ENABLE);
+    spi_txn_submit(txn);
+  }
+
+  {
+    spi_txn_t *txn = spi_txn_init(&bus, NULL);
+    spi_txn_add_seg_const(txn, M25P16_SECTOR_ERASE);
+    m25p16_set_addr(txn, addr);
     spi_txn_submit(txn);
   }
 
   spi_txn_continue(&bus);
+  chip_busy = true;
 
   return 1;
 }
@@ -134,6 +222,7 @@ uint8_t m25p16_write_addr(const uint8_t cmd, const uint32_t addr, uint8_t *data,
   m25p16_set_addr(txn, addr);
   spi_txn_add_seg(txn, NULL, data, len);
   spi_txn_submit_continue(&bus, txn);
+  chip_busy = true;
 
   return ret;
 }
@@ -27,10 +27,13 @@ enum m25p16_commands {
 void m25p16_init();
 void m25p16_wait_for_ready();
 uint8_t m25p16_is_ready();
+uint8_t m25p16_poll_ready();
 void m25p16_get_bounds(data_flash_bounds_t *bounds);
 
 uint8_t m25p16_command(const uint8_t cmd);
 uint8_t m25p16_read_command(const uint8_t cmd, uint8_t *data, const uint32_t len);
 uint8_t m25p16_read_addr(const uint8_t cmd, const uint32_t addr, uint8_t *data, const uint32_t len);
 uint8_t m25p16_write_addr(const uint8_t cmd, const uint32_t addr, uint8_t *data, const uint32_t len);
+uint8_t m25p16_read_start(const uint32_t addr, uint8_t *data, const uint32_t len);
 uint8_t m25p16_page_program(const uint32_t addr, const uint8_t *buf, const uint32_t size);
+uint8_t m25p16_sector_erase(const uint32_t addr);
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 
+#include "debug.h"
 #include "drv_osd.h"
 #include "drv_spi.h"
 #include "drv_time.h"
@@ -27,6 +28,7 @@ static spi_bus_device_t bus = {
     .nss = MAX7456_NSS,
 
     .auto_continue = true,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_OSD,
 };
 
 static uint8_t max7456_map_attr(uint8_t attr) {
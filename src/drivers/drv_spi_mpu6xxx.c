@@ -121,3 +121,14 @@ void mpu6xxx_read_data(uint8_t reg, uint8_t *data, uint32_t size) {
   spi_txn_add_seg(txn, data, NULL, size);
   spi_txn_submit_wait(&gyro_bus, txn);
 }
+
+// persistent txn reading size bytes from reg, they end up at the end of spi_txn_rx_data.
+// done_fn is called from the dma interrupt once the data is there
+spi_txn_t *mpu6xxx_read_txn(uint8_t reg, uint32_t size, spi_txn_done_fn_t done_fn) {
+  spi_bus_device_reconfigure(&gyro_bus, SPI_MODE_TRAILING_EDGE, mpu6xxx_fast_divider());
+
+  spi_txn_t *txn = spi_txn_init_persistent(&gyro_bus, done_fn);
+  spi_txn_add_seg_const(txn, reg | 0x80);
+  spi_txn_add_seg(txn, NULL, NULL, size);
+  return txn;
+}
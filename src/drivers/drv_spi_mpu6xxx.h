@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "drv_spi.h"
+
 #define MPU_BIT_SLEEP 0x40
 #define MPU_BIT_H_RESET 0x80
 #define MPU_BITS_CLKSEL 0x07
@@ -131,4 +133,5 @@ void mpu6xxx_configure();
 void mpu6xxx_write(uint8_t reg, uint8_t data);
 
 uint8_t mpu6xxx_read(uint8_t reg);
-void mpu6xxx_read_data(uint8_t reg, uint8_t *data, uint32_t size);
\ No newline at end of file
+void mpu6xxx_read_data(uint8_t reg, uint8_t *data, uint32_t size);
+spi_txn_t *mpu6xxx_read_txn(uint8_t reg, uint32_t size, spi_txn_done_fn_t done_fn);
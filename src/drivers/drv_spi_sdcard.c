@@ -2,6 +2,7 @@
 
 #include <string.h>
 
+#include "debug.h"
 #include "drv_spi.h"
 #include "drv_time.h"
 #include "project.h"
@@ -49,6 +50,9 @@ typedef struct {
 // how many cycles to delay for write confirm
 #define IDLE_BYTES 16
 
+// bytes clocked per busy check, the card holds miso low while it is programming
+#define BUSY_POLL_BYTES 4
+
 #define SPI_SPEED_SLOW MHZ_TO_HZ(0.5)
 #define SPI_SPEED_FAST MHZ_TO_HZ(25)
 
@@ -57,11 +61,15 @@ sdcard_info_t sdcard_info;
 static volatile sdcard_state_t state = SDCARD_POWER_UP;
 static sdcard_operation_t operation;
 
+static uint8_t busy_poll[BUSY_POLL_BYTES];
+static bool busy_poll_pending = false;
+
 static spi_bus_device_t bus = {
     .port = SDCARD_SPI_PORT,
     .nss = SDCARD_NSS_PIN,
 
     .auto_continue = false,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_FLASH,
 };
 
 void sdcard_init() {
@@ -128,6 +136,24 @@ static bool sdcard_wait_for_idle() {
   return false;
 }
 
+// checks the result of the last busy poll and queues a new one if the card is still busy.
+// never waits on the bus, sdcard_update only comes back here once the poll is done.
+static bool sdcard_poll_idle() {
+  if (busy_poll_pending) {
+    busy_poll_pending = false;
+    if (busy_poll[BUSY_POLL_BYTES - 1] == 0xFF) {
+      return true;
+    }
+  }
+
+  spi_txn_t *txn = spi_txn_init(&bus, NULL);
+  spi_txn_add_seg(txn, busy_poll, NULL, BUSY_POLL_BYTES);
+  spi_txn_submit_continue(&bus, txn);
+
+  busy_poll_pending = true;
+  return false;
+}
+
 static uint8_t sdcard_command(const uint8_t cmd, const uint32_t args) {
   if (cmd != SDCARD_GO_IDLE && cmd != SDCARD_STOP_TRANSMISSION && !sdcard_wait_for_idle()) {
     return 0xFF;
@@ -404,7 +430,7 @@ sdcard_status_t sdcard_update() {
       state = SDCARD_READ_MULTIPLE_CONTINUE;
 
       spi_txn_t *txn = spi_txn_init(&bus, NULL);
-      spi_txn_add_seg(txn, operation.buf + operation.count_done * SDCARD_PAGE_SIZE, NULL, SDCARD_PAGE_SIZE);
+      spi_txn_add_seg_direct(txn, operation.buf + operation.count_done * SDCARD_PAGE_SIZE, NULL, SDCARD_PAGE_SIZE);
 
       // CRC bytes
       spi_txn_add_seg_const(txn, 0xff);
@@ -462,7 +488,7 @@ sdcard_status_t sdcard_update() {
 
     spi_txn_t *txn = spi_txn_init(&bus, NULL);
     spi_txn_add_seg_const(txn, 0xFC);
-    spi_txn_add_seg(txn, NULL, operation.buf, SDCARD_PAGE_SIZE);
+    spi_txn_add_seg_direct(txn, NULL, operation.buf, SDCARD_PAGE_SIZE);
 
     // two bytes CRC
     spi_txn_add_seg_const(txn, 0xff);
@@ -471,6 +497,10 @@ sdcard_status_t sdcard_update() {
     // write response
     spi_txn_add_seg_const(txn, 0xff);
 
+    // first busy check rides along, fast cards are done by then
+    spi_txn_add_seg(txn, busy_poll, NULL, BUSY_POLL_BYTES);
+    busy_poll_pending = true;
+
     spi_txn_submit_continue(&bus, txn);
 
     state = SDCARD_WRITE_MULTIPLE_VERIFY;
@@ -478,31 +508,33 @@ sdcard_status_t sdcard_update() {
   }
 
   case SDCARD_WRITE_MULTIPLE_VERIFY: {
-    if (!sdcard_wait_for_idle()) {
+    if (!sdcard_poll_idle()) {
       break;
     }
 
     operation.count_done++;
     state = SDCARD_WRITE_MULTIPLE_SECTOR_SUCCESS;
-    break;
+    return SDCARD_IDLE;
   }
 
   case SDCARD_WRITE_MULTIPLE_FINISH: {
     spi_txn_t *txn = spi_txn_init(&bus, NULL);
     spi_txn_add_seg_const(txn, 0xfd);
+    spi_txn_add_seg(txn, busy_poll, NULL, BUSY_POLL_BYTES);
     spi_txn_submit_continue(&bus, txn);
 
+    busy_poll_pending = true;
     state = SDCARD_WRITE_MULTIPLE_FINISH_WAIT;
     break;
   }
 
   case SDCARD_WRITE_MULTIPLE_FINISH_WAIT: {
-    if (!sdcard_wait_for_idle()) {
+    if (!sdcard_poll_idle()) {
       break;
     }
 
     state = SDCARD_WRITE_MULTIPLE_DONE;
-    break;
+    return SDCARD_IDLE;
   }
 
   case SDCARD_READY:
@@ -578,7 +610,8 @@ uint8_t sdcard_write_pages_start(uint32_t sector, uint32_t count) {
     return 0;
   }
 
-  if (sdcard_app_command(SDCARD_ACMD_SET_WR_BLK_ERASE_COUNT, count * 2) != 0x0) {
+  // lets the card erase the whole run up front instead of block by block while we write
+  if (sdcard_app_command(SDCARD_ACMD_SET_WR_BLK_ERASE_COUNT, count) != 0x0) {
     return 0;
   }
 
@@ -592,9 +625,9 @@ uint8_t sdcard_write_pages_start(uint32_t sector, uint32_t count) {
   return 0;
 }
 
-uint8_t sdcard_write_pages_continue(uint8_t *buf) {
+uint8_t sdcard_write_pages_continue(const uint8_t *buf) {
   if (state == SDCARD_WRITE_MULTIPLE_READY) {
-    operation.buf = buf;
+    operation.buf = (uint8_t *)buf;
     operation.count++;
 
     state = SDCARD_WRITE_MULTIPLE_CONTINUE;
@@ -139,5 +139,5 @@ uint8_t sdcard_read_pages(uint8_t *buf, uint32_t page, uint32_t count);
 uint8_t sdcard_write_page(uint8_t *buf, uint32_t page);
 
 uint8_t sdcard_write_pages_start(uint32_t page, uint32_t count);
-uint8_t sdcard_write_pages_continue(uint8_t *buf);
+uint8_t sdcard_write_pages_continue(const uint8_t *buf);
 uint8_t sdcard_write_pages_finish();
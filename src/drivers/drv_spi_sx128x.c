@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "debug.h"
 #include "drv_exti.h"
 #include "drv_spi.h"
 #include "drv_time.h"
@@ -18,6 +19,7 @@ static spi_bus_device_t bus = {
 
     .auto_continue = true,
     .poll_fn = sx128x_poll_for_not_busy,
+    .wait_counter = PERF_COUNTER_SPI_QUEUE_RX,
 };
 
 volatile uint8_t dio0_active = 0;
@@ -38,6 +38,11 @@ void failloop(failloop_t val) {
 
     state.failloop = val;
 
+#ifdef SIMULATOR
+    // nobody is watching the leds, end the run
+    sitl_exit(1);
+#endif
+
     if (usb_detect()) {
       usb_configurator();
     }
@@ -14,4 +14,5 @@ typedef enum {
   FAILLOOP_SPI = 8,         // spi error - triggered by hardware spi driver only
 } failloop_t;
 
+const char *failloop_string(failloop_t val);
 void failloop(failloop_t val);
\ No newline at end of file
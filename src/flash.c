@@ -10,7 +10,10 @@
 #include "project.h"
 #include "util/cbor_helper.h"
 
-#define FMC_HEADER 0x12AA0001
+// changes with the storage layout, flash saved with another layout reads as empty
+#define FMC_HEADER 0x12AA0002
+
+_Static_assert(FMC_END_OFFSET + FLASH_WORD_SIZE <= FMC_FLASH_SIZE, "config storage does not fit the config flash");
 
 extern const profile_t default_profile;
 extern profile_t profile;
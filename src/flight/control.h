@@ -42,11 +42,20 @@ typedef struct {
   failloop_t failloop;
 
   uint16_t looptime_autodetect;
-  float looptime;       // looptime in seconds
-  uint32_t looptime_us; // looptime in us
-  float uptime;         // running sum of looptimes
-  float armtime;        // running sum of looptimes (while armed)
-  uint32_t cpu_load;    // micros we have had left last loop
+  uint16_t pid_looptime_autodetect; // looptime_autodetect times the pid rate divider
+  uint16_t gyro_sample_period;      // period of the samples run through the gyro filters in us
+  uint8_t gyro_sample_count;        // gyro samples read during the last loop
+  float pid_looptime;               // time between the last two pid runs in seconds
+  float looptime;                   // looptime in seconds
+  uint32_t looptime_us;             // looptime in us
+  float uptime;                     // running sum of looptimes
+  float armtime;                    // running sum of looptimes (while armed)
+  uint32_t cpu_load;                // micros we have had left last loop
+
+  float gyro_latency;        // average time from gyro sample to motor output in us
+  uint32_t gyro_latency_max; // worst case of the above over the last second
+  float gyro_jitter;         // average deviation of the loop period from its mean in us
+  uint32_t gyro_jitter_max;  // worst case of the above over the last second
 
   uint32_t failsafe_time_ms; // time the last failsafe occured in ms
 
@@ -98,6 +107,8 @@ typedef struct {
   vec3_t pidoutput; // combinded output of the pid controller
 
   vec4_t motor_mix;
+  vec4_t motor_rpm;                  // mechanical rpm per motor, zero when no telemetry is available
+  vec4_t dshot_telemetry_error_rate; // percentage of dshot telemetry replies with invalid gcr or crc
 
   float angleerror[ANGLE_PID_SIZE];
 } control_state_t;
@@ -105,11 +116,19 @@ typedef struct {
 #define STATE_MEMBERS                       \
   MEMBER(failloop, uint8)                   \
   MEMBER(looptime_autodetect, uint16)       \
+  MEMBER(pid_looptime_autodetect, uint16)   \
+  MEMBER(gyro_sample_period, uint16)        \
+  MEMBER(gyro_sample_count, uint8)          \
+  MEMBER(pid_looptime, float)               \
   MEMBER(looptime, float)                   \
   MEMBER(looptime_us, uint32)               \
   MEMBER(uptime, float)                     \
   MEMBER(armtime, float)                    \
   MEMBER(cpu_load, uint32)                  \
+  MEMBER(gyro_latency, float)               \
+  MEMBER(gyro_latency_max, uint32)          \
+  MEMBER(gyro_jitter, float)                \
+  MEMBER(gyro_jitter_max, uint32)           \
   MEMBER(lipo_cell_count, uint8)            \
   MEMBER(cpu_temp, float)                   \
   MEMBER(vbat, float)                       \
@@ -139,7 +158,9 @@ typedef struct {
   MEMBER(setpoint, vec3_t)                  \
   MEMBER(error, vec3_t)                     \
   MEMBER(errorvect, vec3_t)                 \
-  MEMBER(pidoutput, vec3_t)
+  MEMBER(pidoutput, vec3_t)                 \
+  MEMBER(motor_rpm, vec4_t)                 \
+  MEMBER(dshot_telemetry_error_rate, vec4_t)
 
 typedef struct {
   uint8_t active;
@@ -0,0 +1,298 @@
+#include "flight/dyn_notch.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "flight/control.h"
+#include "flight/filter.h"
+#include "profile.h"
+#include "util/util.h"
+
+// a bin has to be this many times above the average to be considered a peak
+#define DYN_NOTCH_PEAK_THRESHOLD 2.0f
+// smoothing applied to the tracked center frequencies
+#define DYN_NOTCH_SMOOTHING 0.4f
+
+typedef enum {
+  DYN_NOTCH_STEP_WINDOW,
+  DYN_NOTCH_STEP_FFT_STAGE_1,
+  DYN_NOTCH_STEP_FFT_STAGE_2,
+  DYN_NOTCH_STEP_FFT_STAGE_3,
+  DYN_NOTCH_STEP_FFT_STAGE_4,
+  DYN_NOTCH_STEP_FFT_STAGE_5,
+  DYN_NOTCH_STEP_MAGNITUDE,
+  DYN_NOTCH_STEP_PEAKS,
+} dyn_notch_step_t;
+
+typedef struct {
+  float re;
+  float im;
+} dyn_notch_complex_t;
+
+dyn_notch_info_t dyn_notch_info;
+
+static filter_biquad notch[3][DYN_NOTCH_COUNT];
+static filter_state_t notch_state[3][DYN_NOTCH_COUNT];
+
+static float sample_ring[3][DYN_NOTCH_FFT_SIZE];
+static float sample_accum[3];
+static uint8_t sample_ring_index = 0;
+static uint8_t sample_accum_count = 0;
+static uint8_t sample_decimation = 1;
+static uint32_t samples_collected = 0;
+static uint16_t sample_period = 0;
+
+static float window[DYN_NOTCH_FFT_SIZE];
+static float twiddle_cos[DYN_NOTCH_FFT_BINS];
+static float twiddle_sin[DYN_NOTCH_FFT_BINS];
+
+// a real fft of size N is computed as a complex fft of size N/2
+static dyn_notch_complex_t fft_buffer[DYN_NOTCH_FFT_BINS];
+static float fft_magnitude[DYN_NOTCH_FFT_BINS];
+
+static dyn_notch_step_t current_step = DYN_NOTCH_STEP_WINDOW;
+static uint8_t current_axis = 0;
+
+static uint8_t bit_reverse(uint8_t val) {
+  uint8_t res = 0;
+  for (uint8_t i = 1; i < DYN_NOTCH_FFT_BINS; i <<= 1) {
+    res = (res << 1) | (val & 1);
+    val >>= 1;
+  }
+  return res;
+}
+
+static void dyn_notch_reset_samples() {
+  sample_period = state.gyro_sample_period;
+
+  const float sample_hz = 1e6f / state.gyro_sample_period;
+  const float fft_hz = profile.filter.gyro_dynamic_notch_max * DYN_NOTCH_SAMPLE_RATIO;
+  sample_decimation = constrain((uint32_t)(sample_hz / fft_hz), 1, 16);
+
+  dyn_notch_info.fft_sample_rate = sample_hz / sample_decimation;
+
+  sample_ring_index = 0;
+  sample_accum_count = 0;
+  samples_collected = 0;
+  for (uint8_t i = 0; i < 3; i++) {
+    sample_accum[i] = 0;
+  }
+
+  current_step = DYN_NOTCH_STEP_WINDOW;
+  current_axis = 0;
+}
+
+void dyn_notch_init() {
+  for (uint32_t i = 0; i < DYN_NOTCH_FFT_SIZE; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI_F * i / (DYN_NOTCH_FFT_SIZE - 1));
+  }
+  for (uint32_t i = 0; i < DYN_NOTCH_FFT_BINS; i++) {
+    twiddle_cos[i] = cosf(2.0f * M_PI_F * i / DYN_NOTCH_FFT_SIZE);
+    twiddle_sin[i] = sinf(2.0f * M_PI_F * i / DYN_NOTCH_FFT_SIZE);
+  }
+
+  // spread the notches evenly over the range until the first peaks are found
+  const float min_hz = profile.filter.gyro_dynamic_notch_min;
+  const float max_hz = profile.filter.gyro_dynamic_notch_max;
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    for (uint8_t i = 0; i < DYN_NOTCH_COUNT; i++) {
+      const float hz = min_hz + (max_hz - min_hz) * (i + 1) / (DYN_NOTCH_COUNT + 1);
+      dyn_notch_info.center_hz[axis][i] = hz;
+      filter_notch_biquad_init(&notch[axis][i], &notch_state[axis][i], 1, hz, profile.filter.gyro_dynamic_notch_q, state.gyro_sample_period);
+    }
+  }
+
+  dyn_notch_reset_samples();
+}
+
+static void dyn_notch_window() {
+  // oldest sample first, the ring index points at the oldest entry
+  const float *samples = sample_ring[current_axis];
+  for (uint32_t i = 0; i < DYN_NOTCH_FFT_BINS; i++) {
+    const uint32_t even = (sample_ring_index + 2 * i) % DYN_NOTCH_FFT_SIZE;
+    const uint32_t odd = (sample_ring_index + 2 * i + 1) % DYN_NOTCH_FFT_SIZE;
+
+    dyn_notch_complex_t *c = &fft_buffer[bit_reverse(i)];
+    c->re = samples[even] * window[2 * i];
+    c->im = samples[odd] * window[2 * i + 1];
+  }
+}
+
+static void dyn_notch_fft_stage(uint8_t stage) {
+  const uint32_t half = 1 << (stage - 1);
+  const uint32_t span = half << 1;
+  const uint32_t twiddle_step = DYN_NOTCH_FFT_SIZE / span;
+
+  for (uint32_t start = 0; start < DYN_NOTCH_FFT_BINS; start += span) {
+    for (uint32_t j = 0; j < half; j++) {
+      const float wr = twiddle_cos[j * twiddle_step];
+      const float wi = -twiddle_sin[j * twiddle_step];
+
+      dyn_notch_complex_t *a = &fft_buffer[start + j];
+      dyn_notch_complex_t *b = &fft_buffer[start + j + half];
+
+      const float tr = wr * b->re - wi * b->im;
+      const float ti = wr * b->im + wi * b->re;
+
+      b->re = a->re - tr;
+      b->im = a->im - ti;
+      a->re += tr;
+      a->im += ti;
+    }
+  }
+}
+
+// unpacks the half size complex fft into the spectrum of the real input
+static void dyn_notch_magnitude() {
+  fft_magnitude[0] = 0;
+
+  for (uint32_t k = 1; k < DYN_NOTCH_FFT_BINS; k++) {
+    const dyn_notch_complex_t *a = &fft_buffer[k];
+    const dyn_notch_complex_t *b = &fft_buffer[DYN_NOTCH_FFT_BINS - k];
+
+    const float even_re = 0.5f * (a->re + b->re);
+    const float even_im = 0.5f * (a->im - b->im);
+    const float odd_re = 0.5f * (a->im + b->im);
+    const float odd_im = -0.5f * (a->re - b->re);
+
+    const float wr = twiddle_cos[k];
+    const float wi = -twiddle_sin[k];
+
+    const float re = even_re + wr * odd_re - wi * odd_im;
+    const float im = even_im + wr * odd_im + wi * odd_re;
+
+    fft_magnitude[k] = sqrtf(re * re + im * im);
+  }
+}
+
+static void dyn_notch_peaks() {
+  const float bin_hz = (float)dyn_notch_info.fft_sample_rate / DYN_NOTCH_FFT_SIZE;
+
+  const uint32_t bin_min = constrain((uint32_t)(profile.filter.gyro_dynamic_notch_min / bin_hz), 1, DYN_NOTCH_FFT_BINS - 2);
+  const uint32_t bin_max = constrain((uint32_t)(profile.filter.gyro_dynamic_notch_max / bin_hz) + 1, bin_min, DYN_NOTCH_FFT_BINS - 2);
+
+  float avg = 0;
+  for (uint32_t k = bin_min; k <= bin_max; k++) {
+    avg += fft_magnitude[k];
+  }
+  avg /= (bin_max - bin_min + 1);
+
+  uint8_t peak_bin[DYN_NOTCH_COUNT];
+  uint8_t peak_count = 0;
+
+  // insertion sort of the largest local maxima
+  for (uint32_t k = bin_min; k <= bin_max; k++) {
+    const float mag = fft_magnitude[k];
+    if (mag < avg * DYN_NOTCH_PEAK_THRESHOLD || mag <= fft_magnitude[k - 1] || mag < fft_magnitude[k + 1]) {
+      continue;
+    }
+
+    uint8_t pos = peak_count;
+    while (pos > 0 && fft_magnitude[peak_bin[pos - 1]] < mag) {
+      if (pos < DYN_NOTCH_COUNT) {
+        peak_bin[pos] = peak_bin[pos - 1];
+      }
+      pos--;
+    }
+    if (pos < DYN_NOTCH_COUNT) {
+      peak_bin[pos] = k;
+      if (peak_count < DYN_NOTCH_COUNT) {
+        peak_count++;
+      }
+    }
+  }
+
+  // order by frequency so each notch keeps following roughly the same peak
+  for (uint8_t i = 1; i < peak_count; i++) {
+    for (uint8_t j = i; j > 0 && peak_bin[j - 1] > peak_bin[j]; j--) {
+      const uint8_t tmp = peak_bin[j];
+      peak_bin[j] = peak_bin[j - 1];
+      peak_bin[j - 1] = tmp;
+    }
+  }
+
+  for (uint8_t i = 0; i < peak_count; i++) {
+    const uint32_t k = peak_bin[i];
+
+    // parabolic interpolation between neighboring bins
+    const float y0 = fft_magnitude[k - 1];
+    const float y1 = fft_magnitude[k];
+    const float y2 = fft_magnitude[k + 1];
+    const float denom = y0 - 2.0f * y1 + y2;
+    const float offset = denom != 0.0f ? 0.5f * (y0 - y2) / denom : 0.0f;
+
+    float hz = (k + offset) * bin_hz;
+    hz = constrainf(hz, profile.filter.gyro_dynamic_notch_min, profile.filter.gyro_dynamic_notch_max);
+
+    float *center = &dyn_notch_info.center_hz[current_axis][i];
+    *center += DYN_NOTCH_SMOOTHING * (hz - *center);
+  }
+
+  for (uint8_t i = 0; i < DYN_NOTCH_COUNT; i++) {
+    filter_notch_biquad_coeff(&notch[current_axis][i], dyn_notch_info.center_hz[current_axis][i], profile.filter.gyro_dynamic_notch_q, state.gyro_sample_period);
+  }
+}
+
+void dyn_notch_sample(const vec3_t *gyro_raw) {
+  if (sample_period != state.gyro_sample_period) {
+    dyn_notch_reset_samples();
+  }
+
+  for (uint8_t i = 0; i < 3; i++) {
+    sample_accum[i] += gyro_raw->axis[i];
+  }
+
+  sample_accum_count++;
+  if (sample_accum_count >= sample_decimation) {
+    for (uint8_t i = 0; i < 3; i++) {
+      sample_ring[i][sample_ring_index] = sample_accum[i] / sample_accum_count;
+      sample_accum[i] = 0;
+    }
+    sample_accum_count = 0;
+    sample_ring_index = (sample_ring_index + 1) % DYN_NOTCH_FFT_SIZE;
+    samples_collected++;
+  }
+}
+
+void dyn_notch_update() {
+  if (samples_collected < DYN_NOTCH_FFT_SIZE) {
+    return;
+  }
+
+  // only one step per loop to keep the cost bounded
+  switch (current_step) {
+  case DYN_NOTCH_STEP_WINDOW:
+    dyn_notch_window();
+    break;
+
+  case DYN_NOTCH_STEP_FFT_STAGE_1:
+  case DYN_NOTCH_STEP_FFT_STAGE_2:
+  case DYN_NOTCH_STEP_FFT_STAGE_3:
+  case DYN_NOTCH_STEP_FFT_STAGE_4:
+  case DYN_NOTCH_STEP_FFT_STAGE_5:
+    dyn_notch_fft_stage(current_step - DYN_NOTCH_STEP_WINDOW);
+    break;
+
+  case DYN_NOTCH_STEP_MAGNITUDE:
+    dyn_notch_magnitude();
+    break;
+
+  case DYN_NOTCH_STEP_PEAKS:
+    dyn_notch_peaks();
+    break;
+  }
+
+  if (current_step == DYN_NOTCH_STEP_PEAKS) {
+    current_step = DYN_NOTCH_STEP_WINDOW;
+    current_axis = (current_axis + 1) % 3;
+  } else {
+    current_step++;
+  }
+}
+
+float dyn_notch_step(uint8_t axis, float in) {
+  for (uint8_t i = 0; i < DYN_NOTCH_COUNT; i++) {
+    in = filter_biquad_step(&notch[axis][i], &notch_state[axis][i], in);
+  }
+  return in;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "util/vector.h"
+
+// number of samples per fft, has to be a power of two
+#define DYN_NOTCH_FFT_SIZE 64
+#define DYN_NOTCH_FFT_BINS (DYN_NOTCH_FFT_SIZE / 2)
+
+// number of noise peaks tracked (and notches applied) per axis
+#define DYN_NOTCH_COUNT 3
+
+// the fft is fed at roughly this multiple of the max notch frequency
+#define DYN_NOTCH_SAMPLE_RATIO 3
+
+typedef struct {
+  float center_hz[3][DYN_NOTCH_COUNT];
+  uint32_t fft_sample_rate;
+} dyn_notch_info_t;
+
+extern dyn_notch_info_t dyn_notch_info;
+
+void dyn_notch_init();
+
+// feeds one raw gyro sample, called for every sample that runs through the notches
+void dyn_notch_sample(const vec3_t *gyro_raw);
+// advances the analysis by one step, called once per loop
+void dyn_notch_update();
+float dyn_notch_step(uint8_t axis, float in);
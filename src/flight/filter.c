@@ -1,6 +1,7 @@
 #include "flight/filter.h"
 
 #include <math.h>
+#include <stdbool.h>
 
 #include "flight/control.h"
 #include "project.h"
@@ -43,20 +44,20 @@ static void filter_init_state(filter_state_t *state, uint8_t count) {
   }
 }
 
-void filter_lp_pt1_init(filter_lp_pt1 *filter, filter_state_t *state, uint8_t count, float hz) {
-  filter_lp_pt1_coeff(filter, hz);
+void filter_lp_pt1_init(filter_lp_pt1 *filter, filter_state_t *state, uint8_t count, float hz, uint32_t sample_period_us) {
+  filter_lp_pt1_coeff(filter, hz, sample_period_us);
   filter_init_state(state, count);
 }
 
-void filter_lp_pt1_coeff(filter_lp_pt1 *filter, float hz) {
-  if (filter->hz == hz && filter->sample_period_us == state.looptime_autodetect) {
+void filter_lp_pt1_coeff(filter_lp_pt1 *filter, float hz, uint32_t sample_period_us) {
+  if (filter->hz == hz && filter->sample_period_us == sample_period_us) {
     return;
   }
   filter->hz = hz;
-  filter->sample_period_us = state.looptime_autodetect;
+  filter->sample_period_us = sample_period_us;
 
   const float rc = 1 / (2 * ORDER1_CORRECTION * M_PI_F * hz);
-  const float sample_period = state.looptime_autodetect * 1e-6f;
+  const float sample_period = sample_period_us * 1e-6f;
 
   filter->alpha = sample_period / (rc + sample_period);
 }
@@ -66,20 +67,20 @@ float filter_lp_pt1_step(filter_lp_pt1 *filter, filter_state_t *state, float in)
   return state->delay_element[0];
 }
 
-void filter_lp_pt2_init(filter_lp_pt2 *filter, filter_state_t *state, uint8_t count, float hz) {
-  filter_lp_pt2_coeff(filter, hz);
+void filter_lp_pt2_init(filter_lp_pt2 *filter, filter_state_t *state, uint8_t count, float hz, uint32_t sample_period_us) {
+  filter_lp_pt2_coeff(filter, hz, sample_period_us);
   filter_init_state(state, count);
 }
 
-void filter_lp_pt2_coeff(filter_lp_pt2 *filter, float hz) {
-  if (filter->hz == hz && filter->sample_period_us == state.looptime_autodetect) {
+void filter_lp_pt2_coeff(filter_lp_pt2 *filter, float hz, uint32_t sample_period_us) {
+  if (filter->hz == hz && filter->sample_period_us == sample_period_us) {
     return;
   }
   filter->hz = hz;
-  filter->sample_period_us = state.looptime_autodetect;
+  filter->sample_period_us = sample_period_us;
 
   const float rc = 1 / (2 * ORDER2_CORRECTION * M_PI_F * hz);
-  const float sample_period = state.looptime_autodetect * 1e-6f;
+  const float sample_period = sample_period_us * 1e-6f;
 
   filter->alpha = sample_period / (rc + sample_period);
 }
@@ -90,20 +91,20 @@ float filter_lp_pt2_step(filter_lp_pt2 *filter, filter_state_t *state, float in)
   return state->delay_element[0];
 }
 
-void filter_lp_pt3_init(filter_lp_pt3 *filter, filter_state_t *state, uint8_t count, float hz) {
-  filter_lp_pt3_coeff(filter, hz);
+void filter_lp_pt3_init(filter_lp_pt3 *filter, filter_state_t *state, uint8_t count, float hz, uint32_t sample_period_us) {
+  filter_lp_pt3_coeff(filter, hz, sample_period_us);
   filter_init_state(state, count);
 }
 
-void filter_lp_pt3_coeff(filter_lp_pt3 *filter, float hz) {
-  if (filter->hz == hz && filter->sample_period_us == state.looptime_autodetect) {
+void filter_lp_pt3_coeff(filter_lp_pt3 *filter, float hz, uint32_t sample_period_us) {
+  if (filter->hz == hz && filter->sample_period_us == sample_period_us) {
     return;
   }
   filter->hz = hz;
-  filter->sample_period_us = state.looptime_autodetect;
+  filter->sample_period_us = sample_period_us;
 
   const float rc = 1 / (2 * ORDER3_CORRECTION * M_PI_F * hz);
-  const float sample_period = state.looptime_autodetect * 1e-6f;
+  const float sample_period = sample_period_us * 1e-6f;
 
   filter->alpha = sample_period / (rc + sample_period);
 }
@@ -115,6 +116,142 @@ float filter_lp_pt3_step(filter_lp_pt3 *filter, filter_state_t *state, float in)
   return state->delay_element[0];
 }
 
+// limits a biquad center frequency to just below nyquist so the coefficients stay stable
+static float filter_biquad_limit_hz(float hz, float sample_period) {
+  const float nyquist_limit = 0.45f / sample_period;
+  if (hz > nyquist_limit) {
+    return nyquist_limit;
+  }
+  if (hz < 1.0f) {
+    return 1.0f;
+  }
+  return hz;
+}
+
+static bool filter_biquad_needs_update(filter_biquad *filter, float hz, float q, uint32_t sample_period_us) {
+  if (filter->hz == hz && filter->q == q && filter->sample_period_us == sample_period_us) {
+    return false;
+  }
+  filter->hz = hz;
+  filter->q = q;
+  filter->sample_period_us = sample_period_us;
+  return true;
+}
+
+void filter_lp_biquad_init(filter_biquad *filter, filter_state_t *state, uint8_t count, float hz, float q, uint32_t sample_period_us) {
+  filter_lp_biquad_coeff(filter, hz, q, sample_period_us);
+  filter_init_state(state, count);
+}
+
+// rbj cookbook lowpass, normalized to a0
+void filter_lp_biquad_coeff(filter_biquad *filter, float hz, float q, uint32_t sample_period_us) {
+  if (!filter_biquad_needs_update(filter, hz, q, sample_period_us)) {
+    return;
+  }
+  if (q <= 0.0f) {
+    q = FILTER_BIQUAD_Q_DEFAULT;
+  }
+
+  const float sample_period = sample_period_us * 1e-6f;
+  const float omega = 2.0f * M_PI_F * filter_biquad_limit_hz(hz, sample_period) * sample_period;
+  const float sn = sinf(omega);
+  const float cs = cosf(omega);
+  const float alpha = sn / (2.0f * q);
+  const float a0_inv = 1.0f / (1.0f + alpha);
+
+  filter->b1 = (1.0f - cs) * a0_inv;
+  filter->b0 = filter->b1 * 0.5f;
+  filter->b2 = filter->b0;
+  filter->a1 = -2.0f * cs * a0_inv;
+  filter->a2 = (1.0f - alpha) * a0_inv;
+}
+
+void filter_notch_biquad_init(filter_biquad *filter, filter_state_t *state, uint8_t count, float hz, float q, uint32_t sample_period_us) {
+  filter_notch_biquad_coeff(filter, hz, q, sample_period_us);
+  filter_init_state(state, count);
+}
+
+// rbj cookbook notch, normalized to a0. hz is the center frequency
+void filter_notch_biquad_coeff(filter_biquad *filter, float hz, float q, uint32_t sample_period_us) {
+  if (!filter_biquad_needs_update(filter, hz, q, sample_period_us)) {
+    return;
+  }
+  if (q <= 0.0f) {
+    q = FILTER_NOTCH_Q_DEFAULT;
+  }
+
+  const float sample_period = sample_period_us * 1e-6f;
+  const float omega = 2.0f * M_PI_F * filter_biquad_limit_hz(hz, sample_period) * sample_period;
+  const float sn = sinf(omega);
+  const float cs = cosf(omega);
+  const float alpha = sn / (2.0f * q);
+  const float a0_inv = 1.0f / (1.0f + alpha);
+
+  filter->b0 = a0_inv;
+  filter->b1 = -2.0f * cs * a0_inv;
+  filter->b2 = a0_inv;
+  filter->a1 = filter->b1;
+  filter->a2 = (1.0f - alpha) * a0_inv;
+}
+
+// direct form II transposed, delay_element[0..1] hold the two states
+float filter_biquad_step(filter_biquad *filter, filter_state_t *state, float in) {
+  const float out = filter->b0 * in + state->delay_element[0];
+  state->delay_element[0] = filter->b1 * in - filter->a1 * out + state->delay_element[1];
+  state->delay_element[1] = filter->b2 * in - filter->a2 * out;
+  return out;
+}
+
+void filter_rpm_init(filter_rpm_t *filter) {
+  for (uint8_t m = 0; m < FILTER_RPM_MOTORS; m++) {
+    for (uint8_t h = 0; h < FILTER_RPM_HARMONICS; h++) {
+      filter->active[m][h] = 0;
+    }
+  }
+  filter_init_state(&filter->state[0][0][0], 3 * FILTER_RPM_MOTORS * FILTER_RPM_HARMONICS);
+  filter->update_index = 0;
+}
+
+// updates the coefficients of a single notch per call to spread the cost over several loops
+void filter_rpm_coeff(filter_rpm_t *filter, const float *motor_rpm, float min_hz, float q, uint32_t sample_period_us) {
+  const uint8_t motor = filter->update_index / FILTER_RPM_HARMONICS;
+  const uint8_t harmonic = filter->update_index % FILTER_RPM_HARMONICS;
+
+  filter->update_index++;
+  if (filter->update_index >= FILTER_RPM_MOTORS * FILTER_RPM_HARMONICS) {
+    filter->update_index = 0;
+  }
+
+  const float hz = motor_rpm[motor] * (harmonic + 1) * (1.0f / 60.0f);
+  const float nyquist_limit = 0.45f * 1e6f / sample_period_us;
+  if (hz < min_hz || hz > nyquist_limit) {
+    filter->active[motor][harmonic] = 0;
+    return;
+  }
+
+  filter_notch_biquad_coeff(&filter->notch[motor][harmonic], hz, q, sample_period_us);
+
+  if (!filter->active[motor][harmonic]) {
+    // notch was idle, start with a clean history
+    filter_init_state(&filter->state[0][motor][harmonic], 1);
+    filter_init_state(&filter->state[1][motor][harmonic], 1);
+    filter_init_state(&filter->state[2][motor][harmonic], 1);
+    filter->active[motor][harmonic] = 1;
+  }
+}
+
+float filter_rpm_step(filter_rpm_t *filter, uint8_t axis, float in) {
+  for (uint8_t m = 0; m < FILTER_RPM_MOTORS; m++) {
+    for (uint8_t h = 0; h < FILTER_RPM_HARMONICS; h++) {
+      if (!filter->active[m][h]) {
+        continue;
+      }
+      in = filter_biquad_step(&filter->notch[m][h], &filter->state[axis][m][h], in);
+    }
+  }
+  return in;
+}
+
 // 16Hz hpf filter for throttle compensation
 // High pass bessel filter order=1 alpha1=0.016
 void filter_hp_be_init(filter_hp_be *filter) {
@@ -156,16 +293,22 @@ void filter_global_init() {
   filter_lp_sp_init(spfilter, 3);
 }
 
-void filter_init(filter_type_t type, filter_t *filter, filter_state_t *state, uint8_t count, float hz) {
+void filter_init(filter_type_t type, filter_t *filter, filter_state_t *state, uint8_t count, float hz, float q, uint32_t sample_period_us) {
   switch (type) {
   case FILTER_LP_PT1:
-    filter_lp_pt1_init(&filter->lp_pt1, state, count, hz);
+    filter_lp_pt1_init(&filter->lp_pt1, state, count, hz, sample_period_us);
     break;
   case FILTER_LP_PT2:
-    filter_lp_pt2_init(&filter->lp_pt2, state, count, hz);
+    filter_lp_pt2_init(&filter->lp_pt2, state, count, hz, sample_period_us);
     break;
   case FILTER_LP_PT3:
-    filter_lp_pt3_init(&filter->lp_pt3, state, count, hz);
+    filter_lp_pt3_init(&filter->lp_pt3, state, count, hz, sample_period_us);
+    break;
+  case FILTER_LP_BIQUAD:
+    filter_lp_biquad_init(&filter->biquad, state, count, hz, q, sample_period_us);
+    break;
+  case FILTER_NOTCH_BIQUAD:
+    filter_notch_biquad_init(&filter->biquad, state, count, hz, q, sample_period_us);
     break;
   default:
     // no filter, do nothing
@@ -173,16 +316,22 @@ void filter_init(filter_type_t type, filter_t *filter, filter_state_t *state, ui
   }
 }
 
-void filter_coeff(filter_type_t type, filter_t *filter, float hz) {
+void filter_coeff(filter_type_t type, filter_t *filter, float hz, float q, uint32_t sample_period_us) {
   switch (type) {
   case FILTER_LP_PT1:
-    filter_lp_pt1_coeff(&filter->lp_pt1, hz);
+    filter_lp_pt1_coeff(&filter->lp_pt1, hz, sample_period_us);
     break;
   case FILTER_LP_PT2:
-    filter_lp_pt2_coeff(&filter->lp_pt2, hz);
+    filter_lp_pt2_coeff(&filter->lp_pt2, hz, sample_period_us);
     break;
   case FILTER_LP_PT3:
-    filter_lp_pt3_coeff(&filter->lp_pt3, hz);
+    filter_lp_pt3_coeff(&filter->lp_pt3, hz, sample_period_us);
+    break;
+  case FILTER_LP_BIQUAD:
+    filter_lp_biquad_coeff(&filter->biquad, hz, q, sample_period_us);
+    break;
+  case FILTER_NOTCH_BIQUAD:
+    filter_notch_biquad_coeff(&filter->biquad, hz, q, sample_period_us);
     break;
   default:
     // no filter, do nothing
@@ -198,6 +347,9 @@ float filter_step(filter_type_t type, filter_t *filter, filter_state_t *state, f
     return filter_lp_pt2_step(&filter->lp_pt2, state, in);
   case FILTER_LP_PT3:
     return filter_lp_pt3_step(&filter->lp_pt3, state, in);
+  case FILTER_LP_BIQUAD:
+  case FILTER_NOTCH_BIQUAD:
+    return filter_biquad_step(&filter->biquad, state, in);
   default:
     // no filter at all
     return in;
@@ -6,13 +6,25 @@
 
 #define FILTER_MAX_SLOTS 2
 
+#define FILTER_RPM_MOTORS 4
+#define FILTER_RPM_HARMONICS 3
+
 typedef enum {
   FILTER_NONE,
   FILTER_LP_PT1,
   FILTER_LP_PT2,
   FILTER_LP_PT3,
+  FILTER_LP_BIQUAD,
+  FILTER_NOTCH_BIQUAD,
 } filter_type_t;
 
+// a configured q of zero picks the default of the filter type
+#define FILTER_Q_TYPE_DEFAULT 0.0f
+// q of a butterworth response, the lowpass default
+#define FILTER_BIQUAD_Q_DEFAULT 0.70710678f
+// a notch about a third of its center frequency wide
+#define FILTER_NOTCH_Q_DEFAULT 3.0f
+
 typedef struct {
   float delay_element[3];
 } filter_state_t;
@@ -38,12 +50,31 @@ typedef struct {
   float alpha;
 } filter_lp_pt3;
 
+typedef struct {
+  float hz;
+  float q;
+  uint32_t sample_period_us;
+
+  float b0, b1, b2;
+  float a1, a2;
+} filter_biquad;
+
 typedef union {
   filter_lp_pt1 lp_pt1;
   filter_lp_pt2 lp_pt2;
   filter_lp_pt3 lp_pt3;
+  filter_biquad biquad;
 } filter_t;
 
+typedef struct {
+  filter_biquad notch[FILTER_RPM_MOTORS][FILTER_RPM_HARMONICS];
+  filter_state_t state[3][FILTER_RPM_MOTORS][FILTER_RPM_HARMONICS];
+  uint8_t active[FILTER_RPM_MOTORS][FILTER_RPM_HARMONICS];
+
+  // index of the next notch to receive new coefficients
+  uint8_t update_index;
+} filter_rpm_t;
+
 typedef struct {
   float v[2];
 } filter_lp_sp;
@@ -59,26 +90,38 @@ void lpf(float *out, float in, float coeff);
 
 void filter_global_init();
 
-void filter_lp_pt1_init(filter_lp_pt1 *filter, filter_state_t *state, uint8_t count, float hz);
-void filter_lp_pt1_coeff(filter_lp_pt1 *filter, float hz);
+void filter_lp_pt1_init(filter_lp_pt1 *filter, filter_state_t *state, uint8_t count, float hz, uint32_t sample_period_us);
+void filter_lp_pt1_coeff(filter_lp_pt1 *filter, float hz, uint32_t sample_period_us);
 float filter_lp_pt1_step(filter_lp_pt1 *filter, filter_state_t *state, float in);
 
-void filter_lp_pt2_init(filter_lp_pt2 *filter, filter_state_t *state, uint8_t count, float hz);
-void filter_lp_pt2_coeff(filter_lp_pt2 *filter, float hz);
+void filter_lp_pt2_init(filter_lp_pt2 *filter, filter_state_t *state, uint8_t count, float hz, uint32_t sample_period_us);
+void filter_lp_pt2_coeff(filter_lp_pt2 *filter, float hz, uint32_t sample_period_us);
 float filter_lp_pt2_step(filter_lp_pt2 *filter, filter_state_t *state, float in);
 
-void filter_lp_pt3_init(filter_lp_pt3 *filter, filter_state_t *state, uint8_t count, float hz);
-void filter_lp_pt3_coeff(filter_lp_pt3 *filter, float hz);
+void filter_lp_pt3_init(filter_lp_pt3 *filter, filter_state_t *state, uint8_t count, float hz, uint32_t sample_period_us);
+void filter_lp_pt3_coeff(filter_lp_pt3 *filter, float hz, uint32_t sample_period_us);
 float filter_lp_pt3_step(filter_lp_pt3 *filter, filter_state_t *state, float in);
 
+void filter_lp_biquad_init(filter_biquad *filter, filter_state_t *state, uint8_t count, float hz, float q, uint32_t sample_period_us);
+void filter_lp_biquad_coeff(filter_biquad *filter, float hz, float q, uint32_t sample_period_us);
+
+void filter_notch_biquad_init(filter_biquad *filter, filter_state_t *state, uint8_t count, float hz, float q, uint32_t sample_period_us);
+void filter_notch_biquad_coeff(filter_biquad *filter, float hz, float q, uint32_t sample_period_us);
+
+float filter_biquad_step(filter_biquad *filter, filter_state_t *state, float in);
+
+void filter_rpm_init(filter_rpm_t *filter);
+void filter_rpm_coeff(filter_rpm_t *filter, const float *motor_rpm, float min_hz, float q, uint32_t sample_period_us);
+float filter_rpm_step(filter_rpm_t *filter, uint8_t axis, float in);
+
 void filter_lp_sp_init(filter_lp_sp *filter, uint8_t count);
 float filter_lp_sp_step(filter_lp_sp *filter, float x);
 
 void filter_hp_be_init(filter_hp_be *filter);
 float filter_hp_be_step(filter_hp_be *filter, float x);
 
-void filter_init(filter_type_t type, filter_t *filter, filter_state_t *state, uint8_t count, float hz);
-void filter_coeff(filter_type_t type, filter_t *filter, float hz);
+void filter_init(filter_type_t type, filter_t *filter, filter_state_t *state, uint8_t count, float hz, float q, uint32_t sample_period_us);
+void filter_coeff(filter_type_t type, filter_t *filter, float hz, float q, uint32_t sample_period_us);
 float filter_step(filter_type_t type, filter_t *filter, filter_state_t *state, float in);
 
 float throttlehpf(float in);
\ No newline at end of file
@@ -48,8 +48,8 @@ void imu_init() {
   }
 
 #ifdef QUICKSILVER_IMU
-  filter_lp_pt1_init(&filter, filter_pass1, 3, PT1_FILTER_HZ);
-  filter_lp_pt1_init(&filter, filter_pass2, 3, PT1_FILTER_HZ);
+  filter_lp_pt1_init(&filter, filter_pass1, 3, PT1_FILTER_HZ, state.looptime_autodetect);
+  filter_lp_pt1_init(&filter, filter_pass2, 3, PT1_FILTER_HZ, state.looptime_autodetect);
 #endif
 }
 
@@ -142,7 +142,7 @@ void imu_calc() {
   state.GEstG.axis[0] = state.GEstG.axis[0] - (gyro_delta_angle[2]) * state.GEstG.axis[1];
   state.GEstG.axis[1] = (gyro_delta_angle[2]) * state.GEstG.axis[0] + state.GEstG.axis[1];
 
-  filter_lp_pt1_coeff(&filter, PT1_FILTER_HZ);
+  filter_lp_pt1_coeff(&filter, PT1_FILTER_HZ, state.looptime_autodetect);
 
   state.accel.axis[0] = filter_lp_pt1_step(&filter, &filter_pass1[0], state.accel_raw.axis[0]);
   state.accel.axis[1] = filter_lp_pt1_step(&filter, &filter_pass1[1], state.accel_raw.axis[1]);
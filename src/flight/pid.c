@@ -83,15 +83,15 @@ static filter_lp_pt1 rx_filter;
 static filter_state_t rx_filter_state[3];
 
 void pid_init() {
-  filter_lp_pt1_init(&rx_filter, rx_filter_state, 3, rx_smoothing_hz());
+  filter_lp_pt1_init(&rx_filter, rx_filter_state, 3, rx_smoothing_hz(), state.pid_looptime_autodetect);
 
   for (uint8_t i = 0; i < FILTER_MAX_SLOTS; i++) {
-    filter_init(profile.filter.dterm[i].type, &filter[i], filter_state[i], 3, profile.filter.dterm[i].cutoff_freq);
+    filter_init(profile.filter.dterm[i].type, &filter[i], filter_state[i], 3, profile.filter.dterm[i].cutoff_freq, profile.filter.dterm[i].q, state.pid_looptime_autodetect);
   }
 
   if (profile.filter.dterm_dynamic_enable) {
     // zero out filter, freq will be updated later on
-    filter_lp_pt1_init(&dynamic_filter, dynamic_filter_state, 3, DYNAMIC_FREQ_MAX);
+    filter_lp_pt1_init(&dynamic_filter, dynamic_filter_state, 3, DYNAMIC_FREQ_MAX, state.pid_looptime_autodetect);
   }
 }
 
@@ -99,11 +99,11 @@ void pid_init() {
 // 0.0032f is there for legacy purposes, should be 0.001f = looptime
 // this is called in advance as an optimization because it has division
 void pid_precalc() {
-  timefactor = 0.0032f / state.looptime;
+  timefactor = 0.0032f / state.pid_looptime;
 
-  filter_lp_pt1_coeff(&rx_filter, rx_smoothing_hz());
-  filter_coeff(profile.filter.dterm[0].type, &filter[0], profile.filter.dterm[0].cutoff_freq);
-  filter_coeff(profile.filter.dterm[1].type, &filter[1], profile.filter.dterm[1].cutoff_freq);
+  filter_lp_pt1_coeff(&rx_filter, rx_smoothing_hz(), state.pid_looptime_autodetect);
+  filter_coeff(profile.filter.dterm[0].type, &filter[0], profile.filter.dterm[0].cutoff_freq, profile.filter.dterm[0].q, state.pid_looptime_autodetect);
+  filter_coeff(profile.filter.dterm[1].type, &filter[1], profile.filter.dterm[1].cutoff_freq, profile.filter.dterm[1].q, state.pid_looptime_autodetect);
 
   if (profile.voltage.pid_voltage_compensation) {
     v_compensation = mapf((state.vbat_filtered_decay / (float)state.lipo_cell_count), 2.5f, 3.85f, PID_VC_FACTOR, 1.0f);
@@ -127,7 +127,7 @@ void pid_precalc() {
     float d_term_dynamic_freq = mapf(dynamic_throttle, 0.0f, 1.0f, profile.filter.dterm_dynamic_min, profile.filter.dterm_dynamic_max);
     d_term_dynamic_freq = constrainf(d_term_dynamic_freq, profile.filter.dterm_dynamic_min, profile.filter.dterm_dynamic_max);
 
-    filter_lp_pt1_coeff(&dynamic_filter, d_term_dynamic_freq);
+    filter_lp_pt1_coeff(&dynamic_filter, d_term_dynamic_freq, state.pid_looptime_autodetect);
   }
 
   for (uint8_t i = 0; i < PID_SIZE; i++) {
@@ -149,13 +149,13 @@ static float pid_compute_iterm_windup(uint8_t x, float pid_output) {
 #ifdef ITERM_RELAX //  Roll - Pitch  Setpoint based I term relax method
   static float avg_setpoint[3] = {0, 0, 0};
   if (x < 2) {
-    lpf(&avg_setpoint[x], state.setpoint.axis[x], FILTERCALC(state.looptime, 1.0f / (float)RELAX_FREQUENCY_HZ)); // 11 Hz filter
+    lpf(&avg_setpoint[x], state.setpoint.axis[x], FILTERCALC(state.pid_looptime, 1.0f / (float)RELAX_FREQUENCY_HZ)); // 11 Hz filter
     const float hpfSetpoint = fabsf(state.setpoint.axis[x] - avg_setpoint[x]);
     return max(1.0f - hpfSetpoint / RELAX_FACTOR, 0.0f);
   }
 #ifdef ITERM_RELAX_YAW
   else {                                                                                                             // axis is yaw
-    lpf(&avg_setpoint[x], state.setpoint.axis[x], FILTERCALC(state.looptime, 1.0f / (float)RELAX_FREQUENCY_HZ_YAW)); // 25 Hz filter
+    lpf(&avg_setpoint[x], state.setpoint.axis[x], FILTERCALC(state.pid_looptime, 1.0f / (float)RELAX_FREQUENCY_HZ_YAW)); // 25 Hz filter
     const float hpfSetpoint = fabsf(state.setpoint.axis[x] - avg_setpoint[x]);
     return max(1.0f - hpfSetpoint / RELAX_FACTOR_YAW, 0.0f);
   }
@@ -211,7 +211,7 @@ static void pid(uint8_t x) {
   // SIMPSON_RULE_INTEGRAL
   // assuming similar time intervals
   const float iterm_windup = pid_compute_iterm_windup(x, pid_output.axis[x]);
-  ierror[x] = ierror[x] + 0.166666f * (lasterror2[x] + 4 * lasterror[x] + state.error.axis[x]) * current_ki[x] * iterm_windup * state.looptime;
+  ierror[x] = ierror[x] + 0.166666f * (lasterror2[x] + 4 * lasterror[x] + state.error.axis[x]) * current_ki[x] * iterm_windup * state.pid_looptime;
   lasterror2[x] = lasterror[x];
   lasterror[x] = state.error.axis[x];
   limitf(&ierror[x], integrallimit[x]);
@@ -252,16 +252,16 @@ void pid_calc() {
   // rotates errors, originally by joelucid
 
   // rotation around x axis:
-  ierror[1] -= ierror[2] * state.gyro.axis[0] * state.looptime;
-  ierror[2] += ierror[1] * state.gyro.axis[0] * state.looptime;
+  ierror[1] -= ierror[2] * state.gyro.axis[0] * state.pid_looptime;
+  ierror[2] += ierror[1] * state.gyro.axis[0] * state.pid_looptime;
 
   // rotation around y axis:
-  ierror[2] -= ierror[0] * state.gyro.axis[1] * state.looptime;
-  ierror[0] += ierror[2] * state.gyro.axis[1] * state.looptime;
+  ierror[2] -= ierror[0] * state.gyro.axis[1] * state.pid_looptime;
+  ierror[0] += ierror[2] * state.gyro.axis[1] * state.pid_looptime;
 
   // rotation around z axis:
-  ierror[0] -= ierror[1] * state.gyro.axis[2] * state.looptime;
-  ierror[1] += ierror[0] * state.gyro.axis[2] * state.looptime;
+  ierror[0] -= ierror[1] * state.gyro.axis[2] * state.pid_looptime;
+  ierror[1] += ierror[0] * state.gyro.axis[2] * state.pid_looptime;
 
   pid(0);
   pid(1);
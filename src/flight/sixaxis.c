@@ -10,8 +10,10 @@
 #include "drv_time.h"
 #include "flash.h"
 #include "flight/control.h"
+#include "flight/dyn_notch.h"
 #include "flight/filter.h"
 #include "flight/sixaxis.h"
+#include "io/blackbox.h"
 #include "io/led.h"
 #include "profile.h"
 #include "project.h"
@@ -29,6 +31,8 @@
 static filter_t filter[FILTER_MAX_SLOTS];
 static filter_state_t filter_state[FILTER_MAX_SLOTS][3];
 
+static filter_rpm_t rpm_filter;
+
 extern profile_t profile;
 extern target_info_t target_info;
 
@@ -39,19 +43,26 @@ bool sixaxis_init() {
 
   target_info.gyro_id = id;
 
+  state.gyro_sample_period = gyro_spi_sample_period(state.looptime_autodetect);
+
   for (uint8_t i = 0; i < FILTER_MAX_SLOTS; i++) {
-    filter_init(profile.filter.gyro[i].type, &filter[i], filter_state[i], 3, profile.filter.gyro[i].cutoff_freq);
+    filter_init(profile.filter.gyro[i].type, &filter[i], filter_state[i], 3, profile.filter.gyro[i].cutoff_freq, profile.filter.gyro[i].q, state.gyro_sample_period);
+  }
+
+  if (profile.filter.gyro_rpm_filter_enable) {
+    filter_rpm_init(&rpm_filter);
+  }
+
+  if (profile.filter.gyro_dynamic_notch_enable) {
+    dyn_notch_init();
   }
 
   return id != GYRO_TYPE_INVALID;
 }
 
-void sixaxis_read() {
-  const gyro_data_t data = gyro_spi_read();
-
-  state.accel_raw = data.accel;
-  state.gyro_temp = data.temp;
-  state.gyro_raw = data.gyro;
+static void sixaxis_accel_sample(const gyro_data_t *data) {
+  state.accel_raw = data->accel;
+  state.gyro_temp = data->temp;
 
   if (profile.motor.gyro_orientation & GYRO_ROTATE_90_CW) {
     float temp = state.accel_raw.axis[1];
@@ -91,6 +102,10 @@ void sixaxis_read() {
   state.accel_raw.axis[0] = (state.accel_raw.axis[0] - flash_storage.accelcal[0]) * (1 / 2048.0f);
   state.accel_raw.axis[1] = (state.accel_raw.axis[1] - flash_storage.accelcal[1]) * (1 / 2048.0f);
   state.accel_raw.axis[2] = (state.accel_raw.axis[2] - flash_storage.accelcal[2]) * (1 / 2048.0f);
+}
+
+static void sixaxis_gyro_sample(const vec3_t *gyro) {
+  state.gyro_raw = *gyro;
 
   state.gyro_raw.axis[0] = state.gyro_raw.axis[0] - gyrocal[0];
   state.gyro_raw.axis[1] = state.gyro_raw.axis[1] - gyrocal[1];
@@ -134,15 +149,70 @@ void sixaxis_read() {
   state.gyro_raw.axis[1] = -state.gyro_raw.axis[1] * GYRO_RANGE * DEGTORAD;
   state.gyro_raw.axis[2] = -state.gyro_raw.axis[2] * GYRO_RANGE * DEGTORAD;
 
-  filter_coeff(profile.filter.gyro[0].type, &filter[0], profile.filter.gyro[0].cutoff_freq);
-  filter_coeff(profile.filter.gyro[1].type, &filter[1], profile.filter.gyro[1].cutoff_freq);
+  if (profile.filter.gyro_dynamic_notch_enable) {
+    dyn_notch_sample(&state.gyro_raw);
+  }
 
+  perf_counter_start(PERF_COUNTER_FILTER_LP);
   for (int i = 0; i < 3; i++) {
     state.gyro.axis[i] = state.gyro_raw.axis[i];
 
     state.gyro.axis[i] = filter_step(profile.filter.gyro[0].type, &filter[0], &filter_state[0][i], state.gyro.axis[i]);
     state.gyro.axis[i] = filter_step(profile.filter.gyro[1].type, &filter[1], &filter_state[1][i], state.gyro.axis[i]);
   }
+  perf_counter_end(PERF_COUNTER_FILTER_LP);
+
+  if (profile.filter.gyro_rpm_filter_enable) {
+    perf_counter_start(PERF_COUNTER_FILTER_RPM);
+    for (int i = 0; i < 3; i++) {
+      state.gyro.axis[i] = filter_rpm_step(&rpm_filter, i, state.gyro.axis[i]);
+    }
+    perf_counter_end(PERF_COUNTER_FILTER_RPM);
+  }
+
+  if (profile.filter.gyro_dynamic_notch_enable) {
+    perf_counter_start(PERF_COUNTER_FILTER_DYN_NOTCH);
+    for (int i = 0; i < 3; i++) {
+      state.gyro.axis[i] = dyn_notch_step(i, state.gyro.axis[i]);
+    }
+    perf_counter_end(PERF_COUNTER_FILTER_DYN_NOTCH);
+  }
+}
+
+void sixaxis_read() {
+  gyro_data_t samples[GYRO_FIFO_MAX_SAMPLES];
+  const uint32_t count = gyro_spi_read_samples(samples, state.looptime_autodetect);
+
+  state.gyro_sample_count = count;
+  state.gyro_sample_period = gyro_spi_sample_period(state.looptime_autodetect);
+
+  if (count == 0) {
+    // no new data, keep the last filtered sample
+    return;
+  }
+
+  sixaxis_accel_sample(&samples[count - 1]);
+
+  filter_coeff(profile.filter.gyro[0].type, &filter[0], profile.filter.gyro[0].cutoff_freq, profile.filter.gyro[0].q, state.gyro_sample_period);
+  filter_coeff(profile.filter.gyro[1].type, &filter[1], profile.filter.gyro[1].cutoff_freq, profile.filter.gyro[1].q, state.gyro_sample_period);
+
+  if (profile.filter.gyro_rpm_filter_enable) {
+    filter_rpm_coeff(&rpm_filter, state.motor_rpm.axis, profile.filter.gyro_rpm_filter_min, profile.filter.gyro_rpm_filter_q, state.gyro_sample_period);
+  }
+
+  // oldest sample first so the filters see the samples in order
+  for (uint32_t i = 0; i < count; i++) {
+    sixaxis_gyro_sample(&samples[i].gyro);
+#ifdef ENABLE_BLACKBOX
+    blackbox_capture_sample(&state.gyro_raw, &state.gyro, i == count - 1);
+#endif
+  }
+
+  if (profile.filter.gyro_dynamic_notch_enable) {
+    perf_counter_start(PERF_COUNTER_DYN_NOTCH);
+    dyn_notch_update();
+    perf_counter_end(PERF_COUNTER_DYN_NOTCH);
+  }
 }
 
 void sixaxis_gyro_cal() {
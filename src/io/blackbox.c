@@ -1,54 +1,374 @@
 #include "io/blackbox.h"
 
+#include <stddef.h>
+#include <string.h>
+
+#include "debug.h"
 #include "drv_time.h"
 #include "flight/control.h"
+#include "io/blackbox_compress.h"
 #include "io/data_flash.h"
 #include "io/usb_configurator.h"
 #include "util/cbor_helper.h"
+#include "util/ring_buffer.h"
 #include "util/util.h"
 
 #ifdef ENABLE_BLACKBOX
 
-static uint32_t blackbox_rate = 4;
+// frames from before logging starts, kept in the flash write buffer while no file is open.
+// the buffer only holds runs that start with an intra frame, when it is full or the runs get
+// too old the oldest one is dropped and the rest still decodes.
+#define PRE_TRIGGER_RUNS_MAX 64
+// left free for the header that goes in front of the frames and the first frames after it
+#define PRE_TRIGGER_HEADROOM (2 * BLACKBOX_HEADER_MAX)
+// the field table alone is well over 512 bytes
+#define BLACKBOX_HEADER_MAX 1024
+
+static uint32_t blackbox_rate = BLACKBOX_RATE_DIVIDER;
 static blackbox_t blackbox;
+static blackbox_codec_t blackbox_codec;
 
 static uint8_t blackbox_enabled = 0;
+// the settings the codec was set up with
+static profile_blackbox_t blackbox_profile;
+
+typedef struct {
+  uint32_t pos;
+  uint32_t time;
+} pre_trigger_run_t;
+
+static pre_trigger_run_t pre_trigger_runs[PRE_TRIGGER_RUNS_MAX];
+static uint32_t pre_trigger_run_first = 0;
+static uint32_t pre_trigger_run_count = 0;
+
+// picked when logging starts, a file is either compressed as a whole or not at all
+static bool compress_enabled = false;
+static blackbox_compressor_t compressor;
+
+// gyro capture, the full sensor range in int16
+#define CAPTURE_DPS_PER_UNIT (4000.0f / 65536.0f)
+
+typedef enum {
+  CAPTURE_IDLE,
+  CAPTURE_STARTING, // the flash gets the file ready, samples would only pile up in the buffer
+  CAPTURE_RUNNING,
+  CAPTURE_FULL, // a sample did not fit, the capture ends with the last one that did
+  CAPTURE_DONE, // the switch has to go off before the next capture
+} capture_state_t;
+
+static capture_state_t capture_state = CAPTURE_IDLE;
+static uint32_t capture_start_us = 0;
+static uint32_t capture_length_us = 0;
+static uint8_t capture_rate = BLACKBOX_CAPTURE_RATE_SAMPLE;
+static uint8_t capture_channels = 0;
+
+#define MEMBER(member, pred) {.name = #member, .size = 1, .scale = 1, .predictor = pred, .divider = 1},
+#define VEC_MEMBER(member, _size, pred) {.name = #member, .size = _size, .scale = BLACKBOX_SCALE, .predictor = pred, .divider = 1},
+#define ARRAY_MEMBER(member, _size, pred) {.name = #member, .size = _size, .scale = 1, .predictor = pred, .divider = 1},
+
+static const blackbox_field_def_t blackbox_field_defs[BLACKBOX_FIELD_MAX] = {BLACKBOX_FIELDS};
+
+#undef MEMBER
+#undef VEC_MEMBER
+#undef ARRAY_MEMBER
+
+// the fields selected in the profile, in the order they are written
+blackbox_field_def_t blackbox_fields[BLACKBOX_FIELD_MAX];
+uint32_t blackbox_field_count = 0;
+static uint32_t blackbox_field_flags = 0;
+
+#define MEMBER CBOR_ENCODE_MEMBER
+#define STR_MEMBER CBOR_ENCODE_STR_MEMBER
+
+CBOR_START_STRUCT_ENCODER(blackbox_field_def_t)
+BLACKBOX_FIELD_DEF_MEMBERS
+CBOR_END_STRUCT_ENCODER()
+
+#undef MEMBER
+#undef STR_MEMBER
+
+cbor_result_t cbor_encode_blackbox_header(cbor_value_t *enc, uint32_t looptime, uint32_t rate, uint8_t compression) {
+  CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_map_indefinite(enc));
+
+  const uint32_t version = BLACKBOX_FORMAT_VERSION;
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "version"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &version));
+
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "looptime"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &looptime));
+
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "blackbox_rate"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &rate));
+
+  const uint32_t intra_interval = BLACKBOX_INTRA_INTERVAL;
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "intra_interval"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &intra_interval));
+
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "compression"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint8(enc, &compression));
+
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "fields"));
+  CBOR_CHECK_ERROR(res = cbor_encode_array(enc, blackbox_field_count));
+  for (uint32_t i = 0; i < blackbox_field_count; i++) {
+    CBOR_CHECK_ERROR(res = cbor_encode_blackbox_field_def_t(enc, &blackbox_fields[i]));
+  }
+
+  CBOR_CHECK_ERROR(res = cbor_encode_end_indefinite(enc));
+
+  return res;
+}
+
+static void blackbox_fields_update() {
+  blackbox_profile = profile.blackbox;
+  blackbox_rate = max(profile.blackbox.rate_divider, 1);
+
+  blackbox_field_flags = profile.blackbox.field_flags | (1 << BLACKBOX_FIELD_LOOP);
+  blackbox_field_count = 0;
+
+  for (uint32_t i = 0; i < BLACKBOX_FIELD_MAX; i++) {
+    if (!(blackbox_field_flags & (1 << i))) {
+      continue;
+    }
+
+    blackbox_fields[blackbox_field_count] = blackbox_field_defs[i];
+    blackbox_fields[blackbox_field_count].divider = max(profile.blackbox.field_divider[i], 1);
+    blackbox_field_count++;
+  }
+
+  blackbox_codec_init(&blackbox_codec, blackbox_fields, blackbox_field_count);
+}
+
+uint32_t blackbox_values(const blackbox_t *b, int32_t *values) {
+  uint32_t count = 0;
+  uint32_t field = 0;
+
+#define MEMBER(member, pred)                   \
+  if (blackbox_field_flags & (1 << field++)) { \
+    values[count++] = b->member;               \
+  }
+#define VEC_MEMBER(member, size, pred)         \
+  if (blackbox_field_flags & (1 << field++)) { \
+    for (uint32_t i = 0; i < size; i++) {      \
+      values[count++] = b->member.axis[i];     \
+    }                                          \
+  }
+#define ARRAY_MEMBER(member, size, pred)       \
+  if (blackbox_field_flags & (1 << field++)) { \
+    for (uint32_t i = 0; i < size; i++) {      \
+      values[count++] = b->member[i];          \
+    }                                          \
+  }
+
+  BLACKBOX_FIELDS
+
+#undef MEMBER
+#undef VEC_MEMBER
+#undef ARRAY_MEMBER
+
+  return count;
+}
+
+// hands the current block to the flash, false if there is no room for it yet
+static bool compress_flush() {
+  const uint8_t *block = NULL;
+  const uint32_t size = blackbox_compress_block(&compressor, &block);
+  if (size > 0 && !data_flash_write_backbox(block, size)) {
+    // the block stays closed until it fits
+    return false;
+  }
+
+  perf_counter_bytes(PERF_COUNTER_BLACKBOX_COMPRESS, compressor.in_size, size);
+  blackbox_compress_init(&compressor);
+  return true;
+}
+
+// takes all of the data or none of it, so a dropped frame never leaves half of itself behind
+static bool blackbox_flash_write(const uint8_t *data, const uint32_t size) {
+  if (!compress_enabled) {
+    return data_flash_write_backbox(data, size);
+  }
+
+  perf_counter_start(PERF_COUNTER_BLACKBOX_COMPRESS);
+
+  bool written = false;
+  if (size <= blackbox_compress_space(&compressor) || compress_flush()) {
+    blackbox_compress(&compressor, data, size);
+    written = true;
+  }
+
+  perf_counter_end(PERF_COUNTER_BLACKBOX_COMPRESS);
+  return written;
+}
+
+static void blackbox_write_header() {
+  static uint8_t buffer[BLACKBOX_HEADER_MAX];
+
+  cbor_value_t enc;
+  cbor_encoder_init(&enc, buffer, sizeof(buffer));
+
+  if (cbor_encode_blackbox_header(&enc, state.looptime_autodetect, blackbox_rate, compress_enabled) < CBOR_OK) {
+    return;
+  }
+  // always as is, the card scan reads looptime and rate straight from the first sector.
+  // the frames from before logging started are already waiting in the flash buffer
+  data_flash_write_backbox_front(buffer, cbor_encoder_len(&enc));
+}
+
+// only records with a flash or card to log to and a switch that can start logging
+static ring_buffer_t *pre_trigger_buffer() {
+  if (profile.blackbox.pre_trigger_ms == 0 || profile.blackbox.capture != BLACKBOX_CAPTURE_OFF || profile.receiver.aux[AUX_BLACKBOX] == AUX_CHANNEL_OFF) {
+    return NULL;
+  }
+  return data_flash_pre_trigger_buffer();
+}
+
+static void pre_trigger_clear() {
+  ring_buffer_t *buffer = data_flash_pre_trigger_buffer();
+  if (buffer != NULL) {
+    ring_buffer_clear(buffer);
+  }
+  pre_trigger_run_first = 0;
+  pre_trigger_run_count = 0;
+
+  // the first frame of a run has to be intra
+  blackbox_codec_reset(&blackbox_codec);
+}
+
+static void pre_trigger_drop_run(ring_buffer_t *buffer) {
+  pre_trigger_run_first = (pre_trigger_run_first + 1) % PRE_TRIGGER_RUNS_MAX;
+  pre_trigger_run_count--;
+
+  const uint32_t pos = pre_trigger_run_count ? pre_trigger_runs[pre_trigger_run_first].pos : buffer->head;
+  ring_buffer_skip(buffer, (pos + buffer->size - buffer->tail) % buffer->size);
+}
+
+static void pre_trigger_record(ring_buffer_t *buffer, const uint8_t *frame, const uint32_t size) {
+  if (frame[0] == BLACKBOX_FRAME_INTRA) {
+    if (pre_trigger_run_count == 0) {
+      // anything left over does not belong to a run
+      ring_buffer_clear(buffer);
+    }
+    if (pre_trigger_run_count == PRE_TRIGGER_RUNS_MAX) {
+      pre_trigger_drop_run(buffer);
+    }
 
-cbor_result_t cbor_encode_blackbox_t(cbor_value_t *enc, const blackbox_t *b) {
-  CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_array_indefinite(enc));
+    pre_trigger_run_t *run = &pre_trigger_runs[(pre_trigger_run_first + pre_trigger_run_count) % PRE_TRIGGER_RUNS_MAX];
+    run->pos = buffer->head;
+    run->time = blackbox.time;
+    pre_trigger_run_count++;
+  } else if (pre_trigger_run_count == 0) {
+    return;
+  }
+
+  // the oldest run goes once the one after it alone covers the time
+  const uint32_t keep_us = profile.blackbox.pre_trigger_ms * 1000;
+  while (pre_trigger_run_count > 1 && (blackbox.time - pre_trigger_runs[(pre_trigger_run_first + 1) % PRE_TRIGGER_RUNS_MAX].time) >= keep_us) {
+    pre_trigger_drop_run(buffer);
+  }
+  while (pre_trigger_run_count > 1 && ring_buffer_free(buffer) <= size + PRE_TRIGGER_HEADROOM) {
+    pre_trigger_drop_run(buffer);
+  }
+  if (ring_buffer_free(buffer) <= size + PRE_TRIGGER_HEADROOM) {
+    // a single run does not fit, start over
+    pre_trigger_clear();
+    return;
+  }
+
+  ring_buffer_write_multi(buffer, frame, size);
+}
+
+static void blackbox_write_frame() {
+  int32_t values[BLACKBOX_VALUES_MAX];
+  blackbox_values(&blackbox, values);
+
+  static uint8_t buffer[BLACKBOX_FRAME_MAX];
+  const uint32_t size = blackbox_encode_frame(&blackbox_codec, values, buffer);
+
+  if (blackbox_enabled == 0) {
+    pre_trigger_record(pre_trigger_buffer(), buffer, size);
+    return;
+  }
 
-  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &b->loop));
-  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &b->time));
+  if (!blackbox_flash_write(buffer, size)) {
+    // the frame is lost, the next one has to stand on its own
+    blackbox_codec_reset(&blackbox_codec);
+  }
+}
 
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->pid_p_term));
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->pid_i_term));
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->pid_d_term));
+static cbor_result_t cbor_encode_capture_header(cbor_value_t *enc, uint32_t looptime, uint32_t sample_period) {
+  CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_map_indefinite(enc));
 
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec4_t(enc, &b->rx));
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec4_t(enc, &b->setpoint));
+  const uint32_t version = BLACKBOX_CAPTURE_VERSION;
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "capture"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &version));
 
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->accel_raw));
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->accel_filter));
+  // same names as a blackbox header, the card scan picks them up the same way
+  const uint32_t rate = 1;
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "looptime"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &looptime));
 
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->gyro_raw));
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec3_t(enc, &b->gyro_filter));
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "blackbox_rate"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &rate));
 
-  CBOR_CHECK_ERROR(res = cbor_encode_compact_vec4_t(enc, &b->motor));
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "sample_period"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &sample_period));
 
-  CBOR_CHECK_ERROR(res = cbor_encode_uint16(enc, &b->cpu_load));
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "channels"));
+  CBOR_CHECK_ERROR(res = cbor_encode_uint8(enc, &capture_channels));
 
-  CBOR_CHECK_ERROR(res = cbor_encode_array(enc, 4));
-  CBOR_CHECK_ERROR(res = cbor_encode_int16(enc, &b->debug[0]));
-  CBOR_CHECK_ERROR(res = cbor_encode_int16(enc, &b->debug[1]));
-  CBOR_CHECK_ERROR(res = cbor_encode_int16(enc, &b->debug[2]));
-  CBOR_CHECK_ERROR(res = cbor_encode_int16(enc, &b->debug[3]));
+  const float scale = CAPTURE_DPS_PER_UNIT;
+  CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "scale"));
+  CBOR_CHECK_ERROR(res = cbor_encode_float(enc, &scale));
 
   CBOR_CHECK_ERROR(res = cbor_encode_end_indefinite(enc));
 
   return res;
 }
 
+static void capture_start() {
+  capture_rate = profile.blackbox.capture_rate;
+  capture_channels = profile.blackbox.capture == BLACKBOX_CAPTURE_GYRO_FILTERED ? BLACKBOX_CAPTURE_CHANNELS_MAX : BLACKBOX_CAPTURE_AXES;
+  capture_length_us = profile.blackbox.capture_ms * 1000;
+
+  const uint32_t sample_period = capture_rate == BLACKBOX_CAPTURE_RATE_LOOP ? state.looptime_autodetect : state.gyro_sample_period;
+
+  uint8_t buffer[128];
+  cbor_value_t enc;
+  cbor_encoder_init(&enc, buffer, sizeof(buffer));
+  if (cbor_encode_capture_header(&enc, state.looptime_autodetect, sample_period) < CBOR_OK) {
+    capture_state = CAPTURE_FULL;
+    return;
+  }
+  data_flash_write_backbox(buffer, cbor_encoder_len(&enc));
+
+  capture_state = CAPTURE_STARTING;
+}
+
+static int16_t capture_value(float val) {
+  return constrain(val * (RADTODEG / CAPTURE_DPS_PER_UNIT), INT16_MIN, INT16_MAX);
+}
+
+void blackbox_capture_sample(const vec3_t *raw, const vec3_t *filtered, bool last) {
+  if (capture_state != CAPTURE_RUNNING) {
+    return;
+  }
+  if (capture_rate == BLACKBOX_CAPTURE_RATE_LOOP && !last) {
+    return;
+  }
+
+  int16_t sample[BLACKBOX_CAPTURE_CHANNELS_MAX];
+  for (uint32_t i = 0; i < BLACKBOX_CAPTURE_AXES; i++) {
+    sample[i] = capture_value(raw->axis[i]);
+    sample[BLACKBOX_CAPTURE_AXES + i] = capture_value(filtered->axis[i]);
+  }
+
+  if (!data_flash_write_backbox((const uint8_t *)sample, capture_channels * sizeof(int16_t))) {
+    capture_state = CAPTURE_FULL;
+  }
+}
+
 void blackbox_init() {
+  blackbox_fields_update();
   data_flash_init();
 }
 
@@ -73,18 +393,67 @@ uint8_t blackbox_update() {
   // flash is either idle or writing, do blackbox
 
   if ((!flags.arm_switch || !rx_aux_on(AUX_BLACKBOX)) && blackbox_enabled == 1) {
+    if (compress_enabled && !compress_flush()) {
+      return 0;
+    }
     data_flash_finish();
+    pre_trigger_clear();
+    capture_state = CAPTURE_IDLE;
     blackbox_enabled = 0;
     return 0;
-  } else if ((flags.arm_switch && flags.turtle_ready == 0 && rx_aux_on(AUX_BLACKBOX)) && blackbox_enabled == 0) {
+  } else if ((flags.arm_switch && flags.turtle_ready == 0 && rx_aux_on(AUX_BLACKBOX)) && blackbox_enabled == 0 && capture_state == CAPTURE_IDLE) {
+    if (profile.blackbox.capture != BLACKBOX_CAPTURE_OFF) {
+      if (data_flash_restart(1, state.looptime_autodetect)) {
+        compress_enabled = false;
+        pre_trigger_clear();
+        capture_start();
+        blackbox_enabled = 1;
+      }
+      return 0;
+    }
+    const bool pre_trigger_kept = pre_trigger_run_count > 0 && memcmp(&blackbox_profile, &profile.blackbox, sizeof(profile_blackbox_t)) == 0;
+    if (!pre_trigger_kept) {
+      // there are no frames that could go ahead of the log
+      blackbox_fields_update();
+      pre_trigger_clear();
+    }
     if (data_flash_restart(blackbox_rate, state.looptime_autodetect)) {
+      // the frames from before are in the flash buffer as they are, a file is compressed as a whole or not at all
+      compress_enabled = blackbox_profile.compression && !pre_trigger_kept;
+      blackbox_compress_init(&compressor);
+      blackbox_write_header();
+      pre_trigger_run_count = 0;
       blackbox_enabled = 1;
     }
     return 0;
   }
 
+  if (capture_state == CAPTURE_DONE && (!flags.arm_switch || !rx_aux_on(AUX_BLACKBOX))) {
+    capture_state = CAPTURE_IDLE;
+  }
+
   if (blackbox_enabled == 0) {
-    return 0;
+    if (pre_trigger_buffer() == NULL) {
+      // the buffer might have been used for something else in the meantime
+      pre_trigger_run_count = 0;
+      return 0;
+    }
+    if (memcmp(&blackbox_profile, &profile.blackbox, sizeof(profile_blackbox_t)) != 0) {
+      // the settings changed, what was recorded so far does not match them
+      blackbox_fields_update();
+      pre_trigger_clear();
+    }
+  } else if (capture_state != CAPTURE_IDLE) {
+    // the samples come straight from the gyro, there are no frames while capturing
+    if (capture_state == CAPTURE_STARTING) {
+      capture_start_us = time_micros();
+      capture_state = CAPTURE_RUNNING;
+    } else if (capture_state == CAPTURE_FULL || (time_micros() - capture_start_us) >= capture_length_us) {
+      data_flash_finish();
+      capture_state = CAPTURE_DONE;
+      blackbox_enabled = 0;
+    }
+    return flash_result == DATA_FLASH_WRITE;
   }
 
   blackbox.loop = loop_counter / blackbox_rate;
@@ -111,8 +480,8 @@ uint8_t blackbox_update() {
 
   blackbox.cpu_load = state.cpu_load;
 
-  if (blackbox_enabled != 0 && (loop_counter % blackbox_rate) == 0) {
-    data_flash_write_backbox(&blackbox);
+  if ((loop_counter % blackbox_rate) == 0) {
+    blackbox_write_frame();
   }
 
   loop_counter++;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "io/blackbox_format.h"
 #include "profile.h"
 
 #define BLACKBOX_SCALE 1000
@@ -28,8 +29,31 @@ typedef struct {
   int16_t debug[4];
 } blackbox_t;
 
-cbor_result_t cbor_encode_blackbox_t(cbor_value_t *enc, const blackbox_t *b);
+// order in which the fields of blackbox_t are written to a frame, matches blackbox_field_t
+#define BLACKBOX_FIELDS                                  \
+  MEMBER(loop, BLACKBOX_PREDICT_INCREMENT)               \
+  MEMBER(time, BLACKBOX_PREDICT_LINEAR)                  \
+  VEC_MEMBER(pid_p_term, 3, BLACKBOX_PREDICT_PREVIOUS)   \
+  VEC_MEMBER(pid_i_term, 3, BLACKBOX_PREDICT_PREVIOUS)   \
+  VEC_MEMBER(pid_d_term, 3, BLACKBOX_PREDICT_PREVIOUS)   \
+  VEC_MEMBER(rx, 4, BLACKBOX_PREDICT_PREVIOUS)           \
+  VEC_MEMBER(setpoint, 4, BLACKBOX_PREDICT_PREVIOUS)     \
+  VEC_MEMBER(accel_raw, 3, BLACKBOX_PREDICT_PREVIOUS)    \
+  VEC_MEMBER(accel_filter, 3, BLACKBOX_PREDICT_PREVIOUS) \
+  VEC_MEMBER(gyro_raw, 3, BLACKBOX_PREDICT_PREVIOUS)     \
+  VEC_MEMBER(gyro_filter, 3, BLACKBOX_PREDICT_PREVIOUS)  \
+  VEC_MEMBER(motor, 4, BLACKBOX_PREDICT_PREVIOUS)        \
+  MEMBER(cpu_load, BLACKBOX_PREDICT_PREVIOUS)            \
+  ARRAY_MEMBER(debug, 4, BLACKBOX_PREDICT_PREVIOUS)
+
+extern blackbox_field_def_t blackbox_fields[BLACKBOX_FIELD_MAX];
+extern uint32_t blackbox_field_count;
+
+cbor_result_t cbor_encode_blackbox_header(cbor_value_t *enc, uint32_t looptime, uint32_t blackbox_rate, uint8_t compression);
+uint32_t blackbox_values(const blackbox_t *b, int32_t *values);
 
 void blackbox_init();
 void blackbox_set_debug(uint8_t index, int16_t data);
+// every gyro sample, last is set for the newest one of the loop
+void blackbox_capture_sample(const vec3_t *raw, const vec3_t *filtered, bool last);
 uint8_t blackbox_update();
\ No newline at end of file
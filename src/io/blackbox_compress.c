@@ -0,0 +1,249 @@
+#include "io/blackbox_compress.h"
+
+#include <string.h>
+
+#define TOKEN_MAX 15
+#define OFFSET_SIZE 2
+
+static inline uint32_t read_u32(const uint8_t *buf) {
+  return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static inline uint32_t hash_u32(uint32_t val) {
+  return (val * 2654435761U) >> (32 - BLACKBOX_HASH_BITS);
+}
+
+// bytes needed to continue a length past what fits into the token
+static inline uint32_t length_size(uint32_t len) {
+  return len >= TOKEN_MAX ? (len - TOKEN_MAX) / 255 + 1 : 0;
+}
+
+static inline uint8_t *length_write(uint8_t *buf, uint32_t len) {
+  if (len < TOKEN_MAX) {
+    return buf;
+  }
+  len -= TOKEN_MAX;
+  while (len >= 255) {
+    *buf++ = 255;
+    len -= 255;
+  }
+  *buf++ = len;
+  return buf;
+}
+
+// returns the number of bytes read, zero if the buffer ended
+static inline uint32_t length_read(const uint8_t *buf, uint32_t size, uint32_t *len) {
+  if (*len < TOKEN_MAX) {
+    return 0;
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    *len += buf[i];
+    if (buf[i] != 255) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// appends the literals from the anchor up to end and a match of match_len, zero for none
+static bool sequence_write(blackbox_compressor_t *comp, uint32_t end, uint32_t offset, uint32_t match_len) {
+  const uint32_t lit_len = end - comp->anchor;
+  uint32_t size = 1 + length_size(lit_len) + lit_len;
+  if (match_len) {
+    size += OFFSET_SIZE + length_size(match_len - BLACKBOX_MATCH_MIN);
+  }
+  if (comp->out_size + size > BLACKBOX_BLOCK_MAX) {
+    comp->stored = true;
+    return false;
+  }
+
+  uint8_t *buf = comp->out + comp->out_size;
+  uint8_t *token = buf++;
+  *token = (lit_len < TOKEN_MAX ? lit_len : TOKEN_MAX) << 4;
+  buf = length_write(buf, lit_len);
+  memcpy(buf, comp->in + comp->anchor, lit_len);
+  buf += lit_len;
+
+  if (match_len) {
+    const uint32_t len = match_len - BLACKBOX_MATCH_MIN;
+    *token |= len < TOKEN_MAX ? len : TOKEN_MAX;
+    *buf++ = offset & 0xFF;
+    *buf++ = offset >> 8;
+    buf = length_write(buf, len);
+  }
+
+  comp->out_size += size;
+  comp->anchor = end + match_len;
+  return true;
+}
+
+void blackbox_compress_init(blackbox_compressor_t *comp) {
+  comp->in_size = 0;
+  comp->out_size = BLACKBOX_BLOCK_HEADER;
+  comp->pos = 0;
+  comp->anchor = 0;
+  comp->stored = false;
+  comp->closed = false;
+  memset(comp->table, 0, sizeof(comp->table));
+}
+
+uint32_t blackbox_compress_space(const blackbox_compressor_t *comp) {
+  if (comp->closed) {
+    return 0;
+  }
+  return BLACKBOX_BLOCK_SIZE - comp->in_size;
+}
+
+void blackbox_compress(blackbox_compressor_t *comp, const uint8_t *data, uint32_t size) {
+  memcpy(comp->in + comp->in_size, data, size);
+  comp->in_size += size;
+
+  while (!comp->stored && comp->pos + BLACKBOX_MATCH_MIN <= comp->in_size) {
+    const uint32_t pos = comp->pos;
+    const uint32_t val = read_u32(comp->in + pos);
+    const uint32_t h = hash_u32(val);
+    const uint32_t candidate = comp->table[h];
+    comp->table[h] = pos + 1;
+
+    if (candidate == 0 || read_u32(comp->in + candidate - 1) != val) {
+      comp->pos++;
+      continue;
+    }
+
+    const uint32_t match = candidate - 1;
+    uint32_t len = BLACKBOX_MATCH_MIN;
+    while (pos + len < comp->in_size && comp->in[match + len] == comp->in[pos + len]) {
+      len++;
+    }
+    if (!sequence_write(comp, pos, pos - match, len)) {
+      return;
+    }
+    comp->pos = pos + len;
+  }
+}
+
+static void block_header_write(blackbox_compressor_t *comp, uint8_t type, uint32_t data_size) {
+  comp->out[0] = type;
+  comp->out[1] = comp->in_size & 0xFF;
+  comp->out[2] = comp->in_size >> 8;
+  comp->out[3] = data_size & 0xFF;
+  comp->out[4] = data_size >> 8;
+}
+
+uint32_t blackbox_compress_block(blackbox_compressor_t *comp, const uint8_t **block) {
+  if (comp->in_size == 0) {
+    return 0;
+  }
+  if (comp->closed) {
+    *block = comp->out;
+    return comp->out_size;
+  }
+  comp->closed = true;
+
+  if (!comp->stored) {
+    sequence_write(comp, comp->in_size, 0, 0);
+  }
+  if (comp->stored || comp->out_size - BLACKBOX_BLOCK_HEADER >= comp->in_size) {
+    memcpy(comp->out + BLACKBOX_BLOCK_HEADER, comp->in, comp->in_size);
+    comp->out_size = BLACKBOX_BLOCK_HEADER + comp->in_size;
+    block_header_write(comp, BLACKBOX_BLOCK_STORED, comp->in_size);
+  } else {
+    block_header_write(comp, BLACKBOX_BLOCK_LZ, comp->out_size - BLACKBOX_BLOCK_HEADER);
+  }
+
+  *block = comp->out;
+  return comp->out_size;
+}
+
+static int32_t lz_decompress(const uint8_t *data, uint32_t size, uint8_t *out, uint32_t out_max) {
+  uint32_t in_pos = 0;
+  uint32_t out_pos = 0;
+
+  while (in_pos < size) {
+    const uint8_t token = data[in_pos++];
+
+    uint32_t lit_len = token >> 4;
+    if (lit_len == TOKEN_MAX) {
+      const uint32_t read = length_read(data + in_pos, size - in_pos, &lit_len);
+      if (read == 0) {
+        return -1;
+      }
+      in_pos += read;
+    }
+    if (lit_len > size - in_pos || lit_len > out_max - out_pos) {
+      return -1;
+    }
+    memcpy(out + out_pos, data + in_pos, lit_len);
+    in_pos += lit_len;
+    out_pos += lit_len;
+
+    if (in_pos == size) {
+      // the last sequence
+      break;
+    }
+
+    if (size - in_pos < OFFSET_SIZE) {
+      return -1;
+    }
+    const uint32_t offset = data[in_pos] | ((uint32_t)data[in_pos + 1] << 8);
+    in_pos += OFFSET_SIZE;
+
+    uint32_t match_len = token & TOKEN_MAX;
+    if (match_len == TOKEN_MAX) {
+      const uint32_t read = length_read(data + in_pos, size - in_pos, &match_len);
+      if (read == 0) {
+        return -1;
+      }
+      in_pos += read;
+    }
+    match_len += BLACKBOX_MATCH_MIN;
+
+    if (offset == 0 || offset > out_pos || match_len > out_max - out_pos) {
+      return -1;
+    }
+    // byte by byte, the match may overlap what it writes
+    for (uint32_t i = 0; i < match_len; i++) {
+      out[out_pos + i] = out[out_pos - offset + i];
+    }
+    out_pos += match_len;
+  }
+
+  return out_pos;
+}
+
+int32_t blackbox_decompress_block(const uint8_t *data, uint32_t size, uint8_t *out, uint32_t *out_size) {
+  if (size < BLACKBOX_BLOCK_HEADER) {
+    return 0;
+  }
+
+  const uint32_t raw_size = data[1] | ((uint32_t)data[2] << 8);
+  const uint32_t data_size = data[3] | ((uint32_t)data[4] << 8);
+  if (raw_size > BLACKBOX_BLOCK_SIZE || data_size > BLACKBOX_BLOCK_SIZE) {
+    return -1;
+  }
+  if (size < BLACKBOX_BLOCK_HEADER + data_size) {
+    return 0;
+  }
+
+  const uint8_t *block = data + BLACKBOX_BLOCK_HEADER;
+  switch (data[0]) {
+  case BLACKBOX_BLOCK_STORED:
+    if (data_size != raw_size) {
+      return -1;
+    }
+    memcpy(out, block, raw_size);
+    break;
+
+  case BLACKBOX_BLOCK_LZ:
+    if (lz_decompress(block, data_size, out, raw_size) != (int32_t)raw_size) {
+      return -1;
+    }
+    break;
+
+  default:
+    return -1;
+  }
+
+  *out_size = raw_size;
+  return BLACKBOX_BLOCK_HEADER + data_size;
+}
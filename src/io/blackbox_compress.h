@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// block compression for the blackbox stream
+//
+// the header of a file stays as is, if its "compression" key is set the frames after it are
+// cut into blocks of at most BLACKBOX_BLOCK_SIZE bytes. a block is a type byte,
+// the raw and the data size as little endian u16, and the data:
+// - lz blocks hold lz4 style sequences: a token with the literal length in the high and the
+//   match length minus BLACKBOX_MATCH_MIN in the low nibble, longer lengths continue in bytes
+//   of 255, then the literals and the match offset as little endian u16. the last sequence
+//   only has literals.
+// - stored blocks hold the raw bytes, they are used when lz would not make the block smaller.
+// matches never reach back past the start of the block, so every block decodes on its own.
+//
+// the compressor works on the bytes as they come in, a call only looks at the new bytes and
+// the table is reset with every block, so the cost per call is bounded by the size of the call.
+//
+// this file does not depend on anything but the c library so host tools can use it as is.
+
+#define BLACKBOX_BLOCK_LZ 'Z'
+#define BLACKBOX_BLOCK_STORED 'S'
+
+#define BLACKBOX_BLOCK_SIZE 1024
+#define BLACKBOX_BLOCK_HEADER 5
+#define BLACKBOX_BLOCK_MAX (BLACKBOX_BLOCK_HEADER + BLACKBOX_BLOCK_SIZE)
+
+#define BLACKBOX_MATCH_MIN 4
+#define BLACKBOX_HASH_BITS 8
+
+typedef struct {
+  uint8_t in[BLACKBOX_BLOCK_SIZE];
+  uint32_t in_size;
+
+  uint8_t out[BLACKBOX_BLOCK_MAX];
+  uint32_t out_size;
+
+  uint32_t pos;    // next position to look for a match at
+  uint32_t anchor; // first byte not yet in a sequence
+  bool stored;     // lz did not fit, the block goes out as is
+  bool closed;     // nothing more goes in until the next init
+
+  // last position plus one for each hash, zero if there was none in this block
+  uint16_t table[1 << BLACKBOX_HASH_BITS];
+} blackbox_compressor_t;
+
+void blackbox_compress_init(blackbox_compressor_t *comp);
+// bytes that still fit into the current block, zero once it is closed
+uint32_t blackbox_compress_space(const blackbox_compressor_t *comp);
+// size must fit into the current block
+void blackbox_compress(blackbox_compressor_t *comp, const uint8_t *data, uint32_t size);
+// closes the current block and returns its size, zero if it is empty.
+// the block stays valid until the next call to blackbox_compress_init, closing it again returns it as is.
+uint32_t blackbox_compress_block(blackbox_compressor_t *comp, const uint8_t **block);
+
+// returns the size of the block read, zero if the buffer ended and negative if it is corrupt.
+// out has to hold BLACKBOX_BLOCK_SIZE bytes.
+int32_t blackbox_decompress_block(const uint8_t *data, uint32_t size, uint8_t *out, uint32_t *out_size);
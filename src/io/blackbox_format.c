@@ -0,0 +1,187 @@
+#include "io/blackbox_format.h"
+
+#include <string.h>
+
+static inline uint32_t zigzag_encode(int32_t val) {
+  return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t val) {
+  return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+static inline uint8_t *varint_write(uint8_t *buf, uint32_t val) {
+  while (val >= 0x80) {
+    *buf++ = (val & 0x7f) | 0x80;
+    val >>= 7;
+  }
+  *buf++ = val;
+  return buf;
+}
+
+// returns the number of bytes read, zero if the buffer ended and negative if the varint is too long
+static inline int32_t varint_read(const uint8_t *buf, uint32_t size, uint32_t *val) {
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < 5; i++) {
+    if (i >= size) {
+      return 0;
+    }
+    result |= (uint32_t)(buf[i] & 0x7f) << (i * 7);
+    if ((buf[i] & 0x80) == 0) {
+      *val = result;
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+// differences are taken modulo 2^32 so unsigned fields like time wrap cleanly
+static inline uint32_t blackbox_predict(const blackbox_codec_t *codec, uint32_t i) {
+  const uint32_t last = codec->last[i];
+  switch (codec->predictor[i]) {
+  case BLACKBOX_PREDICT_INCREMENT:
+    return last + 1;
+  case BLACKBOX_PREDICT_LINEAR:
+    return 2 * last - (uint32_t)codec->last2[i];
+  case BLACKBOX_PREDICT_PREVIOUS:
+  default:
+    return last;
+  }
+}
+
+static inline bool blackbox_value_logged(const blackbox_codec_t *codec, uint32_t frame, uint32_t i) {
+  return codec->divider[i] <= 1 || (frame % codec->divider[i]) == 0;
+}
+
+static inline void blackbox_value_store(blackbox_codec_t *codec, uint32_t i, int32_t val) {
+  const uint64_t bit = 1ULL << i;
+  // nothing to extrapolate from yet, the first predicted value falls back to the previous one
+  codec->last2[i] = (codec->valid & bit) ? codec->last[i] : val;
+  codec->last[i] = val;
+  codec->valid |= bit;
+}
+
+static inline void blackbox_codec_next(blackbox_codec_t *codec) {
+  codec->frame_count++;
+  if (codec->frame_count >= BLACKBOX_INTRA_INTERVAL) {
+    codec->frame_count = 0;
+  }
+}
+
+void blackbox_codec_init(blackbox_codec_t *codec, const blackbox_field_def_t *fields, uint32_t field_count) {
+  codec->value_count = 0;
+
+  for (uint32_t i = 0; i < field_count; i++) {
+    for (uint32_t j = 0; j < fields[i].size && codec->value_count < BLACKBOX_VALUES_MAX; j++) {
+      codec->predictor[codec->value_count] = fields[i].predictor;
+      codec->divider[codec->value_count] = fields[i].divider;
+      codec->value_count++;
+    }
+  }
+
+  // the frame counter decides which values are in a frame, so it has to be in all of them
+  codec->divider[0] = 1;
+
+  blackbox_codec_reset(codec);
+}
+
+void blackbox_codec_reset(blackbox_codec_t *codec) {
+  memset(codec->last, 0, sizeof(codec->last));
+  memset(codec->last2, 0, sizeof(codec->last2));
+  codec->valid = 0;
+  codec->frame_count = 0;
+}
+
+uint32_t blackbox_encode_frame(blackbox_codec_t *codec, const int32_t *values, uint8_t *buf) {
+  const bool intra = codec->frame_count == 0;
+  if (intra) {
+    codec->valid = 0;
+  }
+
+  uint8_t *ptr = buf;
+  *ptr++ = intra ? BLACKBOX_FRAME_INTRA : BLACKBOX_FRAME_PREDICTED;
+
+  const uint32_t frame = values[0];
+  for (uint32_t i = 0; i < codec->value_count; i++) {
+    if (!blackbox_value_logged(codec, frame, i)) {
+      continue;
+    }
+
+    if (codec->valid & (1ULL << i)) {
+      const int32_t delta = (uint32_t)values[i] - blackbox_predict(codec, i);
+      ptr = varint_write(ptr, zigzag_encode(delta));
+    } else {
+      ptr = varint_write(ptr, zigzag_encode(values[i]));
+    }
+    blackbox_value_store(codec, i, values[i]);
+  }
+
+  blackbox_codec_next(codec);
+
+  return ptr - buf;
+}
+
+int32_t blackbox_decode_frame(blackbox_codec_t *codec, const uint8_t *buf, uint32_t size, int32_t *values) {
+  if (size == 0) {
+    return 0;
+  }
+
+  const uint8_t type = buf[0];
+  if (type != BLACKBOX_FRAME_INTRA && type != BLACKBOX_FRAME_PREDICTED) {
+    return -1;
+  }
+
+  const bool intra = type == BLACKBOX_FRAME_INTRA;
+  if (!intra && codec->frame_count == 0) {
+    // predicted frame without the frames it was predicted from
+    return -1;
+  }
+
+  const uint64_t valid = intra ? 0 : codec->valid;
+
+  // read all varints first, the codec is only touched once the whole frame is there
+  uint32_t frame = 0;
+  uint32_t offset = 1;
+  for (uint32_t i = 0; i < codec->value_count; i++) {
+    if (i > 0 && !blackbox_value_logged(codec, frame, i)) {
+      continue;
+    }
+
+    uint32_t val = 0;
+    if (offset < size && buf[offset] < 0x80) {
+      // most deltas fit a single byte
+      val = buf[offset++];
+    } else {
+      const int32_t len = varint_read(buf + offset, size - offset, &val);
+      if (len <= 0) {
+        return len;
+      }
+      offset += len;
+    }
+    values[i] = zigzag_decode(val);
+
+    if (i == 0) {
+      frame = (valid & 1) ? blackbox_predict(codec, 0) + (uint32_t)values[0] : (uint32_t)values[0];
+    }
+  }
+
+  if (intra) {
+    codec->valid = 0;
+    codec->frame_count = 0;
+  }
+
+  for (uint32_t i = 0; i < codec->value_count; i++) {
+    if (i > 0 && !blackbox_value_logged(codec, frame, i)) {
+      values[i] = codec->last[i];
+      continue;
+    }
+    if (codec->valid & (1ULL << i)) {
+      values[i] = blackbox_predict(codec, i) + (uint32_t)values[i];
+    }
+    blackbox_value_store(codec, i, values[i]);
+  }
+
+  blackbox_codec_next(codec);
+
+  return offset;
+}
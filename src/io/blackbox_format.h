@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// binary blackbox format, version 1
+//
+// a file starts with a cbor map describing the logged fields, followed by back to back frames.
+// a frame is a type byte and one zigzag varint per logged value:
+// - intra frames hold the values themselves
+// - predicted frames hold the difference to what the field predictor expected
+// every BLACKBOX_INTRA_INTERVAL frames, and after a dropped frame, an intra frame is sent again
+// so a decoder can pick the stream up again.
+//
+// the first value is the frame counter and is in every frame. a field with a divider of n
+// is only in frames where the counter is a multiple of n, the first time it shows up after an
+// intra frame it holds the value itself. the decoder repeats the last value for skipped fields.
+//
+// this file does not depend on anything but the c library so host tools can use it as is.
+
+#define BLACKBOX_FORMAT_VERSION 1
+
+// gyro capture, version 1
+//
+// a capture only holds the gyro at its full rate, for spectral analysis. the file starts with a
+// cbor map holding the capture version under "capture", the sample period in us, the number of
+// channels and the scale in deg/s per unit. the samples follow back to back, a little endian
+// int16 per channel: raw gyro x y z, then the filtered gyro x y z if there are six channels.
+// a capture has no gaps, it ends with the last sample that fit into the flash buffer.
+#define BLACKBOX_CAPTURE_VERSION 1
+#define BLACKBOX_CAPTURE_AXES 3
+#define BLACKBOX_CAPTURE_CHANNELS_MAX (2 * BLACKBOX_CAPTURE_AXES)
+
+#define BLACKBOX_FRAME_INTRA 'I'
+#define BLACKBOX_FRAME_PREDICTED 'P'
+
+#define BLACKBOX_INTRA_INTERVAL 32
+
+#define BLACKBOX_VALUES_MAX 64
+// a type byte and a five byte varint for every value
+#define BLACKBOX_FRAME_MAX (1 + BLACKBOX_VALUES_MAX * 5)
+
+typedef enum {
+  BLACKBOX_PREDICT_PREVIOUS,  // same as the previous frame
+  BLACKBOX_PREDICT_INCREMENT, // previous frame plus one
+  BLACKBOX_PREDICT_LINEAR,    // extrapolated from the previous two frames
+} blackbox_predictor_t;
+
+typedef struct {
+  const char *name;
+  uint8_t size;      // number of values
+  uint16_t scale;    // values are fixed point with this scale, 1 for plain integers
+  uint8_t predictor; // blackbox_predictor_t
+  uint8_t divider;   // logged every nth frame
+} blackbox_field_def_t;
+
+#define BLACKBOX_FIELD_DEF_MEMBERS \
+  STR_MEMBER(name)                 \
+  MEMBER(size, uint8)              \
+  MEMBER(scale, uint16)            \
+  MEMBER(predictor, uint8)         \
+  MEMBER(divider, uint8)
+
+typedef struct {
+  uint32_t value_count;
+  uint8_t predictor[BLACKBOX_VALUES_MAX];
+  uint8_t divider[BLACKBOX_VALUES_MAX];
+
+  int32_t last[BLACKBOX_VALUES_MAX];
+  int32_t last2[BLACKBOX_VALUES_MAX];
+  // values that were sent since the last intra frame, a bit per value
+  uint64_t valid;
+
+  // frames since the last intra frame, zero forces the next frame to be intra
+  uint32_t frame_count;
+} blackbox_codec_t;
+
+void blackbox_codec_init(blackbox_codec_t *codec, const blackbox_field_def_t *fields, uint32_t field_count);
+void blackbox_codec_reset(blackbox_codec_t *codec);
+
+// writes at most BLACKBOX_FRAME_MAX bytes, returns the size of the frame
+uint32_t blackbox_encode_frame(blackbox_codec_t *codec, const int32_t *values, uint8_t *buf);
+// returns the number of bytes consumed, zero if the frame is incomplete and negative if it is corrupt
+int32_t blackbox_decode_frame(blackbox_codec_t *codec, const uint8_t *buf, uint32_t size, int32_t *values);
@@ -5,6 +5,7 @@
 #include "drv_spi_m25p16.h"
 #include "drv_spi_sdcard.h"
 #include "drv_time.h"
+#include "io/fat32.h"
 #include "io/usb_configurator.h"
 #include "util/cbor_helper.h"
 #include "util/ring_buffer.h"
@@ -17,9 +18,17 @@
 #define PAGE_SIZE M25P16_PAGE_SIZE
 #endif
 #ifdef USE_SDCARD
-#define FLUSH_INTERVAL 8
-#define FILES_SECTOR_OFFSET 1
+// pages pre-erased and written by one multi block write, it stays open across loops until they are used up or the file ends
+#define STREAM_PAGES 8192
+// files live on a fat32 volume, start_page is the lba of their first cluster
+#define FILES_SECTOR_OFFSET 0
 #define PAGE_SIZE SDCARD_PAGE_SIZE
+// sectors read at once while scanning the card, the encode buffer is unused until a file is opened
+#define SCAN_SECTORS (BUFFER_SIZE / PAGE_SIZE)
+#define FAT_COUNT_MAX 2
+// every fat copy, the directory sector and fsinfo
+#define META_RUNS_MAX (FAT_COUNT_MAX + 2)
+#define FILE_SECTORS_MAX (FAT32_FILE_SIZE_MAX / PAGE_SIZE)
 #endif
 
 #define BUFFER_SIZE 8192
@@ -35,24 +44,88 @@ typedef enum {
 
   STATE_READ_HEADER,
 
+#ifdef USE_M25P16
   STATE_ERASE_HEADER,
   STATE_WRITE_HEADER,
+#endif
+#ifdef USE_SDCARD
+  STATE_MOUNT_VOLUME,
+  STATE_SCAN_FAT,
+  STATE_SCAN_DIR,
+  STATE_SCAN_DIR_NEXT,
+  STATE_READ_FILE_INFO,
+  STATE_NO_FILESYSTEM,
+
+  STATE_START_META,
+  STATE_FILL_META,
+  STATE_CONTINUE_META,
+  STATE_FINISH_META,
+#endif
 } data_flash_state_t;
 
 data_flash_bounds_t bounds;
 data_flash_header_t data_flash_header;
 
-static uint8_t encode_buffer_data[BUFFER_SIZE];
+// pages go to the card straight from here and reads land in it, see spi_txn_add_seg_direct
+static DMA_RAM uint8_t encode_buffer_data[BUFFER_SIZE] DMA_ALIGN;
 static ring_buffer_t encode_buffer = {
     .buffer = encode_buffer_data,
     .head = 0,
     .tail = 0,
     .size = BUFFER_SIZE,
 };
-static uint8_t write_buffer[PAGE_SIZE];
+static DMA_RAM uint8_t write_buffer[PAGE_SIZE] DMA_ALIGN;
 static data_flash_state_t state = STATE_DETECT;
 static uint8_t should_flush = 0;
 
+#ifdef USE_M25P16
+// everything from the write head up to here is erased and can be programmed as is
+static uint32_t erased_until = 0;
+// while a file is open an erase stalls the log for the better part of a second,
+// so they only happen in between flights unless the write head catches up
+static bool file_open = false;
+
+static DMA_RAM uint8_t blank_check_buffer[PAGE_SIZE] DMA_ALIGN;
+static bool blank_check_pending = false;
+// the page at erased_until is not blank, its sector has to be erased before the watermark moves on
+static bool erase_pending = false;
+#endif
+
+#ifdef USE_SDCARD
+typedef struct {
+  uint32_t lba;
+  uint32_t count;
+} sector_run_t;
+
+static fat32_volume_t volume;
+static fat32_alloc_t alloc;
+
+static uint32_t scan_pos = 0;
+static uint32_t dir_cluster = 0;
+static uint32_t log_number = 0;
+
+// first unused slot in the root directory, the sector it is in is kept to write it back on close
+static uint32_t dir_entry_lba = 0;
+static uint32_t dir_entry_index = 0;
+static uint8_t dir_entry_sector[PAGE_SIZE];
+
+// the open file gets every cluster from file_cluster on, its chain and directory entry
+// are only written once it is closed
+static uint32_t file_cluster = 0;
+static uint32_t file_clusters = 0;
+static bool file_pending = false;
+
+static sector_run_t meta_runs[META_RUNS_MAX];
+static uint32_t meta_run_count = 0;
+static uint32_t meta_run = 0;
+static uint32_t meta_written = 0;
+static bool meta_format = false;
+
+static uint8_t *read_buffer = NULL;
+static uint32_t read_sector = 0;
+static uint32_t read_sectors = 0;
+#endif
+
 #define MEMBER CBOR_ENCODE_MEMBER
 #define STR_MEMBER CBOR_ENCODE_STR_MEMBER
 #define ARRAY_MEMBER CBOR_ENCODE_ARRAY_MEMBER
@@ -93,13 +166,238 @@ static data_flash_file_t *current_file() {
   return &data_flash_header.files[data_flash_header.file_num - 1];
 }
 
+#ifdef USE_M25P16
+// first page after the last file
+static uint32_t files_end_page() {
+  uint32_t offset = 0;
+
+  for (uint16_t i = 0; i < data_flash_header.file_num; i++) {
+    const uint32_t size = data_flash_header.files[i].size;
+
+    offset += size / PAGE_SIZE;
+    if (size % PAGE_SIZE > 0) {
+      offset += 1;
+    }
+  }
+
+  return offset;
+}
+
+static bool page_is_blank(const uint8_t *page) {
+  for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+    if (page[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// moves the erased watermark one step ahead. the next page is read back first and its sector is
+// only erased if it is not blank already, files are written back to back so it usually is.
+// without may_erase it only checks pages and stops at the first one that needs an erase.
+static void flash_erase_ahead(bool may_erase) {
+  if (!erase_pending) {
+    if (!blank_check_pending) {
+      if (m25p16_read_start(erased_until, blank_check_buffer, PAGE_SIZE)) {
+        blank_check_pending = true;
+      }
+      return;
+    }
+
+    if (!m25p16_poll_ready()) {
+      return;
+    }
+    blank_check_pending = false;
+
+    if (page_is_blank(blank_check_buffer)) {
+      erased_until += PAGE_SIZE;
+      return;
+    }
+    erase_pending = true;
+  }
+
+  if (!may_erase) {
+    return;
+  }
+
+  const uint32_t sector = erased_until / bounds.sector_size * bounds.sector_size;
+  if (m25p16_sector_erase(sector)) {
+    erased_until = sector + bounds.sector_size;
+    erase_pending = false;
+  }
+}
+#endif
+
+#ifdef USE_SDCARD
+static uint32_t volume_end_lba() {
+  return fat32_cluster_lba(&volume, FAT32_FIRST_CLUSTER + volume.cluster_count);
+}
+
+// an erased or zeroed first sector, there is nothing on the card to lose.
+// anything else might be logs in the raw format of older firmware, those need an explicit format
+static bool fat_card_is_blank(const uint8_t *sector) {
+  for (uint32_t i = 1; i < PAGE_SIZE; i++) {
+    if (sector[i] != sector[0]) {
+      return false;
+    }
+  }
+  return sector[0] == 0x00 || sector[0] == 0xFF;
+}
+
+static void fat_log_name(char *name, uint32_t number) {
+  memcpy(name, "LOG00000BBL", FAT32_NAME_SIZE);
+  for (uint32_t i = 7; i >= 3 && number > 0; i--) {
+    name[i] = '0' + number % 10;
+    number /= 10;
+  }
+}
+
+static bool fat_log_number(const char *name, uint32_t *number) {
+  if (memcmp(name, "LOG", 3) != 0 || memcmp(name + 8, "BBL", 3) != 0) {
+    return false;
+  }
+
+  *number = 0;
+  for (uint32_t i = 3; i < 8; i++) {
+    if (name[i] < '0' || name[i] > '9') {
+      return false;
+    }
+    *number = *number * 10 + (name[i] - '0');
+  }
+  return true;
+}
+
+static void fat_scan_dir_start() {
+  data_flash_header.file_num = 0;
+  log_number = 0;
+
+  dir_entry_lba = 0;
+  dir_cluster = volume.root_cluster;
+  scan_pos = 0;
+  state = STATE_SCAN_DIR;
+}
+
+// the header lists the newest logs, ordered by where they are on the card
+static void fat_scan_file(const fat32_file_t *file) {
+  uint32_t number = 0;
+  if (!fat_log_number(file->name, &number)) {
+    return;
+  }
+  log_number = max(log_number, number);
+
+  const uint32_t lba = fat32_cluster_lba(&volume, file->cluster);
+  if (file->size == 0 || file->cluster < FAT32_FIRST_CLUSTER || lba >= volume_end_lba()) {
+    return;
+  }
+
+  uint32_t index = 0;
+  while (index < data_flash_header.file_num && data_flash_header.files[index].start_page < lba) {
+    index++;
+  }
+
+  if (data_flash_header.file_num == DATA_FLASH_MAX_FILES) {
+    if (index == 0) {
+      // older than everything listed
+      return;
+    }
+    // drop the oldest
+    index--;
+    memmove(&data_flash_header.files[0], &data_flash_header.files[1], index * sizeof(data_flash_file_t));
+  } else {
+    memmove(&data_flash_header.files[index + 1], &data_flash_header.files[index], (data_flash_header.file_num - index) * sizeof(data_flash_file_t));
+    data_flash_header.file_num++;
+  }
+
+  data_flash_file_t *entry = &data_flash_header.files[index];
+  entry->looptime = 0;
+  entry->blackbox_rate = 0;
+  entry->start_page = lba;
+  entry->size = file->size;
+}
+
+static void fat_close_file() {
+  const data_flash_file_t *file = current_file();
+  const uint32_t cluster_size = fat32_cluster_size(&volume);
+  file_clusters = (file->size + cluster_size - 1) / cluster_size;
+
+  fat32_file_t entry;
+  fat_log_name(entry.name, log_number + 1);
+  entry.cluster = file_cluster;
+  entry.size = file->size;
+  fat32_dir_entry_set(dir_entry_sector + dir_entry_index * 32, &entry);
+
+  const uint32_t first_index = file_cluster / FAT32_FAT_ENTRIES;
+  const uint32_t last_index = (file_cluster + file_clusters - 1) / FAT32_FAT_ENTRIES;
+
+  meta_run_count = 0;
+  for (uint32_t i = 0; i < volume.fat_count; i++) {
+    meta_runs[meta_run_count].lba = fat32_fat_lba(&volume, i, first_index);
+    meta_runs[meta_run_count].count = last_index - first_index + 1;
+    meta_run_count++;
+  }
+  meta_runs[meta_run_count].lba = dir_entry_lba;
+  meta_runs[meta_run_count].count = 1;
+  meta_run_count++;
+  if (volume.fsinfo_sector > 0 && volume.fsinfo_sector < volume.reserved_sectors) {
+    meta_runs[meta_run_count].lba = volume.part_start + volume.fsinfo_sector;
+    meta_runs[meta_run_count].count = 1;
+    meta_run_count++;
+  }
+
+  meta_run = 0;
+  meta_format = false;
+  state = STATE_START_META;
+}
+
+static void fat_meta_fill(uint32_t lba, uint8_t *sector) {
+  if (meta_format) {
+    fat32_format_sector(&volume, lba, sector);
+    return;
+  }
+
+  if (lba == dir_entry_lba) {
+    memcpy(sector, dir_entry_sector, PAGE_SIZE);
+  } else if (lba == volume.part_start + volume.fsinfo_sector) {
+    const uint32_t free_count = alloc.free_count > file_clusters ? alloc.free_count - file_clusters : 0;
+    fat32_fsinfo_fill(sector, free_count, file_cluster + file_clusters);
+  } else {
+    const uint32_t index = (lba - volume.part_start - volume.reserved_sectors) % volume.fat_size;
+    fat32_alloc_fill(&alloc, index, file_cluster, file_clusters, sector);
+  }
+}
+
+// a fresh volume over the whole card, mounted again once it is written
+static void fat_format() {
+  file_pending = false;
+  meta_run_count = 0;
+  meta_run = 0;
+  meta_format = true;
+
+  if (!fat32_format_init(&volume, bounds.sectors)) {
+    state = STATE_NO_FILESYSTEM;
+    return;
+  }
+
+  meta_runs[0].lba = 0;
+  meta_runs[0].count = 1;
+  meta_runs[1].lba = volume.part_start;
+  meta_runs[1].count = fat32_format_end(&volume) - volume.part_start;
+  meta_run_count = 2;
+
+  state = STATE_START_META;
+}
+#endif
+
 data_flash_result_t data_flash_update() {
   static uint32_t offset = 0;
   static uint32_t write_size = PAGE_SIZE;
 
-  const uint32_t to_write = ring_buffer_available(&encode_buffer);
-
 #ifdef USE_SDCARD
+  static uint32_t stream_pages = 0;
+  static uint32_t stream_written = 0;
+  // either write_buffer or the page in place in the ring buffer
+  static uint8_t *write_ptr = write_buffer;
+
   sdcard_status_t sdcard_status = sdcard_update();
   if (sdcard_status != SDCARD_IDLE) {
     if (state == STATE_DETECT) {
@@ -118,78 +416,224 @@ sdcard_do_more:
   }
 
   case STATE_READ_HEADER: {
-    if (sdcard_read_pages(write_buffer, 0, 1)) {
-      memcpy((uint8_t *)&data_flash_header, write_buffer, sizeof(data_flash_header_t));
+    if (!sdcard_read_pages(write_buffer, 0, 1)) {
+      return DATA_FLASH_DETECT;
+    }
 
-      if (data_flash_header.magic != DATA_FLASH_HEADER_MAGIC) {
-        data_flash_header.magic = DATA_FLASH_HEADER_MAGIC;
-        data_flash_header.file_num = 0;
+    // cards formatted without a partition table start with the boot sector
+    if (fat32_mount(&volume, write_buffer, 0)) {
+      state = STATE_SCAN_FAT;
+      scan_pos = 0;
+      fat32_alloc_init(&alloc);
+      return DATA_FLASH_DETECT;
+    }
 
-        state = STATE_ERASE_HEADER;
-        break;
+    const uint32_t lba = fat32_find_partition(write_buffer);
+    if (lba != 0) {
+      volume.part_start = lba;
+      state = STATE_MOUNT_VOLUME;
+    } else if (fat_card_is_blank(write_buffer)) {
+      // nothing on the card to lose
+      fat_format();
+    } else {
+      state = STATE_NO_FILESYSTEM;
+    }
+    return DATA_FLASH_DETECT;
+  }
+
+  case STATE_MOUNT_VOLUME: {
+    if (!sdcard_read_pages(write_buffer, volume.part_start, 1)) {
+      return DATA_FLASH_DETECT;
+    }
+
+    if (fat32_mount(&volume, write_buffer, volume.part_start) && volume.fat_count <= FAT_COUNT_MAX) {
+      state = STATE_SCAN_FAT;
+      scan_pos = 0;
+      fat32_alloc_init(&alloc);
+    } else {
+      state = STATE_NO_FILESYSTEM;
+    }
+    return DATA_FLASH_DETECT;
+  }
+
+  case STATE_SCAN_FAT: {
+    const uint32_t count = min(SCAN_SECTORS, fat32_fat_sectors(&volume) - scan_pos);
+    if (!sdcard_read_pages(encode_buffer_data, fat32_fat_lba(&volume, 0, scan_pos), count)) {
+      return DATA_FLASH_DETECT;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      fat32_alloc_scan(&alloc, &volume, scan_pos + i, encode_buffer_data + i * PAGE_SIZE);
+    }
+
+    scan_pos += count;
+    if (scan_pos == fat32_fat_sectors(&volume)) {
+      fat_scan_dir_start();
+    }
+    return DATA_FLASH_DETECT;
+  }
+
+  case STATE_SCAN_DIR: {
+    const uint32_t count = min(SCAN_SECTORS, volume.sectors_per_cluster - scan_pos);
+    const uint32_t lba = fat32_cluster_lba(&volume, dir_cluster) + scan_pos;
+    if (!sdcard_read_pages(encode_buffer_data, lba, count)) {
+      return DATA_FLASH_DETECT;
+    }
+
+    for (uint32_t i = 0; i < count * FAT32_DIR_ENTRIES; i++) {
+      const uint8_t *entry = encode_buffer_data + i * 32;
+
+      fat32_file_t file;
+      const fat32_entry_type_t type = fat32_dir_entry(entry, &file);
+      if (type == FAT32_ENTRY_FILE) {
+        fat_scan_file(&file);
+        continue;
+      }
+      if ((type == FAT32_ENTRY_END || type == FAT32_ENTRY_FREE) && dir_entry_lba == 0) {
+        dir_entry_lba = lba + i / FAT32_DIR_ENTRIES;
+        dir_entry_index = i % FAT32_DIR_ENTRIES;
+        memcpy(dir_entry_sector, encode_buffer_data + (i / FAT32_DIR_ENTRIES) * PAGE_SIZE, PAGE_SIZE);
       }
+      if (type == FAT32_ENTRY_END) {
+        scan_pos = 0;
+        state = STATE_READ_FILE_INFO;
+        return DATA_FLASH_DETECT;
+      }
+    }
 
+    scan_pos += count;
+    if (scan_pos == volume.sectors_per_cluster) {
+      state = STATE_SCAN_DIR_NEXT;
+    }
+    return DATA_FLASH_DETECT;
+  }
+
+  case STATE_SCAN_DIR_NEXT: {
+    if (!sdcard_read_pages(write_buffer, fat32_fat_lba(&volume, 0, dir_cluster / FAT32_FAT_ENTRIES), 1)) {
+      return DATA_FLASH_DETECT;
+    }
+
+    const uint32_t next = fat32_fat_entry(write_buffer, dir_cluster);
+    scan_pos = 0;
+    if (next < FAT32_FIRST_CLUSTER || next >= FAT32_CLUSTER_EOC_MIN) {
+      // end of the directory, if there was no free entry it is full
+      state = STATE_READ_FILE_INFO;
+    } else {
+      dir_cluster = next;
+      state = STATE_SCAN_DIR;
+    }
+    return DATA_FLASH_DETECT;
+  }
+
+  case STATE_READ_FILE_INFO: {
+    if (scan_pos >= data_flash_header.file_num) {
       state = STATE_IDLE;
-      goto sdcard_do_more;
+      return DATA_FLASH_DETECT;
     }
-    break;
+
+    data_flash_file_t *file = &data_flash_header.files[scan_pos];
+    if (file->size > 0) {
+      if (!sdcard_read_pages(write_buffer, file->start_page, 1)) {
+        return DATA_FLASH_DETECT;
+      }
+
+      // the blackbox header leads with looptime and blackbox_rate under the same names,
+      // the decoder gives up at the field table which runs past the sector
+      cbor_value_t dec;
+      cbor_decoder_init(&dec, write_buffer, PAGE_SIZE);
+      cbor_decode_data_flash_file_t(&dec, file);
+    }
+    scan_pos++;
+    return DATA_FLASH_DETECT;
   }
 
-  case STATE_IDLE:
-    if (to_write >= PAGE_SIZE) {
+  case STATE_NO_FILESYSTEM:
+    // the card has to be formatted before it can log
+    break;
+
+  case STATE_IDLE: {
+    // a finished write might have just drained the buffer, without a file it holds the frames from before logging
+    const uint32_t available = ring_buffer_available(&encode_buffer);
+    if (file_pending && available >= PAGE_SIZE) {
       state = STATE_START_WRITE;
       goto sdcard_do_more;
     }
-    if (should_flush == 1 && to_write > 0) {
+    if (should_flush == 1 && available > 0) {
       state = STATE_START_WRITE;
       goto sdcard_do_more;
     }
     if (should_flush == 1) {
-      state = STATE_ERASE_HEADER;
       should_flush = 0;
-      goto sdcard_do_more;
+      if (file_pending) {
+        file_pending = false;
+        fat_close_file();
+        goto sdcard_do_more;
+      }
     }
     break;
+  }
 
   case STATE_START_WRITE: {
-    offset = FILES_SECTOR_OFFSET + current_file()->start_page + (current_file()->size / PAGE_SIZE);
-    if (sdcard_write_pages_start(offset, FLUSH_INTERVAL)) {
+    offset = current_file()->start_page + (current_file()->size / PAGE_SIZE);
+
+    const uint32_t end = min(volume_end_lba(), current_file()->start_page + FILE_SECTORS_MAX);
+    if (offset >= end) {
+      // card is full, nothing left to do with the data
+      ring_buffer_clear(&encode_buffer);
+      state = STATE_IDLE;
+      break;
+    }
+
+    stream_pages = min(STREAM_PAGES, end - offset);
+    if (sdcard_write_pages_start(offset, stream_pages)) {
+      stream_written = 0;
       state = STATE_FILL_WRITE_BUFFER;
+      goto sdcard_do_more;
     }
     break;
   }
 
   case STATE_FILL_WRITE_BUFFER: {
+    if (stream_written == stream_pages) {
+      state = STATE_FINISH_WRITE;
+      goto sdcard_do_more;
+    }
+
+    const uint32_t available = ring_buffer_available(&encode_buffer);
+
     write_size = PAGE_SIZE;
-    if (to_write < PAGE_SIZE) {
+    if (available < PAGE_SIZE) {
       if (should_flush == 0) {
         break;
       }
-      if (to_write == 0) {
+      if (available == 0) {
         state = STATE_FINISH_WRITE;
         goto sdcard_do_more;
       }
 
-      write_size = to_write;
+      write_size = available;
     }
 
-    ring_buffer_read_multi(&encode_buffer, write_buffer, write_size);
+    if (write_size == PAGE_SIZE && ring_buffer_peek(&encode_buffer, &write_ptr) >= PAGE_SIZE) {
+      // the page is in one piece, the card can take it straight from the ring buffer
+    } else {
+      ring_buffer_read_multi(&encode_buffer, write_buffer, write_size);
+      write_ptr = write_buffer;
+    }
     state = STATE_CONTINUE_WRITE;
-    break;
+    goto sdcard_do_more;
   }
 
   case STATE_CONTINUE_WRITE: {
-    static uint32_t counter = 0;
-    if (sdcard_write_pages_continue(write_buffer)) {
+    if (sdcard_write_pages_continue(write_ptr)) {
+      if (write_ptr != write_buffer) {
+        ring_buffer_skip(&encode_buffer, write_size);
+      }
       current_file()->size += write_size;
 
-      counter++;
-      if (counter == FLUSH_INTERVAL) {
-        counter = 0;
-        state = STATE_FINISH_WRITE;
-      } else {
-        state = STATE_FILL_WRITE_BUFFER;
-      }
+      stream_written++;
+      state = STATE_FILL_WRITE_BUFFER;
+      goto sdcard_do_more;
     }
     break;
   }
@@ -202,15 +646,54 @@ sdcard_do_more:
     break;
   }
 
-  case STATE_ERASE_HEADER: {
-    memcpy(write_buffer, (uint8_t *)&data_flash_header, sizeof(data_flash_header_t));
-    state = STATE_WRITE_HEADER;
+  case STATE_START_META: {
+    if (meta_run == meta_run_count) {
+      if (meta_format) {
+        // mount what was just written like any other card
+        state = STATE_READ_HEADER;
+        return DATA_FLASH_STARTING;
+      }
+
+      fat32_alloc_commit(&alloc, file_cluster, file_clusters);
+      fat_scan_dir_start();
+      return DATA_FLASH_STARTING;
+    }
+
+    const sector_run_t *run = &meta_runs[meta_run];
+    if (sdcard_write_pages_start(run->lba, run->count)) {
+      meta_written = 0;
+      state = STATE_FILL_META;
+      goto sdcard_do_more;
+    }
     return DATA_FLASH_STARTING;
   }
 
-  case STATE_WRITE_HEADER: {
-    if (sdcard_write_page(write_buffer, 0)) {
-      state = STATE_IDLE;
+  case STATE_FILL_META: {
+    const sector_run_t *run = &meta_runs[meta_run];
+    if (meta_written == run->count) {
+      state = STATE_FINISH_META;
+      goto sdcard_do_more;
+    }
+
+    fat_meta_fill(run->lba + meta_written, write_buffer);
+    state = STATE_CONTINUE_META;
+    goto sdcard_do_more;
+  }
+
+  case STATE_CONTINUE_META: {
+    if (sdcard_write_pages_continue(write_buffer)) {
+      meta_written++;
+      state = STATE_FILL_META;
+      goto sdcard_do_more;
+    }
+    return DATA_FLASH_STARTING;
+  }
+
+  case STATE_FINISH_META: {
+    if (sdcard_write_pages_finish()) {
+      meta_run++;
+      state = STATE_START_META;
+      goto sdcard_do_more;
     }
     return DATA_FLASH_STARTING;
   }
@@ -218,10 +701,17 @@ sdcard_do_more:
 #endif
 
 #ifdef USE_M25P16
+  const uint32_t start = time_micros();
+
 flash_do_more:
+  if ((time_micros() - start) > BLACKBOX_FLASH_BUDGET_US) {
+    // out of time, the state machine picks up from here next loop
+    goto flash_done;
+  }
+
   switch (state) {
   case STATE_DETECT:
-    if (!m25p16_is_ready()) {
+    if (!m25p16_poll_ready()) {
       return DATA_FLASH_DETECT;
     }
 
@@ -230,7 +720,7 @@ flash_do_more:
     return DATA_FLASH_DETECT;
 
   case STATE_READ_HEADER:
-    if (!m25p16_is_ready()) {
+    if (!m25p16_poll_ready()) {
       break;
     }
 
@@ -239,14 +729,21 @@ flash_do_more:
       data_flash_header.magic = DATA_FLASH_HEADER_MAGIC;
       data_flash_header.file_num = 0;
 
+      erased_until = FILES_SECTOR_OFFSET;
       state = STATE_ERASE_HEADER;
       break;
     }
 
+    // the rest of the sector the last file ended in was erased when it was written,
+    // everything after is checked again
+    erased_until = FILES_SECTOR_OFFSET + files_end_page() * PAGE_SIZE;
+    erased_until = (erased_until + bounds.sector_size - 1) / bounds.sector_size * bounds.sector_size;
+
     state = STATE_IDLE;
     break;
 
-  case STATE_IDLE:
+  case STATE_IDLE: {
+    const uint32_t to_write = ring_buffer_available(&encode_buffer);
     if (should_flush == 1) {
       if (to_write > 0 && offset < bounds.total_size) {
         state = STATE_START_WRITE;
@@ -256,11 +753,17 @@ flash_do_more:
       }
       goto flash_do_more;
     }
-    if (to_write >= PAGE_SIZE) {
+    if (file_open && to_write >= PAGE_SIZE) {
       state = STATE_START_WRITE;
       goto flash_do_more;
     }
+    if (erased_until < bounds.total_size) {
+      // without a file this gets the flash ready for the next flight. with one the pages ahead are
+      // checked in between page programs, the erase itself waits until the write head needs it
+      flash_erase_ahead(!file_open);
+    }
     break;
+  }
 
   case STATE_START_WRITE: {
     offset = FILES_SECTOR_OFFSET + current_file()->start_page * PAGE_SIZE + current_file()->size;
@@ -273,6 +776,13 @@ flash_do_more:
   }
 
   case STATE_FILL_WRITE_BUFFER: {
+    // the last page is sent from write_buffer as is, it can only be refilled once the program went out
+    if (!m25p16_poll_ready()) {
+      break;
+    }
+
+    const uint32_t to_write = ring_buffer_available(&encode_buffer);
+
     write_size = PAGE_SIZE;
     if (to_write < PAGE_SIZE) {
       if (should_flush == 0) {
@@ -288,10 +798,15 @@ flash_do_more:
 
     ring_buffer_read_multi(&encode_buffer, write_buffer, write_size);
     state = STATE_CONTINUE_WRITE;
-    break;
+    goto flash_do_more;
   }
 
   case STATE_CONTINUE_WRITE: {
+    if (offset + PAGE_SIZE > erased_until) {
+      // the write head caught up, logging has to wait for the flash
+      flash_erase_ahead(true);
+      break;
+    }
     if (!m25p16_page_program(offset, write_buffer, PAGE_SIZE)) {
       break;
     }
@@ -306,18 +821,14 @@ flash_do_more:
   }
 
   case STATE_ERASE_HEADER: {
-    if (!m25p16_is_ready()) {
+    if (!m25p16_sector_erase(0x0)) {
       return DATA_FLASH_STARTING;
     }
-    m25p16_write_addr(M25P16_SECTOR_ERASE, 0x0, NULL, 0);
     state = STATE_WRITE_HEADER;
     return DATA_FLASH_STARTING;
   }
 
   case STATE_WRITE_HEADER: {
-    if (!m25p16_is_ready()) {
-      return DATA_FLASH_STARTING;
-    }
     if (m25p16_page_program(0x0, (uint8_t *)&data_flash_header, sizeof(data_flash_header_t))) {
       state = STATE_IDLE;
     }
@@ -325,6 +836,7 @@ flash_do_more:
   }
   }
 
+flash_done:
   if (should_flush == 1) {
     return DATA_FLASH_STARTING;
   }
@@ -360,39 +872,61 @@ void data_flash_reset() {
   m25p16_command(M25P16_BULK_ERASE);
 
   m25p16_wait_for_ready();
+
+  erased_until = bounds.total_size;
+  erase_pending = false;
 #endif
 
   data_flash_header.magic = DATA_FLASH_HEADER_MAGIC;
   data_flash_header.file_num = 0;
 
+#ifdef USE_M25P16
   state = STATE_ERASE_HEADER;
+#endif
+#ifdef USE_SDCARD
+  fat_format();
+#endif
 
   reset_looptime();
 }
 
 bool data_flash_restart(uint32_t blackbox_rate, uint32_t looptime) {
-  if (data_flash_header.file_num >= DATA_FLASH_MAX_FILES) {
-    return false;
-  }
-  if (state != STATE_IDLE) {
+  if (state != STATE_IDLE || should_flush == 1) {
     return false;
   }
 
-  uint32_t offset = 0;
-
-  for (uint16_t i = 0; i < data_flash_header.file_num; i++) {
-    const uint32_t size = data_flash_header.files[i].size;
-
-    offset += size / PAGE_SIZE;
-    if (size % PAGE_SIZE > 0) {
-      offset += 1;
-    }
+#ifdef USE_M25P16
+  if (data_flash_header.file_num >= DATA_FLASH_MAX_FILES) {
+    return false;
   }
 
+  const uint32_t offset = files_end_page();
   if ((FILES_SECTOR_OFFSET + (offset + 1) * PAGE_SIZE) >= bounds.total_size) {
     // flash is full
     return false;
   }
+#endif
+#ifdef USE_SDCARD
+  if (file_pending) {
+    // the last file is not closed yet
+    return false;
+  }
+  if (dir_entry_lba == 0 || alloc.next_free >= FAT32_FIRST_CLUSTER + volume.cluster_count) {
+    // root directory or card is full
+    return false;
+  }
+
+  if (data_flash_header.file_num >= DATA_FLASH_MAX_FILES) {
+    // the card keeps the file, it just drops off the list
+    data_flash_header.file_num--;
+    memmove(&data_flash_header.files[0], &data_flash_header.files[1], data_flash_header.file_num * sizeof(data_flash_file_t));
+  }
+
+  file_cluster = alloc.next_free;
+  file_pending = true;
+
+  const uint32_t offset = fat32_cluster_lba(&volume, file_cluster);
+#endif
 
   data_flash_header.files[data_flash_header.file_num].looptime = looptime;
   data_flash_header.files[data_flash_header.file_num].blackbox_rate = blackbox_rate;
@@ -400,68 +934,106 @@ bool data_flash_restart(uint32_t blackbox_rate, uint32_t looptime) {
   data_flash_header.files[data_flash_header.file_num].start_page = offset;
   data_flash_header.file_num++;
 
+#ifdef USE_M25P16
   state = STATE_ERASE_HEADER;
+  file_open = true;
+#endif
 
-  ring_buffer_clear(&encode_buffer);
-
+  // whatever is buffered now are frames from before logging started, they go into the file
   return true;
 }
 
 void data_flash_finish() {
-  if (current_file()->size == 0) {
+  if (current_file()->size == 0 && ring_buffer_available(&encode_buffer) == 0) {
     // file was empty, lets remove it
     data_flash_header.file_num--;
+#ifdef USE_SDCARD
+    file_pending = false;
+#endif
   }
 
   should_flush = 1;
+#ifdef USE_M25P16
+  file_open = false;
+#endif
 }
 
-void data_flash_read_backbox(const uint32_t file_index, const uint32_t offset, uint8_t *buffer, const uint32_t size) {
+bool data_flash_can_read() {
+#ifdef USE_SDCARD
+  // the card only reads once the write stream is closed, which takes data_flash_update
+  return state == STATE_IDLE;
+#else
+  return state != STATE_DETECT && state != STATE_READ_HEADER;
+#endif
+}
+
+bool data_flash_read_start(const uint32_t file_index, const uint32_t offset, uint8_t *buffer, const uint32_t size) {
   const data_flash_file_t *file = &data_flash_header.files[file_index];
 
 #ifdef USE_M25P16
-  uint32_t read = 0;
-  while (read < size) {
-    const uint32_t read_size = min(size - read, PAGE_SIZE);
-
-    const uint32_t abs_offset = FILES_SECTOR_OFFSET + file->start_page * PAGE_SIZE + offset + read;
-    m25p16_read_addr(M25P16_READ_DATA_BYTES, abs_offset, buffer + read, read_size);
+  const uint32_t abs_offset = FILES_SECTOR_OFFSET + file->start_page * PAGE_SIZE + offset;
+  return m25p16_read_start(abs_offset, buffer, size);
+#endif
+#ifdef USE_SDCARD
+  read_buffer = buffer;
+  read_sector = FILES_SECTOR_OFFSET + file->start_page + (offset / PAGE_SIZE);
+  read_sectors = size / PAGE_SIZE + (size % PAGE_SIZE ? 1 : 0);
+
+  // the card only moves while it is polled, this gets the command out and the first sector
+  // going so it reads while the caller is busy, data_flash_read_ready does the rest
+  sdcard_read_pages(read_buffer, read_sector, read_sectors);
+  sdcard_update();
+  return true;
+#endif
+}
 
-    read += read_size;
-  }
+bool data_flash_read_ready() {
+#ifdef USE_M25P16
+  return m25p16_poll_ready();
 #endif
 #ifdef USE_SDCARD
-  const uint32_t sector_offset = FILES_SECTOR_OFFSET + file->start_page + (offset / PAGE_SIZE);
-  const uint32_t sectors = size / PAGE_SIZE + (size % PAGE_SIZE ? 1 : 0);
+  sdcard_update();
+  return sdcard_read_pages(read_buffer, read_sector, read_sectors);
+#endif
+}
 
-  while (1) {
-    sdcard_update();
-    if (sdcard_read_pages(buffer, sector_offset, sectors)) {
-      break;
-    }
+void data_flash_read_backbox(const uint32_t file_index, const uint32_t offset, uint8_t *buffer, const uint32_t size) {
+  while (!data_flash_read_start(file_index, offset, buffer, size)) {
+    __NOP();
+  }
+  while (!data_flash_read_ready()) {
     __NOP();
   }
-#endif
 }
 
-cbor_result_t data_flash_write_backbox(const blackbox_t *b) {
-  static uint8_t buffer[PAGE_SIZE];
+bool data_flash_write_backbox(const uint8_t *data, const uint32_t size) {
+  if (size >= ring_buffer_free(&encode_buffer)) {
+    return false;
+  }
+
+  ring_buffer_write_multi(&encode_buffer, data, size);
+  return true;
+}
 
-  cbor_value_t enc;
-  cbor_encoder_init(&enc, buffer, PAGE_SIZE);
+bool data_flash_write_backbox_front(const uint8_t *data, const uint32_t size) {
+  return ring_buffer_write_front(&encode_buffer, data, size) == size;
+}
 
-  cbor_result_t res = cbor_encode_blackbox_t(&enc, b);
-  if (res < CBOR_OK) {
-    return res;
+ring_buffer_t *data_flash_pre_trigger_buffer() {
+  if (state != STATE_IDLE || should_flush == 1) {
+    return NULL;
   }
-
-  const uint32_t len = cbor_encoder_len(&enc);
-  if (len >= ring_buffer_free(&encode_buffer)) {
-    return res;
+#ifdef USE_M25P16
+  if (file_open) {
+    return NULL;
   }
-
-  ring_buffer_write_multi(&encode_buffer, buffer, len);
-  return res;
+#endif
+#ifdef USE_SDCARD
+  if (file_pending) {
+    return NULL;
+  }
+#endif
+  return &encode_buffer;
 }
 
 #endif
\ No newline at end of file
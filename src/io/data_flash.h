@@ -3,6 +3,7 @@
 #include <cbor.h>
 
 #include "io/blackbox.h"
+#include "util/ring_buffer.h"
 
 #define DATA_FLASH_HEADER_MAGIC 0xdeadbeef
 
@@ -63,5 +64,18 @@ void data_flash_reset();
 bool data_flash_restart(uint32_t blackbox_rate, uint32_t looptime);
 void data_flash_finish();
 
+// false while the reads below would not finish without data_flash_update running in between
+bool data_flash_can_read();
+// reads without waiting, the data is in buffer once data_flash_read_ready returns true.
+// sd cards read whole sectors, offset has to be a multiple of 512 and buffer needs room for the rounded up size
+bool data_flash_read_start(const uint32_t file_index, const uint32_t offset, uint8_t *buffer, const uint32_t size);
+bool data_flash_read_ready();
 void data_flash_read_backbox(const uint32_t file_index, const uint32_t offset, uint8_t *buffer, const uint32_t size);
-cbor_result_t data_flash_write_backbox(const blackbox_t *b);
+bool data_flash_write_backbox(const uint8_t *data, const uint32_t size);
+// goes ahead of everything buffered, for the log header when frames from before logging are already waiting
+bool data_flash_write_backbox_front(const uint8_t *data, const uint32_t size);
+
+// nothing leaves the write buffer while no file is open, the blackbox keeps the frames from before logging
+// starts in it. they become the start of the next file. NULL if there is no flash or card to log to,
+// or while the last file is still being written
+ring_buffer_t *data_flash_pre_trigger_buffer();
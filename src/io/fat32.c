@@ -0,0 +1,379 @@
+#include "io/fat32.h"
+
+#include <string.h>
+
+#define BOOT_SIGNATURE 0xAA55
+
+#define PARTITION_TABLE 446
+#define PARTITION_ENTRY_SIZE 16
+#define PARTITION_COUNT 4
+#define PARTITION_TYPE_FAT32_CHS 0x0B
+#define PARTITION_TYPE_FAT32_LBA 0x0C
+
+// fat32 needs at least this many clusters, below it is fat16
+#define FAT32_CLUSTERS_MIN 65525
+
+// the partition starts on a 4mb boundary, sd cards erase in units of that size or a divisor
+#define FORMAT_PART_ALIGN 8192
+#define FORMAT_RESERVED_SECTORS 32
+#define FORMAT_FAT_COUNT 2
+#define FORMAT_BACKUP_BOOT_SECTOR 6
+#define FORMAT_VOLUME_ID 0x51535631
+#define FORMAT_LABEL "QUICKSILVER"
+
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_ARCHIVE 0x20
+#define ATTR_LONG_NAME 0x0F
+
+#define ENTRY_DELETED 0xE5
+
+// there is no clock to go by, files are dated 2024-01-01
+#define FILE_DATE (((2024 - 1980) << 9) | (1 << 5) | 1)
+
+#define FSINFO_LEAD_SIGNATURE 0x41615252
+#define FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FSINFO_TRAIL_SIGNATURE 0xAA550000
+
+static inline uint16_t read_u16(const uint8_t *buf) {
+  return buf[0] | (buf[1] << 8);
+}
+
+static inline uint32_t read_u32(const uint8_t *buf) {
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static inline void write_u16(uint8_t *buf, uint16_t val) {
+  buf[0] = val;
+  buf[1] = val >> 8;
+}
+
+static inline void write_u32(uint8_t *buf, uint32_t val) {
+  buf[0] = val;
+  buf[1] = val >> 8;
+  buf[2] = val >> 16;
+  buf[3] = val >> 24;
+}
+
+uint32_t fat32_find_partition(const uint8_t *mbr) {
+  if (read_u16(mbr + 510) != BOOT_SIGNATURE) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < PARTITION_COUNT; i++) {
+    const uint8_t *entry = mbr + PARTITION_TABLE + i * PARTITION_ENTRY_SIZE;
+    const uint8_t type = entry[4];
+    if (type == PARTITION_TYPE_FAT32_CHS || type == PARTITION_TYPE_FAT32_LBA) {
+      return read_u32(entry + 8);
+    }
+  }
+  return 0;
+}
+
+bool fat32_mount(fat32_volume_t *vol, const uint8_t *boot, uint32_t lba) {
+  if (read_u16(boot + 510) != BOOT_SIGNATURE) {
+    return false;
+  }
+  if (boot[0] != 0xEB && boot[0] != 0xE9) {
+    return false;
+  }
+
+  const uint32_t sector_size = read_u16(boot + 11);
+  const uint32_t sectors_per_cluster = boot[13];
+  const uint32_t root_entries = read_u16(boot + 17);
+  const uint32_t fat_size_16 = read_u16(boot + 22);
+  if (sector_size != FAT32_SECTOR_SIZE || root_entries != 0 || fat_size_16 != 0) {
+    // fat12, fat16 or something else entirely
+    return false;
+  }
+  if (sectors_per_cluster == 0 || (sectors_per_cluster & (sectors_per_cluster - 1)) != 0) {
+    return false;
+  }
+
+  vol->part_start = lba;
+  vol->part_size = read_u32(boot + 32);
+  vol->sectors_per_cluster = sectors_per_cluster;
+  vol->reserved_sectors = read_u16(boot + 14);
+  vol->fat_count = boot[16];
+  vol->fat_size = read_u32(boot + 36);
+  vol->root_cluster = read_u32(boot + 44);
+  vol->fsinfo_sector = read_u16(boot + 48);
+
+  if (vol->fat_count == 0 || vol->fat_size == 0) {
+    return false;
+  }
+
+  const uint32_t meta_size = vol->reserved_sectors + vol->fat_count * vol->fat_size;
+  if (vol->part_size <= meta_size) {
+    return false;
+  }
+  vol->cluster_count = (vol->part_size - meta_size) / sectors_per_cluster;
+
+  // the fat has to have room for every cluster
+  const uint32_t fat_entries = vol->fat_size * FAT32_FAT_ENTRIES;
+  if (vol->cluster_count + FAT32_FIRST_CLUSTER > fat_entries) {
+    vol->cluster_count = fat_entries - FAT32_FIRST_CLUSTER;
+  }
+
+  return vol->cluster_count >= FAT32_CLUSTERS_MIN;
+}
+
+uint32_t fat32_fat_lba(const fat32_volume_t *vol, uint32_t copy, uint32_t index) {
+  return vol->part_start + vol->reserved_sectors + copy * vol->fat_size + index;
+}
+
+uint32_t fat32_cluster_lba(const fat32_volume_t *vol, uint32_t cluster) {
+  const uint32_t data_start = vol->part_start + vol->reserved_sectors + vol->fat_count * vol->fat_size;
+  return data_start + (cluster - FAT32_FIRST_CLUSTER) * vol->sectors_per_cluster;
+}
+
+uint32_t fat32_cluster_size(const fat32_volume_t *vol) {
+  return vol->sectors_per_cluster * FAT32_SECTOR_SIZE;
+}
+
+uint32_t fat32_fat_sectors(const fat32_volume_t *vol) {
+  return (vol->cluster_count + FAT32_FIRST_CLUSTER + FAT32_FAT_ENTRIES - 1) / FAT32_FAT_ENTRIES;
+}
+
+uint32_t fat32_fat_entry(const uint8_t *sector, uint32_t cluster) {
+  return read_u32(sector + (cluster % FAT32_FAT_ENTRIES) * 4) & FAT32_CLUSTER_MASK;
+}
+
+void fat32_alloc_init(fat32_alloc_t *alloc) {
+  alloc->next_free = FAT32_FIRST_CLUSTER;
+  alloc->free_count = 0;
+  alloc->boundary_index = 0;
+  memset(alloc->boundary, 0, FAT32_SECTOR_SIZE);
+}
+
+void fat32_alloc_scan(fat32_alloc_t *alloc, const fat32_volume_t *vol, uint32_t index, const uint8_t *sector) {
+  const uint32_t first = index * FAT32_FAT_ENTRIES;
+  const uint32_t end = vol->cluster_count + FAT32_FIRST_CLUSTER;
+
+  bool used = false;
+  for (uint32_t i = 0; i < FAT32_FAT_ENTRIES && first + i < end; i++) {
+    const uint32_t cluster = first + i;
+    if (cluster < FAT32_FIRST_CLUSTER) {
+      continue;
+    }
+
+    if (read_u32(sector + i * 4) & FAT32_CLUSTER_MASK) {
+      alloc->next_free = cluster + 1;
+      used = true;
+    } else {
+      alloc->free_count++;
+    }
+  }
+
+  if (used) {
+    alloc->boundary_index = index;
+    memcpy(alloc->boundary, sector, FAT32_SECTOR_SIZE);
+  }
+}
+
+void fat32_alloc_fill(const fat32_alloc_t *alloc, uint32_t index, uint32_t first, uint32_t count, uint8_t *sector) {
+  // everything past the boundary is free, so only that one sector has anything to keep
+  if (index == alloc->boundary_index) {
+    memcpy(sector, alloc->boundary, FAT32_SECTOR_SIZE);
+  } else {
+    memset(sector, 0, FAT32_SECTOR_SIZE);
+  }
+
+  const uint32_t last = first + count - 1;
+  for (uint32_t i = 0; i < FAT32_FAT_ENTRIES; i++) {
+    const uint32_t cluster = index * FAT32_FAT_ENTRIES + i;
+    if (count == 0 || cluster < first || cluster > last) {
+      continue;
+    }
+    write_u32(sector + i * 4, cluster == last ? FAT32_CLUSTER_EOC : cluster + 1);
+  }
+}
+
+void fat32_alloc_commit(fat32_alloc_t *alloc, uint32_t first, uint32_t count) {
+  if (count == 0) {
+    return;
+  }
+
+  const uint32_t last = first + count - 1;
+  const uint32_t index = last / FAT32_FAT_ENTRIES;
+
+  uint8_t sector[FAT32_SECTOR_SIZE];
+  fat32_alloc_fill(alloc, index, first, count, sector);
+  memcpy(alloc->boundary, sector, FAT32_SECTOR_SIZE);
+  alloc->boundary_index = index;
+
+  alloc->next_free = last + 1;
+  alloc->free_count = alloc->free_count > count ? alloc->free_count - count : 0;
+}
+
+fat32_entry_type_t fat32_dir_entry(const uint8_t *entry, fat32_file_t *file) {
+  if (entry[0] == 0x00) {
+    return FAT32_ENTRY_END;
+  }
+  if (entry[0] == ENTRY_DELETED) {
+    return FAT32_ENTRY_FREE;
+  }
+
+  const uint8_t attr = entry[11];
+  if (attr == ATTR_LONG_NAME || (attr & (ATTR_VOLUME_ID | ATTR_DIRECTORY))) {
+    return FAT32_ENTRY_OTHER;
+  }
+
+  memcpy(file->name, entry, FAT32_NAME_SIZE);
+  file->cluster = (read_u16(entry + 20) << 16) | read_u16(entry + 26);
+  file->size = read_u32(entry + 28);
+  return FAT32_ENTRY_FILE;
+}
+
+void fat32_dir_entry_set(uint8_t *entry, const fat32_file_t *file) {
+  memset(entry, 0, 32);
+  memcpy(entry, file->name, FAT32_NAME_SIZE);
+  entry[11] = ATTR_ARCHIVE;
+
+  write_u16(entry + 16, FILE_DATE);
+  write_u16(entry + 18, FILE_DATE);
+  write_u16(entry + 20, file->cluster >> 16);
+  write_u16(entry + 24, FILE_DATE);
+  write_u16(entry + 26, file->cluster & 0xFFFF);
+  write_u32(entry + 28, file->size);
+}
+
+void fat32_fsinfo_fill(uint8_t *sector, uint32_t free_count, uint32_t next_free) {
+  memset(sector, 0, FAT32_SECTOR_SIZE);
+  write_u32(sector + 0, FSINFO_LEAD_SIGNATURE);
+  write_u32(sector + 484, FSINFO_STRUCT_SIGNATURE);
+  write_u32(sector + 488, free_count);
+  write_u32(sector + 492, next_free);
+  write_u32(sector + 508, FSINFO_TRAIL_SIGNATURE);
+}
+
+// cluster sizes microsoft picks for a volume of this size
+static uint32_t format_sectors_per_cluster(uint32_t sectors) {
+  if (sectors <= 532480) {
+    return 1;
+  }
+  if (sectors <= 16777216) {
+    return 8;
+  }
+  if (sectors <= 33554432) {
+    return 16;
+  }
+  if (sectors <= 67108864) {
+    return 32;
+  }
+  return 64;
+}
+
+bool fat32_format_init(fat32_volume_t *vol, uint32_t card_sectors) {
+  if (card_sectors <= FORMAT_PART_ALIGN) {
+    return false;
+  }
+
+  vol->part_start = FORMAT_PART_ALIGN;
+  vol->part_size = card_sectors - FORMAT_PART_ALIGN;
+  vol->sectors_per_cluster = format_sectors_per_cluster(vol->part_size);
+  vol->fat_count = FORMAT_FAT_COUNT;
+  vol->root_cluster = FAT32_FIRST_CLUSTER;
+  vol->fsinfo_sector = 1;
+
+  // sized as if the fats took no space, which leaves a few spare entries at most
+  const uint32_t clusters = (vol->part_size - FORMAT_RESERVED_SECTORS) / vol->sectors_per_cluster;
+  vol->fat_size = (clusters + FAT32_FIRST_CLUSTER + FAT32_FAT_ENTRIES - 1) / FAT32_FAT_ENTRIES;
+
+  // pad the reserved area so clusters line up with the erase blocks of the card
+  const uint32_t meta_size = FORMAT_RESERVED_SECTORS + vol->fat_count * vol->fat_size;
+  const uint32_t pad = (vol->sectors_per_cluster - meta_size % vol->sectors_per_cluster) % vol->sectors_per_cluster;
+  vol->reserved_sectors = FORMAT_RESERVED_SECTORS + pad;
+
+  vol->cluster_count = (vol->part_size - meta_size - pad) / vol->sectors_per_cluster;
+  return vol->cluster_count >= FAT32_CLUSTERS_MIN;
+}
+
+static void format_mbr(const fat32_volume_t *vol, uint8_t *sector) {
+  uint8_t *entry = sector + PARTITION_TABLE;
+
+  // chs addresses are meaningless at this size, these are the values for out of range
+  entry[1] = 0xFE;
+  entry[2] = 0xFF;
+  entry[3] = 0xFF;
+  entry[4] = PARTITION_TYPE_FAT32_LBA;
+  entry[5] = 0xFE;
+  entry[6] = 0xFF;
+  entry[7] = 0xFF;
+  write_u32(entry + 8, vol->part_start);
+  write_u32(entry + 12, vol->part_size);
+
+  write_u16(sector + 510, BOOT_SIGNATURE);
+}
+
+static void format_boot_sector(const fat32_volume_t *vol, uint8_t *sector) {
+  sector[0] = 0xEB;
+  sector[1] = 0x58;
+  sector[2] = 0x90;
+  memcpy(sector + 3, "MSWIN4.1", 8);
+
+  write_u16(sector + 11, FAT32_SECTOR_SIZE);
+  sector[13] = vol->sectors_per_cluster;
+  write_u16(sector + 14, vol->reserved_sectors);
+  sector[16] = vol->fat_count;
+  sector[21] = 0xF8; // fixed media
+  write_u16(sector + 24, 63);
+  write_u16(sector + 26, 255);
+  write_u32(sector + 28, vol->part_start);
+  write_u32(sector + 32, vol->part_size);
+
+  write_u32(sector + 36, vol->fat_size);
+  write_u32(sector + 44, vol->root_cluster);
+  write_u16(sector + 48, vol->fsinfo_sector);
+  write_u16(sector + 50, FORMAT_BACKUP_BOOT_SECTOR);
+
+  sector[64] = 0x80; // drive number
+  sector[66] = 0x29; // the next three fields are valid
+  write_u32(sector + 67, FORMAT_VOLUME_ID);
+  memcpy(sector + 71, FORMAT_LABEL, FAT32_NAME_SIZE);
+  memcpy(sector + 82, "FAT32   ", 8);
+
+  write_u16(sector + 510, BOOT_SIGNATURE);
+}
+
+void fat32_format_sector(const fat32_volume_t *vol, uint32_t lba, uint8_t *sector) {
+  memset(sector, 0, FAT32_SECTOR_SIZE);
+
+  if (lba == 0) {
+    format_mbr(vol, sector);
+    return;
+  }
+  if (lba < vol->part_start) {
+    return;
+  }
+
+  const uint32_t offset = lba - vol->part_start;
+  if (offset == 0 || offset == FORMAT_BACKUP_BOOT_SECTOR) {
+    format_boot_sector(vol, sector);
+    return;
+  }
+  if (offset == vol->fsinfo_sector || offset == FORMAT_BACKUP_BOOT_SECTOR + vol->fsinfo_sector) {
+    // the root directory takes the first cluster
+    fat32_fsinfo_fill(sector, vol->cluster_count - 1, vol->root_cluster + 1);
+    return;
+  }
+
+  for (uint32_t i = 0; i < vol->fat_count; i++) {
+    if (lba == fat32_fat_lba(vol, i, 0)) {
+      write_u32(sector + 0, 0x0FFFFF00 | 0xF8);
+      write_u32(sector + 4, FAT32_CLUSTER_EOC);
+      write_u32(sector + vol->root_cluster * 4, FAT32_CLUSTER_EOC);
+      return;
+    }
+  }
+
+  if (lba == fat32_cluster_lba(vol, vol->root_cluster)) {
+    memcpy(sector, FORMAT_LABEL, FAT32_NAME_SIZE);
+    sector[11] = ATTR_VOLUME_ID;
+    write_u16(sector + 24, FILE_DATE);
+  }
+}
+
+uint32_t fat32_format_end(const fat32_volume_t *vol) {
+  return fat32_cluster_lba(vol, vol->root_cluster) + vol->sectors_per_cluster;
+}
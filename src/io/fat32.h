@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// minimal fat32 for blackbox logs on sd cards
+//
+// files only go into the root directory. a new file gets all clusters past the last used one,
+// so it is a single contiguous run and the card sees one long multi block write. the fat chain
+// and the directory entry are only written when the file is closed, a file that is never closed
+// leaves the volume as it was.
+//
+// nothing in here touches the card, the caller reads and writes the sectors.
+// this file does not depend on anything but the c library so host tools can use it as is.
+
+#define FAT32_SECTOR_SIZE 512
+#define FAT32_FAT_ENTRIES (FAT32_SECTOR_SIZE / 4)
+#define FAT32_DIR_ENTRIES (FAT32_SECTOR_SIZE / 32)
+#define FAT32_NAME_SIZE 11
+
+#define FAT32_FIRST_CLUSTER 2
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF
+#define FAT32_CLUSTER_EOC 0x0FFFFFFF
+#define FAT32_CLUSTER_EOC_MIN 0x0FFFFFF8
+
+#define FAT32_FILE_SIZE_MAX 0xFFFFFFFF
+
+typedef struct {
+  uint32_t part_start; // lba of the boot sector
+  uint32_t part_size;  // sectors
+
+  uint32_t sectors_per_cluster;
+  uint32_t reserved_sectors;
+  uint32_t fat_count;
+  uint32_t fat_size; // sectors per fat
+
+  uint32_t cluster_count;
+  uint32_t root_cluster;
+  uint32_t fsinfo_sector; // relative to part_start
+} fat32_volume_t;
+
+// where files can be put, from a scan of the whole fat
+typedef struct {
+  uint32_t next_free; // first cluster past the last used one
+  uint32_t free_count;
+
+  // the fat sector holding the last used cluster, as it is on the card
+  uint32_t boundary_index;
+  uint8_t boundary[FAT32_SECTOR_SIZE];
+} fat32_alloc_t;
+
+typedef enum {
+  FAT32_ENTRY_END,  // this and all following entries are unused
+  FAT32_ENTRY_FREE, // deleted
+  FAT32_ENTRY_FILE,
+  FAT32_ENTRY_OTHER, // directories, long names and the volume label
+} fat32_entry_type_t;
+
+typedef struct {
+  char name[FAT32_NAME_SIZE]; // space padded 8.3 without the dot
+  uint32_t cluster;
+  uint32_t size;
+} fat32_file_t;
+
+// returns the lba of the first fat32 partition, zero if there is none
+uint32_t fat32_find_partition(const uint8_t *mbr);
+bool fat32_mount(fat32_volume_t *vol, const uint8_t *boot, uint32_t lba);
+
+uint32_t fat32_fat_lba(const fat32_volume_t *vol, uint32_t copy, uint32_t index);
+uint32_t fat32_cluster_lba(const fat32_volume_t *vol, uint32_t cluster);
+uint32_t fat32_cluster_size(const fat32_volume_t *vol);
+// number of fat sectors that hold entries for actual clusters
+uint32_t fat32_fat_sectors(const fat32_volume_t *vol);
+uint32_t fat32_fat_entry(const uint8_t *sector, uint32_t cluster);
+
+void fat32_alloc_init(fat32_alloc_t *alloc);
+// feed every fat sector in order
+void fat32_alloc_scan(fat32_alloc_t *alloc, const fat32_volume_t *vol, uint32_t index, const uint8_t *sector);
+// content of a fat sector once a chain of count clusters from first is added
+void fat32_alloc_fill(const fat32_alloc_t *alloc, uint32_t index, uint32_t first, uint32_t count, uint8_t *sector);
+void fat32_alloc_commit(fat32_alloc_t *alloc, uint32_t first, uint32_t count);
+
+fat32_entry_type_t fat32_dir_entry(const uint8_t *entry, fat32_file_t *file);
+void fat32_dir_entry_set(uint8_t *entry, const fat32_file_t *file);
+
+void fat32_fsinfo_fill(uint8_t *sector, uint32_t free_count, uint32_t next_free);
+
+// lays out a new volume over the whole card, fails if the card is too small for fat32
+bool fat32_format_init(fat32_volume_t *vol, uint32_t card_sectors);
+// content of any sector up to the end of the root directory, only those have to be written
+void fat32_format_sector(const fat32_volume_t *vol, uint32_t lba, uint8_t *sector);
+// last sector written by a format, plus one
+uint32_t fat32_format_end(const fat32_volume_t *vol);
@@ -17,7 +17,9 @@
 #include "io/vtx.h"
 #include "osd/osd_render.h"
 #include "profile.h"
+#include "scheduler.h"
 #include "util/cbor_helper.h"
+#include "util/crc.h"
 
 #define ENCODE_BUFFER_SIZE 2048
 
@@ -27,7 +29,6 @@ static uint8_t frame_encode_buffer[ENCODE_BUFFER_SIZE + QUIC_HEADER_LEN];
 static uint8_t *encode_buffer = frame_encode_buffer + QUIC_HEADER_LEN;
 
 extern uint8_t blackbox_override;
-extern uint32_t blackbox_rate;
 
 #define check_cbor_error(cmd)               \
   if (res < CBOR_OK) {                      \
@@ -49,11 +50,15 @@ static cbor_result_t cbor_encode_motor_test_t(cbor_value_t *enc, const motor_tes
   return res;
 }
 
+static void quic_write_header(uint8_t *frame, quic_command cmd, quic_flag flag, uint32_t len) {
+  frame[0] = QUIC_MAGIC;
+  frame[1] = (cmd & (0xff >> 3)) | (flag & (0xff >> 5)) << 5;
+  frame[2] = (len >> 8) & 0xFF;
+  frame[3] = len & 0xFF;
+}
+
 static void quic_send_header(quic_t *quic, quic_command cmd, quic_flag flag, uint32_t len) {
-  frame_encode_buffer[0] = QUIC_MAGIC;
-  frame_encode_buffer[1] = (cmd & (0xff >> 3)) | (flag & (0xff >> 5)) << 5;
-  frame_encode_buffer[2] = (len >> 8) & 0xFF;
-  frame_encode_buffer[3] = len & 0xFF;
+  quic_write_header(frame_encode_buffer, cmd, flag, len);
 
   if (quic->send) {
     quic->send(frame_encode_buffer, QUIC_HEADER_LEN, quic->priv_data);
@@ -61,10 +66,7 @@ static void quic_send_header(quic_t *quic, quic_command cmd, quic_flag flag, uin
 }
 
 static void quic_send(quic_t *quic, quic_command cmd, quic_flag flag, uint8_t *data, uint32_t len) {
-  frame_encode_buffer[0] = QUIC_MAGIC;
-  frame_encode_buffer[1] = (cmd & (0xff >> 3)) | (flag & (0xff >> 5)) << 5;
-  frame_encode_buffer[2] = (len >> 8) & 0xFF;
-  frame_encode_buffer[3] = len & 0xFF;
+  quic_write_header(frame_encode_buffer, cmd, flag, len);
 
   if ((frame_encode_buffer + QUIC_HEADER_LEN) != data) {
     memcpy(frame_encode_buffer + QUIC_HEADER_LEN, data, len);
@@ -213,14 +215,35 @@ static void get_quic(quic_t *quic, cbor_value_t *dec) {
     quic_send(quic, QUIC_CMD_GET, QUIC_FLAG_NONE, encode_buffer, cbor_encoder_len(&enc));
     break;
   }
-#ifdef DEBUG
   case QUIC_VAL_PERF_COUNTERS: {
     res = cbor_encode_perf_counters(&enc);
     check_cbor_error(QUIC_CMD_GET);
     quic_send(quic, QUIC_CMD_GET, QUIC_FLAG_NONE, encode_buffer, cbor_encoder_len(&enc));
     break;
   }
-#endif
+  case QUIC_VAL_PERF_HISTOGRAMS: {
+    // the bucket starts go first, followed by one histogram per counter
+    res = cbor_encode_perf_histogram_buckets(&enc);
+    check_cbor_error(QUIC_CMD_GET);
+    quic_send(quic, QUIC_CMD_GET, QUIC_FLAG_STREAMING, encode_buffer, cbor_encoder_len(&enc));
+
+    for (uint32_t i = 0; i < PERF_COUNTER_MAX; i++) {
+      cbor_encoder_init(&enc, encode_buffer, ENCODE_BUFFER_SIZE);
+      res = cbor_encode_perf_histogram(&enc, i);
+      check_cbor_error(QUIC_CMD_GET);
+
+      quic_send(quic, QUIC_CMD_GET, QUIC_FLAG_STREAMING, encode_buffer, cbor_encoder_len(&enc));
+    }
+
+    quic_send_header(quic, QUIC_CMD_GET, QUIC_FLAG_STREAMING, 0);
+    break;
+  }
+  case QUIC_VAL_TASKS: {
+    res = cbor_encode_tasks(&enc);
+    check_cbor_error(QUIC_CMD_GET);
+    quic_send(quic, QUIC_CMD_GET, QUIC_FLAG_NONE, encode_buffer, cbor_encoder_len(&enc));
+    break;
+  }
   default:
     quic_errorf(QUIC_CMD_GET, "INVALID VALUE %d", value);
     break;
@@ -317,6 +340,15 @@ static void set_quic(quic_t *quic, cbor_value_t *dec) {
     break;
   }
 #endif
+  case QUIC_VAL_PERF_COUNTERS: {
+    perf_counter_reset();
+
+    res = cbor_encode_perf_counters(&enc);
+    check_cbor_error(QUIC_CMD_SET);
+
+    quic_send(quic, QUIC_CMD_SET, QUIC_FLAG_NONE, encode_buffer, cbor_encoder_len(&enc));
+    break;
+  }
   case QUIC_VAL_BIND_INFO: {
     res = cbor_decode_rx_bind_storage_t(dec, &bind_storage);
     check_cbor_error(QUIC_CMD_SET);
@@ -337,6 +369,56 @@ static void set_quic(quic_t *quic, cbor_value_t *dec) {
 }
 
 #ifdef ENABLE_BLACKBOX
+static void write_u32(uint8_t *buf, uint32_t val) {
+  buf[0] = val;
+  buf[1] = val >> 8;
+  buf[2] = val >> 16;
+  buf[3] = val >> 24;
+}
+
+// the next chunk is read from the flash while the last one goes out over usb
+static void blackbox_send_range(quic_t *quic, const uint32_t file_index, uint32_t offset, const uint32_t end) {
+  static uint8_t frames[2][QUIC_HEADER_LEN + QUIC_BLACKBOX_CHUNK_HEADER + QUIC_BLACKBOX_CHUNK_SIZE];
+  const uint32_t data_offset = QUIC_HEADER_LEN + QUIC_BLACKBOX_CHUNK_HEADER;
+
+  uint32_t index = 0;
+  uint32_t size = min(end - offset, QUIC_BLACKBOX_CHUNK_SIZE);
+  if (size > 0) {
+    while (!data_flash_read_start(file_index, offset, frames[index] + data_offset, size)) {
+      __NOP();
+    }
+  }
+
+  while (size > 0) {
+    while (!data_flash_read_ready()) {
+      __NOP();
+    }
+
+    uint8_t *frame = frames[index];
+    const uint32_t frame_offset = offset;
+    const uint32_t frame_size = size;
+
+    offset += size;
+    index = (index + 1) % 2;
+    size = min(end - offset, QUIC_BLACKBOX_CHUNK_SIZE);
+    if (size > 0) {
+      while (!data_flash_read_start(file_index, offset, frames[index] + data_offset, size)) {
+        __NOP();
+      }
+    }
+
+    const uint32_t len = QUIC_BLACKBOX_CHUNK_HEADER + frame_size;
+    quic_write_header(frame, QUIC_CMD_BLACKBOX, QUIC_FLAG_STREAMING, len);
+    write_u32(frame + QUIC_HEADER_LEN, frame_offset);
+    write_u32(frame + QUIC_HEADER_LEN + 4, crc32_data(0, frame + data_offset, frame_size));
+    if (quic->send) {
+      quic->send(frame, QUIC_HEADER_LEN + len, quic->priv_data);
+    }
+  }
+
+  quic_send_header(quic, QUIC_CMD_BLACKBOX, QUIC_FLAG_STREAMING, 0);
+}
+
 static void process_blackbox(quic_t *quic, cbor_value_t *dec) {
   cbor_result_t res = CBOR_OK;
 
@@ -389,6 +471,11 @@ static void process_blackbox(quic_t *quic, cbor_value_t *dec) {
     res = cbor_decode_uint8(dec, &file_index);
     check_cbor_error(QUIC_CMD_BLACKBOX);
 
+    if (!data_flash_can_read()) {
+      quic_errorf(QUIC_CMD_BLACKBOX, "BLACKBOX BUSY");
+      break;
+    }
+
     quic_send(quic, QUIC_CMD_BLACKBOX, QUIC_FLAG_STREAMING, encode_buffer, cbor_encoder_len(&enc));
 
     if (data_flash_header.file_num > file_index) {
@@ -409,6 +496,54 @@ static void process_blackbox(quic_t *quic, cbor_value_t *dec) {
 
     break;
   }
+  case QUIC_BLACKBOX_GET_RANGE: {
+    uint8_t file_index;
+    res = cbor_decode_uint8(dec, &file_index);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    uint32_t offset;
+    res = cbor_decode_uint32(dec, &offset);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    uint32_t size;
+    res = cbor_decode_uint32(dec, &size);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    if (file_index >= data_flash_header.file_num) {
+      quic_errorf(QUIC_CMD_BLACKBOX, "INVALID FILE %d", file_index);
+      break;
+    }
+    if (!data_flash_can_read()) {
+      quic_errorf(QUIC_CMD_BLACKBOX, "BLACKBOX BUSY");
+      break;
+    }
+
+    const uint32_t file_size = data_flash_header.files[file_index].size;
+    const uint32_t end = (size == 0 || size > file_size - min(offset, file_size)) ? file_size : offset + size;
+    offset = min(offset, file_size) / QUIC_BLACKBOX_RANGE_ALIGN * QUIC_BLACKBOX_RANGE_ALIGN;
+    size = end - offset;
+
+    res = cbor_encode_map_indefinite(&enc);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    res = cbor_encode_str(&enc, "offset");
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+    res = cbor_encode_uint32(&enc, &offset);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    res = cbor_encode_str(&enc, "size");
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+    res = cbor_encode_uint32(&enc, &size);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    res = cbor_encode_end_indefinite(&enc);
+    check_cbor_error(QUIC_CMD_BLACKBOX);
+
+    quic_send(quic, QUIC_CMD_BLACKBOX, QUIC_FLAG_STREAMING, encode_buffer, cbor_encoder_len(&enc));
+
+    blackbox_send_range(quic, file_index, offset, end);
+    break;
+  }
   default:
     quic_errorf(QUIC_CMD_BLACKBOX, "INVALID CMD %d", cmd);
     break;
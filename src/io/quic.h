@@ -8,7 +8,7 @@
 #define QUIC_MAGIC '#'
 #define QUIC_HEADER_LEN 4
 
-#define QUIC_PROTOCOL_VERSION MAKE_SEMVER(0, 1, 2)
+#define QUIC_PROTOCOL_VERSION MAKE_SEMVER(0, 1, 3)
 
 typedef enum {
   QUIC_CMD_INVALID,
@@ -25,9 +25,18 @@ typedef enum {
 typedef enum {
   QUIC_BLACKBOX_RESET,
   QUIC_BLACKBOX_LIST,
-  QUIC_BLACKBOX_GET
+  QUIC_BLACKBOX_GET,
+  // file index, offset and size, a size of zero reads to the end of the file.
+  // the reply is a cbor map with the offset and size actually sent, the start is rounded down
+  // to QUIC_BLACKBOX_RANGE_ALIGN. then come chunks of the little endian offset, the crc32 of
+  // the data and the data itself, and an empty frame at the end.
+  QUIC_BLACKBOX_GET_RANGE,
 } quic_blackbox_command;
 
+#define QUIC_BLACKBOX_RANGE_ALIGN 512
+#define QUIC_BLACKBOX_CHUNK_HEADER 8
+#define QUIC_BLACKBOX_CHUNK_SIZE 2048
+
 typedef enum {
   QUIC_MOTOR_TEST_STATUS,
   QUIC_MOTOR_TEST_ENABLE,
@@ -59,6 +68,8 @@ typedef enum {
   QUIC_VAL_BLHEL_SETTINGS,
   QUIC_VAL_BIND_INFO,
   QUIC_VAL_PERF_COUNTERS,
+  QUIC_VAL_TASKS,
+  QUIC_VAL_PERF_HISTOGRAMS,
 } quic_values;
 
 typedef void (*quic_send_fn_t)(uint8_t *data, uint32_t len, void *priv);
@@ -1,5 +1,7 @@
 #include "io/vbat.h"
 
+#include <math.h>
+
 #include "drv_adc.h"
 #include "flash.h"
 #include "flight/control.h"
@@ -14,7 +16,27 @@
 
 extern profile_t profile;
 
+// the filter coefficients are per loop, from when vbat_calc ran every loop.
+// stepping once per task period they are raised to the loops that fit in it, so the filters keep their time
+#define VBAT_FILTER_STEPS ((float)VBAT_PERIOD_US / (float)LOOPTIME)
+
+static float vbat_coeff;
+static float ibat_coeff;
+static float vbat_decay_coeff;
+#ifdef AUTO_VDROP_FACTOR
+static float vdrop_hpf_coeff;
+static float vdrop_score_coeff;
+#endif
+
 void vbat_init() {
+  vbat_coeff = powf(0.9968f, VBAT_FILTER_STEPS);
+  ibat_coeff = powf(FILTERCALC(1000, 5000e3), VBAT_FILTER_STEPS);
+  vbat_decay_coeff = powf(FILTERCALC(1000, 18000e3), VBAT_FILTER_STEPS);
+#ifdef AUTO_VDROP_FACTOR
+  vdrop_hpf_coeff = powf(FILTERCALC(1000 * 12, 6000e3), VBAT_FILTER_STEPS);
+  vdrop_score_coeff = powf(FILTERCALC(1000 * 12, 60e6), VBAT_FILTER_STEPS);
+#endif
+
   int count = 0;
   while (count < 5000) {
     state.vbat = adc_read(ADC_CHAN_VBAT);
@@ -43,12 +65,12 @@ void vbat_calc() {
 
   // read acd and scale based on processor voltage
   state.ibat = adc_read(ADC_CHAN_IBAT);
-  lpf(&state.ibat_filtered, state.ibat, FILTERCALC(1000, 5000e3));
+  lpf(&state.ibat_filtered, state.ibat, ibat_coeff);
 
   // li-ion battery model compensation time decay ( 18 seconds )
   state.vbat = adc_read(ADC_CHAN_VBAT);
-  lpf(&state.vbat_filtered, state.vbat, 0.9968f);
-  lpf(&state.vbat_filtered_decay, state.vbat_filtered, FILTERCALC(1000, 18000e3));
+  lpf(&state.vbat_filtered, state.vbat, vbat_coeff);
+  lpf(&state.vbat_filtered_decay, state.vbat_filtered, vbat_decay_coeff);
 
   state.vbat_cell_avg = state.vbat_filtered_decay / (float)state.lipo_cell_count;
 
@@ -56,7 +78,7 @@ void vbat_calc() {
   // filter motorpwm so it has the same delay as the filtered voltage
   // ( or they can use a single filter)
   static float thrfilt = 0;
-  lpf(&thrfilt, state.thrsum, 0.9968f); // 0.5 sec at 1.6ms loop time
+  lpf(&thrfilt, state.thrsum, vbat_coeff);
 
   float tempvolt = state.vbat_filtered * (1.00f + CF1) - state.vbat_filtered_decay * (CF1);
 
@@ -82,10 +104,10 @@ void vbat_calc() {
     //  y(n) = x(n) - x(n-1) + R * y(n-1)
     //  out = in - lastin + coeff*lastout
     // hpf
-    ans = vcomp[z] - lastin[z] + FILTERCALC(1000 * 12, 6000e3) * lastout[z];
+    ans = vcomp[z] - lastin[z] + vdrop_hpf_coeff * lastout[z];
     lastin[z] = vcomp[z];
     lastout[z] = ans;
-    lpf(&score[z], ans * ans, FILTERCALC(1000 * 12, 60e6));
+    lpf(&score[z], ans * ans, vdrop_score_coeff);
     z++;
 
     if (z >= 12) {
@@ -1,5 +1,8 @@
 #pragma once
 
+// vbat_calc runs as a scheduler task with this period
+#define VBAT_PERIOD_US 1000
+
 void vbat_init();
 void vbat_calc();
 void vbat_lvc_throttle();
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include "drv_rgb_led.h"
 #include "drv_serial.h"
 #include "drv_spi.h"
+#include "drv_spi_gyro.h"
 #include "drv_spi_soft.h"
 #include "drv_time.h"
 #include "drv_usb.h"
@@ -33,6 +34,7 @@
 #include "profile.h"
 #include "project.h"
 #include "reset.h"
+#include "scheduler.h"
 #include "rx.h"
 #include "util/util.h"
 
@@ -40,6 +42,9 @@ uint32_t lastlooptime;
 uint8_t looptime_warning;
 uint8_t blown_loop_counter;
 
+// looptime picked by the autodetect, the loop might run a little off it when synced to the gyro
+static uint32_t looptime_target = LOOPTIME;
+
 __attribute__((__used__)) void memory_section_init() {
 #ifdef USE_FAST_RAM
   extern uint8_t _fast_ram_start;
@@ -94,12 +99,15 @@ void looptime_update() {
   if (loop_counter == 200) {
     loop_avg /= 200;
 
-    if (loop_avg < 130.f) {
-      state.looptime_autodetect = LOOPTIME_8K;
+    if (profile.filter.pid_rate_divider > 1) {
+      // the divider already takes the load off, slowing down would sample the gyro below the configured rate
+      looptime_target = LOOPTIME;
+    } else if (loop_avg < 130.f) {
+      looptime_target = LOOPTIME_8K;
     } else if (loop_avg < 255.f) {
-      state.looptime_autodetect = LOOPTIME_4K;
+      looptime_target = LOOPTIME_4K;
     } else {
-      state.looptime_autodetect = LOOPTIME_2K;
+      looptime_target = LOOPTIME_2K;
     }
 
     loop_counter++;
@@ -119,11 +127,114 @@ void looptime_update() {
   }
 }
 
+static uint8_t blackbox_active = 0;
+
+static void task_rx() {
+  perf_counter_start(PERF_COUNTER_RX);
+  rx_update();
+  perf_counter_end(PERF_COUNTER_RX);
+}
+
+static void task_blackbox() {
+#ifdef ENABLE_BLACKBOX
+  perf_counter_start(PERF_COUNTER_BLACKBOX);
+  blackbox_active = blackbox_update();
+  perf_counter_end(PERF_COUNTER_BLACKBOX);
+#endif
+}
+
+static void task_osd() {
+  // flash is occupying the spi bus
+  if (blackbox_active) {
+    return;
+  }
+
+  perf_counter_start(PERF_COUNTER_OSD);
+  osd_display();
+  perf_counter_end(PERF_COUNTER_OSD);
+}
+
+static void task_gestures() {
+  if (flags.on_ground && !flags.gestures_disabled) {
+    gestures();
+  }
+}
+
+static void task_rgb_led() {
+#if (RGB_LED_NUMBER > 0)
+  rgb_led_lvc();
+#ifdef RGB_LED_DMA
+  rgb_dma_start();
+#endif
+#endif
+}
+
+typedef enum {
+  TASK_RX,
+  TASK_BLACKBOX,
+  TASK_VBAT,
+  TASK_OSD,
+  TASK_LED,
+  TASK_RGB_LED,
+  TASK_GESTURES,
+  TASK_BUZZER,
+  TASK_VTX,
+
+  TASK_MAX
+} tasks_t;
+
+// rx and blackbox sample the loop and have to run every time, the rest only needs a fraction of the loop rate
+static task_t tasks[TASK_MAX] = {
+    [TASK_RX] = TASK_INIT("RX", task_rx, TASK_PRIORITY_REALTIME, 0, 20),
+    [TASK_BLACKBOX] = TASK_INIT("BLACKBOX", task_blackbox, TASK_PRIORITY_REALTIME, 0, 20),
+    [TASK_VBAT] = TASK_INIT("VBAT", vbat_calc, TASK_PRIORITY_HIGH, VBAT_PERIOD_US, 10),
+    [TASK_OSD] = TASK_INIT("OSD", task_osd, TASK_PRIORITY_MEDIUM, 1000, 30),
+    [TASK_LED] = TASK_INIT("LED", led_update, TASK_PRIORITY_LOW, 1000, 5),
+    [TASK_RGB_LED] = TASK_INIT("RGB_LED", task_rgb_led, TASK_PRIORITY_LOW, 1000, 10),
+    [TASK_GESTURES] = TASK_INIT("GESTURES", task_gestures, TASK_PRIORITY_LOW, 5000, 10),
+    [TASK_BUZZER] = TASK_INIT("BUZZER", buzzer_update, TASK_PRIORITY_LOW, 5000, 5),
+    [TASK_VTX] = TASK_INIT("VTX", vtx_update, TASK_PRIORITY_LOW, 5000, 20),
+};
+
+// sample to motor latency and jitter of the loop period, the worst case is taken over roughly one second
+void gyro_stats_update() {
+  static uint32_t latency_max = 0;
+  static uint32_t jitter_max = 0;
+  static uint32_t loop_counter = 0;
+  static float period_avg = 0;
+
+  const uint32_t latency = (time_cycles() - gyro_sample_info.sample_time) / TICKS_PER_US;
+  lpf(&state.gyro_latency, latency, 0.99f);
+  latency_max = max(latency_max, latency);
+
+  if (period_avg == 0) {
+    period_avg = state.looptime_us;
+  }
+  lpf(&period_avg, state.looptime_us, 0.99f);
+
+  const uint32_t jitter = fabsf(state.looptime_us - period_avg);
+  lpf(&state.gyro_jitter, jitter, 0.99f);
+  jitter_max = max(jitter_max, jitter);
+
+  loop_counter++;
+  if (loop_counter >= (1000000 / state.pid_looptime_autodetect)) {
+    state.gyro_latency_max = latency_max;
+    state.gyro_jitter_max = jitter_max;
+
+    latency_max = 0;
+    jitter_max = 0;
+    loop_counter = 0;
+  }
+}
+
 __attribute__((__used__)) int main() {
   // init some initial values
   // attempt 8k looptime for f405 or 4k looptime for f411
   state.looptime = LOOPTIME * 1e-6;
   state.looptime_autodetect = LOOPTIME;
+  state.pid_looptime = state.looptime;
+  state.pid_looptime_autodetect = state.looptime_autodetect;
+  state.gyro_sample_period = state.looptime_autodetect;
 
   // init timer so we can use delays etc
   time_init();
@@ -195,9 +306,13 @@ __attribute__((__used__)) int main() {
 
   osd_clear();
   perf_counter_init();
+  scheduler_init(tasks, TASK_MAX, time_micros);
 
   lastlooptime = time_micros();
 
+  uint32_t last_pid_time = lastlooptime;
+  uint8_t pid_loop_counter = 0;
+
   while (1) {
     perf_counter_start(PERF_COUNTER_TOTAL);
 
@@ -215,9 +330,17 @@ __attribute__((__used__)) int main() {
     }
 
     looptime_update();
+#ifdef USE_GYRO_EXTI
+    state.looptime_autodetect = gyro_spi_exti_looptime(looptime_target);
+#else
+    state.looptime_autodetect = looptime_target;
+#endif
 
     state.looptime = state.looptime_us * 1e-6f;
 
+    const uint8_t pid_rate_divider = constrain(profile.filter.pid_rate_divider, 1, PID_RATE_DIVIDER_MAX);
+    state.pid_looptime_autodetect = state.looptime_autodetect * pid_rate_divider;
+
     state.uptime += state.looptime;
     if (flags.arm_state) {
       state.armtime += state.looptime;
@@ -228,59 +351,28 @@ __attribute__((__used__)) int main() {
     sixaxis_read();
     perf_counter_end(PERF_COUNTER_GYRO);
 
-    // all flight calculations and motors
-    perf_counter_start(PERF_COUNTER_CONTROL);
-    control();
-    perf_counter_end(PERF_COUNTER_CONTROL);
+    // all flight calculations and motors, only on every nth gyro sample
+    pid_loop_counter++;
+    if (pid_loop_counter >= pid_rate_divider) {
+      state.pid_looptime = max(time - last_pid_time, 1) * 1e-6f;
+      last_pid_time = time;
+      pid_loop_counter = 0;
 
-    perf_counter_start(PERF_COUNTER_MISC);
+      perf_counter_start(PERF_COUNTER_CONTROL);
+      control();
+      perf_counter_end(PERF_COUNTER_CONTROL);
 
-    // attitude calculations for level mode
-    imu_calc();
-
-    // battery low logic
-    vbat_calc();
-
-    // check gestures
-    if (flags.on_ground && !flags.gestures_disabled) {
-      gestures();
+      gyro_stats_update();
     }
 
-    // handle led commands
-    led_update();
-
-#if (RGB_LED_NUMBER > 0)
-    // RGB led control
-    rgb_led_lvc();
-#ifdef RGB_LED_DMA
-    rgb_dma_start();
-#endif
-#endif
-
-    buzzer_update();
-    vtx_update();
+    // attitude calculations for level mode
+    imu_calc();
 
+    // everything else runs in the time left until the next loop
+    perf_counter_start(PERF_COUNTER_MISC);
+    scheduler_run(lastlooptime + state.looptime_autodetect);
     perf_counter_end(PERF_COUNTER_MISC);
 
-    // receiver function
-    perf_counter_start(PERF_COUNTER_RX);
-    rx_update();
-    perf_counter_end(PERF_COUNTER_RX);
-
-    uint8_t blackbox_active = 0;
-
-#ifdef ENABLE_BLACKBOX
-    perf_counter_start(PERF_COUNTER_BLACKBOX);
-    blackbox_active = blackbox_update();
-    perf_counter_end(PERF_COUNTER_BLACKBOX);
-#endif
-
-    if (!blackbox_active) {
-      perf_counter_start(PERF_COUNTER_OSD);
-      osd_display();
-      perf_counter_end(PERF_COUNTER_OSD);
-    }
-
     state.cpu_load = (time_micros() - lastlooptime);
 
     perf_counter_end(PERF_COUNTER_TOTAL);
@@ -298,8 +390,13 @@ __attribute__((__used__)) int main() {
       motor_test.active = 0;
     }
 
+#ifdef USE_GYRO_EXTI
+    // the next loop starts as soon as the data ready triggered read has landed
+    gyro_spi_exti_wait(state.looptime_autodetect);
+#else
     while ((time_micros() - time) < state.looptime_autodetect)
       __NOP();
+#endif
 
   } // end loop
 }
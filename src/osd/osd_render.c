@@ -313,12 +313,20 @@ static void print_osd_flightmode(osd_element_t *el) {
   osd_write_data(flightmode_labels[flightmode], 21);
 }
 
+#define OSD_RSSI_FILTER_TIME_US 2e6f
+
 static void print_osd_rssi(osd_element_t *el) {
   static float rx_rssi_filt;
+  static uint32_t last_time = 0;
   if (flags.failsafe)
     state.rx_rssi = 0.0f;
 
-  lpf(&rx_rssi_filt, state.rx_rssi, FILTERCALC(state.looptime * 1e6f * 133.0f, 2e6f)); // 2 second filtertime and 15hz refresh rate @4k, 30hz@ 8k loop
+  // the osd task draws one element per run, the filter steps once per pass over all of them
+  const uint32_t now = time_micros();
+  const float period = last_time ? min((float)(now - last_time), OSD_RSSI_FILTER_TIME_US / 3) : 0.0f;
+  last_time = now;
+
+  lpf(&rx_rssi_filt, state.rx_rssi, FILTERCALC(period, OSD_RSSI_FILTER_TIME_US));
 
   osd_start(osd_attr(el), el->pos_x, el->pos_y);
   osd_write_uint(rx_rssi_filt - 0.5f, 4);
@@ -962,6 +970,9 @@ void osd_display() {
         " PT1",
         " PT2",
         " PT3",
+        // the biquad types are set from the configurator, the menu only shows them
+        " BLP",
+        "NTCH",
     };
 
     osd_menu_select(4, 4, "PASS 1 TYPE");
@@ -986,6 +997,23 @@ void osd_display() {
       profile.filter.gyro[1].cutoff_freq = osd_menu_adjust_float(profile.filter.gyro[1].cutoff_freq, 10, 50, 500);
     }
 
+    const char *notch_enable_labels[] = {
+        " OFF",
+        "  ON",
+    };
+
+    osd_menu_select(4, 8, "DYN NOTCH");
+    if (osd_menu_select_enum(18, 8, profile.filter.gyro_dynamic_notch_enable, notch_enable_labels)) {
+      profile.filter.gyro_dynamic_notch_enable = osd_menu_adjust_int(profile.filter.gyro_dynamic_notch_enable, 1, 0, 1);
+      osd_state.reboot_fc_requested = 1;
+    }
+
+    osd_menu_select(4, 9, "RPM FILTER");
+    if (osd_menu_select_enum(18, 9, profile.filter.gyro_rpm_filter_enable, notch_enable_labels)) {
+      profile.filter.gyro_rpm_filter_enable = osd_menu_adjust_int(profile.filter.gyro_rpm_filter_enable, 1, 0, 1);
+      osd_state.reboot_fc_requested = 1;
+    }
+
     osd_menu_select_save_and_exit(4);
     osd_menu_finish();
     break;
@@ -999,6 +1027,10 @@ void osd_display() {
         "NONE",
         " PT1",
         " PT2",
+        " PT3",
+        // the biquad types are set from the configurator, the menu only shows them
+        " BLP",
+        "NTCH",
     };
 
     osd_menu_select(4, 3, "PASS 1 TYPE");
@@ -1491,11 +1523,29 @@ void osd_display() {
         osd_write_str("% USAGE");
       }
 
+      const char *capture_labels[] = {
+          "OFF        ",
+          "GYRO       ",
+          "GYRO+FILTER",
+      };
+      osd_menu_select_enum_adjust(4, 6, "CAPTURE", 16, &profile.blackbox.capture, capture_labels, BLACKBOX_CAPTURE_OFF, BLACKBOX_CAPTURE_GYRO_FILTERED);
+
+      const char *capture_rate_labels[] = {
+          "SAMPLE",
+          "LOOP  ",
+      };
+      osd_menu_select_enum_adjust(4, 7, "CAPTURE RATE", 16, &profile.blackbox.capture_rate, capture_rate_labels, BLACKBOX_CAPTURE_RATE_SAMPLE, BLACKBOX_CAPTURE_RATE_LOOP);
+
+      osd_menu_select(4, 8, "CAPTURE MS");
+      if (osd_menu_select_int(16, 8, profile.blackbox.capture_ms, 5)) {
+        profile.blackbox.capture_ms = osd_menu_adjust_int(profile.blackbox.capture_ms, 500, 500, 30000);
+      }
+
       if (osd_menu_button(4, 13, "RESET")) {
         osd_push_screen_replace(OSD_SCREEN_BLACKBOX);
         reset_state = 1;
       }
-      osd_menu_select_exit(4);
+      osd_menu_select_save_and_exit(4);
       osd_menu_finish();
       break;
 
@@ -141,7 +141,7 @@ void rx_lqi_update_direct(float rssi) {
 }
 
 static void rx_apply_smoothing() {
-  filter_lp_pt1_coeff(&rx_filter, rx_smoothing_hz());
+  filter_lp_pt1_coeff(&rx_filter, rx_smoothing_hz(), state.looptime_autodetect);
 
   for (int i = 0; i < 4; ++i) {
     if (i == 3) {
@@ -188,7 +188,7 @@ void rx_init() {
   state.aux[AUX_CHANNEL_GESTURE] = 1;
 #endif
 
-  filter_lp_pt1_init(&rx_filter, rx_filter_state, 4, rx_smoothing_hz());
+  filter_lp_pt1_init(&rx_filter, rx_filter_state, 4, rx_smoothing_hz(), state.looptime_autodetect);
 
   switch (profile.receiver.protocol) {
   case RX_PROTOCOL_INVALID:
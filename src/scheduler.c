@@ -0,0 +1,169 @@
+#include "scheduler.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "util/cbor_helper.h"
+
+// the scheduler only depends on the time source passed to scheduler_init
+// and can be driven by a simulated clock
+
+static task_t *task_list = NULL;
+static uint32_t task_count = 0;
+static scheduler_time_fn_t scheduler_time = NULL;
+static uint32_t scheduler_pass = 0;
+
+void scheduler_init(task_t *tasks, uint32_t count, scheduler_time_fn_t time_fn) {
+  task_list = tasks;
+  task_count = count;
+  scheduler_time = time_fn;
+  scheduler_pass = 0;
+
+  const uint32_t now = scheduler_time();
+  for (uint32_t i = 0; i < task_count; i++) {
+    task_t *task = &task_list[i];
+
+    task->last_run_us = now;
+    task->last_pass = 0;
+    task->defer_streak = 0;
+
+    task->run_count = 0;
+    task->overrun_count = 0;
+    task->defer_count = 0;
+    task->runtime_us = 0;
+    task->runtime_max_us = 0;
+  }
+}
+
+static bool task_is_due(const task_t *task, uint32_t now) {
+  if (task->last_pass == scheduler_pass) {
+    // already ran during this loop
+    return false;
+  }
+  if (task->period_us == 0) {
+    return true;
+  }
+  return (now - task->last_run_us) >= task->period_us;
+}
+
+static bool task_fits(const task_t *task, uint32_t now, uint32_t deadline) {
+  if (task->priority == TASK_PRIORITY_REALTIME || task->defer_streak >= TASK_MAX_DEFER) {
+    return true;
+  }
+  const int32_t slack = deadline - now;
+  return slack >= 0 && (uint32_t)slack >= task->budget_us;
+}
+
+static uint32_t task_lateness(const task_t *task, uint32_t now) {
+  if (task->period_us == 0) {
+    return 0;
+  }
+  return (now - task->last_run_us) - task->period_us;
+}
+
+static task_t *scheduler_next_task(uint32_t now, uint32_t deadline) {
+  task_t *next = NULL;
+
+  for (uint32_t i = 0; i < task_count; i++) {
+    task_t *task = &task_list[i];
+    if (!task_is_due(task, now) || !task_fits(task, now, deadline)) {
+      continue;
+    }
+
+    if (next == NULL ||
+        task->priority < next->priority ||
+        (task->priority == next->priority && task_lateness(task, now) > task_lateness(next, now))) {
+      next = task;
+    }
+  }
+
+  return next;
+}
+
+static void scheduler_run_task(task_t *task, uint32_t start) {
+  task->fn();
+
+  const uint32_t end = scheduler_time();
+  task->runtime_us = end - start;
+  if (task->runtime_us > task->runtime_max_us) {
+    task->runtime_max_us = task->runtime_us;
+  }
+  if (task->budget_us && task->runtime_us > task->budget_us) {
+    task->overrun_count++;
+  }
+
+  if (task->period_us && (start - task->last_run_us) < 2 * task->period_us) {
+    // keep the phase so the average rate matches the period
+    task->last_run_us += task->period_us;
+  } else {
+    task->last_run_us = start;
+  }
+
+  task->last_pass = scheduler_pass;
+  task->defer_streak = 0;
+  task->run_count++;
+}
+
+void scheduler_run(uint32_t deadline_us) {
+  scheduler_pass++;
+
+  while (1) {
+    const uint32_t now = scheduler_time();
+
+    task_t *task = scheduler_next_task(now, deadline_us);
+    if (task == NULL) {
+      break;
+    }
+
+    scheduler_run_task(task, now);
+  }
+
+  const uint32_t now = scheduler_time();
+  for (uint32_t i = 0; i < task_count; i++) {
+    task_t *task = &task_list[i];
+    if (task_is_due(task, now)) {
+      task->defer_streak++;
+      task->defer_count++;
+    }
+  }
+}
+
+cbor_result_t cbor_encode_tasks(cbor_value_t *enc) {
+  CBOR_CHECK_ERROR(cbor_result_t res = cbor_encode_array_indefinite(enc));
+
+  for (uint32_t i = 0; i < task_count; i++) {
+    const task_t *task = &task_list[i];
+
+    CBOR_CHECK_ERROR(res = cbor_encode_map_indefinite(enc));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "name"));
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, task->name));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "period"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->period_us));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "budget"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->budget_us));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "runs"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->run_count));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "overruns"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->overrun_count));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "deferred"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->defer_count));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "runtime"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->runtime_us));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_str(enc, "runtime_max"));
+    CBOR_CHECK_ERROR(res = cbor_encode_uint32(enc, &task->runtime_max_us));
+
+    CBOR_CHECK_ERROR(res = cbor_encode_end_indefinite(enc));
+  }
+
+  CBOR_CHECK_ERROR(res = cbor_encode_end_indefinite(enc));
+
+  return res;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cbor.h>
+#include <stdint.h>
+
+// a task that is due but did not fit into the slack is forced to run after being deferred this many times
+#define TASK_MAX_DEFER 8
+
+typedef enum {
+  TASK_PRIORITY_REALTIME, // runs whenever it is due, regardless of the slack left
+  TASK_PRIORITY_HIGH,
+  TASK_PRIORITY_MEDIUM,
+  TASK_PRIORITY_LOW,
+} task_priority_t;
+
+typedef void (*task_fn_t)();
+typedef uint32_t (*scheduler_time_fn_t)();
+
+typedef struct {
+  const char *name;
+  task_fn_t fn;
+  task_priority_t priority;
+  uint32_t period_us; // zero runs the task once per loop
+  uint32_t budget_us; // expected worst case runtime, used to decide if the task fits into the slack
+
+  uint32_t last_run_us;
+  uint32_t last_pass;
+  uint32_t defer_streak;
+
+  uint32_t run_count;
+  uint32_t overrun_count; // runs that took longer than the budget
+  uint32_t defer_count;   // loops where the task was due but did not fit
+  uint32_t runtime_us;
+  uint32_t runtime_max_us;
+} task_t;
+
+#define TASK_INIT(_name, _fn, _priority, _period_us, _budget_us) \
+  {                                                              \
+    .name = _name,                                               \
+    .fn = _fn,                                                   \
+    .priority = _priority,                                       \
+    .period_us = _period_us,                                     \
+    .budget_us = _budget_us,                                     \
+  }
+
+void scheduler_init(task_t *tasks, uint32_t count, scheduler_time_fn_t time_fn);
+
+// runs due tasks until none are left or the next one would not finish before deadline_us
+void scheduler_run(uint32_t deadline_us);
+
+cbor_result_t cbor_encode_tasks(cbor_value_t *enc);
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// host replacements for the cmsis and stm32 ll bits used outside of the drivers.
+// peripherals the simulator does not model are opaque, the rest is backed by sitl_*.c
+
+typedef int32_t IRQn_Type;
+
+typedef struct {
+  uint32_t unused;
+} GPIO_TypeDef;
+
+typedef struct {
+  uint32_t unused;
+} SPI_TypeDef;
+
+typedef struct {
+  uint32_t unused;
+} TIM_TypeDef;
+
+typedef struct {
+  uint32_t unused;
+} DMA_TypeDef;
+
+typedef struct {
+  uint32_t unused;
+} DMA_Stream_TypeDef;
+
+// a single byte wide uart, written by the simulated receiver and drained by the rx isr
+typedef struct {
+  volatile uint32_t SR;
+  volatile uint32_t CR;
+  volatile uint8_t DR;
+} USART_TypeDef;
+
+#define SITL_USART_SR_RXNE (1 << 0)
+#define SITL_USART_SR_TC (1 << 1)
+#define SITL_USART_SR_TXE (1 << 2)
+#define SITL_USART_SR_ORE (1 << 3)
+
+#define SITL_USART_CR_RXNEIE (1 << 0)
+#define SITL_USART_CR_TCIE (1 << 1)
+#define SITL_USART_CR_TXEIE (1 << 2)
+
+typedef struct {
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+
+extern DWT_Type sitl_dwt;
+#define DWT (&sitl_dwt)
+
+typedef struct {
+  uint32_t Pin;
+  uint32_t Mode;
+  uint32_t Speed;
+  uint32_t OutputType;
+  uint32_t Pull;
+  uint32_t Alternate;
+} LL_GPIO_InitTypeDef;
+
+typedef struct {
+  uint32_t BaudRate;
+  uint32_t DataWidth;
+  uint32_t StopBits;
+  uint32_t Parity;
+  uint32_t TransferDirection;
+  uint32_t HardwareFlowControl;
+  uint32_t OverSampling;
+} LL_USART_InitTypeDef;
+
+#define LL_GPIO_MODE_INPUT 0
+#define LL_GPIO_MODE_OUTPUT 1
+#define LL_GPIO_MODE_ALTERNATE 2
+#define LL_GPIO_MODE_ANALOG 3
+
+#define LL_GPIO_SPEED_FREQ_LOW 0
+#define LL_GPIO_SPEED_FREQ_HIGH 2
+#define LL_GPIO_SPEED_FREQ_VERY_HIGH 3
+
+#define LL_GPIO_OUTPUT_PUSHPULL 0
+#define LL_GPIO_OUTPUT_OPENDRAIN 1
+
+#define LL_GPIO_PULL_NO 0
+#define LL_GPIO_PULL_UP 1
+#define LL_GPIO_PULL_DOWN 2
+
+#define LL_USART_HWCONTROL_NONE 0
+#define LL_USART_DATAWIDTH_8B 0
+#define LL_USART_OVERSAMPLING_16 0
+#define LL_USART_STOPBITS_1 0
+#define LL_USART_STOPBITS_2 1
+#define LL_USART_PARITY_NONE 0
+#define LL_USART_PARITY_EVEN 1
+#define LL_USART_DIRECTION_RX 1
+#define LL_USART_DIRECTION_TX 2
+#define LL_USART_DIRECTION_TX_RX 3
+
+#define __NVIC_PRIO_BITS 4
+
+extern uint32_t sitl_uid[3];
+#define UID_BASE ((uintptr_t)sitl_uid)
+
+// the simulated clock only moves forward when the firmware waits, so busy loops have to advance it
+void sitl_nop();
+#define __NOP() sitl_nop()
+
+#define __disable_irq()
+#define __enable_irq()
+#define __get_PRIMASK() 0
+#define __set_BASEPRI(val) ((void)(val))
+#define __set_BASEPRI_MAX(val) ((void)(val))
+#define __get_BASEPRI() 0
+#define __DSB()
+#define __ISB()
+
+// ends the simulation, a reset or failloop is reported as a failed run
+void sitl_exit(int status);
+#define NVIC_SystemReset() sitl_exit(1)
+
+static inline void LL_USART_StructInit(LL_USART_InitTypeDef *init) {
+  *init = (LL_USART_InitTypeDef){0};
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_RXNE(USART_TypeDef *usart) {
+  return (usart->SR & SITL_USART_SR_RXNE) != 0;
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_ORE(USART_TypeDef *usart) {
+  return (usart->SR & SITL_USART_SR_ORE) != 0;
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_TC(USART_TypeDef *usart) {
+  return (usart->SR & SITL_USART_SR_TC) != 0;
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_TXE(USART_TypeDef *usart) {
+  return (usart->SR & SITL_USART_SR_TXE) != 0;
+}
+
+static inline void LL_USART_ClearFlag_ORE(USART_TypeDef *usart) {
+  usart->SR &= ~SITL_USART_SR_ORE;
+}
+
+static inline void LL_USART_ClearFlag_TC(USART_TypeDef *usart) {
+  usart->SR &= ~SITL_USART_SR_TC;
+}
+
+static inline uint32_t LL_USART_IsEnabledIT_RXNE(USART_TypeDef *usart) {
+  return (usart->CR & SITL_USART_CR_RXNEIE) != 0;
+}
+
+static inline uint32_t LL_USART_IsEnabledIT_TC(USART_TypeDef *usart) {
+  return (usart->CR & SITL_USART_CR_TCIE) != 0;
+}
+
+static inline uint32_t LL_USART_IsEnabledIT_TXE(USART_TypeDef *usart) {
+  return (usart->CR & SITL_USART_CR_TXEIE) != 0;
+}
+
+static inline void LL_USART_EnableIT_RXNE(USART_TypeDef *usart) {
+  usart->CR |= SITL_USART_CR_RXNEIE;
+}
+
+static inline void LL_USART_EnableIT_TC(USART_TypeDef *usart) {
+  usart->CR |= SITL_USART_CR_TCIE;
+}
+
+static inline void LL_USART_EnableIT_TXE(USART_TypeDef *usart) {
+  usart->CR |= SITL_USART_CR_TXEIE;
+}
+
+static inline void LL_USART_DisableIT_TC(USART_TypeDef *usart) {
+  usart->CR &= ~SITL_USART_CR_TCIE;
+}
+
+static inline void LL_USART_DisableIT_TXE(USART_TypeDef *usart) {
+  usart->CR &= ~SITL_USART_CR_TXEIE;
+}
+
+static inline uint8_t LL_USART_ReceiveData8(USART_TypeDef *usart) {
+  usart->SR &= ~SITL_USART_SR_RXNE;
+  return usart->DR;
+}
+
+// telemetry is sent into the void, the byte is done as soon as it is written
+static inline void LL_USART_TransmitData8(USART_TypeDef *usart, uint8_t val) {
+  (void)val;
+  usart->SR |= SITL_USART_SR_TXE | SITL_USART_SR_TC;
+}
@@ -0,0 +1,25 @@
+#include "drv_adc.h"
+
+#include "sitl_sim.h"
+
+void adc_init() {}
+
+float adc_read(adc_chan_t chan) {
+  switch (chan) {
+  case ADC_CHAN_VREF:
+    return 3.3f;
+
+  case ADC_CHAN_TEMP:
+    return 25.0f;
+
+  case ADC_CHAN_VBAT:
+    return sitl_quad.vbat;
+
+  case ADC_CHAN_IBAT:
+    // ma, like a current sensor after ibat_scale
+    return sitl_quad.ibat * 1000.0f;
+
+  default:
+    return 0;
+  }
+}
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "io/blackbox.h"
+#include "io/blackbox_compress.h"
+#include "io/data_flash.h"
+#include "sitl_sim.h"
+
+// decodes the last blackbox file straight from the simulated flash,
+// which checks the encoder against the decoder and measures how well it packs real flight data
+
+#define BENCH_ROUNDS 10
+
+static double wall_time_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void sitl_blackbox_bench(const int32_t *values, uint32_t frames, uint32_t value_count) {
+  blackbox_codec_t codec;
+  uint8_t *stream = malloc(frames * BLACKBOX_FRAME_MAX);
+  uint16_t *frame_size = malloc(frames * sizeof(uint16_t));
+  uint32_t size = 0;
+
+  const double start = wall_time_ns();
+  for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+    blackbox_codec_init(&codec, blackbox_fields, blackbox_field_count);
+    size = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+      frame_size[i] = blackbox_encode_frame(&codec, values + i * value_count, stream + size);
+      size += frame_size[i];
+    }
+  }
+  const double elapsed = wall_time_ns() - start;
+
+  printf("sitl: blackbox_bench encode=%.1fns/frame %.1fMB/s\n",
+         elapsed / (frames * BENCH_ROUNDS),
+         size * BENCH_ROUNDS / (elapsed * 1e-9) / 1e6);
+
+  // frame by frame, the way blackbox_update hands them over
+  static blackbox_compressor_t comp;
+  uint32_t compressed = 0;
+
+  const double compress_start = wall_time_ns();
+  for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+    blackbox_compress_init(&comp);
+    compressed = 0;
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i <= frames; i++) {
+      const uint8_t *block = NULL;
+      if (i == frames || frame_size[i] > blackbox_compress_space(&comp)) {
+        compressed += blackbox_compress_block(&comp, &block);
+        blackbox_compress_init(&comp);
+      }
+      if (i < frames) {
+        blackbox_compress(&comp, stream + offset, frame_size[i]);
+        offset += frame_size[i];
+      }
+    }
+  }
+  const double compress_elapsed = wall_time_ns() - compress_start;
+
+  printf("sitl: blackbox_bench compress=%.1fns/frame %.1fMB/s ratio=%.2f\n",
+         compress_elapsed / (frames * BENCH_ROUNDS),
+         size * BENCH_ROUNDS / (compress_elapsed * 1e-9) / 1e6,
+         (float)size / compressed);
+
+  free(frame_size);
+  free(stream);
+}
+
+static void sitl_blackbox_read(const data_flash_file_t *file, uint8_t *data) {
+#ifdef USE_SDCARD
+  sitl_sdcard_read(file->start_page * bounds.page_size, data, file->size);
+#else
+  sitl_flash_read(bounds.sector_size + file->start_page * bounds.page_size, data, file->size);
+#endif
+}
+
+// looks up an unsigned key of the header, zero if it is missing
+static uint32_t sitl_blackbox_header_value(uint8_t *data, uint32_t size, const char *key) {
+  cbor_value_t dec;
+  cbor_decoder_init(&dec, data, size);
+
+  cbor_container_t map;
+  if (cbor_decode_map(&dec, &map) < CBOR_OK) {
+    return 0;
+  }
+  for (uint32_t i = 0; i < cbor_decode_map_size(&dec, &map); i++) {
+    const uint8_t *name;
+    uint32_t name_len;
+    if (cbor_decode_tstr(&dec, &name, &name_len) < CBOR_OK) {
+      return 0;
+    }
+
+    uint32_t value = 0;
+    if (name_len == strlen(key) && memcmp(name, key, name_len) == 0) {
+      return cbor_decode_uint32(&dec, &value) >= CBOR_OK ? value : 0;
+    }
+    if (cbor_decode_skip(&dec) < CBOR_OK) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// returns the header and the frames as the encoder wrote them, data itself if the file is not compressed
+static uint8_t *sitl_blackbox_decompress(uint8_t *data, uint32_t *size, uint32_t header_size) {
+  // the header stays as is, compressed files have their frames in blocks after it
+  if (!sitl_blackbox_header_value(data, header_size, "compression")) {
+    return data;
+  }
+
+  uint32_t capacity = *size * 4;
+  uint8_t *raw = malloc(capacity);
+  memcpy(raw, data, header_size);
+  uint32_t raw_size = header_size;
+  uint32_t blocks = 0;
+  uint32_t errors = 0;
+
+  uint32_t offset = header_size;
+  while (offset < *size) {
+    if (raw_size + BLACKBOX_BLOCK_SIZE > capacity) {
+      capacity *= 2;
+      raw = realloc(raw, capacity);
+    }
+
+    uint32_t block_size = 0;
+    const int32_t len = blackbox_decompress_block(data + offset, *size - offset, raw + raw_size, &block_size);
+    if (len == 0) {
+      break;
+    }
+    if (len < 0) {
+      errors++;
+      offset++;
+      continue;
+    }
+    offset += len;
+    raw_size += block_size;
+    blocks++;
+  }
+
+  printf("sitl: blackbox compressed=%u raw=%u ratio=%.2f blocks=%u errors=%u\n",
+         *size - header_size,
+         raw_size - header_size,
+         raw_size > header_size ? (float)(raw_size - header_size) / (*size - header_size) : 0.0f,
+         blocks,
+         errors);
+
+  free(data);
+  *size = raw_size;
+  return raw;
+}
+
+void sitl_blackbox_report() {
+#ifdef USE_SDCARD
+  sitl_sdcard_report();
+#endif
+
+  if (data_flash_header.file_num == 0) {
+    return;
+  }
+
+  const data_flash_file_t *file = &data_flash_header.files[data_flash_header.file_num - 1];
+  if (file->size == 0) {
+    return;
+  }
+
+  uint8_t *data = malloc(file->size);
+  sitl_blackbox_read(file, data);
+
+  if (sitl_config.blackbox_path) {
+    FILE *f = fopen(sitl_config.blackbox_path, "wb");
+    if (f) {
+      fwrite(data, 1, file->size, f);
+      fclose(f);
+    }
+  }
+
+  // the cbor header describing the fields comes first
+  cbor_value_t dec;
+  cbor_decoder_init(&dec, data, file->size);
+  if (cbor_decode_skip(&dec) < CBOR_OK) {
+    printf("sitl: blackbox header invalid\n");
+    free(data);
+    return;
+  }
+
+  const uint32_t header_size = dec.curr - dec.start;
+  if (sitl_blackbox_header_value(data, header_size, "capture")) {
+    // gyro captures are plain samples after the header
+    const uint32_t channels = sitl_blackbox_header_value(data, header_size, "channels");
+    const uint32_t sample_period = sitl_blackbox_header_value(data, header_size, "sample_period");
+    const uint32_t samples = channels ? (file->size - header_size) / (channels * sizeof(int16_t)) : 0;
+    printf("sitl: capture size=%u channels=%u samples=%u sample_period=%uus duration=%.2fs\n",
+           file->size,
+           channels,
+           samples,
+           sample_period,
+           samples * sample_period * 1e-6f);
+    free(data);
+    return;
+  }
+
+  uint32_t size = file->size;
+  data = sitl_blackbox_decompress(data, &size, header_size);
+
+  blackbox_codec_t codec;
+  blackbox_codec_init(&codec, blackbox_fields, blackbox_field_count);
+
+  const uint32_t max_frames = size / 2;
+  int32_t *values = malloc(max_frames * codec.value_count * sizeof(int32_t));
+
+  uint32_t frames = 0;
+  uint32_t errors = 0;
+  uint32_t dropped = 0;
+
+  uint32_t offset = header_size;
+  const uint32_t frame_start = offset;
+  while (offset < size) {
+    int32_t *frame = values + frames * codec.value_count;
+
+    const int32_t len = blackbox_decode_frame(&codec, data + offset, size - offset, frame);
+    if (len == 0) {
+      break;
+    }
+    if (len < 0) {
+      // skip ahead to the next intra frame
+      errors++;
+      blackbox_codec_reset(&codec);
+      offset++;
+      continue;
+    }
+
+    // the first value is the loop counter, gaps are frames that did not fit into the write buffer
+    if (frames > 0) {
+      dropped += frame[0] - values[(frames - 1) * codec.value_count] - 1;
+    }
+
+    offset += len;
+    frames++;
+  }
+
+  printf("sitl: blackbox size=%u frames=%u bytes_per_frame=%.1f raw_bytes_per_frame=%u dropped=%u errors=%u\n",
+         size,
+         frames,
+         frames ? (float)(offset - frame_start) / frames : 0.0f,
+         (uint32_t)sizeof(blackbox_t),
+         dropped,
+         errors);
+
+  if (sitl_config.bench && frames) {
+    sitl_blackbox_bench(values, frames, codec.value_count);
+  }
+
+  free(values);
+  free(data);
+}
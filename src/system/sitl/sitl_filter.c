@@ -0,0 +1,266 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "flight/control.h"
+#include "flight/dyn_notch.h"
+#include "flight/filter.h"
+#include "profile.h"
+#include "sitl_sim.h"
+
+// runs sines through the filters and compares the measured gain against the analog prototype the
+// rbj cookbook coefficients are derived from, mapped through the prewarped bilinear transform.
+
+#define BENCH_SAMPLE_PERIOD_US SITL_GYRO_PERIOD_US
+#define BENCH_SAMPLE_HZ (1e6 / BENCH_SAMPLE_PERIOD_US)
+// half a second to let the filter settle, then a full second so every integer frequency fits whole periods
+#define BENCH_SETTLE_SAMPLES 4000
+#define BENCH_MEASURE_SAMPLES 8000
+// largest difference in linear gain that still passes
+#define BENCH_GAIN_TOLERANCE 0.01
+
+typedef struct {
+  float hz;
+  double expected;
+} bench_point_t;
+
+static double prototype_omega(float hz, float center_hz) {
+  const double period = BENCH_SAMPLE_PERIOD_US * 1e-6;
+  return tan(M_PI * hz * period) / tan(M_PI * center_hz * period);
+}
+
+static double lp_biquad_gain(float hz, float center_hz, float q) {
+  const double w = prototype_omega(hz, center_hz);
+  const double re = 1 - w * w;
+  const double im = w / q;
+  return 1 / sqrt(re * re + im * im);
+}
+
+static double notch_biquad_gain(float hz, float center_hz, float q) {
+  const double w = prototype_omega(hz, center_hz);
+  const double re = 1 - w * w;
+  const double im = w / q;
+  return fabs(re) / sqrt(re * re + im * im);
+}
+
+// amplitude of the output at the input frequency, from the correlation with a sine and cosine
+static double measure_gain(filter_biquad *filter, float hz) {
+  filter_state_t state = {0};
+
+  double re = 0;
+  double im = 0;
+  for (uint32_t i = 0; i < BENCH_SETTLE_SAMPLES + BENCH_MEASURE_SAMPLES; i++) {
+    const double phase = 2 * M_PI * hz * i / BENCH_SAMPLE_HZ;
+    const float out = filter_biquad_step(filter, &state, sin(phase));
+    if (i >= BENCH_SETTLE_SAMPLES) {
+      re += out * sin(phase);
+      im += out * cos(phase);
+    }
+  }
+  return 2 * sqrt(re * re + im * im) / BENCH_MEASURE_SAMPLES;
+}
+
+static bool bench_response(const char *name, filter_biquad *filter, const bench_point_t *points, uint32_t count) {
+  bool pass = true;
+
+  printf("sitl: filter_response %s", name);
+  for (uint32_t i = 0; i < count; i++) {
+    const double gain = measure_gain(filter, points[i].hz);
+    pass = pass && fabs(gain - points[i].expected) <= BENCH_GAIN_TOLERANCE;
+    printf(" %.0fhz=%.1fdb", points[i].hz, 20 * log10(fmax(gain, 1e-6)));
+  }
+  printf(" pass=%u\n", pass);
+
+  return pass;
+}
+
+static bool sitl_filter_biquad_bench() {
+  static const float lp_hz = 100;
+  static const float notch_hz = 200;
+
+  filter_biquad filter;
+  filter_state_t state;
+
+  const float lp_points_hz[] = {10, 50, 100, 200, 400, 1000};
+  bench_point_t lp_points[6];
+  for (uint32_t i = 0; i < 6; i++) {
+    lp_points[i].hz = lp_points_hz[i];
+    lp_points[i].expected = lp_biquad_gain(lp_points_hz[i], lp_hz, FILTER_BIQUAD_Q_DEFAULT);
+  }
+  filter_lp_biquad_init(&filter, &state, 1, lp_hz, FILTER_BIQUAD_Q_DEFAULT, BENCH_SAMPLE_PERIOD_US);
+  const bool lp_pass = bench_response("lp_biquad", &filter, lp_points, 6);
+
+  const float notch_points_hz[] = {50, 150, 190, 200, 210, 300};
+  bench_point_t notch_points[6];
+  for (uint32_t i = 0; i < 6; i++) {
+    notch_points[i].hz = notch_points_hz[i];
+    notch_points[i].expected = notch_biquad_gain(notch_points_hz[i], notch_hz, FILTER_NOTCH_Q_DEFAULT);
+  }
+  // a slot without a configured q
+  filter_notch_biquad_init(&filter, &state, 1, notch_hz, FILTER_Q_TYPE_DEFAULT, BENCH_SAMPLE_PERIOD_US);
+  const bool notch_pass = bench_response("notch_biquad", &filter, notch_points, 6);
+
+  return lp_pass && notch_pass;
+}
+
+// a tone swept through the dynamic notch range on every axis, on top of broadband noise.
+// each axis sweeps a slightly different range so the axes can not hide each others errors.
+#define SWEEP_SAMPLES (2 * (uint32_t)BENCH_SAMPLE_HZ)
+// the first fft windows are still filled with the initial notch positions
+#define SWEEP_SETTLE_SAMPLES (SWEEP_SAMPLES / 8)
+#define SWEEP_NOISE 0.1f
+
+static float sweep_hz(uint8_t axis, uint32_t sample) {
+  const float min_hz = profile.filter.gyro_dynamic_notch_min * 1.25f;
+  const float max_hz = profile.filter.gyro_dynamic_notch_max * 0.75f;
+  return (min_hz + (max_hz - min_hz) * sample / SWEEP_SAMPLES) * (1.0f + 0.1f * axis);
+}
+
+static bool sitl_filter_dyn_notch_bench() {
+  state.gyro_sample_period = BENCH_SAMPLE_PERIOD_US;
+  dyn_notch_init();
+
+  const float bin_hz = (float)dyn_notch_info.fft_sample_rate / DYN_NOTCH_FFT_SIZE;
+
+  double phase[3] = {0};
+  double tone_sq[3] = {0};
+  double out_re[3] = {0};
+  double out_im[3] = {0};
+
+  float error_max = 0;
+  double error_sq = 0;
+  uint32_t error_count = 0;
+
+  for (uint32_t i = 0; i < SWEEP_SAMPLES; i++) {
+    vec3_t gyro;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+      phase[axis] += 2 * M_PI * sweep_hz(axis, i) / BENCH_SAMPLE_HZ;
+      gyro.axis[axis] = sin(phase[axis]) + SWEEP_NOISE * sitl_random_float();
+    }
+
+    dyn_notch_sample(&gyro);
+    dyn_notch_update();
+
+    for (uint8_t axis = 0; axis < 3; axis++) {
+      const float out = dyn_notch_step(axis, gyro.axis[axis]);
+      if (i < SWEEP_SETTLE_SAMPLES) {
+        continue;
+      }
+
+      // the tone that is left in the output, the noise does not correlate with it
+      tone_sq[axis] += sin(phase[axis]) * sin(phase[axis]);
+      out_re[axis] += out * sin(phase[axis]);
+      out_im[axis] += out * cos(phase[axis]);
+
+      float error = INFINITY;
+      for (uint8_t n = 0; n < DYN_NOTCH_COUNT; n++) {
+        error = fminf(error, fabsf(dyn_notch_info.center_hz[axis][n] - sweep_hz(axis, i)));
+      }
+      error_max = fmaxf(error_max, error);
+      error_sq += error * error;
+      error_count++;
+    }
+  }
+
+  double attenuation = INFINITY;
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    const double gain = sqrt(out_re[axis] * out_re[axis] + out_im[axis] * out_im[axis]) / tone_sq[axis];
+    attenuation = fmin(attenuation, -20 * log10(fmax(gain, 1e-6)));
+  }
+
+  // the peak has to be found within a bin and the tone mostly removed
+  const bool pass = error_max <= bin_hz && attenuation >= 10;
+  printf("sitl: dyn_notch_sweep bin=%.1fhz error_rms=%.1fhz error_max=%.1fhz attenuation=%.1fdb pass=%u\n",
+         bin_hz,
+         sqrt(error_sq / error_count),
+         error_max,
+         attenuation,
+         pass);
+
+  return pass;
+}
+
+// the four motors ramp from cruise to full throttle and back, each a little apart from the others.
+// the gyro sees every harmonic of every motor, the rpm filter only gets the rpm traces.
+#define RPM_SAMPLES (2 * (uint32_t)BENCH_SAMPLE_HZ)
+#define RPM_SETTLE_SAMPLES (RPM_SAMPLES / 16)
+#define RPM_LOW 9000.0f
+#define RPM_HIGH 27000.0f
+// what is left of the flight itself, has to pass untouched
+#define RPM_SIGNAL_HZ 20
+
+static float rpm_trace(uint8_t motor, uint32_t sample) {
+  const float ramp = 1.0f - fabsf(2.0f * sample / RPM_SAMPLES - 1.0f);
+  return (RPM_LOW + (RPM_HIGH - RPM_LOW) * ramp) * (0.94f + 0.04f * motor);
+}
+
+// runs the gyro through the rpm filter, with just the motor noise or just the flight signal
+static double rpm_filter_run(bool motor_noise, double *signal_gain) {
+  static filter_rpm_t filter;
+  filter_rpm_init(&filter);
+
+  double phase[FILTER_RPM_MOTORS] = {0};
+  double in_sq = 0;
+  double out_sq = 0;
+  double out_re = 0;
+  double out_im = 0;
+
+  for (uint32_t i = 0; i < RPM_SAMPLES; i++) {
+    float motor_rpm[FILTER_RPM_MOTORS];
+    for (uint8_t m = 0; m < FILTER_RPM_MOTORS; m++) {
+      motor_rpm[m] = rpm_trace(m, i);
+      phase[m] += 2 * M_PI * motor_rpm[m] / 60 / BENCH_SAMPLE_HZ;
+    }
+    filter_rpm_coeff(&filter, motor_rpm, profile.filter.gyro_rpm_filter_min, profile.filter.gyro_rpm_filter_q, BENCH_SAMPLE_PERIOD_US);
+
+    const double signal_phase = 2 * M_PI * RPM_SIGNAL_HZ * i / BENCH_SAMPLE_HZ;
+
+    float in = 0;
+    if (motor_noise) {
+      for (uint8_t m = 0; m < FILTER_RPM_MOTORS; m++) {
+        for (uint8_t h = 0; h < FILTER_RPM_HARMONICS; h++) {
+          in += sin(phase[m] * (h + 1)) / (h + 1);
+        }
+      }
+    } else {
+      in = sin(signal_phase);
+    }
+
+    const float out = filter_rpm_step(&filter, 0, in);
+    if (i < RPM_SETTLE_SAMPLES) {
+      continue;
+    }
+
+    in_sq += in * in;
+    out_sq += out * out;
+    out_re += out * sin(signal_phase);
+    out_im += out * cos(signal_phase);
+  }
+
+  if (signal_gain) {
+    *signal_gain = 2 * sqrt(out_re * out_re + out_im * out_im) / (RPM_SAMPLES - RPM_SETTLE_SAMPLES);
+  }
+  return 10 * log10(in_sq / fmax(out_sq, 1e-12));
+}
+
+static bool sitl_filter_rpm_bench() {
+  const double attenuation = rpm_filter_run(true, NULL);
+
+  double signal_gain = 0;
+  rpm_filter_run(false, &signal_gain);
+  const double signal_loss = -20 * log10(signal_gain);
+
+  const bool pass = attenuation >= 20 && signal_loss <= 0.5;
+  printf("sitl: rpm_filter_traces attenuation=%.1fdb signal_loss=%.2fdb pass=%u\n", attenuation, signal_loss, pass);
+
+  return pass;
+}
+
+bool sitl_filter_report() {
+  if (!sitl_config.bench) {
+    return true;
+  }
+  const bool biquad_pass = sitl_filter_biquad_bench();
+  const bool dyn_notch_pass = sitl_filter_dyn_notch_bench();
+  const bool rpm_pass = sitl_filter_rpm_bench();
+  return biquad_pass && dyn_notch_pass && rpm_pass;
+}
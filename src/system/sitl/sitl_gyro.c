@@ -0,0 +1,87 @@
+#include "drv_spi_gyro.h"
+
+#include <string.h>
+
+#include "drv_time.h"
+#include "sitl_sim.h"
+
+// samples produced by the model wait here like in the fifo of a real gyro
+#define GYRO_QUEUE_SIZE 32
+
+gyro_types_t gyro_type = GYRO_TYPE_INVALID;
+gyro_sample_info_t gyro_sample_info;
+
+static gyro_data_t queue[GYRO_QUEUE_SIZE];
+static uint32_t queue_head = 0;
+static uint32_t queue_count = 0;
+
+static gyro_data_t last_sample;
+static uint32_t last_sample_time = 0;
+
+void sitl_gyro_push_sample() {
+  if (gyro_type == GYRO_TYPE_INVALID) {
+    return;
+  }
+
+  gyro_data_t sample;
+  sitl_quad_gyro_sample(&sample.gyro, &sample.accel);
+  sample.temp = 25;
+
+  if (queue_count == GYRO_QUEUE_SIZE) {
+    // fifo overflow, the oldest sample is lost
+    queue_head = (queue_head + 1) % GYRO_QUEUE_SIZE;
+    queue_count--;
+  }
+  queue[(queue_head + queue_count) % GYRO_QUEUE_SIZE] = sample;
+  queue_count++;
+
+  last_sample = sample;
+  last_sample_time = time_cycles();
+}
+
+uint8_t gyro_spi_init() {
+  // looks like an icm42688p to the rest of the firmware, 8khz odr
+  gyro_type = GYRO_TYPE_ICM42688P;
+
+  memset(&last_sample, 0, sizeof(gyro_data_t));
+  last_sample_time = time_cycles();
+
+  return gyro_type;
+}
+
+uint32_t gyro_spi_sample_period(uint32_t looptime_us) {
+#ifdef USE_GYRO_FIFO
+  return SITL_GYRO_PERIOD_US;
+#else
+  return looptime_us;
+#endif
+}
+
+bool gyro_spi_exti_wait(uint32_t period_us) {
+  return false;
+}
+
+uint32_t gyro_spi_read_samples(gyro_data_t *samples, uint32_t looptime_us) {
+  sitl_stats.loops++;
+  gyro_sample_info.sample_time = last_sample_time;
+
+#ifdef USE_GYRO_FIFO
+  uint32_t count = 0;
+  while (queue_count && count < GYRO_FIFO_MAX_SAMPLES) {
+    samples[count++] = queue[queue_head];
+    queue_head = (queue_head + 1) % GYRO_QUEUE_SIZE;
+    queue_count--;
+  }
+  return count;
+#else
+  // the data registers always hold the newest sample
+  queue_count = 0;
+  samples[0] = last_sample;
+  return 1;
+#endif
+}
+
+gyro_data_t gyro_spi_read() {
+  gyro_sample_info.sample_time = last_sample_time;
+  return last_sample;
+}
@@ -0,0 +1,134 @@
+#include "drv_spi_m25p16.h"
+
+#include <string.h>
+
+#include "drv_time.h"
+#include "sitl_sim.h"
+
+#ifdef USE_M25P16
+
+// a 16mbit spi nor flash kept in ram, with the typical program and erase times of a m25p16
+#define FLASH_SECTORS 32
+#define FLASH_PAGES_PER_SECTOR 256
+#define FLASH_SECTOR_SIZE (FLASH_PAGES_PER_SECTOR * M25P16_PAGE_SIZE)
+#define FLASH_SIZE (FLASH_SECTORS * FLASH_SECTOR_SIZE)
+
+#define FLASH_PAGE_PROGRAM_US 640
+#define FLASH_SECTOR_ERASE_US 600000
+#define FLASH_BULK_ERASE_US 13000000
+
+static uint8_t flash[FLASH_SIZE];
+static uint64_t busy_until_us = 0;
+
+static void m25p16_set_busy(uint32_t us) {
+  busy_until_us = sitl_time_us() + us;
+}
+
+void m25p16_init() {
+  memset(flash, 0xFF, FLASH_SIZE);
+}
+
+uint8_t m25p16_is_ready() {
+  return sitl_time_us() >= busy_until_us;
+}
+
+uint8_t m25p16_poll_ready() {
+  return m25p16_is_ready();
+}
+
+void m25p16_wait_for_ready() {
+  while (!m25p16_is_ready()) {
+    time_delay_us(10);
+  }
+}
+
+void m25p16_get_bounds(data_flash_bounds_t *bounds) {
+  bounds->page_size = M25P16_PAGE_SIZE;
+  bounds->pages_per_sector = FLASH_PAGES_PER_SECTOR;
+  bounds->sectors = FLASH_SECTORS;
+  bounds->sector_size = FLASH_SECTOR_SIZE;
+  bounds->total_size = FLASH_SIZE;
+}
+
+uint8_t m25p16_command(const uint8_t cmd) {
+  m25p16_wait_for_ready();
+
+  if (cmd == M25P16_BULK_ERASE) {
+    memset(flash, 0xFF, FLASH_SIZE);
+    m25p16_set_busy(FLASH_BULK_ERASE_US);
+  }
+
+  return 0;
+}
+
+uint8_t m25p16_read_command(const uint8_t cmd, uint8_t *data, const uint32_t len) {
+  m25p16_wait_for_ready();
+  memset(data, 0, len);
+  return 0;
+}
+
+uint8_t m25p16_read_addr(const uint8_t cmd, const uint32_t addr, uint8_t *data, const uint32_t len) {
+  m25p16_wait_for_ready();
+
+  for (uint32_t i = 0; i < len; i++) {
+    data[i] = flash[(addr + i) % FLASH_SIZE];
+  }
+  return 0;
+}
+
+uint8_t m25p16_write_addr(const uint8_t cmd, const uint32_t addr, uint8_t *data, const uint32_t len) {
+  m25p16_wait_for_ready();
+
+  if (cmd == M25P16_SECTOR_ERASE) {
+    const uint32_t sector = (addr % FLASH_SIZE) / FLASH_SECTOR_SIZE;
+    memset(flash + sector * FLASH_SECTOR_SIZE, 0xFF, FLASH_SECTOR_SIZE);
+    m25p16_set_busy(FLASH_SECTOR_ERASE_US);
+  }
+
+  return 0;
+}
+
+uint8_t m25p16_read_start(const uint32_t addr, uint8_t *data, const uint32_t len) {
+  if (!m25p16_is_ready()) {
+    return 0;
+  }
+
+  sitl_flash_read(addr, data, len);
+  return 1;
+}
+
+uint8_t m25p16_sector_erase(const uint32_t addr) {
+  if (!m25p16_is_ready()) {
+    return 0;
+  }
+
+  const uint32_t sector = (addr % FLASH_SIZE) / FLASH_SECTOR_SIZE;
+  memset(flash + sector * FLASH_SECTOR_SIZE, 0xFF, FLASH_SECTOR_SIZE);
+  m25p16_set_busy(FLASH_SECTOR_ERASE_US);
+
+  return 1;
+}
+
+uint8_t m25p16_page_program(const uint32_t addr, const uint8_t *buf, const uint32_t size) {
+  if (!m25p16_is_ready()) {
+    return 0;
+  }
+
+  // programming only clears bits and wraps around within the page
+  const uint32_t page = (addr % FLASH_SIZE) & ~(M25P16_PAGE_SIZE - 1);
+  for (uint32_t i = 0; i < size; i++) {
+    flash[page + ((addr + i) % M25P16_PAGE_SIZE)] &= buf[i];
+  }
+  m25p16_set_busy(FLASH_PAGE_PROGRAM_US);
+
+  return 1;
+}
+
+// direct access for the simulator, without waiting for the flash
+void sitl_flash_read(uint32_t addr, uint8_t *data, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    data[i] = flash[(addr + i) % FLASH_SIZE];
+  }
+}
+
+#endif
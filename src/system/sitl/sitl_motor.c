@@ -0,0 +1,296 @@
+#include "drv_motor.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "flight/control.h"
+#include "sitl_sim.h"
+#include "util/dshot_encode.h"
+#include "util/dshot_telemetry.h"
+
+static motor_direction_t motor_direction = MOTOR_FORWARD;
+
+void motor_init() {
+  for (uint32_t i = 0; i < SITL_MOTOR_COUNT; i++) {
+    sitl_quad.motor_cmd[i] = MOTOR_OFF;
+  }
+}
+
+void motor_wait_for_ready() {}
+
+void motor_beep() {}
+
+void motor_write(float *values) {
+  for (uint32_t i = 0; i < SITL_MOTOR_COUNT; i++) {
+    sitl_quad.motor_cmd[i] = values[i];
+
+    // what bidirectional dshot would report
+    state.motor_rpm.axis[i] = sitl_quad.motor_rpm[i];
+  }
+}
+
+void motor_set_direction(motor_direction_t dir) {
+  motor_direction = dir;
+}
+
+bool motor_direction_change_done() {
+  return true;
+}
+
+// the dma buffers of a dshot frame, from the per bit loop the driver used before and from the encoder.
+// two gpio ports with three and one motors, the pins of the driver's usual targets
+#define BENCH_PORTS 2
+#define BENCH_FRAMES 1000000
+#define BENCH_BUFFER_SIZE (3 * (16 + 2))
+
+static const uint32_t bench_pin[SITL_MOTOR_COUNT] = {1 << 8, 1 << 9, 1 << 10, 1 << 0};
+static const uint32_t bench_port[SITL_MOTOR_COUNT] = {0, 0, 0, 1};
+
+static uint32_t bench_buffer[BENCH_PORTS][BENCH_BUFFER_SIZE];
+static uint32_t bench_reference[BENCH_PORTS][BENCH_BUFFER_SIZE];
+
+static double wall_time_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static uint32_t bench_port_mask(uint32_t port) {
+  uint32_t mask = 0;
+  for (uint32_t motor = 0; motor < SITL_MOTOR_COUNT; motor++) {
+    if (bench_port[motor] == port) {
+      mask |= bench_pin[motor];
+    }
+  }
+  return mask;
+}
+
+static void bench_encode_loop(uint32_t buffer[BENCH_PORTS][BENCH_BUFFER_SIZE], uint16_t *packet, bool bidir) {
+  for (uint32_t j = 0; j < BENCH_PORTS; j++) {
+    const uint32_t mask = bench_port_mask(j);
+    const uint32_t idle = bidir ? mask : mask << 16;
+    const uint32_t active = bidir ? mask << 16 : mask;
+
+    buffer[j][0] = idle;
+    buffer[j][1] = idle;
+    buffer[j][2] = idle;
+
+    for (uint8_t i = 0; i < 16; i++) {
+      buffer[j][(i + 1) * 3 + 0] = active;
+      buffer[j][(i + 1) * 3 + 1] = 0;
+      buffer[j][(i + 1) * 3 + 2] = idle;
+    }
+
+    buffer[j][17 * 3 + 0] = idle;
+    buffer[j][17 * 3 + 1] = idle;
+    buffer[j][17 * 3 + 2] = idle;
+  }
+
+  for (uint8_t i = 0; i < 16; i++) {
+    for (uint8_t motor = 0; motor < SITL_MOTOR_COUNT; motor++) {
+      const uint32_t port = bench_port[motor];
+      const uint32_t motor_high = bidir ? (bench_pin[motor] << 16) : (bench_pin[motor]);
+      const uint32_t motor_low = bidir ? (bench_pin[motor]) : (bench_pin[motor] << 16);
+
+      const bool bit = packet[motor] & 0x8000;
+      buffer[port][(i + 1) * 3 + 1] |= bit ? motor_high : motor_low;
+
+      packet[motor] <<= 1;
+    }
+  }
+}
+
+static void bench_encode_table(uint32_t tables[BENCH_PORTS][DSHOT_ENCODE_TABLE_SIZE], bool bidir) {
+  for (uint32_t j = 0; j < BENCH_PORTS; j++) {
+    uint32_t high[DSHOT_ENCODE_MOTORS] = {0};
+    uint32_t low[DSHOT_ENCODE_MOTORS] = {0};
+    for (uint32_t motor = 0; motor < SITL_MOTOR_COUNT; motor++) {
+      if (bench_port[motor] == j) {
+        high[motor] = bidir ? (bench_pin[motor] << 16) : (bench_pin[motor]);
+        low[motor] = bidir ? (bench_pin[motor]) : (bench_pin[motor] << 16);
+      }
+    }
+    dshot_encode_table(tables[j], high, low);
+  }
+}
+
+static void sitl_motor_bench(bool bidir) {
+  uint32_t tables[BENCH_PORTS][DSHOT_ENCODE_TABLE_SIZE];
+  bench_encode_table(tables, bidir);
+
+  // the constant words are only written once, as the driver does
+  uint16_t idle_packet[SITL_MOTOR_COUNT] = {0};
+  bench_encode_loop(bench_buffer, idle_packet, bidir);
+
+  uint16_t packets[SITL_MOTOR_COUNT];
+  uint32_t mismatch = 0;
+  for (uint32_t i = 0; i < 10000; i++) {
+    for (uint32_t motor = 0; motor < SITL_MOTOR_COUNT; motor++) {
+      packets[motor] = sitl_random();
+    }
+
+    const dshot_encode_bits_t bits = dshot_encode_transpose(packets);
+    for (uint32_t j = 0; j < BENCH_PORTS; j++) {
+      dshot_encode_port(tables[j], bits, &bench_buffer[j][4], 3);
+    }
+
+    bench_encode_loop(bench_reference, packets, bidir);
+    mismatch += memcmp(bench_buffer, bench_reference, sizeof(bench_buffer)) != 0;
+  }
+
+  const double loop_start = wall_time_ns();
+  for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+    for (uint32_t motor = 0; motor < SITL_MOTOR_COUNT; motor++) {
+      packets[motor] = i * (motor + 1);
+    }
+    bench_encode_loop(bench_reference, packets, bidir);
+    __asm__ volatile("" : : "r"(bench_reference) : "memory");
+  }
+  const double loop = wall_time_ns() - loop_start;
+
+  const double encode_start = wall_time_ns();
+  for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+    for (uint32_t motor = 0; motor < SITL_MOTOR_COUNT; motor++) {
+      packets[motor] = i * (motor + 1);
+    }
+    const dshot_encode_bits_t bits = dshot_encode_transpose(packets);
+    for (uint32_t j = 0; j < BENCH_PORTS; j++) {
+      dshot_encode_port(tables[j], bits, &bench_buffer[j][4], 3);
+    }
+    __asm__ volatile("" : : "r"(bench_buffer) : "memory");
+  }
+  const double encode = wall_time_ns() - encode_start;
+
+  printf("sitl: dshot_bench bidir=%u loop=%.1fns/frame encode=%.1fns/frame mismatch=%u\n",
+         bidir,
+         loop / BENCH_FRAMES,
+         encode / BENCH_FRAMES,
+         mismatch);
+}
+
+// gpio captures of an esc reply as the driver takes them at dshot600, three samples per dshot bit.
+// the esc starts about 30us after the frame and runs off its own clock, so the reply start, the sample
+// phase and the bit rate vary from capture to capture. the other pins of the port toggle at random.
+#define CAPTURE_SAMPLES 126
+#define CAPTURE_SAMPLES_PER_BIT 2.4f
+#define CAPTURE_SAMPLES_PER_BIT_Q8 ((3 * 4 * 256) / 5)
+#define CAPTURE_PIN (1 << 8)
+#define CAPTURE_ROUNDS 10000
+
+static const uint8_t gcr_encode_table[16] = {
+    0x19, 0x1B, 0x12, 0x13, 0x1D, 0x15, 0x16, 0x17,
+    0x1A, 0x09, 0x0A, 0x0B, 0x1E, 0x0D, 0x0E, 0x0F};
+
+// eeem mmmm mmmm followed by the inverted xor of the nibbles, each nibble gcr coded
+static uint32_t capture_gcr(uint32_t value, bool valid_crc) {
+  uint32_t csum = (value ^ (value >> 4) ^ (value >> 8)) & 0xF;
+  if (valid_crc) {
+    csum = ~csum & 0xF;
+  }
+
+  const uint32_t packet = (value << 4) | csum;
+
+  uint32_t gcr = 0;
+  for (int32_t i = 3; i >= 0; i--) {
+    gcr = (gcr << 5) | gcr_encode_table[(packet >> (i * 4)) & 0xF];
+  }
+  return gcr;
+}
+
+// the reply starts with a low bit, every one in the gcr flips the line
+static void capture_samples(uint32_t *samples, uint32_t gcr, uint32_t count) {
+  const uint32_t start = 50 + sitl_random() % 20;
+  const float phase = (sitl_random() % 100) / 100.0f;
+  const float samples_per_bit = CAPTURE_SAMPLES_PER_BIT * (1.0f + 0.04f * sitl_random_float());
+
+  uint32_t levels = 0;
+  uint32_t level = 0;
+  for (int32_t bit = DSHOT_TELEMETRY_BITS - 1; bit >= 0; bit--) {
+    levels |= level << bit;
+    if (bit > 0) {
+      level ^= (gcr >> (bit - 1)) & 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    const int32_t bit = i < start ? -1 : (int32_t)((i - start + phase) / samples_per_bit);
+    const bool high = bit < 0 || bit >= DSHOT_TELEMETRY_BITS || ((levels >> (DSHOT_TELEMETRY_BITS - 1 - bit)) & 1);
+    samples[i] = (sitl_random() & ~CAPTURE_PIN) | (high ? CAPTURE_PIN : 0);
+  }
+}
+
+static dshot_telemetry_result_t capture_decode(const uint32_t *samples, uint32_t count, uint32_t *erpm) {
+  uint32_t gcr = 0;
+  const dshot_telemetry_result_t res = dshot_telemetry_decode_samples(samples, count, CAPTURE_PIN, CAPTURE_SAMPLES_PER_BIT_Q8, &gcr);
+  if (res != DSHOT_TELEMETRY_OK) {
+    return res;
+  }
+  return dshot_telemetry_decode_gcr(gcr, erpm);
+}
+
+static bool sitl_motor_telemetry_bench() {
+  uint32_t samples[CAPTURE_SAMPLES];
+  uint32_t erpm = 0;
+
+  uint32_t mismatch = 0;
+  for (uint32_t i = 0; i < CAPTURE_ROUNDS; i++) {
+    const uint32_t exponent = sitl_random() % 8;
+    const uint32_t mantissa = 1 + sitl_random() % 511;
+    const uint32_t value = (exponent << 9) | mantissa;
+
+    // the largest period is the stop code
+    const uint32_t period_us = mantissa << exponent;
+    const uint32_t expected = value == 0x0FFF ? 0 : (60 * 1000000 + period_us / 2) / period_us;
+
+    capture_samples(samples, capture_gcr(value, true), CAPTURE_SAMPLES);
+    const dshot_telemetry_result_t res = capture_decode(samples, CAPTURE_SAMPLES, &erpm);
+    mismatch += res != DSHOT_TELEMETRY_OK || erpm != expected;
+  }
+
+  capture_samples(samples, capture_gcr(0x0FFF, true), CAPTURE_SAMPLES);
+  erpm = 1;
+  const bool stopped = capture_decode(samples, CAPTURE_SAMPLES, &erpm) == DSHOT_TELEMETRY_OK && erpm == 0;
+
+  for (uint32_t i = 0; i < CAPTURE_SAMPLES; i++) {
+    samples[i] = sitl_random() | CAPTURE_PIN;
+  }
+  const bool no_response = capture_decode(samples, CAPTURE_SAMPLES, &erpm) == DSHOT_TELEMETRY_NO_RESPONSE;
+
+  capture_samples(samples, capture_gcr(0x123, false), CAPTURE_SAMPLES);
+  const bool invalid_crc = capture_decode(samples, CAPTURE_SAMPLES, &erpm) == DSHOT_TELEMETRY_INVALID_CRC;
+
+  // zero is not a gcr symbol
+  capture_samples(samples, capture_gcr(0x123, true) & ~0x1F, CAPTURE_SAMPLES);
+  const bool invalid_gcr = capture_decode(samples, CAPTURE_SAMPLES, &erpm) == DSHOT_TELEMETRY_INVALID_GCR;
+
+  // the capture ends on the last low sample, before the line returns to idle
+  capture_samples(samples, capture_gcr(0x123, true), CAPTURE_SAMPLES);
+  uint32_t cut = CAPTURE_SAMPLES;
+  while (cut > 0 && (samples[cut - 1] & CAPTURE_PIN)) {
+    cut--;
+  }
+  const bool cut_off = capture_decode(samples, cut, &erpm) == DSHOT_TELEMETRY_INVALID_GCR;
+
+  const bool pass = mismatch == 0 && stopped && no_response && invalid_crc && invalid_gcr && cut_off;
+  printf("sitl: dshot_telemetry captures=%u mismatch=%u stopped=%u no_response=%u invalid_crc=%u invalid_gcr=%u cut_off=%u pass=%u\n",
+         CAPTURE_ROUNDS,
+         mismatch,
+         stopped,
+         no_response,
+         invalid_crc,
+         invalid_gcr,
+         cut_off,
+         pass);
+
+  return pass;
+}
+
+bool sitl_motor_report() {
+  if (!sitl_config.bench) {
+    return true;
+  }
+  sitl_motor_bench(false);
+  sitl_motor_bench(true);
+  return sitl_motor_telemetry_bench();
+}
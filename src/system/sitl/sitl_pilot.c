@@ -0,0 +1,223 @@
+#include <math.h>
+#include <string.h>
+
+#include "rx_crsf.h"
+#include "sitl_sim.h"
+#include "util/crc.h"
+#include "util/util.h"
+
+// the scripted pilot flies the model through a crsf receiver, like a person with a radio would
+
+#define PILOT_FRAME_INTERVAL_US 6667 // 150hz packet rate
+
+#define PILOT_ARM_TIME_US 5000000
+#define PILOT_TAKEOFF_TIME_US 5500000
+#define PILOT_LAND_TIME_US 8000000 // before the end of the run
+#define PILOT_DISARM_TIME_US 1000000
+
+#define PILOT_FLIP_INTERVAL_US 5000000
+#define PILOT_TARGET_INTERVAL_US 1000000
+
+#define PILOT_ALTITUDE 3.0f
+#define PILOT_HOVER_THROTTLE 0.35f
+#define PILOT_DESCENT_RATE 1.0f // m/s
+#define PILOT_TILT_MAX 0.35f // rad
+#define PILOT_TILT_GAIN 2.0f
+#define PILOT_YAW_MAX 0.4f
+
+#define CRSF_CHANNEL_LOW 172
+#define CRSF_CHANNEL_HIGH 1811
+
+typedef enum {
+  PILOT_WAIT,
+  PILOT_ARMED,
+  PILOT_FLYING,
+  PILOT_FLIP,
+  PILOT_LANDING,
+  PILOT_DISARMED,
+} pilot_state_t;
+
+typedef struct {
+  float roll;
+  float pitch;
+  float throttle;
+  float yaw;
+  bool arm;
+} pilot_sticks_t;
+
+static pilot_state_t pilot_state = PILOT_WAIT;
+static uint64_t last_frame_us = 0;
+static uint64_t next_frame_us = 0;
+static uint64_t next_target_us = 0;
+static uint64_t next_flip_us = 0;
+
+static float target_tilt[2] = {0, 0};
+static float target_yaw = 0;
+static float target_altitude = PILOT_ALTITUDE;
+
+static uint8_t flip_axis = 0;
+static float flip_angle = 0;
+
+static uint32_t pilot_channel(float val) {
+  return constrainf(990.5f + val / 0.00125707103f, CRSF_CHANNEL_LOW, CRSF_CHANNEL_HIGH);
+}
+
+static void pilot_send(const pilot_sticks_t *sticks) {
+  uint8_t frame[CRSF_FRAME_RC_CHANNELS_PAYLOAD_SIZE + 4];
+  memset(frame, 0, sizeof(frame));
+
+  frame[0] = CRSF_ADDRESS_FLIGHT_CONTROLLER;
+  frame[1] = CRSF_FRAME_RC_CHANNELS_PAYLOAD_SIZE + CRSF_FRAME_LENGTH_TYPE_CRC;
+  frame[2] = CRSF_FRAMETYPE_RC_CHANNELS_PACKED;
+
+  crsf_channels_t *chan = (crsf_channels_t *)&frame[3];
+  chan->chan0 = pilot_channel(sticks->roll);
+  chan->chan1 = pilot_channel(sticks->pitch);
+  chan->chan2 = pilot_channel(sticks->throttle * 2.0f - 1.0f);
+  chan->chan3 = pilot_channel(sticks->yaw);
+  chan->chan4 = sticks->arm ? CRSF_CHANNEL_HIGH : CRSF_CHANNEL_LOW;
+  chan->chan5 = CRSF_CHANNEL_LOW;
+  chan->chan6 = CRSF_CHANNEL_LOW;
+  chan->chan7 = CRSF_CHANNEL_LOW;
+  chan->chan8 = CRSF_CHANNEL_LOW;
+  chan->chan9 = CRSF_CHANNEL_LOW;
+  chan->chan10 = CRSF_CHANNEL_LOW;
+  chan->chan11 = CRSF_CHANNEL_LOW;
+  chan->chan12 = CRSF_CHANNEL_LOW;
+  chan->chan13 = CRSF_CHANNEL_LOW;
+  chan->chan14 = CRSF_CHANNEL_LOW;
+  chan->chan15 = CRSF_CHANNEL_LOW;
+
+  frame[sizeof(frame) - 1] = crc8_dvb_s2_data(0, &frame[2], frame[1] - 1);
+
+  sitl_serial_write_frame(frame, sizeof(frame));
+}
+
+// roll and pitch stick to bring the gravity vector seen by the quad to the target tilt
+static void pilot_level(pilot_sticks_t *sticks) {
+  const float *rot = sitl_quad.rot;
+
+  // world up in body frame
+  const float up_x = rot[6];
+  const float up_y = rot[7];
+
+  sticks->roll = constrainf(-PILOT_TILT_GAIN * (up_x - target_tilt[0]), -1.0f, 1.0f);
+  sticks->pitch = constrainf(-PILOT_TILT_GAIN * (up_y - target_tilt[1]), -1.0f, 1.0f);
+}
+
+static float pilot_throttle() {
+  const float tilt = max(sitl_quad.rot[8], 0.5f);
+  const float throttle = PILOT_HOVER_THROTTLE + 0.1f * (target_altitude - sitl_quad.pos[2]) - 0.1f * sitl_quad.vel[2];
+  return constrainf(throttle / tilt, 0.1f, 0.9f);
+}
+
+static void pilot_new_target() {
+  target_tilt[0] = sitl_random_float() * PILOT_TILT_MAX;
+  target_tilt[1] = sitl_random_float() * PILOT_TILT_MAX;
+  target_yaw = sitl_random_float() * PILOT_YAW_MAX;
+  target_altitude = PILOT_ALTITUDE + sitl_random_float();
+}
+
+void sitl_pilot_update(uint64_t now_us) {
+  if (now_us < next_frame_us) {
+    return;
+  }
+
+  const float dt = (now_us - last_frame_us) * 1e-6f;
+  last_frame_us = now_us;
+  next_frame_us = now_us + PILOT_FRAME_INTERVAL_US;
+
+  pilot_sticks_t sticks = {
+      .roll = 0,
+      .pitch = 0,
+      .throttle = 0,
+      .yaw = 0,
+      .arm = false,
+  };
+
+  const uint64_t land_us = sitl_config.duration_us > PILOT_LAND_TIME_US ? sitl_config.duration_us - PILOT_LAND_TIME_US : 0;
+
+  switch (pilot_state) {
+  case PILOT_WAIT:
+    if (now_us >= PILOT_ARM_TIME_US) {
+      pilot_state = PILOT_ARMED;
+    }
+    break;
+
+  case PILOT_ARMED:
+    sticks.arm = true;
+    if (now_us >= PILOT_TAKEOFF_TIME_US) {
+      next_target_us = now_us + PILOT_TARGET_INTERVAL_US;
+      next_flip_us = now_us + PILOT_FLIP_INTERVAL_US;
+      pilot_state = PILOT_FLYING;
+    }
+    break;
+
+  case PILOT_FLYING:
+    sticks.arm = true;
+
+    if (now_us >= land_us) {
+      target_tilt[0] = target_tilt[1] = 0;
+      target_yaw = 0;
+      pilot_state = PILOT_LANDING;
+      break;
+    }
+
+    if (now_us >= next_target_us) {
+      next_target_us = now_us + PILOT_TARGET_INTERVAL_US;
+      pilot_new_target();
+    }
+
+    if (now_us >= next_flip_us && sitl_quad.pos[2] > PILOT_ALTITUDE - 0.5f) {
+      next_flip_us = now_us + PILOT_FLIP_INTERVAL_US;
+      flip_axis = !flip_axis;
+      flip_angle = 0;
+      pilot_state = PILOT_FLIP;
+    }
+
+    pilot_level(&sticks);
+    sticks.throttle = pilot_throttle();
+    sticks.yaw = target_yaw;
+    break;
+
+  case PILOT_FLIP: {
+    sticks.arm = true;
+
+    // full stick until the quad went most of the way around, leveling out does the rest
+    const float rate = flip_axis ? sitl_quad.rate[0] : -sitl_quad.rate[1];
+    flip_angle += fabsf(rate) * dt;
+
+    if (flip_angle > 1.7f * M_PI_F) {
+      target_tilt[0] = target_tilt[1] = 0;
+      pilot_state = PILOT_FLYING;
+    }
+
+    if (flip_axis) {
+      sticks.pitch = 1.0f;
+    } else {
+      sticks.roll = 1.0f;
+    }
+    sticks.throttle = 0.3f;
+    break;
+  }
+
+  case PILOT_LANDING:
+    sticks.arm = true;
+
+    pilot_level(&sticks);
+    sticks.throttle = constrainf(PILOT_HOVER_THROTTLE - 0.15f * (sitl_quad.vel[2] + PILOT_DESCENT_RATE), 0.0f, 0.6f);
+
+    if (sitl_quad.on_ground) {
+      sticks.throttle = 0;
+      if (now_us + PILOT_DISARM_TIME_US >= sitl_config.duration_us) {
+        pilot_state = PILOT_DISARMED;
+      }
+    }
+    break;
+
+  case PILOT_DISARMED:
+    break;
+  }
+
+  pilot_send(&sticks);
+}
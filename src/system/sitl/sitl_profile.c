@@ -0,0 +1,96 @@
+#include <stdio.h>
+
+#include "drv_fmc.h"
+#include "flash.h"
+#include "profile.h"
+#include "sitl_sim.h"
+
+// encodes the default profile and one with every integer at its largest value,
+// cbor grows with the value of an integer while floats and the fixed size strings always take the same space.
+// a profile that does not fit PROFILE_STORAGE_SIZE would fail every save.
+
+extern const profile_t default_profile;
+
+static void worst_uint8(void *val) {
+  *(uint8_t *)val = UINT8_MAX;
+}
+
+static void worst_uint16(void *val) {
+  *(uint16_t *)val = UINT16_MAX;
+}
+
+static void worst_uint32(void *val) {
+  *(uint32_t *)val = UINT32_MAX;
+}
+
+static void worst_float(void *val) {}
+
+static void worst_vec3_t(void *val) {}
+
+static void worst_profile_metadata_t(void *val) {
+  profile_metadata_t *meta = val;
+  worst_uint32(&meta->datetime);
+}
+
+#define MEMBER(member, type) worst_##type(&o->member);
+#define STR_MEMBER(member)
+#define TSTR_MEMBER(member, size)
+#define ARRAY_MEMBER(member, size, type) \
+  for (uint32_t i = 0; i < size; i++) {  \
+    worst_##type(&o->member[i]);         \
+  }
+#define STR_ARRAY_MEMBER(member, size)
+
+#define WORST_STRUCT(type, members) \
+  static void worst_##type(void *val) { \
+    type *o = val;                      \
+    members                             \
+  }
+
+WORST_STRUCT(rate_t, RATE_MEMBERS)
+WORST_STRUCT(profile_rate_t, PROFILE_RATE_MEMBERS)
+WORST_STRUCT(profile_motor_t, MOTOR_MEMBERS)
+WORST_STRUCT(profile_serial_t, SERIAL_MEMBERS)
+WORST_STRUCT(profile_filter_parameter_t, FILTER_PARAMETER_MEMBERS)
+WORST_STRUCT(profile_filter_t, FILTER_MEMBERS)
+WORST_STRUCT(profile_osd_t, OSD_MEMBERS)
+WORST_STRUCT(profile_voltage_t, VOLTAGE_MEMBERS)
+WORST_STRUCT(profile_blackbox_t, BLACKBOX_MEMBERS)
+WORST_STRUCT(pid_rate_t, PID_RATE_MEMBERS)
+WORST_STRUCT(angle_pid_rate_t, ANGLE_PID_RATE_MEMBERS)
+WORST_STRUCT(stick_rate_t, STICK_RATE_MEMBERS)
+WORST_STRUCT(throttle_dterm_attenuation_t, DTERM_ATTENUATION_MEMBERS)
+WORST_STRUCT(profile_pid_t, PID_MEMBERS)
+WORST_STRUCT(profile_stick_calibration_limits_t, CALIBRATION_LIMIT_MEMBERS)
+WORST_STRUCT(profile_receiver_t, RECEIVER_MEMBERS)
+WORST_STRUCT(profile_t, PROFILE_MEMBERS)
+
+#undef MEMBER
+#undef STR_MEMBER
+#undef TSTR_MEMBER
+#undef ARRAY_MEMBER
+#undef STR_ARRAY_MEMBER
+#undef WORST_STRUCT
+
+static uint32_t profile_encoded_size(const profile_t *p) {
+  static uint8_t buffer[2 * PROFILE_STORAGE_SIZE];
+
+  cbor_value_t enc;
+  cbor_encoder_init(&enc, buffer, sizeof(buffer));
+  if (cbor_encode_profile_t(&enc, p) < CBOR_OK) {
+    return UINT32_MAX;
+  }
+  return cbor_encoder_len(&enc);
+}
+
+bool sitl_profile_report() {
+  static profile_t worst;
+  worst = default_profile;
+  worst_profile_t(&worst);
+
+  const uint32_t default_size = profile_encoded_size(&default_profile);
+  const uint32_t worst_size = profile_encoded_size(&worst);
+
+  printf("sitl: profile default=%u worst=%u storage=%u\n", default_size, worst_size, PROFILE_STORAGE_SIZE);
+  return worst_size <= PROFILE_STORAGE_SIZE;
+}
@@ -0,0 +1,244 @@
+#include <math.h>
+#include <string.h>
+
+#include "drv_motor.h"
+#include "sitl_sim.h"
+#include "util/util.h"
+
+// roughly a 5 inch quad on 4s
+#define QUAD_MASS 0.5f           // kg
+#define QUAD_ARM 0.08f           // m, motor offset along both body axes
+#define QUAD_INERTIA_XY 2.5e-3f  // kg m^2
+#define QUAD_INERTIA_Z 4.5e-3f   // kg m^2
+#define QUAD_DRAG 0.15f          // N per m/s
+#define QUAD_RATE_DRAG 1.0e-3f   // Nm per rad/s
+#define QUAD_CRASH_SPEED 4.0f    // m/s, vertical speed on touch down
+#define QUAD_CRASH_TILT 0.5f     // cos of the max tilt on touch down
+
+#define MOTOR_THRUST_MAX 10.0f   // N at full throttle and full battery
+#define MOTOR_RPM_MAX 30000.0f   // at full throttle and full battery
+#define MOTOR_TIME_CONSTANT 0.02f
+#define MOTOR_YAW_TORQUE 0.015f  // Nm of prop drag per N of thrust
+#define MOTOR_AMPS_PER_NEWTON 2.5f
+
+#define BATTERY_VOLTAGE 16.8f
+#define BATTERY_RESISTANCE 0.02f
+
+#define GRAVITY 9.81f
+
+// +-2000deg/s over 16bit and +-16g over 16bit
+#define GYRO_LSB_PER_RAD (65536.0f / 4000.0f * RADTODEG)
+#define ACCEL_LSB_PER_G 2048.0f
+
+#define GYRO_NOISE 0.02f     // rad/s
+#define GYRO_VIBRATION 0.4f  // rad/s per motor at full rpm
+
+sitl_quad_t sitl_quad;
+
+// body frame position of each motor and the direction of its prop drag torque
+static const float motor_pos[SITL_MOTOR_COUNT][2] = {
+    [MOTOR_BL] = {QUAD_ARM, QUAD_ARM},
+    [MOTOR_FL] = {QUAD_ARM, -QUAD_ARM},
+    [MOTOR_BR] = {-QUAD_ARM, QUAD_ARM},
+    [MOTOR_FR] = {-QUAD_ARM, -QUAD_ARM},
+};
+
+static const float motor_yaw_dir[SITL_MOTOR_COUNT] = {
+    [MOTOR_BL] = 1.0f,
+    [MOTOR_FL] = -1.0f,
+    [MOTOR_BR] = -1.0f,
+    [MOTOR_FR] = 1.0f,
+};
+
+// how much each motor shakes each gyro axis
+static const float motor_vibration[SITL_MOTOR_COUNT][3] = {
+    [MOTOR_BL] = {0.7f, 0.5f, 0.2f},
+    [MOTOR_FL] = {0.6f, 0.7f, 0.1f},
+    [MOTOR_BR] = {0.5f, 0.6f, 0.3f},
+    [MOTOR_FR] = {0.7f, 0.6f, 0.2f},
+};
+
+void sitl_quad_init() {
+  memset(&sitl_quad, 0, sizeof(sitl_quad_t));
+
+  sitl_quad.rot[0] = 1;
+  sitl_quad.rot[4] = 1;
+  sitl_quad.rot[8] = 1;
+
+  sitl_quad.accel[2] = 1;
+
+  for (uint32_t i = 0; i < SITL_MOTOR_COUNT; i++) {
+    sitl_quad.motor_cmd[i] = MOTOR_OFF;
+    sitl_quad.motor_phase[i] = sitl_random_float() * M_PI_F;
+  }
+
+  sitl_quad.vbat = BATTERY_VOLTAGE;
+  sitl_quad.on_ground = true;
+}
+
+static void rot_to_world(const float *rot, const float *in, float *out) {
+  for (uint32_t i = 0; i < 3; i++) {
+    out[i] = rot[i * 3 + 0] * in[0] + rot[i * 3 + 1] * in[1] + rot[i * 3 + 2] * in[2];
+  }
+}
+
+static void rot_to_body(const float *rot, const float *in, float *out) {
+  for (uint32_t i = 0; i < 3; i++) {
+    out[i] = rot[0 * 3 + i] * in[0] + rot[1 * 3 + i] * in[1] + rot[2 * 3 + i] * in[2];
+  }
+}
+
+// rot = rot * (I + [w]x), followed by gram-schmidt to keep it a rotation
+static void rot_integrate(float *rot, const float *w) {
+  float out[9];
+  for (uint32_t i = 0; i < 3; i++) {
+    const float *r = &rot[i * 3];
+    out[i * 3 + 0] = r[0] + r[1] * w[2] - r[2] * w[1];
+    out[i * 3 + 1] = r[1] + r[2] * w[0] - r[0] * w[2];
+    out[i * 3 + 2] = r[2] + r[0] * w[1] - r[1] * w[0];
+  }
+
+  // columns are the body axes in world frame
+  float x[3] = {out[0], out[3], out[6]};
+  float y[3] = {out[1], out[4], out[7]};
+
+  const float x_len = sqrtf(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+  for (uint32_t i = 0; i < 3; i++) {
+    x[i] /= x_len;
+  }
+
+  const float dot = x[0] * y[0] + x[1] * y[1] + x[2] * y[2];
+  for (uint32_t i = 0; i < 3; i++) {
+    y[i] -= dot * x[i];
+  }
+  const float y_len = sqrtf(y[0] * y[0] + y[1] * y[1] + y[2] * y[2]);
+  for (uint32_t i = 0; i < 3; i++) {
+    y[i] /= y_len;
+  }
+
+  const float z[3] = {
+      x[1] * y[2] - x[2] * y[1],
+      x[2] * y[0] - x[0] * y[2],
+      x[0] * y[1] - x[1] * y[0],
+  };
+
+  for (uint32_t i = 0; i < 3; i++) {
+    rot[i * 3 + 0] = x[i];
+    rot[i * 3 + 1] = y[i];
+    rot[i * 3 + 2] = z[i];
+  }
+}
+
+static float sitl_motor_step(uint32_t i, float dt) {
+  const float cmd = sitl_quad.motor_cmd[i] < 0.0f ? 0.0f : constrainf(sitl_quad.motor_cmd[i], 0.0f, 1.0f);
+  const float rpm_target = cmd * MOTOR_RPM_MAX * (sitl_quad.vbat / BATTERY_VOLTAGE);
+
+  sitl_quad.motor_rpm[i] += (rpm_target - sitl_quad.motor_rpm[i]) * (dt / (MOTOR_TIME_CONSTANT + dt));
+
+  sitl_quad.motor_phase[i] += sitl_quad.motor_rpm[i] * (2.0f * M_PI_F / 60.0f) * dt;
+  if (sitl_quad.motor_phase[i] > 2.0f * M_PI_F) {
+    sitl_quad.motor_phase[i] -= 2.0f * M_PI_F;
+  }
+
+  const float rpm = sitl_quad.motor_rpm[i] / MOTOR_RPM_MAX;
+  return MOTOR_THRUST_MAX * rpm * rpm;
+}
+
+void sitl_quad_step(float dt) {
+  float thrust = 0;
+  float torque[3] = {0, 0, 0};
+
+  for (uint32_t i = 0; i < SITL_MOTOR_COUNT; i++) {
+    const float t = sitl_motor_step(i, dt);
+
+    thrust += t;
+    torque[0] += motor_pos[i][1] * t;
+    torque[1] -= motor_pos[i][0] * t;
+    torque[2] += motor_yaw_dir[i] * MOTOR_YAW_TORQUE * t;
+  }
+
+  sitl_quad.ibat = thrust * MOTOR_AMPS_PER_NEWTON;
+  sitl_quad.vbat = BATTERY_VOLTAGE - sitl_quad.ibat * BATTERY_RESISTANCE;
+
+  // translation in world frame
+  const float body_thrust[3] = {0, 0, thrust};
+  float force[3];
+  rot_to_world(sitl_quad.rot, body_thrust, force);
+
+  float accel[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    accel[i] = (force[i] - QUAD_DRAG * sitl_quad.vel[i]) / QUAD_MASS;
+  }
+  accel[2] -= GRAVITY;
+
+  const bool grounded = sitl_quad.on_ground && accel[2] <= 0.0f;
+  if (grounded) {
+    // resting on the ground, the ground takes up all the forces
+    for (uint32_t i = 0; i < 3; i++) {
+      accel[i] = 0;
+      sitl_quad.vel[i] = 0;
+      sitl_quad.rate[i] = 0;
+    }
+  } else {
+    sitl_quad.on_ground = false;
+
+    for (uint32_t i = 0; i < 3; i++) {
+      sitl_quad.vel[i] += accel[i] * dt;
+      sitl_quad.pos[i] += sitl_quad.vel[i] * dt;
+    }
+
+    if (sitl_quad.pos[2] <= 0.0f) {
+      if (sitl_quad.vel[2] < -QUAD_CRASH_SPEED || sitl_quad.rot[8] < QUAD_CRASH_TILT) {
+        sitl_quad.crashed = true;
+      }
+
+      sitl_quad.pos[2] = 0;
+      sitl_quad.on_ground = true;
+    }
+
+    // rotation in body frame, including the gyroscopic coupling
+    const float inertia[3] = {QUAD_INERTIA_XY, QUAD_INERTIA_XY, QUAD_INERTIA_Z};
+    const float *w = sitl_quad.rate;
+    const float momentum[3] = {inertia[0] * w[0], inertia[1] * w[1], inertia[2] * w[2]};
+    const float coupling[3] = {
+        w[1] * momentum[2] - w[2] * momentum[1],
+        w[2] * momentum[0] - w[0] * momentum[2],
+        w[0] * momentum[1] - w[1] * momentum[0],
+    };
+
+    for (uint32_t i = 0; i < 3; i++) {
+      const float t = torque[i] - QUAD_RATE_DRAG * w[i] - coupling[i];
+      sitl_quad.rate[i] += t / inertia[i] * dt;
+    }
+
+    const float delta[3] = {w[0] * dt, w[1] * dt, w[2] * dt};
+    rot_integrate(sitl_quad.rot, delta);
+  }
+
+  // the accelerometer measures everything but gravity
+  const float specific[3] = {accel[0] / GRAVITY, accel[1] / GRAVITY, accel[2] / GRAVITY + 1.0f};
+  rot_to_body(sitl_quad.rot, specific, sitl_quad.accel);
+}
+
+void sitl_quad_gyro_sample(vec3_t *gyro, vec3_t *accel) {
+  float rate[3] = {
+      -sitl_quad.rate[1],
+      -sitl_quad.rate[0],
+      sitl_quad.rate[2],
+  };
+
+  for (uint32_t i = 0; i < SITL_MOTOR_COUNT; i++) {
+    const float rpm = sitl_quad.motor_rpm[i] / MOTOR_RPM_MAX;
+    const float shake = GYRO_VIBRATION * rpm * rpm * sinf(sitl_quad.motor_phase[i]);
+    for (uint32_t j = 0; j < 3; j++) {
+      rate[j] += motor_vibration[i][j] * shake;
+    }
+  }
+
+  for (uint32_t i = 0; i < 3; i++) {
+    rate[i] += GYRO_NOISE * sitl_random_float();
+
+    gyro->axis[i] = constrainf(roundf(rate[i] * GYRO_LSB_PER_RAD), -32768, 32767);
+    accel->axis[i] = constrainf(roundf(sitl_quad.accel[i] * ACCEL_LSB_PER_G), -32768, 32767);
+  }
+}
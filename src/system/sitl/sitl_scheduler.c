@@ -0,0 +1,162 @@
+#include <stdio.h>
+
+#include "scheduler.h"
+#include "sitl_sim.h"
+
+// drives the scheduler with a clock of its own that only moves by the time the loop and the tasks take.
+// the sitl clock can not be used here, advancing it past the end of the run would exit again.
+// the report runs after the firmware loop has stopped, so taking over the scheduler is fine.
+
+#define BENCH_LOOP_US 125
+// time the control loop takes before the scheduler gets the rest
+#define BENCH_CONTROL_US 60
+#define BENCH_DURATION_US 1000000
+// starts short of the rollover so the run crosses it
+#define BENCH_START_US (UINT32_MAX - BENCH_DURATION_US / 4)
+
+typedef enum {
+  BENCH_TASK_RT,
+  BENCH_TASK_RX,
+  BENCH_TASK_OSD,
+  BENCH_TASK_HOG,
+  BENCH_TASK_MAX,
+} bench_task_id_t;
+
+static uint32_t bench_now = 0;
+static uint32_t bench_loop = 0;
+
+static uint32_t bench_overruns = 0;
+static uint32_t bench_hog_last_loop = 0;
+static uint32_t bench_hog_gap_max = 0;
+
+static uint32_t bench_time() {
+  return bench_now;
+}
+
+static void bench_task_rt() {
+  bench_now += 5;
+}
+
+static void bench_task_rx() {
+  bench_now += 15;
+}
+
+// every fifth draw takes longer than its budget
+static void bench_task_osd() {
+  static uint32_t draws = 0;
+  if (++draws % 5 == 0) {
+    bench_now += 50;
+    bench_overruns++;
+  } else {
+    bench_now += 35;
+  }
+}
+
+// due every loop but never fits the slack, only runs when forced
+static void bench_task_hog() {
+  bench_now += 100;
+
+  const uint32_t gap = bench_loop - bench_hog_last_loop;
+  if (gap > bench_hog_gap_max) {
+    bench_hog_gap_max = gap;
+  }
+  bench_hog_last_loop = bench_loop;
+}
+
+static task_t bench_tasks[BENCH_TASK_MAX] = {
+    [BENCH_TASK_RT] = TASK_INIT("rt", bench_task_rt, TASK_PRIORITY_REALTIME, 0, 5),
+    [BENCH_TASK_RX] = TASK_INIT("rx", bench_task_rx, TASK_PRIORITY_HIGH, 1000, 20),
+    [BENCH_TASK_OSD] = TASK_INIT("osd", bench_task_osd, TASK_PRIORITY_MEDIUM, 20000, 40),
+    [BENCH_TASK_HOG] = TASK_INIT("hog", bench_task_hog, TASK_PRIORITY_LOW, 0, 100),
+};
+
+static bool count_near(uint32_t count, uint32_t expected) {
+  return count + 1 >= expected && count <= expected + 1;
+}
+
+// the loop runs the control part and hands the rest of the period to the scheduler
+static bool sitl_scheduler_loop_bench() {
+  bench_now = BENCH_START_US;
+  bench_loop = 0;
+  scheduler_init(bench_tasks, BENCH_TASK_MAX, bench_time);
+
+  while ((uint32_t)(bench_now - BENCH_START_US) < BENCH_DURATION_US) {
+    const uint32_t loop_start = bench_now;
+    bench_now += BENCH_CONTROL_US;
+
+    scheduler_run(loop_start + BENCH_LOOP_US);
+
+    // idle until the next loop, unless a forced task overran it
+    if ((int32_t)(bench_now - (loop_start + BENCH_LOOP_US)) < 0) {
+      bench_now = loop_start + BENCH_LOOP_US;
+    }
+    bench_loop++;
+  }
+
+  const task_t *rt = &bench_tasks[BENCH_TASK_RT];
+  const task_t *rx = &bench_tasks[BENCH_TASK_RX];
+  const task_t *osd = &bench_tasks[BENCH_TASK_OSD];
+  const task_t *hog = &bench_tasks[BENCH_TASK_HOG];
+
+  const bool pass = rt->run_count == bench_loop && rt->defer_count == 0 &&
+                    count_near(rx->run_count, BENCH_DURATION_US / rx->period_us) &&
+                    count_near(osd->run_count, BENCH_DURATION_US / osd->period_us) &&
+                    osd->overrun_count == bench_overruns &&
+                    hog->run_count > 0 && bench_hog_gap_max <= TASK_MAX_DEFER + 1;
+
+  printf("sitl: scheduler_loop loops=%u rt=%u rx=%u osd=%u osd_overruns=%u hog=%u hog_gap=%u pass=%u\n",
+         bench_loop,
+         rt->run_count,
+         rx->run_count,
+         osd->run_count,
+         osd->overrun_count,
+         hog->run_count,
+         bench_hog_gap_max,
+         pass);
+
+  return pass;
+}
+
+static void bench_task_slot() {
+  bench_now += 30;
+}
+
+// two tasks come due together with room for one, the higher priority goes first
+// and the other one is forced after TASK_MAX_DEFER loops without slack
+static bool sitl_scheduler_priority_bench() {
+  static task_t tasks[] = {
+      TASK_INIT("medium", bench_task_slot, TASK_PRIORITY_MEDIUM, 1000, 30),
+      TASK_INIT("high", bench_task_slot, TASK_PRIORITY_HIGH, 1000, 30),
+  };
+  const task_t *medium = &tasks[0];
+  const task_t *high = &tasks[1];
+
+  bench_now = 0;
+  scheduler_init(tasks, 2, bench_time);
+
+  bench_now += 1000;
+  scheduler_run(bench_now + 40);
+  const bool priority = high->run_count == 1 && medium->run_count == 0;
+
+  uint32_t loops = 0;
+  while (medium->run_count == 0 && loops <= TASK_MAX_DEFER) {
+    bench_now += 50;
+    scheduler_run(bench_now);
+    loops++;
+  }
+  const bool forced = medium->run_count == 1 && medium->defer_count == TASK_MAX_DEFER;
+
+  const bool pass = priority && forced;
+  printf("sitl: scheduler_priority priority=%u forced=%u loops=%u pass=%u\n", priority, forced, loops, pass);
+
+  return pass;
+}
+
+bool sitl_scheduler_report() {
+  if (!sitl_config.bench) {
+    return true;
+  }
+  const bool loop_pass = sitl_scheduler_loop_bench();
+  const bool priority_pass = sitl_scheduler_priority_bench();
+  return loop_pass && priority_pass;
+}
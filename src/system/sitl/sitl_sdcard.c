@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "drv_spi_sdcard.h"
+#include "project.h"
+#include "sitl_sim.h"
+#include "util/util.h"
+
+#ifdef USE_SDCARD
+
+// a sdhc card in spi mode, byte by byte as the host clocks it.
+// multi block writes program a block in SDCARD_BLOCK_WRITE_US, unless the run was pre-erased
+// with ACMD23. every SDCARD_STALL_INTERVAL blocks the card stalls like a real controller
+// does when it has to allocate a new erase unit.
+#define SDCARD_BLOCKS (64 * 2048)
+#define SDCARD_SIZE (SDCARD_BLOCKS * SDCARD_PAGE_SIZE)
+
+#define SDCARD_BLOCK_WRITE_US 250
+#define SDCARD_BLOCK_WRITE_ERASED_US 100
+#define SDCARD_STALL_INTERVAL 512
+#define SDCARD_STALL_US 4000
+#define SDCARD_STOP_TRAN_US 500
+
+#define SDCARD_INIT_TRIES 3
+
+#define TOKEN_START_BLOCK 0xFE
+#define TOKEN_START_MULTI_WRITE 0xFC
+#define TOKEN_STOP_MULTI_WRITE 0xFD
+#define DATA_RESPONSE_ACCEPTED 0x05
+
+typedef enum {
+  CARD_COMMAND,
+  CARD_MULTI_WRITE,
+  CARD_RX_BLOCK,
+} card_state_t;
+
+static uint8_t card[SDCARD_SIZE];
+
+static card_state_t card_state = CARD_COMMAND;
+static bool card_ready = false;
+static bool app_cmd = false;
+static uint32_t init_tries = 0;
+
+static uint8_t cmd[6];
+static uint32_t cmd_size = 0;
+
+// bytes the card shifts out next
+static uint8_t out[SDCARD_PAGE_SIZE + 8];
+static uint32_t out_size = 0;
+static uint32_t out_pos = 0;
+
+static bool reading = false;
+static uint32_t read_block = 0;
+
+static uint32_t write_block = 0;
+static uint32_t erased_blocks = 0;
+static uint8_t rx_block[SDCARD_PAGE_SIZE + 2];
+static uint32_t rx_size = 0;
+
+// programming starts once the data response is out, miso stays low until it is done
+static uint32_t busy_pending_us = 0;
+static uint64_t busy_until_us = 0;
+
+static uint32_t stat_blocks = 0;
+static uint32_t stat_streams = 0;
+static uint32_t stat_busy_max_us = 0;
+
+static void card_out(const uint8_t *data, uint32_t size) {
+  memcpy(out + out_size, data, size);
+  out_size += size;
+}
+
+static void card_out_byte(uint8_t val) {
+  out[out_size++] = val;
+}
+
+static void card_out_reset() {
+  out_size = 0;
+  out_pos = 0;
+}
+
+static void card_out_data(const uint8_t *data, uint32_t size) {
+  card_out_byte(0xFF);
+  card_out_byte(TOKEN_START_BLOCK);
+  card_out(data, size);
+  card_out_byte(0xFF);
+  card_out_byte(0xFF);
+}
+
+static void card_command() {
+  const uint8_t index = cmd[0] & 0x3F;
+  const uint32_t arg = ((uint32_t)cmd[1] << 24) | ((uint32_t)cmd[2] << 16) | ((uint32_t)cmd[3] << 8) | cmd[4];
+  const uint8_t r1 = card_ready ? 0x00 : SDCARD_R1_IDLE;
+
+  const bool is_app_cmd = app_cmd;
+  app_cmd = false;
+
+  card_out_reset();
+  // one byte of Ncr before every response
+  card_out_byte(0xFF);
+
+  if (is_app_cmd) {
+    switch (index) {
+    case SDCARD_ACMD_OD_COND:
+      init_tries++;
+      card_ready = init_tries >= SDCARD_INIT_TRIES;
+      card_out_byte(card_ready ? 0x00 : SDCARD_R1_IDLE);
+      return;
+
+    case SDCARD_ACMD_SET_WR_BLK_ERASE_COUNT:
+      erased_blocks = arg & 0x7FFFFF;
+      card_out_byte(r1);
+      return;
+
+    default:
+      card_out_byte(r1 | SDCARD_R1_ILLEGAL_COMMAND);
+      return;
+    }
+  }
+
+  switch (index) {
+  case SDCARD_GO_IDLE:
+    card_ready = false;
+    init_tries = 0;
+    card_out_byte(SDCARD_R1_IDLE);
+    break;
+
+  case SDCARD_IF_COND: {
+    const uint8_t resp[5] = {r1, 0x00, 0x00, (arg >> 8) & 0x0F, arg & 0xFF};
+    card_out(resp, 5);
+    break;
+  }
+
+  case SDCARD_OCR: {
+    // powered up and high capacity
+    const uint8_t resp[5] = {r1, 0xC0, 0xFF, 0x80, 0x00};
+    card_out(resp, 5);
+    break;
+  }
+
+  case SDCARD_CID: {
+    const uint8_t cid[16] = {0x03, 'S', 'D', 'S', 'I', 'T', 'L', '0', 0x10, 0x12, 0x34, 0x56, 0x78, 0x01, 0x5A, 0x01};
+    card_out_byte(r1);
+    card_out_data(cid, 16);
+    break;
+  }
+
+  case SDCARD_CSD: {
+    // csd version 2, C_SIZE is the size in 512k units minus one
+    const uint32_t c_size = SDCARD_BLOCKS / 1024 - 1;
+    const uint8_t csd[16] = {0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, (c_size >> 16) & 0x3F, c_size >> 8, c_size, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01};
+    card_out_byte(r1);
+    card_out_data(csd, 16);
+    break;
+  }
+
+  case SDACARD_SET_BLOCK_LEN:
+    card_out_byte(r1);
+    break;
+
+  case SDCARD_APP_CMD:
+    app_cmd = true;
+    card_out_byte(r1);
+    break;
+
+  case SDCARD_READ_BLOCK:
+  case SDCARD_READ_MULTIPLE_BLOCK:
+    if (arg >= SDCARD_BLOCKS) {
+      card_out_byte(r1 | SDCARD_R1_ADDRESS_ERROR);
+      break;
+    }
+    card_out_byte(r1);
+    card_out_data(card + arg * SDCARD_PAGE_SIZE, SDCARD_PAGE_SIZE);
+    read_block = arg + 1;
+    reading = index == SDCARD_READ_MULTIPLE_BLOCK;
+    break;
+
+  case SDCARD_STOP_TRANSMISSION:
+    reading = false;
+    // the host clocks a stuff byte before it looks for the response
+    card_out_byte(r1);
+    break;
+
+  case SDCARD_WRITE_MULTIPLE_BLOCK:
+    if (arg >= SDCARD_BLOCKS) {
+      card_out_byte(r1 | SDCARD_R1_ADDRESS_ERROR);
+      break;
+    }
+    card_out_byte(r1);
+    write_block = arg;
+    card_state = CARD_MULTI_WRITE;
+    stat_streams++;
+    break;
+
+  default:
+    card_out_byte(r1 | SDCARD_R1_ILLEGAL_COMMAND);
+    break;
+  }
+}
+
+static void card_write_block() {
+  if (write_block < SDCARD_BLOCKS) {
+    memcpy(card + write_block * SDCARD_PAGE_SIZE, rx_block, SDCARD_PAGE_SIZE);
+  }
+  write_block++;
+  stat_blocks++;
+
+  uint32_t busy_us = SDCARD_BLOCK_WRITE_US;
+  if (erased_blocks > 0) {
+    busy_us = SDCARD_BLOCK_WRITE_ERASED_US;
+    erased_blocks--;
+  }
+  if ((stat_blocks % SDCARD_STALL_INTERVAL) == 0) {
+    busy_us += SDCARD_STALL_US;
+  }
+  busy_pending_us = busy_us;
+
+  card_out_reset();
+  card_out_byte(DATA_RESPONSE_ACCEPTED);
+}
+
+static void card_receive(uint8_t tx) {
+  switch (card_state) {
+  case CARD_RX_BLOCK:
+    rx_block[rx_size++] = tx;
+    if (rx_size == sizeof(rx_block)) {
+      card_write_block();
+      card_state = CARD_MULTI_WRITE;
+    }
+    break;
+
+  case CARD_MULTI_WRITE:
+    if (tx == TOKEN_START_MULTI_WRITE) {
+      rx_size = 0;
+      card_state = CARD_RX_BLOCK;
+    } else if (tx == TOKEN_STOP_MULTI_WRITE) {
+      // one byte before the card signals busy
+      card_out_reset();
+      card_out_byte(0xFF);
+      busy_pending_us = SDCARD_STOP_TRAN_US;
+      erased_blocks = 0;
+      card_state = CARD_COMMAND;
+    }
+    break;
+
+  case CARD_COMMAND:
+    if (cmd_size == 0 && (tx & 0xC0) != 0x40) {
+      break;
+    }
+    cmd[cmd_size++] = tx;
+    if (cmd_size == sizeof(cmd)) {
+      cmd_size = 0;
+      card_command();
+    }
+    break;
+  }
+}
+
+static uint8_t card_transmit() {
+  if (out_pos < out_size) {
+    const uint8_t val = out[out_pos++];
+    if (out_pos == out_size && busy_pending_us) {
+      busy_until_us = sitl_time_us() + busy_pending_us;
+      stat_busy_max_us = max(stat_busy_max_us, busy_pending_us);
+      busy_pending_us = 0;
+    }
+    return val;
+  }
+
+  if (sitl_time_us() < busy_until_us) {
+    return 0x00;
+  }
+
+  if (reading && read_block < SDCARD_BLOCKS) {
+    card_out_reset();
+    card_out_data(card + read_block * SDCARD_PAGE_SIZE, SDCARD_PAGE_SIZE);
+    read_block++;
+    return card_transmit();
+  }
+
+  return 0xFF;
+}
+
+uint8_t sitl_sdcard_transfer(uint8_t tx) {
+  const uint8_t rx = card_transmit();
+  card_receive(tx);
+  return rx;
+}
+
+void sitl_sdcard_select(bool selected) {
+  if (!selected) {
+    cmd_size = 0;
+  }
+}
+
+// direct access for the simulator, without going through spi
+void sitl_sdcard_read(uint32_t addr, uint8_t *data, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    data[i] = card[(addr + i) % SDCARD_SIZE];
+  }
+}
+
+// the card survives between runs in an image file, which the host can mount or check
+void sitl_sdcard_load() {
+  if (!sitl_config.sdcard_image) {
+    return;
+  }
+
+  FILE *f = fopen(sitl_config.sdcard_image, "rb");
+  if (f == NULL) {
+    // a new card
+    return;
+  }
+  const size_t size = fread(card, 1, SDCARD_SIZE, f);
+  fclose(f);
+
+  printf("sitl: sdcard image %s loaded %zu bytes\n", sitl_config.sdcard_image, size);
+}
+
+void sitl_sdcard_save() {
+  if (!sitl_config.sdcard_image) {
+    return;
+  }
+
+  FILE *f = fopen(sitl_config.sdcard_image, "wb");
+  if (f == NULL) {
+    printf("sitl: sdcard image %s could not be written\n", sitl_config.sdcard_image);
+    return;
+  }
+  fwrite(card, 1, SDCARD_SIZE, f);
+  fclose(f);
+}
+
+void sitl_sdcard_report() {
+  printf("sitl: sdcard blocks=%u streams=%u busy_max=%uus\n", stat_blocks, stat_streams, stat_busy_max_us);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "drv_serial.h"
+
+#include <string.h>
+
+#include "profile.h"
+#include "project.h"
+#include "sitl_sim.h"
+
+// a 420kbaud wire needs about 24us per byte, the model hands over one byte per step
+#define SERIAL_WIRE_SIZE 64
+
+usart_ports_t serial_rx_port = USART_PORT_INVALID;
+usart_ports_t serial_smart_audio_port = USART_PORT_INVALID;
+usart_ports_t serial_hdzero_port = USART_PORT_INVALID;
+
+static USART_TypeDef sitl_usart[USART_PORTS_MAX];
+
+#define USART_PORT(chan, rx, tx)                   \
+  {                                                \
+      .channel_index = chan,                       \
+      .channel = &sitl_usart[USART_IDENT(chan)],   \
+      .gpio_af = 0,                                \
+      .rx_pin = rx,                                \
+      .tx_pin = tx,                                \
+  },
+#define SOFT_SERIAL_PORT(index, rx_pin, tx_pin)
+
+usart_port_def_t usart_port_defs[USART_PORTS_MAX] = {{}, USART_PORTS};
+
+#undef USART_PORT
+#undef SOFT_SERIAL_PORT
+
+static uint8_t wire[SERIAL_WIRE_SIZE];
+static uint32_t wire_size = 0;
+static uint32_t wire_offset = 0;
+
+#define USART usart_port_defs[port]
+
+void serial_enable_rcc(usart_ports_t port) {}
+
+void serial_enable_isr(usart_ports_t port) {}
+
+void serial_disable_isr(usart_ports_t port) {}
+
+void serial_port_init(usart_ports_t port, LL_USART_InitTypeDef *usart_init, bool half_duplex, bool invert) {
+  if (port == USART_PORT_INVALID) {
+    return;
+  }
+
+  USART.channel->SR = SITL_USART_SR_TXE | SITL_USART_SR_TC;
+  USART.channel->CR = 0;
+}
+
+void serial_rx_init(rx_serial_protocol_t proto) {
+  serial_rx_port = profile.serial.rx;
+
+  if (serial_rx_port == USART_PORT_INVALID) {
+    return;
+  }
+
+  LL_USART_InitTypeDef usart_init;
+  LL_USART_StructInit(&usart_init);
+  serial_port_init(serial_rx_port, &usart_init, false, false);
+
+  LL_USART_EnableIT_RXNE(usart_port_defs[serial_rx_port].channel);
+}
+
+// nothing but the receiver is connected, other ports stay silent
+void serial_init(serial_port_t *serial, usart_ports_t port, uint32_t baudrate, uint8_t stop_bits, bool half_duplex) {
+  if (port == USART_PORT_INVALID) {
+    return;
+  }
+
+  LL_USART_InitTypeDef usart_init;
+  LL_USART_StructInit(&usart_init);
+  serial_port_init(port, &usart_init, half_duplex, false);
+
+  if (serial) {
+    serial->port = port;
+  }
+}
+
+uint32_t serial_read_bytes(serial_port_t *serial, uint8_t *data, const uint32_t size) {
+  return 0;
+}
+
+bool serial_write_bytes(serial_port_t *serial, const uint8_t *data, const uint32_t size) {
+  return true;
+}
+
+bool serial_is_soft(usart_ports_t port) {
+  return false;
+}
+
+bool sitl_serial_write_frame(const uint8_t *data, uint32_t size) {
+  if (wire_offset < wire_size || size > SERIAL_WIRE_SIZE) {
+    // previous frame still on the wire
+    return false;
+  }
+
+  memcpy(wire, data, size);
+  wire_size = size;
+  wire_offset = 0;
+  return true;
+}
+
+void sitl_serial_update(uint64_t now_us) {
+  if (wire_offset >= wire_size) {
+    return;
+  }
+
+  const uint8_t data = wire[wire_offset++];
+
+  const usart_ports_t port = serial_rx_port;
+  if (port == USART_PORT_INVALID || !LL_USART_IsEnabledIT_RXNE(USART.channel)) {
+    // nobody listening, the byte is lost
+    return;
+  }
+
+  if (LL_USART_IsActiveFlag_RXNE(USART.channel)) {
+    USART.channel->SR |= SITL_USART_SR_ORE;
+  }
+  USART.channel->DR = data;
+  USART.channel->SR |= SITL_USART_SR_RXNE;
+
+  extern void rx_serial_isr();
+  rx_serial_isr();
+}
@@ -0,0 +1,220 @@
+#include "sitl_sim.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "drv_time.h"
+#include "failloop.h"
+#include "flight/control.h"
+#include "project.h"
+#include "util/util.h"
+
+#define SITL_DEFAULT_DURATION_S 30
+#define SITL_DEFAULT_SEED 1
+
+// the realtime mode lets the simulation run ahead of the wall clock by at most this much
+#define SITL_REALTIME_SLACK_US 1000
+
+sitl_config_t sitl_config;
+sitl_stats_t sitl_stats;
+
+DWT_Type sitl_dwt;
+uint32_t sitl_uid[3];
+
+static uint64_t sim_cycles = 0;
+// what the firmware sees as now, trails sim_cycles while the model catches up
+static uint64_t now_cycles = 0;
+static uint64_t model_time_us = 0;
+static bool model_running = false;
+
+static uint32_t random_state = SITL_DEFAULT_SEED;
+
+static struct timespec wall_start;
+
+static uint32_t env_uint(const char *name, uint32_t fallback) {
+  const char *val = getenv(name);
+  if (val == NULL || *val == 0) {
+    return fallback;
+  }
+  return strtoul(val, NULL, 0);
+}
+
+void sitl_init() {
+  sitl_config.duration_us = env_uint("SITL_DURATION", SITL_DEFAULT_DURATION_S) * 1000000;
+  sitl_config.seed = env_uint("SITL_SEED", SITL_DEFAULT_SEED);
+  sitl_config.realtime = env_uint("SITL_REALTIME", 0);
+  sitl_config.pty = env_uint("SITL_PTY", 0);
+  sitl_config.bench = env_uint("SITL_BENCH", 0);
+  sitl_config.blackbox_path = getenv("SITL_BLACKBOX");
+  sitl_config.sdcard_image = getenv("SITL_SDCARD_IMAGE");
+
+  random_state = sitl_config.seed ? sitl_config.seed : SITL_DEFAULT_SEED;
+  for (uint32_t i = 0; i < 3; i++) {
+    sitl_uid[i] = sitl_random();
+  }
+
+  sitl_quad_init();
+#ifdef USE_SDCARD
+  sitl_sdcard_load();
+#endif
+
+  clock_gettime(CLOCK_MONOTONIC, &wall_start);
+}
+
+uint32_t sitl_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+// uniform in [-1, 1]
+float sitl_random_float() {
+  return (float)sitl_random() / (float)UINT32_MAX * 2.0f - 1.0f;
+}
+
+uint64_t sitl_time_us() {
+  return now_cycles / TICKS_PER_US;
+}
+
+static void sitl_set_now(uint64_t cycles) {
+  now_cycles = cycles;
+  sitl_dwt.CYCCNT = cycles;
+}
+
+static void sitl_realtime_wait() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  const int64_t wall_us = (now.tv_sec - wall_start.tv_sec) * 1000000LL + (now.tv_nsec - wall_start.tv_nsec) / 1000;
+  const int64_t ahead_us = (int64_t)sitl_time_us() - wall_us;
+  if (ahead_us < SITL_REALTIME_SLACK_US) {
+    return;
+  }
+
+  const struct timespec delay = {
+      .tv_sec = ahead_us / 1000000,
+      .tv_nsec = (ahead_us % 1000000) * 1000,
+  };
+  nanosleep(&delay, NULL);
+}
+
+static void sitl_stats_update() {
+  if (!flags.arm_state || sitl_quad.on_ground) {
+    return;
+  }
+
+  sitl_stats.flight_us += SITL_STEP_US;
+
+  // the model rates in the axis convention of the firmware
+  const float rate[3] = {
+      -sitl_quad.rate[1],
+      sitl_quad.rate[0],
+      -sitl_quad.rate[2],
+  };
+  for (uint32_t i = 0; i < 3; i++) {
+    const float error = state.setpoint.axis[i] - rate[i];
+    sitl_stats.rate_error_sq[i] += error * error;
+    sitl_stats.rate_error_max = max(sitl_stats.rate_error_max, fabsf(error));
+  }
+  sitl_stats.rate_error_count++;
+
+  const float speed = sqrtf(sitl_quad.vel[0] * sitl_quad.vel[0] + sitl_quad.vel[1] * sitl_quad.vel[1] + sitl_quad.vel[2] * sitl_quad.vel[2]);
+  sitl_stats.max_speed = max(sitl_stats.max_speed, speed);
+  sitl_stats.max_altitude = max(sitl_stats.max_altitude, sitl_quad.pos[2]);
+}
+
+void sitl_advance_cycles(uint64_t cycles) {
+  sim_cycles += cycles;
+  sitl_set_now(sim_cycles);
+
+  if (model_running) {
+    // called from within a simulated interrupt
+    return;
+  }
+  model_running = true;
+
+  const uint64_t now_us = sim_cycles / TICKS_PER_US;
+  while (model_time_us + SITL_STEP_US <= now_us) {
+    model_time_us += SITL_STEP_US;
+
+    // interrupts fired by the model see the time they happened at
+    sitl_set_now(model_time_us * TICKS_PER_US);
+
+    sitl_quad_step(SITL_STEP_US * 1e-6f);
+    if ((model_time_us % SITL_GYRO_PERIOD_US) == 0) {
+      sitl_gyro_push_sample();
+    }
+
+    sitl_pilot_update(model_time_us);
+    sitl_serial_update(model_time_us);
+    sitl_stats_update();
+
+    if (sitl_quad.crashed || model_time_us >= sitl_config.duration_us) {
+      sitl_exit(sitl_quad.crashed ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+  }
+
+  sitl_set_now(sim_cycles);
+  model_running = false;
+
+  if (sitl_config.realtime) {
+    sitl_realtime_wait();
+  }
+}
+
+static const char *sitl_result(bool profile_fits, bool bench_pass) {
+  if (state.failloop) {
+    return failloop_string(state.failloop);
+  }
+  if (sitl_quad.crashed) {
+    return "crashed";
+  }
+  if (model_time_us < sitl_config.duration_us) {
+    return "reset";
+  }
+  if (!profile_fits) {
+    return "profile_overflow";
+  }
+  if (!bench_pass) {
+    return "bench_failed";
+  }
+  return "ok";
+}
+
+void sitl_exit(int status) {
+  const float count = max(sitl_stats.rate_error_count, 1);
+
+  printf("sitl: seed=%u time=%.3fs loops=%u flight=%.3fs\n",
+         sitl_config.seed,
+         model_time_us * 1e-6,
+         sitl_stats.loops,
+         sitl_stats.flight_us * 1e-6);
+  printf("sitl: rate_rms=%.2f,%.2f,%.2f rate_max=%.2f deg/s\n",
+         sqrtf(sitl_stats.rate_error_sq[0] / count) * RADTODEG,
+         sqrtf(sitl_stats.rate_error_sq[1] / count) * RADTODEG,
+         sqrtf(sitl_stats.rate_error_sq[2] / count) * RADTODEG,
+         sitl_stats.rate_error_max * RADTODEG);
+  printf("sitl: max_altitude=%.2fm max_speed=%.2fm/s position=%.2f,%.2f,%.2f\n",
+         sitl_stats.max_altitude,
+         sitl_stats.max_speed,
+         sitl_quad.pos[0],
+         sitl_quad.pos[1],
+         sitl_quad.pos[2]);
+  const bool profile_fits = sitl_profile_report();
+  sitl_spi_report();
+  const bool motor_pass = sitl_motor_report();
+  sitl_blackbox_report();
+  const bool filter_pass = sitl_filter_report();
+  const bool scheduler_pass = sitl_scheduler_report();
+  const bool bench_pass = motor_pass && filter_pass && scheduler_pass;
+#ifdef USE_SDCARD
+  sitl_sdcard_save();
+#endif
+  printf("sitl: result=%s\n", sitl_result(profile_fits, bench_pass));
+
+  fflush(stdout);
+  exit(profile_fits && bench_pass ? status : EXIT_FAILURE);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/vector.h"
+
+// the quad model is integrated in fixed steps, independent of how the firmware advances the clock
+#define SITL_STEP_US 25
+// output data rate of the simulated gyro
+#define SITL_GYRO_PERIOD_US 125
+
+#define SITL_MOTOR_COUNT 4
+
+typedef struct {
+  uint32_t duration_us;
+  uint32_t seed;
+  bool realtime;
+  bool pty;
+  bool bench;
+  const char *blackbox_path;
+  const char *sdcard_image;
+} sitl_config_t;
+
+typedef struct {
+  float pos[3]; // world frame, z up, m
+  float vel[3]; // world frame, m/s
+  float rot[9]; // body to world rotation, row major
+
+  // body frame: x left, y back, z up
+  float rate[3]; // rad/s
+  float accel[3]; // specific force in g
+
+  float motor_cmd[SITL_MOTOR_COUNT]; // last value written by the firmware, negative is off
+  float motor_rpm[SITL_MOTOR_COUNT];
+  float motor_phase[SITL_MOTOR_COUNT];
+
+  float vbat;
+  float ibat;
+
+  bool on_ground;
+  bool crashed;
+} sitl_quad_t;
+
+typedef struct {
+  uint32_t loops;
+  uint32_t flight_us;
+
+  float rate_error_sq[3];
+  uint32_t rate_error_count;
+  float rate_error_max;
+
+  float max_altitude;
+  float max_speed;
+} sitl_stats_t;
+
+extern sitl_config_t sitl_config;
+extern sitl_quad_t sitl_quad;
+extern sitl_stats_t sitl_stats;
+
+void sitl_init();
+
+uint64_t sitl_time_us();
+// moves the simulated clock forward and runs everything that happened in the meantime
+void sitl_advance_cycles(uint64_t cycles);
+
+uint32_t sitl_random();
+float sitl_random_float();
+
+void sitl_quad_init();
+void sitl_quad_step(float dt);
+void sitl_quad_gyro_sample(vec3_t *gyro, vec3_t *accel);
+
+void sitl_gyro_push_sample();
+
+void sitl_pilot_update(uint64_t now_us);
+
+void sitl_serial_update(uint64_t now_us);
+bool sitl_serial_write_frame(const uint8_t *data, uint32_t size);
+
+void sitl_flash_read(uint32_t addr, uint8_t *data, uint32_t len);
+
+uint8_t sitl_sdcard_transfer(uint8_t tx);
+void sitl_sdcard_select(bool selected);
+void sitl_sdcard_read(uint32_t addr, uint8_t *data, uint32_t len);
+void sitl_sdcard_load();
+void sitl_sdcard_save();
+void sitl_sdcard_report();
+
+void sitl_spi_report();
+
+// false if the dshot telemetry decoder failed the bench
+bool sitl_motor_report();
+
+// false if the largest possible profile does not fit its flash storage
+bool sitl_profile_report();
+
+void sitl_blackbox_report();
+
+// false if one of the filter checks of the bench failed
+bool sitl_filter_report();
+
+// false if the scheduler misbehaved on the simulated clock
+bool sitl_scheduler_report();
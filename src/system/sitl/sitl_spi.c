@@ -0,0 +1,529 @@
+#include "drv_spi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "drv_time.h"
+#include "failloop.h"
+#include "project.h"
+#include "sitl_sim.h"
+#include "util/slab.h"
+#include "util/util.h"
+
+// the txn api on top of simulated devices. a txn is clocked through the device the moment it is
+// submitted, the bus then stays busy for as long as the transfer would take on the wire.
+
+const spi_port_def_t spi_port_defs[SPI_PORTS_MAX] = {};
+
+static uint64_t bus_busy_until[SPI_PORTS_MAX];
+
+// the same slab pools as the dma buffers on hardware
+#define SITL_ARENA_SLABS 8
+
+static uint8_t arena_data[SITL_ARENA_SLABS * SLAB_SIZE] __attribute__((aligned(SLAB_ALIGN)));
+static slab_t arena_slabs[SITL_ARENA_SLABS];
+static slab_arena_t arena = {
+    .data = arena_data,
+    .slabs = arena_slabs,
+    .count = SITL_ARENA_SLABS,
+    .unused = SLAB_ARENA_UNUSED(SITL_ARENA_SLABS),
+};
+static slab_pool_t pools[SPI_PORTS_MAX];
+
+// bytes that went through a txn buffer and bytes that went straight to or from the caller
+static uint64_t bytes_staged = 0;
+static uint64_t bytes_direct = 0;
+
+static uint8_t sitl_spi_transfer(spi_bus_device_t *bus, uint8_t tx) {
+#ifdef USE_SDCARD
+  if (bus->port == SDCARD_SPI_PORT) {
+    return sitl_sdcard_transfer(tx);
+  }
+#endif
+  return 0xFF;
+}
+
+static void sitl_spi_select(spi_bus_device_t *bus, bool selected) {
+#ifdef USE_SDCARD
+  if (bus->port == SDCARD_SPI_PORT) {
+    sitl_sdcard_select(selected);
+  }
+#endif
+}
+
+uint8_t spi_dma_is_ready(spi_ports_t port) {
+  return sitl_time_us() >= bus_busy_until[port];
+}
+
+void spi_bus_device_init(spi_bus_device_t *bus) {
+  bus->txn_head = 0;
+  bus->txn_tail = 0;
+  if (pools[bus->port].arena == NULL) {
+    slab_pool_init(&pools[bus->port], &arena);
+  }
+  for (uint32_t i = 0; i < SPI_TXN_MAX; i++) {
+    bus->txn_pool[i].status = TXN_IDLE;
+  }
+}
+
+void spi_bus_device_reconfigure(spi_bus_device_t *bus, spi_mode_t mode, uint32_t hz) {
+  bus->mode = mode;
+  bus->hz = hz;
+}
+
+void spi_csn_enable(spi_bus_device_t *bus) {
+  sitl_spi_select(bus, true);
+}
+
+void spi_csn_disable(spi_bus_device_t *bus) {
+  sitl_spi_select(bus, false);
+}
+
+spi_txn_t *spi_txn_init(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn) {
+  // txns finish when they are submitted, so one per bus is enough
+  spi_txn_t *txn = &bus->txn_pool[0];
+  if (txn->status != TXN_IDLE) {
+    failloop(FAILLOOP_SPI);
+  }
+
+  txn->buffer_size = 1;
+  txn->buffer = slab_alloc(&pools[bus->port], &txn->buffer_size);
+  if (txn->buffer == NULL) {
+    failloop(FAILLOOP_DMA);
+  }
+
+  txn->rx_buffer = NULL;
+  txn->status = TXN_WAITING;
+  txn->bus = bus;
+  txn->segment_count = 0;
+  txn->flags = 0;
+  txn->size = 0;
+  txn->done_fn = done_fn;
+
+  return txn;
+}
+
+// persistent txns stay with their owner, the first slot is left to the others
+spi_txn_t *spi_txn_init_persistent(spi_bus_device_t *bus, spi_txn_done_fn_t done_fn) {
+  for (uint32_t i = 1; i < SPI_TXN_MAX; i++) {
+    spi_txn_t *txn = &bus->txn_pool[i];
+    if (txn->status != TXN_IDLE) {
+      continue;
+    }
+
+    txn->buffer_size = 1;
+    txn->buffer = slab_alloc(&pools[bus->port], &txn->buffer_size);
+    if (txn->buffer == NULL) {
+      failloop(FAILLOOP_DMA);
+    }
+
+    txn->rx_buffer = NULL;
+    txn->status = TXN_WAITING;
+    txn->bus = bus;
+    txn->segment_count = 0;
+    txn->flags = TXN_PERSISTENT;
+    txn->size = 0;
+    txn->done_fn = done_fn;
+    return txn;
+  }
+
+  failloop(FAILLOOP_SPI);
+  return NULL;
+}
+
+uint8_t *spi_txn_rx_data(spi_txn_t *txn) {
+  return txn->rx_buffer;
+}
+
+void spi_txn_release(spi_txn_t *txn) {
+  slab_free(&arena, txn->buffer);
+  txn->buffer = NULL;
+  if (txn->rx_buffer) {
+    slab_free(&arena, txn->rx_buffer);
+    txn->rx_buffer = NULL;
+  }
+  txn->status = TXN_IDLE;
+}
+
+static void spi_txn_ensure_buffer_space(spi_txn_t *txn, uint32_t size) {
+  if (txn->buffer_size >= (txn->size + size)) {
+    return;
+  }
+
+  uint32_t new_size = txn->size + size;
+  uint8_t *buffer = slab_alloc(&pools[txn->bus->port], &new_size);
+  if (buffer == NULL) {
+    failloop(FAILLOOP_DMA);
+  }
+  memcpy(buffer, txn->buffer, txn->size);
+  slab_free(&arena, txn->buffer);
+
+  txn->buffer = buffer;
+  txn->buffer_size = new_size;
+}
+
+static spi_txn_segment_t *spi_txn_new_seg(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size) {
+  spi_txn_segment_t *last_seg = txn->segment_count > 0 ? &txn->segments[txn->segment_count - 1] : NULL;
+  if (rx_data == NULL && tx_data == NULL && last_seg != NULL && !last_seg->direct && last_seg->rx_data == NULL && last_seg->tx_data == NULL) {
+    // merge segments
+    last_seg->size += size;
+    return last_seg;
+  }
+
+  if (txn->segment_count >= SPI_TXN_SEG_MAX) {
+    failloop(FAILLOOP_SPI);
+  }
+
+  spi_txn_segment_t *seg = &txn->segments[txn->segment_count++];
+  seg->rx_data = rx_data;
+  seg->tx_data = tx_data;
+  seg->size = size;
+  seg->direct = false;
+  return seg;
+}
+
+// every address is in reach of the dma here
+void spi_txn_add_seg_direct(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+
+  if (txn->segment_count >= SPI_TXN_SEG_MAX) {
+    failloop(FAILLOOP_SPI);
+  }
+
+  spi_txn_segment_t *seg = &txn->segments[txn->segment_count++];
+  seg->rx_data = rx_data;
+  seg->tx_data = tx_data;
+  seg->size = size;
+  seg->direct = true;
+}
+
+void spi_txn_add_seg_delay(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+
+  spi_txn_ensure_buffer_space(txn, size);
+  txn->size += size;
+  txn->flags |= TXN_DELAYED_TX;
+  spi_txn_new_seg(txn, rx_data, tx_data, size);
+}
+
+void spi_txn_add_seg(spi_txn_t *txn, uint8_t *rx_data, const uint8_t *tx_data, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+
+  spi_txn_ensure_buffer_space(txn, size);
+  for (uint32_t i = 0; i < size; i++) {
+    txn->buffer[txn->size + i] = tx_data ? tx_data[i] : 0xFF;
+  }
+  txn->size += size;
+  spi_txn_new_seg(txn, rx_data, NULL, size);
+}
+
+uint8_t *spi_txn_add_seg_tx_raw(spi_txn_t *txn, uint32_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+
+  spi_txn_ensure_buffer_space(txn, size);
+  uint8_t *ptr = txn->buffer + txn->size;
+  txn->size += size;
+  spi_txn_new_seg(txn, NULL, NULL, size);
+  return ptr;
+}
+
+void spi_txn_add_seg_const(spi_txn_t *txn, const uint8_t tx_data) {
+  spi_txn_add_seg(txn, NULL, &tx_data, 1);
+}
+
+void spi_txn_submit(spi_txn_t *txn) {
+  spi_bus_device_t *bus = txn->bus;
+
+  if ((txn->flags & TXN_PERSISTENT) && txn->rx_buffer == NULL) {
+    uint32_t size = txn->size;
+    txn->rx_buffer = slab_alloc(&pools[bus->port], &size);
+    if (txn->rx_buffer == NULL) {
+      failloop(FAILLOOP_DMA);
+    }
+  }
+
+  spi_csn_enable(bus);
+
+  uint32_t offset = 0;
+  uint32_t wire_size = 0;
+  for (uint32_t i = 0; i < txn->segment_count; i++) {
+    const spi_txn_segment_t *seg = &txn->segments[i];
+    for (uint32_t j = 0; j < seg->size; j++) {
+      uint8_t tx = 0xFF;
+      if (seg->tx_data) {
+        tx = seg->tx_data[j];
+      } else if (!seg->direct) {
+        tx = txn->buffer[offset + j];
+      }
+      const uint8_t rx = sitl_spi_transfer(bus, tx);
+      if (seg->rx_data) {
+        seg->rx_data[j] = rx;
+      }
+      if (txn->rx_buffer && !seg->direct) {
+        txn->rx_buffer[offset + j] = rx;
+      }
+    }
+    if (!seg->direct) {
+      offset += seg->size;
+    }
+    wire_size += seg->size;
+  }
+  bytes_staged += offset;
+  bytes_direct += wire_size - offset;
+
+  spi_csn_disable(bus);
+
+  const uint64_t start_us = max(sitl_time_us(), bus_busy_until[bus->port]);
+  bus_busy_until[bus->port] = start_us + (uint64_t)wire_size * 8 * 1000000 / max(bus->hz, 1);
+
+  if (txn->flags & TXN_PERSISTENT) {
+    txn->status = TXN_WAITING;
+  } else {
+    if (!slab_free(&arena, txn->buffer)) {
+      failloop(FAILLOOP_DMA);
+    }
+    txn->buffer = NULL;
+    txn->status = TXN_IDLE;
+  }
+
+  if (txn->done_fn) {
+    txn->done_fn();
+  }
+}
+
+void spi_txn_continue(spi_bus_device_t *bus) {}
+
+void spi_txn_continue_ex(spi_bus_device_t *bus, bool force_sync) {}
+
+bool spi_txn_ready(spi_bus_device_t *bus) {
+  return spi_dma_is_ready(bus->port);
+}
+
+void spi_txn_wait(spi_bus_device_t *bus) {
+  while (!spi_txn_ready(bus)) {
+    time_delay_us(1);
+  }
+}
+
+void spi_txn_submit_wait(spi_bus_device_t *bus, spi_txn_t *txn) {
+  spi_txn_submit(txn);
+  spi_txn_wait(bus);
+}
+
+void spi_txn_submit_continue(spi_bus_device_t *bus, spi_txn_t *txn) {
+  spi_txn_submit(txn);
+}
+
+#define BENCH_ROUNDS 1000000
+
+// many pools churning through random sizes with random lifetimes, far more than the firmware does.
+// every slot is filled with a pattern that has to survive until it is freed, overlapping slots show up as corruption.
+#define STRESS_POOLS 4
+#define STRESS_LIVE 24
+#define STRESS_OPS 1000000
+#define STRESS_SLABS SLAB_ARENA_MAX
+
+typedef struct {
+  uint8_t *ptr;
+  uint32_t size;
+  uint8_t pattern;
+} stress_alloc_t;
+
+static double wall_time_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// mostly register access, some osd strings and the occasional flash page or sd block
+static uint32_t stress_size() {
+  const uint32_t r = sitl_random() % 100;
+  if (r < 60) {
+    return 1 + sitl_random() % 32;
+  }
+  if (r < 85) {
+    return 33 + sitl_random() % 96;
+  }
+  if (r < 95) {
+    return 129 + sitl_random() % 192;
+  }
+  return 321 + sitl_random() % (SLAB_ALLOC_MAX - 320);
+}
+
+static void sitl_spi_bench() {
+  static uint8_t data[STRESS_SLABS * SLAB_SIZE] __attribute__((aligned(SLAB_ALIGN)));
+  static slab_t slabs[STRESS_SLABS];
+  static slab_pool_t stress_pools[STRESS_POOLS];
+  static stress_alloc_t live[STRESS_POOLS][STRESS_LIVE];
+
+  slab_arena_t stress_arena;
+  slab_arena_init(&stress_arena, data, slabs, STRESS_SLABS);
+  for (uint32_t i = 0; i < STRESS_POOLS; i++) {
+    slab_pool_init(&stress_pools[i], &stress_arena);
+  }
+
+  // the gyro read, one small txn allocated and freed every loop
+  const double start = wall_time_ns();
+  for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+    uint32_t size = 1;
+    void *ptr = slab_alloc(&stress_pools[0], &size);
+    // grows to fit the register burst
+    uint32_t grown = 15;
+    void *next = slab_alloc(&stress_pools[0], &grown);
+    slab_free(&stress_arena, ptr);
+    slab_free(&stress_arena, next);
+  }
+  const double elapsed = wall_time_ns() - start;
+
+  uint32_t failed = 0;
+  uint32_t corrupt = 0;
+  uint32_t unaligned = 0;
+  uint32_t live_max = 0;
+
+  const double stress_start = wall_time_ns();
+  for (uint32_t op = 0; op < STRESS_OPS; op++) {
+    const uint32_t pool = sitl_random() % STRESS_POOLS;
+    stress_alloc_t *alloc = &live[pool][sitl_random() % STRESS_LIVE];
+
+    if (alloc->ptr) {
+      for (uint32_t i = 0; i < alloc->size; i++) {
+        if (alloc->ptr[i] != (uint8_t)(alloc->pattern + i)) {
+          corrupt++;
+          break;
+        }
+      }
+      if (!slab_free(&stress_arena, alloc->ptr)) {
+        failed++;
+      }
+      alloc->ptr = NULL;
+      continue;
+    }
+
+    uint32_t size = stress_size();
+    const uint32_t requested = size;
+    alloc->ptr = slab_alloc(&stress_pools[pool], &size);
+    if (alloc->ptr == NULL || size < requested) {
+      alloc->ptr = NULL;
+      failed++;
+      continue;
+    }
+    if ((uintptr_t)alloc->ptr % SLAB_ALIGN) {
+      unaligned++;
+    }
+
+    alloc->size = size;
+    alloc->pattern = op;
+    for (uint32_t i = 0; i < size; i++) {
+      alloc->ptr[i] = alloc->pattern + i;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t p = 0; p < STRESS_POOLS; p++) {
+      for (uint32_t i = 0; i < STRESS_LIVE; i++) {
+        count += live[p][i].ptr != NULL;
+      }
+    }
+    live_max = max(live_max, count);
+  }
+  const double stress_elapsed = wall_time_ns() - stress_start;
+
+  // a burst of page reads on one port holds every slab of the arena for a moment,
+  // a class another port has not used before has to fit once they are done
+  static uint8_t burst_data[SITL_ARENA_SLABS * SLAB_SIZE] __attribute__((aligned(SLAB_ALIGN)));
+  static slab_t burst_slabs[SITL_ARENA_SLABS];
+  slab_arena_t burst_arena;
+  slab_pool_t burst_pools[2];
+  slab_arena_init(&burst_arena, burst_data, burst_slabs, SITL_ARENA_SLABS);
+  slab_pool_init(&burst_pools[0], &burst_arena);
+  slab_pool_init(&burst_pools[1], &burst_arena);
+
+  void *burst[SITL_ARENA_SLABS];
+  for (uint32_t i = 0; i < SITL_ARENA_SLABS; i++) {
+    uint32_t size = SLAB_ALLOC_MAX;
+    burst[i] = slab_alloc(&burst_pools[0], &size);
+  }
+  uint32_t size = 1;
+  const bool burst_full = slab_alloc(&burst_pools[1], &size) == NULL;
+  for (uint32_t i = 0; i < SITL_ARENA_SLABS; i++) {
+    slab_free(&burst_arena, burst[i]);
+  }
+  size = 1;
+  const bool burst_reclaimed = slab_alloc(&burst_pools[1], &size) != NULL;
+
+  printf("sitl: slab_bench alloc_free=%.1fns\n", elapsed / (BENCH_ROUNDS * 2));
+  printf("sitl: slab_stress ops=%u live_max=%u slabs=%u/%u failed=%u corrupt=%u unaligned=%u time=%.0fms\n",
+         STRESS_OPS,
+         live_max,
+         slab_arena_used(&stress_arena),
+         STRESS_SLABS,
+         failed,
+         corrupt,
+         unaligned,
+         stress_elapsed * 1e-6);
+  printf("sitl: slab_reclaim full=%u reclaimed=%u\n", burst_full, burst_reclaimed);
+}
+
+// the gyro read of every loop, built from scratch each time against a persistent txn that is only submitted again
+#define TXN_BENCH_ROUNDS 1000000
+#define TXN_BENCH_SIZE 14
+
+static void sitl_spi_txn_bench() {
+  static spi_bus_device_t bench_bus = {
+      .port = SPI_PORT_INVALID,
+  };
+  spi_bus_device_init(&bench_bus);
+  spi_bus_device_reconfigure(&bench_bus, SPI_MODE_TRAILING_EDGE, 10000000);
+
+  uint8_t data[TXN_BENCH_SIZE];
+
+  const double start = wall_time_ns();
+  for (uint32_t i = 0; i < TXN_BENCH_ROUNDS; i++) {
+    spi_txn_t *txn = spi_txn_init(&bench_bus, NULL);
+    spi_txn_add_seg_const(txn, 0x3B | 0x80);
+    spi_txn_add_seg(txn, data, NULL, TXN_BENCH_SIZE);
+    spi_txn_submit(txn);
+  }
+  const double built = wall_time_ns() - start;
+
+  spi_txn_t *txn = spi_txn_init_persistent(&bench_bus, NULL);
+  spi_txn_add_seg_const(txn, 0x3B | 0x80);
+  spi_txn_add_seg(txn, NULL, NULL, TXN_BENCH_SIZE);
+
+  const double persistent_start = wall_time_ns();
+  for (uint32_t i = 0; i < TXN_BENCH_ROUNDS; i++) {
+    spi_txn_submit(txn);
+  }
+  const double persistent = wall_time_ns() - persistent_start;
+
+  // the register address has to survive every run
+  const bool intact = txn->buffer[0] == (0x3B | 0x80) && txn->status == TXN_WAITING;
+  spi_txn_release(txn);
+
+  printf("sitl: txn_bench built=%.1fns persistent=%.1fns intact=%u\n",
+         built / TXN_BENCH_ROUNDS,
+         persistent / TXN_BENCH_ROUNDS,
+         intact);
+}
+
+void sitl_spi_report() {
+  printf("sitl: spi slabs=%u/%u bytes_staged=%llu bytes_direct=%llu\n",
+         slab_arena_used(&arena),
+         SITL_ARENA_SLABS,
+         (unsigned long long)bytes_staged,
+         (unsigned long long)bytes_direct);
+
+  if (sitl_config.bench) {
+    sitl_spi_bench();
+    sitl_spi_txn_bench();
+  }
+}
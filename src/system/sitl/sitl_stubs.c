@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "drv_fmc.h"
+#include "drv_gpio.h"
+#include "drv_rgb_led.h"
+#include "drv_serial_vtx_msp.h"
+#include "drv_serial_vtx_sa.h"
+#include "drv_serial_vtx_tramp.h"
+#include "drv_spi_soft.h"
+#include "reset.h"
+
+// peripherals the simulator has nothing behind
+
+void gpio_init() {}
+void gpio_pin_init(LL_GPIO_InitTypeDef *init, gpio_pins_t pin) {}
+void gpio_pin_init_af(LL_GPIO_InitTypeDef *init, gpio_pins_t pin, uint32_t af) {}
+void gpio_pin_set(gpio_pins_t pin) {}
+void gpio_pin_reset(gpio_pins_t pin) {}
+void gpio_pin_toggle(gpio_pins_t pin) {}
+
+uint32_t gpio_pin_read(gpio_pins_t pin) {
+  return 0;
+}
+
+void spi_init() {}
+
+void rgb_init() {}
+void rgb_send(int data) {}
+void rgb_dma_start() {}
+
+void system_reset() {
+  NVIC_SystemReset();
+}
+
+void system_reset_to_bootloader() {
+  system_reset();
+}
+
+void system_check_for_bootloader() {}
+
+// the config flash lives in ram, every run starts from the defaults
+static uint8_t config_flash[FMC_FLASH_SIZE];
+static bool config_flash_erased = false;
+
+void fmc_lock() {}
+
+void fmc_unlock() {}
+
+uint8_t fmc_erase() {
+  memset(config_flash, 0xFF, sizeof(config_flash));
+  config_flash_erased = true;
+  return 0;
+}
+
+flash_word_t fmc_read(uint32_t addr) {
+  if (!config_flash_erased) {
+    fmc_erase();
+  }
+
+  flash_word_t val;
+  memcpy(&val, config_flash + addr, sizeof(flash_word_t));
+  return val;
+}
+
+void fmc_read_buf(uint32_t offset, uint8_t *data, uint32_t size) {
+  for (uint32_t i = 0; i < (size / sizeof(flash_word_t)); i++) {
+    const flash_word_t val = fmc_read(offset + i * sizeof(flash_word_t));
+    memcpy(data + i * sizeof(flash_word_t), &val, sizeof(flash_word_t));
+  }
+}
+
+void fmc_write(uint32_t offset, flash_word_t value) {
+  memcpy(config_flash + FLASH_ALIGN(offset), &value, sizeof(flash_word_t));
+}
+
+void fmc_write_buf(uint32_t offset, uint8_t *data, uint32_t size) {
+  for (uint32_t i = 0; i < (size / FLASH_WORD_SIZE); i++) {
+    memcpy(config_flash + FLASH_ALIGN(offset + i * FLASH_WORD_SIZE), data + i * FLASH_WORD_SIZE, FLASH_WORD_SIZE);
+  }
+}
+
+// no vtx is connected, the vtx code gives up after its retries
+smart_audio_settings_t smart_audio_settings;
+tramp_settings_t tramp_settings;
+
+void serial_smart_audio_init() {}
+
+vtx_update_result_t serial_smart_audio_update() {
+  return VTX_ERROR;
+}
+
+void serial_smart_audio_send_payload(uint8_t cmd, const uint8_t *payload, const uint32_t size) {}
+
+uint8_t smart_audio_dac_power_level_index(uint8_t dac) {
+  return 0;
+}
+
+void serial_tramp_init() {}
+
+vtx_update_result_t serial_tramp_update() {
+  return VTX_ERROR;
+}
+
+void serial_tramp_send_payload(uint8_t cmd, const uint16_t payload) {}
+
+void serial_msp_vtx_init() {}
+
+vtx_update_result_t serial_msp_vtx_update() {
+  return VTX_ERROR;
+}
@@ -0,0 +1,32 @@
+#include "drv_time.h"
+
+#include "project.h"
+#include "sitl_sim.h"
+
+void time_init() {
+  sitl_init();
+}
+
+uint32_t time_micros() {
+  return sitl_time_us();
+}
+
+uint32_t time_millis() {
+  return sitl_time_us() / 1000;
+}
+
+uint32_t time_cycles() {
+  return DWT->CYCCNT;
+}
+
+void time_delay_us(uint32_t us) {
+  sitl_advance_cycles((uint64_t)us * TICKS_PER_US);
+}
+
+void time_delay_ms(uint32_t ms) {
+  time_delay_us(ms * 1000);
+}
+
+void sitl_nop() {
+  sitl_advance_cycles(TICKS_PER_US);
+}
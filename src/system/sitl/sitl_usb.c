@@ -0,0 +1,111 @@
+#define _XOPEN_SOURCE 600
+
+#include "drv_usb.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "drv_time.h"
+#include "sitl_sim.h"
+
+// with SITL_PTY set the configurator talks to a pseudo terminal instead of the usb cdc.
+// its timing follows the wall clock, so runs using it are not reproducible
+static int usb_fd = -1;
+
+// how long a write waits for the other end to drain the pty, like the cdc waits for its tx buffer
+#define USB_WRITE_TIMEOUT_MS 1000
+
+void usb_init() {
+  if (!sitl_config.pty) {
+    return;
+  }
+
+  usb_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (usb_fd < 0 || grantpt(usb_fd) < 0 || unlockpt(usb_fd) < 0) {
+    perror("sitl: pty");
+    usb_fd = -1;
+    return;
+  }
+
+  printf("sitl: usb on %s\n", ptsname(usb_fd));
+  fflush(stdout);
+}
+
+uint8_t usb_detect() {
+  if (usb_fd < 0) {
+    return 0;
+  }
+
+  // hangup until the other end opened the pty
+  struct pollfd pfd = {.fd = usb_fd, .events = POLLIN};
+  if (poll(&pfd, 1, 0) < 0 || (pfd.revents & POLLHUP)) {
+    return 0;
+  }
+  return 1;
+}
+
+uint32_t usb_serial_read(uint8_t *data, uint32_t len) {
+  if (usb_fd < 0 || data == NULL || len == 0) {
+    return 0;
+  }
+
+  const ssize_t res = read(usb_fd, data, len);
+  if (res < 0) {
+    return 0;
+  }
+  return res;
+}
+
+uint8_t usb_serial_read_byte() {
+  uint8_t byte = 0;
+  for (uint32_t timeout = 1000; usb_serial_read(&byte, 1) != 1 && timeout; --timeout) {
+    time_delay_us(10);
+  }
+  return byte;
+}
+
+void usb_serial_write(uint8_t *data, uint32_t len) {
+  if (usb_fd < 0 || data == NULL || len == 0) {
+    return;
+  }
+
+  uint32_t written = 0;
+  while (written < len) {
+    const ssize_t res = write(usb_fd, data + written, len - written);
+    if (res < 0 && errno == EAGAIN) {
+      struct pollfd pfd = {.fd = usb_fd, .events = POLLOUT};
+      if (poll(&pfd, 1, USB_WRITE_TIMEOUT_MS) > 0) {
+        continue;
+      }
+    }
+    if (res <= 0) {
+      // the other end is not draining the pty, drop the rest
+      return;
+    }
+    written += res;
+  }
+}
+
+void usb_serial_print(char *str) {
+  usb_serial_write((uint8_t *)str, strlen(str));
+}
+
+void usb_serial_printf(const char *fmt, ...) {
+  const size_t size = strlen(fmt) + 128;
+  char str[size];
+
+  memset(str, 0, size);
+
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(str, size, fmt, args);
+  va_end(args);
+
+  usb_serial_print(str);
+}
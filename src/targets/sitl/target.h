@@ -0,0 +1,41 @@
+
+#include "config.h"
+
+// PORTS
+#ifdef SITL_SDCARD
+#define SPI_PORTS \
+  SPI_PORT(1, PIN_A5, PIN_A6, PIN_A7)
+#else
+#define SPI_PORTS
+#endif
+
+// the rx uart is fed by the simulator
+#define USART_PORTS \
+  USART1_PA10PA9
+
+// RX
+#define RX_USART USART_PORT1
+#define RX_CRSF
+
+// LEDS
+#define LED_NUMBER 1
+#define LED1PIN PIN_A8
+
+// BLACKBOX
+#ifdef SITL_SDCARD
+#define USE_SDCARD
+#define SDCARD_SPI_PORT SPI_PORT1
+#define SDCARD_NSS_PIN PIN_A4
+#else
+#define USE_M25P16
+#endif
+#define BLACKBOX_SWITCH AUX_CHANNEL_ON
+
+// GYRO
+#define GYRO_ORIENTATION GYRO_ROTATE_NONE
+
+// MOTOR PINS
+#define MOTOR_PIN0 MOTOR_PIN_PA0
+#define MOTOR_PIN1 MOTOR_PIN_PA1
+#define MOTOR_PIN2 MOTOR_PIN_PA2
+#define MOTOR_PIN3 MOTOR_PIN_PA3
@@ -3,4 +3,7 @@
 #include <stdint.h>
 
 uint8_t crc8_dvb_s2_calc(uint8_t crc, const uint8_t input);
-uint8_t crc8_dvb_s2_data(uint8_t crc, const uint8_t *data, const uint32_t size);
\ No newline at end of file
+uint8_t crc8_dvb_s2_data(uint8_t crc, const uint8_t *data, const uint32_t size);
+
+// start with zero, pass the result back in to continue over more data
+uint32_t crc32_data(uint32_t crc, const uint8_t *data, const uint32_t size);
\ No newline at end of file
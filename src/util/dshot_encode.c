@@ -0,0 +1,37 @@
+#include "util/dshot_encode.h"
+
+// moves bit n of an 8 bit value to bit 4n
+static inline uint32_t spread_byte(uint32_t x) {
+  x = (x | (x << 12)) & 0x000F000F;
+  x = (x | (x << 6)) & 0x03030303;
+  x = (x | (x << 3)) & 0x11111111;
+  return x;
+}
+
+void dshot_encode_table(uint32_t *table, const uint32_t *high, const uint32_t *low) {
+  for (uint32_t i = 0; i < DSHOT_ENCODE_TABLE_SIZE; i++) {
+    uint32_t word = 0;
+    for (uint32_t motor = 0; motor < DSHOT_ENCODE_MOTORS; motor++) {
+      word |= (i & (1 << motor)) ? high[motor] : low[motor];
+    }
+    table[i] = word;
+  }
+}
+
+dshot_encode_bits_t dshot_encode_transpose(const uint16_t *packets) {
+  dshot_encode_bits_t bits = {0, 0};
+  for (uint32_t motor = 0; motor < DSHOT_ENCODE_MOTORS; motor++) {
+    bits.hi |= spread_byte(packets[motor] >> 8) << motor;
+    bits.lo |= spread_byte(packets[motor] & 0xFF) << motor;
+  }
+  return bits;
+}
+
+void dshot_encode_port(const uint32_t *table, dshot_encode_bits_t bits, uint32_t *words, uint32_t stride) {
+  for (uint32_t i = 0; i < 8; i++) {
+    words[i * stride] = table[bits.hi >> 28];
+    words[(i + 8) * stride] = table[bits.lo >> 28];
+    bits.hi <<= 4;
+    bits.lo <<= 4;
+  }
+}
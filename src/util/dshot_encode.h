@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// dshot frames for all motors at once, as the bsrr words the dma writes to a gpio port.
+//
+// the packets are transposed so each bit of a frame becomes one nibble with a bit per motor,
+// a per port table then turns that nibble into the bsrr word which drives all motor pins of the port.
+// a frame costs a table lookup per bit and port instead of a branch per bit and motor.
+
+#define DSHOT_ENCODE_MOTORS 4
+#define DSHOT_ENCODE_TABLE_SIZE (1 << DSHOT_ENCODE_MOTORS)
+#define DSHOT_ENCODE_BITS 16
+
+typedef struct {
+  // nibble of bit 15 - 8 and 7 - 0 of each packet, highest nibble first
+  uint32_t hi;
+  uint32_t lo;
+} dshot_encode_bits_t;
+
+// high and low are the bsrr words which drive the pin of a motor active and idle, zero for motors on other ports
+void dshot_encode_table(uint32_t *table, const uint32_t *high, const uint32_t *low);
+
+dshot_encode_bits_t dshot_encode_transpose(const uint16_t *packets);
+
+// writes the data word of bit n to words[n * stride], msb first
+void dshot_encode_port(const uint32_t *table, dshot_encode_bits_t bits, uint32_t *words, uint32_t stride);
@@ -0,0 +1,95 @@
+#include "util/dshot_telemetry.h"
+
+#define GCR_INVALID 0xFF
+
+static const uint8_t gcr_decode_table[32] = {
+    GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID,
+    GCR_INVALID, 0x9, 0xA, 0xB, GCR_INVALID, 0xD, 0xE, 0xF,
+    GCR_INVALID, GCR_INVALID, 0x2, 0x3, GCR_INVALID, 0x5, 0x6, 0x7,
+    GCR_INVALID, 0x0, 0x8, 0x1, GCR_INVALID, 0x4, 0xC, GCR_INVALID};
+
+dshot_telemetry_result_t dshot_telemetry_decode_samples(const uint32_t *samples, uint32_t count, uint32_t pin_mask, uint32_t samples_per_bit_q8, uint32_t *gcr) {
+  // line idles high, the reply starts with the first low sample
+  uint32_t start = 0;
+  while (start < count && (samples[start] & pin_mask)) {
+    start++;
+  }
+  if (start >= count) {
+    return DSHOT_TELEMETRY_NO_RESPONSE;
+  }
+
+  uint32_t levels = 0;
+  uint32_t bits = 0;
+  uint32_t level = 0;
+  uint32_t run_start = start;
+
+  for (uint32_t i = start + 1; i < count && bits < DSHOT_TELEMETRY_BITS; i++) {
+    const uint32_t sample = (samples[i] & pin_mask) ? 1 : 0;
+    if (sample == level) {
+      continue;
+    }
+
+    // round the run length to a whole number of bits
+    uint32_t len = ((i - run_start) * 256 + samples_per_bit_q8 / 2) / samples_per_bit_q8;
+    if (len == 0) {
+      len = 1;
+    }
+    if (bits + len > DSHOT_TELEMETRY_BITS) {
+      len = DSHOT_TELEMETRY_BITS - bits;
+    }
+
+    levels = (levels << len) | (level ? ((1 << len) - 1) : 0);
+    bits += len;
+
+    level = sample;
+    run_start = i;
+  }
+
+  if (bits < DSHOT_TELEMETRY_BITS) {
+    if (level == 0) {
+      // the line never returned high, the capture was cut off
+      return DSHOT_TELEMETRY_INVALID_GCR;
+    }
+
+    // trailing high bits merge with the idle line
+    const uint32_t len = DSHOT_TELEMETRY_BITS - bits;
+    levels = (levels << len) | ((1 << len) - 1);
+  }
+
+  // a level change encodes a one, no change a zero
+  *gcr = (levels ^ (levels >> 1)) & 0xFFFFF;
+  return DSHOT_TELEMETRY_OK;
+}
+
+dshot_telemetry_result_t dshot_telemetry_decode_gcr(uint32_t gcr, uint32_t *erpm) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < 4; i++) {
+    const uint8_t nibble = gcr_decode_table[(gcr >> (i * 5)) & 0x1F];
+    if (nibble == GCR_INVALID) {
+      return DSHOT_TELEMETRY_INVALID_GCR;
+    }
+    value |= nibble << (i * 4);
+  }
+
+  uint32_t csum = value;
+  csum = csum ^ (csum >> 8);
+  csum = csum ^ (csum >> 4);
+  if ((csum & 0xF) != 0xF) {
+    return DSHOT_TELEMETRY_INVALID_CRC;
+  }
+
+  // eeem mmmm mmmm, period in us is mantissa << exponent
+  value >>= 4;
+  if (value == 0x0FFF) {
+    *erpm = 0;
+    return DSHOT_TELEMETRY_OK;
+  }
+
+  const uint32_t period_us = (value & 0x1FF) << (value >> 9);
+  if (period_us == 0) {
+    return DSHOT_TELEMETRY_INVALID_CRC;
+  }
+
+  *erpm = (60 * 1000000 + period_us / 2) / period_us;
+  return DSHOT_TELEMETRY_OK;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// bidirectional dshot replies with 21 bits at 5/4 of the dshot bitrate
+#define DSHOT_TELEMETRY_BITS 21
+
+typedef enum {
+  DSHOT_TELEMETRY_OK,
+  DSHOT_TELEMETRY_NO_RESPONSE,
+  DSHOT_TELEMETRY_INVALID_GCR,
+  DSHOT_TELEMETRY_INVALID_CRC,
+} dshot_telemetry_result_t;
+
+// samples are raw gpio input register reads, pin_mask selects the motor pin
+// samples_per_bit_q8 is the number of samples per telemetry bit in 24.8 fixed point
+dshot_telemetry_result_t dshot_telemetry_decode_samples(const uint32_t *samples, uint32_t count, uint32_t pin_mask, uint32_t samples_per_bit_q8, uint32_t *gcr);
+
+// gcr holds the 20 transition-decoded bits, erpm is set to zero for a stopped motor
+dshot_telemetry_result_t dshot_telemetry_decode_gcr(uint32_t gcr, uint32_t *erpm);
@@ -32,6 +32,19 @@ uint32_t ring_buffer_write_multi(ring_buffer_t *c, const uint8_t *data, const ui
   return len;
 }
 
+uint32_t ring_buffer_write_front(ring_buffer_t *c, const uint8_t *data, const uint32_t len) {
+  if (len >= ring_buffer_free(c)) {
+    return 0;
+  }
+
+  const uint32_t tail = (c->tail + c->size - len) % c->size;
+  for (uint32_t i = 0; i < len; i++) {
+    c->buffer[(tail + i) % c->size] = data[i];
+  }
+  c->tail = tail;
+  return len;
+}
+
 uint32_t ring_buffer_available(ring_buffer_t *c) {
   if (c->head >= c->tail) {
     return c->head - c->tail;
@@ -59,6 +72,18 @@ uint32_t ring_buffer_read_multi(ring_buffer_t *c, uint8_t *data, const uint32_t
   return len;
 }
 
+uint32_t ring_buffer_peek(ring_buffer_t *c, uint8_t **data) {
+  *data = c->buffer + c->tail;
+  if (c->head >= c->tail) {
+    return c->head - c->tail;
+  }
+  return c->size - c->tail;
+}
+
+void ring_buffer_skip(ring_buffer_t *c, const uint32_t len) {
+  c->tail = (c->tail + len) % c->size;
+}
+
 void ring_buffer_clear(ring_buffer_t *c) {
   ATOMIC_BLOCK_ALL {
     c->tail = c->head = 0;
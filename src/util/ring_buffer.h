@@ -14,10 +14,17 @@ typedef struct {
 uint32_t ring_buffer_free(ring_buffer_t *c);
 uint8_t ring_buffer_write(ring_buffer_t *c, uint8_t data);
 uint32_t ring_buffer_write_multi(ring_buffer_t *c, const uint8_t *data, const uint32_t len);
+// puts all of data in front of the buffered bytes or none of it, only while the reader is not running
+uint32_t ring_buffer_write_front(ring_buffer_t *c, const uint8_t *data, const uint32_t len);
 
 uint32_t ring_buffer_available(ring_buffer_t *c);
 uint8_t ring_buffer_read(ring_buffer_t *c, uint8_t *data);
 uint32_t ring_buffer_read_multi(ring_buffer_t *c, uint8_t *data, const uint32_t len);
 
+// for reading in place: points data at the tail and returns how many bytes follow it without wrapping.
+// the bytes stay owned by the reader until they are released with ring_buffer_skip.
+uint32_t ring_buffer_peek(ring_buffer_t *c, uint8_t **data);
+void ring_buffer_skip(ring_buffer_t *c, const uint32_t len);
+
 // only function with internal blocking as both head & tail are written to
 void ring_buffer_clear(ring_buffer_t *c);
@@ -0,0 +1,173 @@
+#include "util/slab.h"
+
+#include <stddef.h>
+
+// sized for the spi txns: register access, osd strings, flash pages and sd card blocks
+static const uint16_t class_size[SLAB_CLASS_MAX] = {32, 128, 320, 1024};
+
+static inline uint32_t class_slots(uint32_t size_class) {
+  return SLAB_SIZE / class_size[size_class];
+}
+
+static inline uint32_t class_mask(uint32_t size_class) {
+  const uint32_t slots = class_slots(size_class);
+  return slots >= 32 ? 0xFFFFFFFF : (1U << slots) - 1;
+}
+
+static inline bool cas_u32(volatile uint32_t *ptr, uint32_t *expected, uint32_t desired) {
+  return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+void slab_arena_init(slab_arena_t *arena, uint8_t *data, slab_t *slabs, uint32_t count) {
+  if (count > SLAB_ARENA_MAX) {
+    count = SLAB_ARENA_MAX;
+  }
+
+  arena->data = data;
+  arena->slabs = slabs;
+  arena->count = count;
+  arena->unused = SLAB_ARENA_UNUSED(count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    slabs[i].free = 0;
+    slabs[i].pool = NULL;
+  }
+}
+
+uint32_t slab_arena_used(const slab_arena_t *arena) {
+  return arena->count - __builtin_popcount(arena->unused);
+}
+
+void slab_pool_init(slab_pool_t *pool, slab_arena_t *arena) {
+  pool->arena = arena;
+  for (uint32_t i = 0; i < SLAB_CLASS_MAX; i++) {
+    pool->slabs[i] = 0;
+  }
+}
+
+static void *slot_take(slab_arena_t *arena, uint32_t index, uint32_t size_class) {
+  slab_t *slab = &arena->slabs[index];
+
+  uint32_t free = slab->free;
+  while (free) {
+    const uint32_t slot = __builtin_ctz(free);
+    if (!cas_u32(&slab->free, &free, free & ~(1U << slot))) {
+      continue;
+    }
+
+    if (slab->size_class != size_class) {
+      // the slab was taken back and handed to another class in the meantime
+      __atomic_fetch_or(&slab->free, 1U << slot, __ATOMIC_RELEASE);
+      return NULL;
+    }
+    return arena->data + index * SLAB_SIZE + slot * class_size[size_class];
+  }
+  return NULL;
+}
+
+static void *class_take(slab_pool_t *pool, uint32_t size_class) {
+  uint32_t slabs = pool->slabs[size_class];
+  while (slabs) {
+    const uint32_t index = __builtin_ctz(slabs);
+    void *ptr = slot_take(pool->arena, index, size_class);
+    if (ptr) {
+      return ptr;
+    }
+    slabs &= ~(1U << index);
+  }
+  return NULL;
+}
+
+// an unused slab, or one without any slot in use taken back from its pool. -1 if there is neither
+static int32_t slab_claim(slab_arena_t *arena) {
+  uint32_t unused = arena->unused;
+  while (unused) {
+    const uint32_t index = __builtin_ctz(unused);
+    if (cas_u32(&arena->unused, &unused, unused & ~(1U << index))) {
+      return index;
+    }
+  }
+
+  for (uint32_t index = 0; index < arena->count; index++) {
+    slab_t *slab = &arena->slabs[index];
+
+    // clearing all free bits at once keeps the pool from taking a slot while the slab changes hands
+    uint32_t free = class_mask(slab->size_class);
+    if (cas_u32(&slab->free, &free, 0)) {
+      __atomic_fetch_and(&slab->pool->slabs[slab->size_class], ~(1U << index), __ATOMIC_RELEASE);
+      return index;
+    }
+  }
+  return -1;
+}
+
+// claims a slab for the pool, its first slot goes straight to the caller
+static void *class_grow(slab_pool_t *pool, uint32_t size_class) {
+  slab_arena_t *arena = pool->arena;
+
+  const int32_t index = slab_claim(arena);
+  if (index < 0) {
+    return NULL;
+  }
+
+  slab_t *slab = &arena->slabs[index];
+  slab->size_class = size_class;
+  slab->pool = pool;
+  __atomic_store_n(&slab->free, class_mask(size_class) & ~1U, __ATOMIC_RELEASE);
+
+  __atomic_fetch_or(&pool->slabs[size_class], 1U << index, __ATOMIC_RELEASE);
+
+  return arena->data + index * SLAB_SIZE;
+}
+
+void *slab_alloc(slab_pool_t *pool, uint32_t *size) {
+  uint32_t size_class = 0;
+  while (size_class < SLAB_CLASS_MAX && class_size[size_class] < *size) {
+    size_class++;
+  }
+  if (size_class == SLAB_CLASS_MAX) {
+    return NULL;
+  }
+
+  void *ptr = class_take(pool, size_class);
+  if (ptr == NULL) {
+    ptr = class_grow(pool, size_class);
+  }
+  if (ptr) {
+    *size = class_size[size_class];
+    return ptr;
+  }
+
+  // the arena ran out, a larger slot the pool already has will do
+  for (uint32_t i = size_class + 1; i < SLAB_CLASS_MAX; i++) {
+    ptr = class_take(pool, i);
+    if (ptr) {
+      *size = class_size[i];
+      return ptr;
+    }
+  }
+  return NULL;
+}
+
+bool slab_free(slab_arena_t *arena, void *ptr) {
+  if ((uint8_t *)ptr < arena->data) {
+    return false;
+  }
+
+  const uint32_t offset = (uint8_t *)ptr - arena->data;
+  const uint32_t index = offset / SLAB_SIZE;
+  if (index >= arena->count || (arena->unused & (1U << index))) {
+    return false;
+  }
+
+  slab_t *slab = &arena->slabs[index];
+  const uint32_t size = class_size[slab->size_class];
+  const uint32_t slot_offset = offset % SLAB_SIZE;
+  if ((slot_offset % size) != 0 || slot_offset / size >= class_slots(slab->size_class)) {
+    return false;
+  }
+
+  const uint32_t bit = 1U << (slot_offset / size);
+  // a slot that is already free was freed twice
+  return (__atomic_fetch_or(&slab->free, bit, __ATOMIC_RELEASE) & bit) == 0;
+}
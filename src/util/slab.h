@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// fixed size slab allocator for dma buffers.
+//
+// the arena is cut into SLAB_SIZE byte slabs, each slab holds slots of one size class.
+// a pool takes slabs from the shared arena the first time it needs a class and keeps them,
+// so after start up allocating and freeing only flips a bit in the free mask of a slab.
+// once the arena runs out, a slab without any slot in use is taken back from whichever pool holds it,
+// a burst on one pool can not starve the others.
+// both are lock free, free may be called from an interrupt while the main loop allocates.
+//
+// every class is a multiple of SLAB_ALIGN, with an aligned arena no two slots share a cache line.
+//
+// this file does not depend on anything but the c library so the simulator can use it as is.
+
+#define SLAB_SIZE 1024
+#define SLAB_ALIGN 32
+#define SLAB_CLASS_MAX 4
+// largest allocation, one slot per slab
+#define SLAB_ALLOC_MAX SLAB_SIZE
+// slabs are tracked in one bit each
+#define SLAB_ARENA_MAX 32
+
+struct slab_pool;
+
+typedef struct {
+  volatile uint32_t free; // one bit per slot, zero while the slab is not part of a pool
+  uint8_t size_class;
+  struct slab_pool *pool;
+} slab_t;
+
+typedef struct {
+  uint8_t *data;
+  slab_t *slabs;
+  uint32_t count;
+  volatile uint32_t unused; // one bit per slab no pool holds
+} slab_arena_t;
+
+#define SLAB_ARENA_UNUSED(count) ((count) >= SLAB_ARENA_MAX ? 0xFFFFFFFF : (1U << (count)) - 1)
+
+typedef struct slab_pool {
+  slab_arena_t *arena;
+  // one bit per slab of the arena the pool holds, per class
+  volatile uint32_t slabs[SLAB_CLASS_MAX];
+} slab_pool_t;
+
+// data has to be SLAB_ALIGN aligned and hold count slabs, count is at most SLAB_ARENA_MAX
+void slab_arena_init(slab_arena_t *arena, uint8_t *data, slab_t *slabs, uint32_t count);
+// slabs held by all pools
+uint32_t slab_arena_used(const slab_arena_t *arena);
+
+void slab_pool_init(slab_pool_t *pool, slab_arena_t *arena);
+
+// returns NULL if size is above SLAB_ALLOC_MAX or the arena ran out, size is set to the size of the slot
+void *slab_alloc(slab_pool_t *pool, uint32_t *size);
+// false if ptr is not an allocated slot of the arena
+bool slab_free(slab_arena_t *arena, void *ptr);
@@ -0,0 +1,621 @@
+#include "cbor.h"
+#include "io/blackbox_compress.h"
+#include "io/blackbox_format.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// decodes blackbox files as pulled from the flash into csv or one raw float32 file per column.
+// input is streamed through a fixed size buffer, so files of any size are fine.
+// the frames of compressed files are decompressed on the way in.
+
+#define READ_BUFFER_SIZE (1024 * 1024)
+#define CSV_BUFFER_SIZE (1024 * 1024)
+#define COLUMN_BUFFER_SIZE (64 * 1024)
+
+// sign, ten digits, a dot and a separator
+#define CSV_VALUE_MAX 13
+
+#define FIELD_NAME_MAX 32
+
+typedef enum {
+  OUTPUT_CSV,
+  OUTPUT_COLUMNS,
+} output_format_t;
+
+typedef struct {
+  uint32_t version;
+  uint32_t looptime;
+  uint32_t blackbox_rate;
+  uint32_t compression;
+  uint32_t capture;
+
+  uint32_t field_count;
+  char names[BLACKBOX_VALUES_MAX][FIELD_NAME_MAX];
+  blackbox_field_def_t fields[BLACKBOX_VALUES_MAX];
+
+  uint32_t value_count;
+  // per value, not per field
+  uint16_t value_scale[BLACKBOX_VALUES_MAX];
+  uint8_t value_decimals[BLACKBOX_VALUES_MAX];
+} header_t;
+
+typedef struct {
+  FILE *file;
+  uint8_t *buf;
+  uint32_t pos;
+  uint32_t fill;
+  bool eof;
+
+  // compressed blocks as read from the file
+  bool compressed;
+  uint8_t *raw;
+  uint32_t raw_pos;
+  uint32_t raw_fill;
+  bool raw_eof;
+} reader_t;
+
+typedef struct {
+  FILE *file;
+  uint8_t *buf;
+  uint32_t size;
+  uint32_t fill;
+} writer_t;
+
+typedef struct {
+  uint64_t frames;
+  uint64_t errors;
+  uint64_t dropped;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+} stats_t;
+
+static stats_t stats;
+
+static bool key_equal(const uint8_t *buf, uint32_t len, const char *str) {
+  return strlen(str) == len && memcmp(buf, str, len) == 0;
+}
+
+static void reader_fill_raw(reader_t *r) {
+  memmove(r->raw, r->raw + r->raw_pos, r->raw_fill - r->raw_pos);
+  r->raw_fill -= r->raw_pos;
+  r->raw_pos = 0;
+
+  while (r->raw_fill < READ_BUFFER_SIZE) {
+    const size_t read = fread(r->raw + r->raw_fill, 1, READ_BUFFER_SIZE - r->raw_fill, r->file);
+    if (read == 0) {
+      r->raw_eof = true;
+      break;
+    }
+    r->raw_fill += read;
+    stats.bytes_in += read;
+  }
+}
+
+static void reader_fill_compressed(reader_t *r) {
+  while (r->fill + BLACKBOX_BLOCK_SIZE <= READ_BUFFER_SIZE) {
+    if (r->raw_fill - r->raw_pos < BLACKBOX_BLOCK_MAX && !r->raw_eof) {
+      reader_fill_raw(r);
+    }
+
+    uint32_t size = 0;
+    const int32_t len = blackbox_decompress_block(r->raw + r->raw_pos, r->raw_fill - r->raw_pos, r->buf + r->fill, &size);
+    if (len == 0) {
+      // end of the file, a truncated block is dropped
+      r->eof = true;
+      break;
+    }
+    if (len < 0) {
+      // skip ahead until something decodes as a block again
+      stats.errors++;
+      r->raw_pos++;
+      continue;
+    }
+    r->raw_pos += len;
+    r->fill += size;
+  }
+}
+
+// everything after the header is blocks, what was read so far becomes the raw data
+static void reader_start_compressed(reader_t *r) {
+  r->compressed = true;
+  r->raw = r->buf;
+  r->raw_pos = r->pos;
+  r->raw_fill = r->fill;
+  r->raw_eof = r->eof;
+
+  r->buf = malloc(READ_BUFFER_SIZE);
+  r->pos = 0;
+  r->fill = 0;
+  r->eof = false;
+  reader_fill_compressed(r);
+}
+
+static void reader_fill(reader_t *r) {
+  if (r->eof) {
+    return;
+  }
+
+  memmove(r->buf, r->buf + r->pos, r->fill - r->pos);
+  r->fill -= r->pos;
+  r->pos = 0;
+
+  if (r->compressed) {
+    reader_fill_compressed(r);
+    return;
+  }
+
+  while (r->fill < READ_BUFFER_SIZE) {
+    const size_t read = fread(r->buf + r->fill, 1, READ_BUFFER_SIZE - r->fill, r->file);
+    if (read == 0) {
+      r->eof = true;
+      break;
+    }
+    r->fill += read;
+    stats.bytes_in += read;
+  }
+}
+
+static void writer_flush(writer_t *w) {
+  if (w->fill == 0) {
+    return;
+  }
+  if (fwrite(w->buf, 1, w->fill, w->file) != w->fill) {
+    fprintf(stderr, "write failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  stats.bytes_out += w->fill;
+  w->fill = 0;
+}
+
+static void writer_init(writer_t *w, FILE *file, uint32_t size) {
+  w->file = file;
+  w->buf = malloc(size);
+  w->size = size;
+  w->fill = 0;
+}
+
+static void writer_close(writer_t *w) {
+  writer_flush(w);
+  if (w->file != stdout) {
+    fclose(w->file);
+  }
+  free(w->buf);
+}
+
+static cbor_result_t decode_field(cbor_value_t *dec, header_t *h, uint32_t index) {
+  blackbox_field_def_t *field = &h->fields[index];
+
+  cbor_container_t map;
+  cbor_result_t res = cbor_decode_map(dec, &map);
+  if (res < CBOR_OK) {
+    return res;
+  }
+
+  for (uint32_t i = 0; i < cbor_decode_map_size(dec, &map); i++) {
+    const uint8_t *name;
+    uint32_t name_len;
+    res = cbor_decode_tstr(dec, &name, &name_len);
+    if (res < CBOR_OK) {
+      return res;
+    }
+
+    if (key_equal(name, name_len, "name")) {
+      const uint8_t *str;
+      uint32_t str_len;
+      res = cbor_decode_tstr(dec, &str, &str_len);
+      if (str_len >= FIELD_NAME_MAX) {
+        str_len = FIELD_NAME_MAX - 1;
+      }
+      memcpy(h->names[index], str, str_len);
+      h->names[index][str_len] = 0;
+      field->name = h->names[index];
+    } else if (key_equal(name, name_len, "size")) {
+      res = cbor_decode_uint8(dec, &field->size);
+    } else if (key_equal(name, name_len, "scale")) {
+      res = cbor_decode_uint16(dec, &field->scale);
+    } else if (key_equal(name, name_len, "predictor")) {
+      res = cbor_decode_uint8(dec, &field->predictor);
+    } else if (key_equal(name, name_len, "divider")) {
+      res = cbor_decode_uint8(dec, &field->divider);
+    } else {
+      res = cbor_decode_skip(dec);
+    }
+    if (res < CBOR_OK) {
+      return res;
+    }
+  }
+
+  return CBOR_OK;
+}
+
+static cbor_result_t decode_header(cbor_value_t *dec, header_t *h) {
+  cbor_container_t map;
+  cbor_result_t res = cbor_decode_map(dec, &map);
+  if (res < CBOR_OK) {
+    return res;
+  }
+
+  for (uint32_t i = 0; i < cbor_decode_map_size(dec, &map); i++) {
+    const uint8_t *name;
+    uint32_t name_len;
+    res = cbor_decode_tstr(dec, &name, &name_len);
+    if (res < CBOR_OK) {
+      return res;
+    }
+
+    if (key_equal(name, name_len, "version")) {
+      res = cbor_decode_uint32(dec, &h->version);
+    } else if (key_equal(name, name_len, "looptime")) {
+      res = cbor_decode_uint32(dec, &h->looptime);
+    } else if (key_equal(name, name_len, "blackbox_rate")) {
+      res = cbor_decode_uint32(dec, &h->blackbox_rate);
+    } else if (key_equal(name, name_len, "compression")) {
+      res = cbor_decode_uint32(dec, &h->compression);
+    } else if (key_equal(name, name_len, "capture")) {
+      res = cbor_decode_uint32(dec, &h->capture);
+    } else if (key_equal(name, name_len, "fields")) {
+      cbor_container_t array;
+      res = cbor_decode_array(dec, &array);
+      if (res < CBOR_OK) {
+        return res;
+      }
+      for (uint32_t j = 0; j < cbor_decode_array_size(dec, &array); j++) {
+        if (h->field_count >= BLACKBOX_VALUES_MAX) {
+          return CBOR_ERR_OVERFLOW;
+        }
+        res = decode_field(dec, h, h->field_count++);
+        if (res < CBOR_OK) {
+          return res;
+        }
+      }
+    } else {
+      res = cbor_decode_skip(dec);
+    }
+    if (res < CBOR_OK) {
+      return res;
+    }
+  }
+
+  return CBOR_OK;
+}
+
+static bool read_header(reader_t *r, header_t *h) {
+  memset(h, 0, sizeof(header_t));
+
+  reader_fill(r);
+
+  cbor_value_t dec;
+  cbor_decoder_init(&dec, r->buf, r->fill);
+  if (decode_header(&dec, h) < CBOR_OK) {
+    fprintf(stderr, "invalid blackbox header\n");
+    return false;
+  }
+  if (h->capture) {
+    fprintf(stderr, "gyro capture, use tools/spectrum\n");
+    return false;
+  }
+  if (h->version != BLACKBOX_FORMAT_VERSION) {
+    fprintf(stderr, "unsupported blackbox version %u\n", h->version);
+    return false;
+  }
+  r->pos = dec.curr - dec.start;
+
+  for (uint32_t i = 0; i < h->field_count; i++) {
+    const blackbox_field_def_t *field = &h->fields[i];
+    if (field->name == NULL || field->scale == 0) {
+      fprintf(stderr, "invalid blackbox field %u\n", i);
+      return false;
+    }
+
+    // power of ten scales are printed as exact decimals, everything else goes through a float
+    uint8_t decimals = 0;
+    uint32_t scale = field->scale;
+    while (scale > 1 && (scale % 10) == 0) {
+      scale /= 10;
+      decimals++;
+    }
+    if (scale != 1) {
+      decimals = UINT8_MAX;
+    }
+
+    for (uint32_t j = 0; j < field->size && h->value_count < BLACKBOX_VALUES_MAX; j++) {
+      h->value_scale[h->value_count] = field->scale;
+      h->value_decimals[h->value_count] = decimals;
+      h->value_count++;
+    }
+  }
+
+  return true;
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static uint32_t digit_count(uint32_t val) {
+  uint32_t count = 1;
+  while (val >= 10) {
+    val /= 10;
+    count++;
+  }
+  return count;
+}
+// writes exactly len digits, zero padded
+static void write_digits(char *ptr, uint32_t val, uint32_t len) {
+  while (len >= 2) {
+    len -= 2;
+    memcpy(ptr + len, &digit_pairs[(val % 100) * 2], 2);
+    val /= 100;
+  }
+  if (len) {
+    ptr[0] = '0' + (val % 10);
+  }
+}
+
+static char *write_uint(char *ptr, uint32_t val) {
+  const uint32_t len = digit_count(val);
+  write_digits(ptr, val, len);
+  return ptr + len;
+}
+
+static char *write_value(char *ptr, int32_t val, uint16_t scale, uint8_t decimals) {
+  if (decimals == UINT8_MAX) {
+    return ptr + sprintf(ptr, "%.6g", (double)val / scale);
+  }
+
+  uint32_t abs = val < 0 ? -(uint32_t)val : (uint32_t)val;
+  if (val < 0) {
+    *ptr++ = '-';
+  }
+  if (decimals == 0) {
+    return write_uint(ptr, abs);
+  }
+
+  // write all digits with at least one before the dot, then move the fraction over to make room for it
+  uint32_t len = digit_count(abs);
+  if (len < decimals + 1u) {
+    len = decimals + 1;
+  }
+  write_digits(ptr, abs, len);
+
+  char *dot = ptr + len - decimals;
+  memmove(dot + 1, dot, decimals);
+  *dot = '.';
+  return ptr + len + 1;
+}
+
+static void csv_write_header(writer_t *w, const header_t *h) {
+  char *ptr = (char *)w->buf;
+  for (uint32_t i = 0; i < h->field_count; i++) {
+    const blackbox_field_def_t *field = &h->fields[i];
+    for (uint32_t j = 0; j < field->size; j++) {
+      if (ptr != (char *)w->buf) {
+        *ptr++ = ',';
+      }
+      if (field->size == 1) {
+        ptr += sprintf(ptr, "%s", field->name);
+      } else {
+        ptr += sprintf(ptr, "%s[%u]", field->name, j);
+      }
+    }
+  }
+  *ptr++ = '\n';
+  w->fill = ptr - (char *)w->buf;
+}
+
+static void csv_write_frame(writer_t *w, const header_t *h, const int32_t *values) {
+  if (w->fill + h->value_count * CSV_VALUE_MAX + 1 > w->size) {
+    writer_flush(w);
+  }
+
+  char *ptr = (char *)w->buf + w->fill;
+  for (uint32_t i = 0; i < h->value_count; i++) {
+    ptr = write_value(ptr, values[i], h->value_scale[i], h->value_decimals[i]);
+    *ptr++ = ',';
+  }
+  ptr[-1] = '\n';
+  w->fill = ptr - (char *)w->buf;
+}
+
+static bool columns_open(writer_t *columns, const header_t *h, const char *dir) {
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "could not create %s: %s\n", dir, strerror(errno));
+    return false;
+  }
+
+  uint32_t index = 0;
+  for (uint32_t i = 0; i < h->field_count; i++) {
+    const blackbox_field_def_t *field = &h->fields[i];
+    for (uint32_t j = 0; j < field->size && index < h->value_count; j++) {
+      char path[4096];
+      if (field->size == 1) {
+        snprintf(path, sizeof(path), "%s/%s.f32", dir, field->name);
+      } else {
+        snprintf(path, sizeof(path), "%s/%s_%u.f32", dir, field->name, j);
+      }
+
+      FILE *f = fopen(path, "wb");
+      if (f == NULL) {
+        fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+        return false;
+      }
+      writer_init(&columns[index++], f, COLUMN_BUFFER_SIZE);
+    }
+  }
+  return true;
+}
+
+static void columns_write_frame(writer_t *columns, const header_t *h, const int32_t *values) {
+  for (uint32_t i = 0; i < h->value_count; i++) {
+    writer_t *w = &columns[i];
+    if (w->fill + sizeof(float) > w->size) {
+      writer_flush(w);
+    }
+
+    const float val = (float)values[i] / h->value_scale[i];
+    memcpy(w->buf + w->fill, &val, sizeof(float));
+    w->fill += sizeof(float);
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-f csv|columns] [-o output] <file>\n", name);
+  fprintf(stderr, "  -f csv      comma separated values, the default\n");
+  fprintf(stderr, "  -f columns  one little endian float32 file per value, -o names the directory\n");
+  fprintf(stderr, "  -o output   output file or directory, csv defaults to stdout\n");
+  fprintf(stderr, "  <file>      blackbox file, - reads from stdin\n");
+}
+
+int main(int argc, char **argv) {
+  output_format_t format = OUTPUT_CSV;
+  const char *output = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:o:h")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (strcmp(optarg, "csv") == 0) {
+        format = OUTPUT_CSV;
+      } else if (strcmp(optarg, "columns") == 0) {
+        format = OUTPUT_COLUMNS;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1 || (format == OUTPUT_COLUMNS && output == NULL)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  reader_t reader = {
+      .file = stdin,
+      .buf = malloc(READ_BUFFER_SIZE),
+      .pos = 0,
+      .fill = 0,
+      .eof = false,
+      .compressed = false,
+      .raw = NULL,
+      .raw_pos = 0,
+      .raw_fill = 0,
+      .raw_eof = false,
+  };
+  if (strcmp(argv[optind], "-") != 0) {
+    reader.file = fopen(argv[optind], "rb");
+    if (reader.file == NULL) {
+      fprintf(stderr, "could not open %s: %s\n", argv[optind], strerror(errno));
+      return 1;
+    }
+  }
+
+  static header_t header;
+  if (!read_header(&reader, &header)) {
+    return 1;
+  }
+  if (header.compression) {
+    reader_start_compressed(&reader);
+  }
+
+  writer_t csv;
+  static writer_t columns[BLACKBOX_VALUES_MAX];
+
+  if (format == OUTPUT_CSV) {
+    FILE *f = stdout;
+    if (output != NULL) {
+      f = fopen(output, "wb");
+      if (f == NULL) {
+        fprintf(stderr, "could not open %s: %s\n", output, strerror(errno));
+        return 1;
+      }
+    }
+    writer_init(&csv, f, CSV_BUFFER_SIZE);
+    csv_write_header(&csv, &header);
+  } else if (!columns_open(columns, &header, output)) {
+    return 1;
+  }
+
+  static blackbox_codec_t codec;
+  blackbox_codec_init(&codec, header.fields, header.field_count);
+
+  // the loop counter lets us count frames that never made it to the flash
+  const bool has_loop = header.field_count > 0 && header.fields[0].predictor == BLACKBOX_PREDICT_INCREMENT;
+  int32_t last_loop = 0;
+
+  int32_t values[BLACKBOX_VALUES_MAX];
+  while (true) {
+    if (reader.fill - reader.pos < BLACKBOX_FRAME_MAX) {
+      reader_fill(&reader);
+    }
+    if (reader.pos >= reader.fill) {
+      break;
+    }
+
+    const int32_t len = blackbox_decode_frame(&codec, reader.buf + reader.pos, reader.fill - reader.pos, values);
+    if (len == 0) {
+      // truncated frame at the end of the file
+      break;
+    }
+    if (len < 0) {
+      // skip ahead to the next intra frame
+      stats.errors++;
+      blackbox_codec_reset(&codec);
+      reader.pos++;
+      continue;
+    }
+    reader.pos += len;
+
+    if (has_loop) {
+      if (stats.frames > 0 && values[0] > last_loop) {
+        stats.dropped += values[0] - last_loop - 1;
+      }
+      last_loop = values[0];
+    }
+    stats.frames++;
+
+    if (format == OUTPUT_CSV) {
+      csv_write_frame(&csv, &header, values);
+    } else {
+      columns_write_frame(columns, &header, values);
+    }
+  }
+
+  if (format == OUTPUT_CSV) {
+    writer_close(&csv);
+  } else {
+    for (uint32_t i = 0; i < header.value_count; i++) {
+      writer_close(&columns[i]);
+    }
+  }
+
+  fprintf(stderr, "frames=%llu dropped=%llu errors=%llu in=%llu out=%llu\n",
+          (unsigned long long)stats.frames,
+          (unsigned long long)stats.dropped,
+          (unsigned long long)stats.errors,
+          (unsigned long long)stats.bytes_in,
+          (unsigned long long)stats.bytes_out);
+
+  return 0;
+}
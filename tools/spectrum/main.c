@@ -0,0 +1,396 @@
+#include "cbor.h"
+#include "io/blackbox_format.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// turns gyro captures into a power spectral density or a spectrogram as csv.
+// captures only last a few seconds, so the whole file is read at once.
+
+#define FFT_SIZE_DEFAULT 1024
+#define FFT_SIZE_MAX 65536
+
+typedef enum {
+  OUTPUT_PSD,
+  OUTPUT_SPECTROGRAM,
+  OUTPUT_SAMPLES,
+} output_format_t;
+
+typedef struct {
+  uint32_t version;
+  uint32_t sample_period; // us
+  uint32_t channels;
+  float scale; // deg/s per unit
+} header_t;
+
+static const char *channel_names[BLACKBOX_CAPTURE_CHANNELS_MAX] = {
+    "gyro_raw[0]",
+    "gyro_raw[1]",
+    "gyro_raw[2]",
+    "gyro_filter[0]",
+    "gyro_filter[1]",
+    "gyro_filter[2]",
+};
+
+static bool key_equal(const uint8_t *buf, uint32_t len, const char *str) {
+  return strlen(str) == len && memcmp(buf, str, len) == 0;
+}
+
+static cbor_result_t decode_header(cbor_value_t *dec, header_t *h) {
+  cbor_container_t map;
+  cbor_result_t res = cbor_decode_map(dec, &map);
+  if (res < CBOR_OK) {
+    return res;
+  }
+
+  for (uint32_t i = 0; i < cbor_decode_map_size(dec, &map); i++) {
+    const uint8_t *name;
+    uint32_t name_len;
+    res = cbor_decode_tstr(dec, &name, &name_len);
+    if (res < CBOR_OK) {
+      return res;
+    }
+
+    if (key_equal(name, name_len, "capture")) {
+      res = cbor_decode_uint32(dec, &h->version);
+    } else if (key_equal(name, name_len, "sample_period")) {
+      res = cbor_decode_uint32(dec, &h->sample_period);
+    } else if (key_equal(name, name_len, "channels")) {
+      res = cbor_decode_uint32(dec, &h->channels);
+    } else if (key_equal(name, name_len, "scale")) {
+      res = cbor_decode_float(dec, &h->scale);
+    } else {
+      res = cbor_decode_skip(dec);
+    }
+    if (res < CBOR_OK) {
+      return res;
+    }
+  }
+
+  return CBOR_OK;
+}
+
+static uint8_t *read_file(const char *path, uint32_t *size) {
+  FILE *f = stdin;
+  if (strcmp(path, "-") != 0) {
+    f = fopen(path, "rb");
+    if (f == NULL) {
+      fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+      return NULL;
+    }
+  }
+
+  uint32_t capacity = 1024 * 1024;
+  uint8_t *data = malloc(capacity);
+  *size = 0;
+  while (true) {
+    if (*size == capacity) {
+      capacity *= 2;
+      data = realloc(data, capacity);
+    }
+    const size_t read = fread(data + *size, 1, capacity - *size, f);
+    if (read == 0) {
+      break;
+    }
+    *size += read;
+  }
+
+  if (f != stdin) {
+    fclose(f);
+  }
+  return data;
+}
+
+// in place radix 2, size has to be a power of two
+static void fft(double *re, double *im, uint32_t size) {
+  for (uint32_t i = 1, j = 0; i < size; i++) {
+    uint32_t bit = size >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+
+    if (i < j) {
+      double tmp = re[i];
+      re[i] = re[j];
+      re[j] = tmp;
+      tmp = im[i];
+      im[i] = im[j];
+      im[j] = tmp;
+    }
+  }
+
+  for (uint32_t len = 2; len <= size; len <<= 1) {
+    const double angle = -2 * M_PI / len;
+    for (uint32_t i = 0; i < size; i += len) {
+      for (uint32_t j = 0; j < len / 2; j++) {
+        const double w_re = cos(angle * j);
+        const double w_im = sin(angle * j);
+
+        const double *a_re = &re[i + j + len / 2];
+        const double *a_im = &im[i + j + len / 2];
+        const double t_re = *a_re * w_re - *a_im * w_im;
+        const double t_im = *a_re * w_im + *a_im * w_re;
+
+        re[i + j + len / 2] = re[i + j] - t_re;
+        im[i + j + len / 2] = im[i + j] - t_im;
+        re[i + j] += t_re;
+        im[i + j] += t_im;
+      }
+    }
+  }
+}
+
+typedef struct {
+  uint32_t size;
+  double rate;
+  double *window;
+  double window_power; // sum of the squared window
+  double *re;
+  double *im;
+} spectrum_t;
+
+static void spectrum_init(spectrum_t *s, uint32_t size, double rate) {
+  s->size = size;
+  s->rate = rate;
+  s->window = malloc(size * sizeof(double));
+  s->re = malloc(size * sizeof(double));
+  s->im = malloc(size * sizeof(double));
+
+  // hann
+  s->window_power = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    s->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / size);
+    s->window_power += s->window[i] * s->window[i];
+  }
+}
+
+// one sided power spectral density of a segment in (deg/s)^2/hz, added to psd
+static void spectrum_segment(spectrum_t *s, const float *values, double *psd) {
+  double mean = 0;
+  for (uint32_t i = 0; i < s->size; i++) {
+    mean += values[i];
+  }
+  mean /= s->size;
+
+  for (uint32_t i = 0; i < s->size; i++) {
+    s->re[i] = (values[i] - mean) * s->window[i];
+    s->im[i] = 0;
+  }
+  fft(s->re, s->im, s->size);
+
+  const double norm = 1.0 / (s->rate * s->window_power);
+  for (uint32_t i = 0; i <= s->size / 2; i++) {
+    double power = (s->re[i] * s->re[i] + s->im[i] * s->im[i]) * norm;
+    if (i > 0 && i < s->size / 2) {
+      power *= 2;
+    }
+    psd[i] += power;
+  }
+}
+
+static void write_psd(FILE *out, spectrum_t *s, float **values, const header_t *h, uint32_t samples) {
+  const uint32_t bins = s->size / 2 + 1;
+  double *psd = calloc(bins * h->channels, sizeof(double));
+
+  // welch, half overlapping segments
+  uint32_t segments = 0;
+  for (uint32_t start = 0; start + s->size <= samples; start += s->size / 2) {
+    for (uint32_t c = 0; c < h->channels; c++) {
+      spectrum_segment(s, values[c] + start, psd + c * bins);
+    }
+    segments++;
+  }
+
+  fprintf(out, "freq");
+  for (uint32_t c = 0; c < h->channels; c++) {
+    fprintf(out, ",%s", channel_names[c]);
+  }
+  fprintf(out, "\n");
+
+  for (uint32_t i = 0; i < bins; i++) {
+    fprintf(out, "%.3f", i * s->rate / s->size);
+    for (uint32_t c = 0; c < h->channels; c++) {
+      fprintf(out, ",%.6g", psd[c * bins + i] / segments);
+    }
+    fprintf(out, "\n");
+  }
+
+  fprintf(stderr, "segments=%u resolution=%.2fhz\n", segments, s->rate / s->size);
+  free(psd);
+}
+
+static void write_spectrogram(FILE *out, spectrum_t *s, const float *values, uint32_t samples) {
+  const uint32_t bins = s->size / 2 + 1;
+  double *psd = malloc(bins * sizeof(double));
+
+  fprintf(out, "time");
+  for (uint32_t i = 0; i < bins; i++) {
+    fprintf(out, ",%.3f", i * s->rate / s->size);
+  }
+  fprintf(out, "\n");
+
+  // a row per half segment in db, timed at the center of the segment
+  for (uint32_t start = 0; start + s->size <= samples; start += s->size / 2) {
+    memset(psd, 0, bins * sizeof(double));
+    spectrum_segment(s, values + start, psd);
+
+    fprintf(out, "%.4f", (start + s->size / 2) / s->rate);
+    for (uint32_t i = 0; i < bins; i++) {
+      fprintf(out, ",%.2f", 10 * log10(psd[i] + 1e-12));
+    }
+    fprintf(out, "\n");
+  }
+
+  free(psd);
+}
+
+static void write_samples(FILE *out, float **values, const header_t *h, uint32_t samples) {
+  fprintf(out, "time");
+  for (uint32_t c = 0; c < h->channels; c++) {
+    fprintf(out, ",%s", channel_names[c]);
+  }
+  fprintf(out, "\n");
+
+  for (uint32_t i = 0; i < samples; i++) {
+    fprintf(out, "%.6f", i * h->sample_period * 1e-6);
+    for (uint32_t c = 0; c < h->channels; c++) {
+      fprintf(out, ",%.3f", values[c][i]);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-f psd|spectrogram|samples] [-n size] [-c channel] [-o output] <file>\n", name);
+  fprintf(stderr, "  -f psd          averaged power spectral density of every channel, the default\n");
+  fprintf(stderr, "  -f spectrogram  power over time of one channel in db\n");
+  fprintf(stderr, "  -f samples      the samples in deg/s\n");
+  fprintf(stderr, "  -n size         fft size, a power of two, defaults to %u\n", FFT_SIZE_DEFAULT);
+  fprintf(stderr, "  -c channel      channel of the spectrogram, 0-2 raw and 3-5 filtered gyro\n");
+  fprintf(stderr, "  -o output       output file, defaults to stdout\n");
+  fprintf(stderr, "  <file>          gyro capture, - reads from stdin\n");
+}
+
+int main(int argc, char **argv) {
+  output_format_t format = OUTPUT_PSD;
+  const char *output = NULL;
+  uint32_t fft_size = FFT_SIZE_DEFAULT;
+  uint32_t channel = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:n:c:o:h")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (strcmp(optarg, "psd") == 0) {
+        format = OUTPUT_PSD;
+      } else if (strcmp(optarg, "spectrogram") == 0) {
+        format = OUTPUT_SPECTROGRAM;
+      } else if (strcmp(optarg, "samples") == 0) {
+        format = OUTPUT_SAMPLES;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'n':
+      fft_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      channel = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1 || fft_size < 16 || fft_size > FFT_SIZE_MAX || (fft_size & (fft_size - 1)) != 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint32_t size = 0;
+  uint8_t *data = read_file(argv[optind], &size);
+  if (data == NULL) {
+    return 1;
+  }
+
+  header_t header = {0};
+  cbor_value_t dec;
+  cbor_decoder_init(&dec, data, size);
+  if (decode_header(&dec, &header) < CBOR_OK || header.version == 0) {
+    fprintf(stderr, "not a gyro capture\n");
+    return 1;
+  }
+  if (header.version != BLACKBOX_CAPTURE_VERSION) {
+    fprintf(stderr, "unsupported capture version %u\n", header.version);
+    return 1;
+  }
+  if (header.channels == 0 || header.channels > BLACKBOX_CAPTURE_CHANNELS_MAX || header.sample_period == 0) {
+    fprintf(stderr, "invalid capture header\n");
+    return 1;
+  }
+  if (channel >= header.channels) {
+    fprintf(stderr, "capture only has %u channels\n", header.channels);
+    return 1;
+  }
+
+  const uint32_t offset = dec.curr - dec.start;
+  const uint32_t sample_size = header.channels * sizeof(int16_t);
+  const uint32_t samples = (size - offset) / sample_size;
+
+  float *values[BLACKBOX_CAPTURE_CHANNELS_MAX];
+  for (uint32_t c = 0; c < header.channels; c++) {
+    values[c] = malloc(samples * sizeof(float));
+    for (uint32_t i = 0; i < samples; i++) {
+      const uint8_t *ptr = data + offset + i * sample_size + c * sizeof(int16_t);
+      values[c][i] = (int16_t)(ptr[0] | (ptr[1] << 8)) * header.scale;
+    }
+  }
+
+  const double rate = 1e6 / header.sample_period;
+  fprintf(stderr, "samples=%u channels=%u rate=%.1fhz duration=%.2fs\n", samples, header.channels, rate, samples / rate);
+
+  if (format != OUTPUT_SAMPLES && samples < fft_size) {
+    fprintf(stderr, "capture is shorter than the fft size\n");
+    return 1;
+  }
+
+  FILE *out = stdout;
+  if (output != NULL) {
+    out = fopen(output, "wb");
+    if (out == NULL) {
+      fprintf(stderr, "could not open %s: %s\n", output, strerror(errno));
+      return 1;
+    }
+  }
+
+  spectrum_t spectrum;
+  spectrum_init(&spectrum, fft_size, rate);
+
+  switch (format) {
+  case OUTPUT_PSD:
+    write_psd(out, &spectrum, values, &header, samples);
+    break;
+  case OUTPUT_SPECTROGRAM:
+    write_spectrogram(out, &spectrum, values[channel], samples);
+    break;
+  case OUTPUT_SAMPLES:
+    write_samples(out, values, &header, samples);
+    break;
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}